@@ -242,7 +242,7 @@ namespace ff {
     }
 
 
-    void App::Render(const delta_t dt, const delta_t elapsed)
+    void App::Render(const delta_t dt, const delta_t elapsed, const delta_t alpha)
     {	
 		float vWhite[] = { 1, 1, 1, 1 };
 		modelViewMatrix.PushMatrix();
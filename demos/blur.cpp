@@ -279,7 +279,7 @@ GLuint GetBlurFrame3(){ return (1 + ((curBlurFrame) % BLUR_TEXTURE_COUNT)); }
 
 // paint pretty pixels
 
-    void App::Render(const delta_t dt, const delta_t elapsed)
+    void App::Render(const delta_t dt, const delta_t elapsed, const delta_t alpha)
     {	
 		// clear buffer and save matrix state
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -381,7 +381,7 @@ GLuint GetBlurFrame3(){ return (1 + ((curBlurFrame) % BLUR_TEXTURE_COUNT)); }
         GL_DEBUG(glViewport(0, 0, width, height));
 
 		// use a perspective projection for the viewport
-		proj.PushMatrix(perspective(35.f, (float) width / (float) height, 0.1f, 1000.f));
+		proj.LoadMatrix(perspective(35.f, (float) width / (float) height, 0.1f, 1000.f));
 		transform.SetMatrices(mv, proj);
 	}
 
@@ -1,6 +1,8 @@
 #include <firefly.hpp>
 #include <firefly/core/random.hpp>
 #include <firefly/graphics/shader.hpp>
+#include <firefly/graphics/primitive.hpp>
+#include <firefly/graphics/state.hpp>
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <GLTools.h>
@@ -29,7 +31,7 @@ GLint   locCubeMap;
 GLint	locCubeMVP;		
 GLint   locSampler;
 
-GLTriangleBatch sphereBatch;
+ff::UVSphere    sphere;
 GLBatch cubeBatch;
 GLuint cubeTexture, tarnishTexture;
 
@@ -100,7 +102,7 @@ namespace ff {
 		viewFrame.MoveForward(-5.0f);
 
 		// make the sphere
-		gltMakeSphere(sphereBatch, 1.0f, 128, 64);
+		sphere.Create(1.0f, 128, 64);
 
 		// make the skybox
 		gltMakeCube(cubeBatch, 20);
@@ -164,6 +166,7 @@ namespace ff {
 	
 	void App::Exit()
     {
+		sphere.Delete();
 		g_Shader.DeletePrograms();
     }
 
@@ -199,7 +202,7 @@ namespace ff {
 
 // paint pretty pixels
 
-    void App::Render(const delta_t dt, const delta_t elapsed)
+    void App::Render(const delta_t dt, const delta_t elapsed, const delta_t alpha)
     {	
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		M3DMatrix44f mCamera;
@@ -220,7 +223,7 @@ namespace ff {
 			glUniformMatrix3fv(locNM, 1, GL_FALSE, transformPipeline.GetNormalMatrix());
 			glUniform1i(locTexture, 0);
 			glUniform1i(locSampler, 1);
-			sphereBatch.Draw();
+			sphere.Render();
 			glDisable(GL_CULL_FACE);
 		modelViewMatrix.PopMatrix();
 
@@ -232,6 +235,7 @@ namespace ff {
 			//glUniform1i(locCubeMap, 0);
 			glUniformMatrix4fv(locCubeMVP, 1, GL_FALSE, transformPipeline.GetModelViewProjectionMatrix());
 			cubeBatch.Draw();
+			g_GLState.InvalidateVertexArray(); // GLTools binds behind the state cache
 		modelViewMatrix.PopMatrix();
 	}
 
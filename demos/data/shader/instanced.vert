@@ -0,0 +1,37 @@
+#version 130
+
+in vec4 vVertex;
+in vec3 vNormal;
+in vec2 vTexture0;
+
+// per instance, the model view matrix must be rigid (no scaling)
+in vec4 vInstanceColor;
+in mat4 vInstanceMatrix;
+
+uniform mat4 pMatrix;
+uniform vec3 lightPos;
+
+smooth out vec3 vVaryingNormal;
+smooth out vec3 vVaryingLightDir;
+smooth out vec2 vVaryingTexCoord;
+flat out vec4 vVaryingColor;
+
+void main(void)
+{
+	// get surface normal in eye coordinates
+	vVaryingNormal = mat3(vInstanceMatrix) * vNormal;
+
+	// get vertex position in eye coordinates
+	vec4 vPos4 = vInstanceMatrix * vVertex;
+	vec3 vPos3 = vPos4.xyz / vPos4.w;
+
+	// get vector to light source
+	vVaryingLightDir = normalize(lightPos - vPos3);
+
+	// pass through texture and instance details
+	vVaryingTexCoord = vTexture0.st;
+	vVaryingColor = vInstanceColor;
+
+	// finally transform the geometry
+	gl_Position = pMatrix * vPos4;
+}
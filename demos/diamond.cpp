@@ -129,7 +129,7 @@ namespace ff {
 	}
 
 
-    void App::Render(const delta_t dt, const delta_t elapsed)
+    void App::Render(const delta_t dt, const delta_t elapsed, const delta_t alpha)
     {
 		GLfloat vRed[] = { 1, 0, 0, 1 };
 		GLfloat vWhite[] = { 1, 1, 1, 1 };
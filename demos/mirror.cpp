@@ -384,7 +384,7 @@ void DrawWorld(ff::delta_t dt, ff::delta_t elapsed, bool blur)
 
 // paint pretty pixels
 
-    void App::Render(const delta_t dt, const delta_t elapsed)
+    void App::Render(const delta_t dt, const delta_t elapsed, const delta_t alpha)
     {	
 		// set position of mirror
 		vec3 vMirrorPos(0, 1.75f, -14.f);
@@ -438,7 +438,7 @@ void DrawWorld(ff::delta_t dt, ff::delta_t elapsed, bool blur)
         GL_DEBUG(glViewport(0, 0, width, height));
 
 		// use a perspective projection for the viewport
-		proj.PushMatrix(perspective(35.f, (float) width / (float) height, 0.1f, 1000.f));
+		proj.LoadMatrix(perspective(35.f, (float) width / (float) height, 0.1f, 1000.f));
 		transform.SetMatrices(mv, proj);
 	}
 
@@ -1,6 +1,7 @@
 #include <firefly.hpp>
 #include <firefly/core/random.hpp>
 #include <firefly/graphics/shader.hpp>
+#include <firefly/graphics/primitive.hpp>
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <GLTools.h>
@@ -14,7 +15,7 @@
 // global vars
 GLFrame             viewFrame;
 GLFrustum           viewFrustum;
-GLTriangleBatch     sphereBatch;
+ff::UVSphere        sphere;
 GLMatrixStack       modelViewMatrix;
 GLMatrixStack       projectionMatrix;
 GLGeometryTransform transformPipeline;
@@ -86,7 +87,7 @@ namespace ff {
 		viewFrame.MoveForward(4.0f);
 
 		// Make the sphere
-		gltMakeSphere(sphereBatch, 1.0f, 128, 64);
+		sphere.Create(1.0f, 128, 64);
 
 		shader = g_Shader.CreateProgram(
 			"phong.vert", "phong.frag", 3, 
@@ -114,6 +115,7 @@ namespace ff {
 	void App::Exit()
     {
 		glDeleteTextures(1, &texture);
+		sphere.Delete();
 		g_Shader.DeletePrograms();
     }
 
@@ -132,7 +134,7 @@ namespace ff {
 
 // paint pretty pixels
 
-    void App::Render(const delta_t dt, const delta_t elapsed)
+    void App::Render(const delta_t dt, const delta_t elapsed, const delta_t alpha)
     {	
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		modelViewMatrix.PushMatrix(viewFrame);
@@ -153,7 +155,7 @@ namespace ff {
 		glUniformMatrix4fv(locMV, 1, GL_FALSE, transformPipeline.GetModelViewMatrix());
 		glUniformMatrix3fv(locNM, 1, GL_FALSE, transformPipeline.GetNormalMatrix());
 		glUniform1i(locTexture, 0);
-		sphereBatch.Draw();
+		sphere.Render();
 
 		modelViewMatrix.PopMatrix();
 	}
@@ -1,7 +1,12 @@
 #include <firefly.hpp>
 #include <firefly/core/random.hpp>
+#include <firefly/graphics/primitive.hpp>
+#include <firefly/graphics/instance.hpp>
+#include <firefly/graphics/shader.hpp>
+#include <firefly/graphics/state.hpp>
 
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
 #include <GLTools.h>
 #include <GLShaderManager.h>
 #include <GLFrustum.h>
@@ -15,14 +20,20 @@ GLMatrixStack projectionMatrix;
 GLFrustum viewFrustum;
 GLGeometryTransform transformPipeline;
 
-GLTriangleBatch torusBatch;
-GLTriangleBatch sphereBatch;
+ff::Torus       torus;
+ff::UVSphere    sphere;
 GLBatch floorBatch;
 
 #define NUM_SPHERES 50
 GLFrame spheres[NUM_SPHERES];
 GLFrame cameraFrame;
 
+// the world spheres are drawn in one instanced call
+GLuint             instancedShader;
+GLuint             whiteTexture;
+ff::InstanceBuffer sphereInstances;
+glm::mat4          sphereMatrices[NUM_SPHERES];
+
 #define JUMP_VEL  3
 float jumpVel;
 float gravity = 4;
@@ -45,8 +56,8 @@ namespace ff {
 		shaderManager.InitializeStockShaders();
 
 		// create 3d objects
-		gltMakeTorus(torusBatch, 0.4f, 0.15f, 60, 60);	
-		gltMakeSphere(sphereBatch, 0.1f, 80, 40);
+		torus.Create(0.4f, 0.15f, 60, 60);
+		sphere.Create(0.1f, 80, 40);
     	
 		floorBatch.Begin(GL_LINES, 324);
 		for(GLfloat x = -20.0; x <= 20.0f; x += 0.5) {
@@ -65,13 +76,36 @@ namespace ff {
 			spheres[i].SetOrigin(x, 0, z);
 		}
 
+		// the instanced shader modulates a texture, the spheres have none
+		instancedShader = g_Shader.CreateProgram("instanced.vert", "instanced.frag", 5,
+											FF_ATTRIBUTE_VERTEX, "vVertex",
+											FF_ATTRIBUTE_NORMAL, "vNormal",
+											FF_ATTRIBUTE_TEXTURE0, "vTexture0",
+											FF_ATTRIBUTE_INSTANCE_COLOR, "vInstanceColor",
+											FF_ATTRIBUTE_INSTANCE_MATRIX, "vInstanceMatrix");
+
+		const GLubyte white[4] = { 255, 255, 255, 255 };
+		GL_DEBUG(glGenTextures(1, &whiteTexture));
+		g_GLState.BindTexture(0, whiteTexture);
+		GL_DEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+		GL_DEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+		GL_DEBUG(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white));
+
+		// every sphere is the same color, only the matrices change
+		vector<vec4> colors(NUM_SPHERES, vec4(0, 0, 1, 1));
+		sphereInstances.Create(NUM_SPHERES);
+		sphereInstances.Attach(sphere.GetMesh().GetVertexArray());
+		sphereInstances.SetColors(&colors[0], NUM_SPHERES);
+
         return true;
     }
 
 
     bool App::Exit()
     {
-
+		sphereInstances.Delete();
+		g_GLState.DeleteTextures(1, &whiteTexture);
+		g_Shader.DeletePrograms();
         return true;
     }
 
@@ -121,7 +155,7 @@ namespace ff {
     }
 
 
-    void App::Render(const delta_t dt, const delta_t elapsed)
+    void App::Render(const delta_t dt, const delta_t elapsed, const delta_t alpha)
     {
 		static GLfloat vFloorColor[] = { 0, 1, 0, 1 };		
 		static GLfloat vTorusColor[] = { 1, 0, 0, 1 };
@@ -147,20 +181,26 @@ namespace ff {
 									 vLightEyePos,
 									 vFloorColor);
 		floorBatch.Draw();
+		g_GLState.Invalidate(); // GLTools binds programs and arrays behind the state cache
 
-		// draw world spheres
+		// draw world spheres, one draw call for all of them
 		GL_DEBUG(glPolygonMode(GL_FRONT_AND_BACK, GL_FILL));
 		for (int i = 0; i < NUM_SPHERES; ++i) {
 			modelViewMatrix.PushMatrix();
 			modelViewMatrix.MultMatrix(spheres[i]);
-			shaderManager.UseStockShader(GLT_SHADER_POINT_LIGHT_DIFF,
-										 transformPipeline.GetModelViewMatrix(),
-										 transformPipeline.GetProjectionMatrix(),
-										 vLightEyePos,
-										 vSphereColor);
-			sphereBatch.Draw();
+			sphereMatrices[i] = glm::make_mat4(modelViewMatrix.GetMatrix());
 			modelViewMatrix.PopMatrix();
 		}
+		sphereInstances.SetMatrices(sphereMatrices, NUM_SPHERES);
+
+		g_Shader.UseProgram(instancedShader);
+		g_Shader.SetUniform("pMatrix", glm::make_mat4(transformPipeline.GetProjectionMatrix()));
+		g_Shader.SetUniform("lightPos", vec3(vLightEyePos[0], vLightEyePos[1], vLightEyePos[2]));
+		g_Shader.SetUniform("ambient", vec4(0, 0, 0, 1));
+		g_Shader.SetUniform("specular", vec4(0, 0, 0, 1));
+		g_Shader.SetUniform("texSampler", 0);
+		g_GLState.BindTexture(0, whiteTexture);
+		sphere.GetMesh().DrawInstanced(NUM_SPHERES);
 
 		// draw torus
 		modelViewMatrix.Translate(0, 0, -2.5);
@@ -172,7 +212,7 @@ namespace ff {
 									 transformPipeline.GetProjectionMatrix(),
 									 vLightEyePos,
 									 vTorusColor);
-		torusBatch.Draw();
+		torus.Render();
 		modelViewMatrix.PopMatrix();
 
 		modelViewMatrix.Rotate(yRot * -2.f, 0, 1, 0);
@@ -182,7 +222,7 @@ namespace ff {
 									 transformPipeline.GetProjectionMatrix(),
 									 vLightEyePos,
 									 vSphereColor);
-		sphereBatch.Draw();
+		sphere.Render();
 
 		modelViewMatrix.PopMatrix();
 		modelViewMatrix.PopMatrix();
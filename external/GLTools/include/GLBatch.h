@@ -92,6 +92,10 @@ class GLBatch : public GLBatchBase
 		inline void CopyTexCoordData2f(GLfloat *vTex, GLuint uiTextureLayer) { CopyTexCoordData2f((M3DVector2f *)(vTex), uiTextureLayer); }
 
 		virtual void Draw(void);
+
+		// For drawing the batch through something else, instanced for one
+		inline GLuint GetVertexArray(void) { return vertexArrayObject; }
+		inline GLuint GetVertexCount(void) { return nNumVerts; }
  
 		// Immediate mode emulation
 		// Slowest way to build an array on purpose... Use the above if you can instead
@@ -4,5 +4,7 @@
 #include <firefly/common.hpp>
 #include <firefly/opengl.hpp>
 #include <firefly/core/app.hpp>
+#include <firefly/core/snapshot.hpp>
+#include <firefly/debug/profiler.hpp>
 
 #endif
@@ -148,4 +148,11 @@ namespace ff {
 #define ELEMENT_LAST(x)  ((x)[ELEMENT_COUNT(x) - 1])
 #define ARRAY_END(x)     ((x) + ELEMENT_COUNT(x))
 
+// alignment for data loaded with aligned SIMD instructions
+#if defined(_MSC_VER)
+#   define FF_ALIGN(n) __declspec(align(n))
+#else
+#   define FF_ALIGN(n) __attribute__((aligned(n)))
+#endif
+
 #endif
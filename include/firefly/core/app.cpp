@@ -1,10 +1,16 @@
 #include <firefly/core/app.hpp>
+#include <firefly/core/job.hpp>
 #include <firefly/core/helper/string.hpp>
 #include <firefly/debug/gl_debug.hpp>
+#include <firefly/debug/profiler.hpp>
 #include <firefly/io/SOIL/SOIL.h>
 #include <firefly/io/ini_file.hpp>
 
 #include <firefly/graphics/texture.hpp>
+#include <firefly/graphics/shader.hpp>
+#include <firefly/graphics/state.hpp>
+
+#include <algorithm>
 
 // handle the main function
 int main(int argc, char * argv[])
@@ -50,6 +56,8 @@ namespace ff {
         m_bRunning = false;
         m_bActive = true;
         m_bAutoPause = false;
+        m_bShaderReload = false;
+        m_bProfile = false;
         m_frameTime = 0;
         m_gameTime = 0;
         m_runTime = 0;
@@ -59,6 +67,24 @@ namespace ff {
         m_msPerFrameAvg = 0;
         m_msPerFrameMin = 99999;
         m_msPerFrameMax = 0;
+        m_updateStep = 0;
+        m_accumulator = 0;
+        m_maxUpdates = FF_MAX_UPDATES;
+        m_skippedUpdates = 0;
+        m_bUpdateThread = false;
+        m_bPipeline = false;
+        m_bSimBusy = false;
+        m_simFrameTime = 0;
+        m_simAlpha = 1;
+        m_snapshot = 0;
+        m_bSnapshotDirty = false;
+        m_bTitleChanged = false;
+        m_mouseX = m_mouseY = 0;
+        m_bMouseMoved = false;
+        m_glThread = std::this_thread::get_id();
+        m_mouse = m_polledMouse = m_simMouse = mouse_info();
+        std::fill(m_polledKeys, m_polledKeys + GLFW_KEY_LAST + 1, false);
+        std::fill(m_simKeys, m_simKeys + GLFW_KEY_LAST + 1, false);
     }
 
 
@@ -102,7 +128,8 @@ namespace ff {
 	}
 
 
-// update window title
+// update window title / move the mouse, done on the GL thread after the
+// frame is rendered
 
     void App::SetWindowTitle(const char * title, ...)
     {
@@ -111,7 +138,18 @@ namespace ff {
         va_start(va, title);
         vsnprintf(buffer, 256, title, va);
         va_end(va);
-        glfwSetWindowTitle(buffer);
+
+        std::lock_guard<std::mutex> lock(m_windowLock);
+        m_windowTitle = buffer;
+        m_bTitleChanged = true;
+    }
+
+    void App::SetMousePos(int x, int y)
+    {
+        std::lock_guard<std::mutex> lock(m_windowLock);
+        m_mouseX = x;
+        m_mouseY = y;
+        m_bMouseMoved = true;
     }
 
 
@@ -151,6 +189,36 @@ namespace ff {
         config.select("APP");
         g_Log.set(config.get("Log", FF_LOG_FILE));
         m_bAutoPause = config.get<bool>("AutoPause", false);
+        m_bShaderReload = config.get<bool>("ShaderReload", false);
+        m_bProfile = config.get<bool>("Profile", false);
+
+        int updateRate = config.get<int>("UpdateRate", 0);
+        m_updateStep = (updateRate > 0) ? 1.0 / updateRate : 0;
+        m_maxUpdates = std::max(1, config.get<int>("MaxUpdates", m_maxUpdates));
+        m_bUpdateThread = config.get<bool>("UpdateThread", false);
+        if (m_bUpdateThread && updateRate <= 0)
+        {
+            g_Log.write(LOG_WARNING, "app::load_config > UpdateThread needs an UpdateRate, "
+                        "updating on the render thread");
+            m_bUpdateThread = false;
+        }
+        double frameRate = config.get<double>("FrameRate", 0);
+        m_pacer.set_rate(frameRate);
+        if (frameRate > 0)
+            g_Log.write(LOG_CONFIG, "Frame rate: paced to %.2f fps", frameRate);
+
+        m_bPipeline = config.get<bool>("Pipeline", false);
+        if (m_bPipeline && m_bUpdateThread)
+        {
+            g_Log.write(LOG_WARNING, "app::load_config > Pipeline and UpdateThread both set, "
+                        "using UpdateThread");
+            m_bPipeline = false;
+        }
+        if (updateRate > 0)
+            g_Log.write(LOG_CONFIG, "Updates: %i Hz fixed, at most %i per frame%s", updateRate,
+                        m_maxUpdates, m_bUpdateThread ? ", on their own thread" : "");
+        if (m_bPipeline)
+            g_Log.write(LOG_CONFIG, "Updates: pipelined, a frame ahead of rendering");
 
         config.select("GRAPHICS");
         ws.fullscreen = config.get<bool>("Fullscreen", ws.fullscreen);
@@ -235,7 +303,13 @@ namespace ff {
         }
 
         // start sub-systems
+        g_Job.Init(m_numProcessors);
+		g_GLState.Init();
+		g_Profiler.Init(m_bProfile);
 		g_Texture.Init();
+		g_Shader.Init();
+		if (m_bShaderReload)
+			g_Shader.StartWatching();
 
 		// load the game
         g_Log.write(LOG_INTERNAL, " ");
@@ -247,28 +321,207 @@ namespace ff {
             return false;
 		}
 
+		// Load() is free to make GL calls the state cache doesn't see
+		g_GLState.Invalidate();
+
         g_Log.write(LOG_INTERNAL, " ");
         return (m_bRunning = true);
     }
 
 
-// the main game loop
+// the main game loop. Render() is handed the game time it shows and how
+// far (alpha) it is from the second last update to the last one, with a
+// fixed timestep it should draw its state interpolated by alpha. Snapshots
+// are swapped here, between frames, whichever thread the updates run on.
 
     void App::main_loop()
     {
         assert(m_bRunning);
         Log("... main loop ...");
-        delta_t frameTime = 0;
         m_timer.start();
+        m_pacer.start();
+
+        // one zero length update, so the first frame has a snapshot to draw
+        frame_update(0, m_gameTime);
+        publish_snapshot();
+
+        m_lastUpdate = std::chrono::steady_clock::now();
+        if (m_bUpdateThread)
+            m_updateThread = std::thread(&App::update_loop, this);
+        else if (m_bPipeline)
+            m_updateThread = std::thread(&App::pipeline_loop, this);
 
         while (m_bRunning)
         {
-			// NOTE runTime should be game time later.
-            frameTime = GetFrameTime();
-            frame_update(m_frameTime, m_runTime);
-            frame_render(m_frameTime, m_runTime);
+            g_Profiler.NextFrame();
+
+            bool active = (glfwGetWindowParam(GLFW_ACTIVE) != 0);
+            if (m_bActive != active)
+            {
+                if (active) on_active();
+                else on_inactive();
+            }
+            poll_input();
+
+            delta_t alpha, elapsed;
+            if (m_bUpdateThread)
+            {
+                std::lock_guard<std::mutex> lock(m_stateLock);
+                publish_snapshot();
+                std::chrono::duration<double> since = std::chrono::steady_clock::now() - m_lastUpdate;
+                alpha = clamp(since.count() / m_updateStep, 0.0, 1.0);
+                elapsed = m_gameTime - (1.0 - alpha) * m_updateStep;
+            }
+            else if (m_bPipeline)
+            {
+                // wait for the updates of the frame about to be drawn, then
+                // start on the next frame's while this one renders
+                std::unique_lock<std::mutex> lock(m_pipeLock);
+                while (m_bSimBusy)
+                    m_pipeCond.wait(lock);
+                publish_snapshot();
+                alpha = m_simAlpha;
+                elapsed = m_gameTime - (1.0 - alpha) * m_updateStep;
+                m_simFrameTime = m_frameTime;
+                m_bSimBusy = true;
+                m_pipeCond.notify_all();
+            }
+            else
+            {
+                alpha = step_simulation(m_frameTime);
+                publish_snapshot();
+                elapsed = m_gameTime - (1.0 - alpha) * m_updateStep;
+            }
+
+            frame_render(m_frameTime, elapsed, alpha);
             update_timer();
         }
+
+        // wake the pipelined thread so it sees we have stopped
+        if (m_updateThread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_pipeLock);
+                m_pipeCond.notify_all();
+            }
+            m_updateThread.join();
+        }
+    }
+
+
+// runs the updates due this frame on the render thread and returns alpha.
+// Variable rate: one update of the whole frame time. Fixed rate: as many
+// steps as the accumulated time covers, at most m_maxUpdates of them.
+
+    delta_t App::step_simulation(const delta_t frameTime)
+    {
+        if (m_updateStep <= 0)
+        {
+            m_gameTime += frameTime;
+            frame_update(frameTime, m_gameTime);
+            return 1.0;
+        }
+
+        m_accumulator += frameTime;
+        for (int updates = 0; m_accumulator >= m_updateStep && updates < m_maxUpdates; ++updates)
+        {
+            m_gameTime += m_updateStep;
+            frame_update(m_updateStep, m_gameTime);
+            m_accumulator -= m_updateStep;
+        }
+
+        // too far behind to catch up, let the game slow down rather than
+        // spend ever longer frames updating
+        if (m_accumulator >= m_updateStep)
+        {
+            uint32 skipped = (uint32)(m_accumulator / m_updateStep);
+            m_skippedUpdates += skipped;
+            m_accumulator -= skipped * m_updateStep;
+        }
+
+        return m_accumulator / m_updateStep;
+    }
+
+
+// update thread, ticks at the fixed rate independent of rendering and
+// holds the state lock for each update
+
+    void App::update_loop()
+    {
+        typedef std::chrono::steady_clock clock;
+        g_Profiler.SetThreadName("Update");
+
+        const clock::duration step = std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>(m_updateStep));
+        clock::time_point next = clock::now();
+
+        while (m_bRunning)
+        {
+            for (int updates = 0; next <= clock::now() && updates < m_maxUpdates && m_bRunning; ++updates)
+            {
+                std::lock_guard<std::mutex> lock(m_stateLock);
+                drain_input();
+                m_gameTime += m_updateStep;
+                frame_update(m_updateStep, m_gameTime);
+                m_lastUpdate = next;
+                next += step;
+            }
+
+            clock::time_point now = clock::now();
+            if (next <= now)
+            {
+                m_skippedUpdates += (uint32)((now - next) / step);
+                next = now;
+            }
+
+            std::this_thread::sleep_until(next);
+        }
+    }
+
+
+// pipelined update thread, runs one frame's worth of updates each time
+// the render thread hands it a frame time, under the state lock so
+// Input() still sees whole updates
+
+    void App::pipeline_loop()
+    {
+        g_Profiler.SetThreadName("Update");
+        std::unique_lock<std::mutex> lock(m_pipeLock);
+
+        while (true)
+        {
+            while (!m_bSimBusy && m_bRunning)
+                m_pipeCond.wait(lock);
+            if (!m_bRunning)
+                break;
+
+            const delta_t frameTime = m_simFrameTime;
+            lock.unlock();
+            delta_t alpha;
+            {
+                std::lock_guard<std::mutex> state(m_stateLock);
+                drain_input();
+                alpha = step_simulation(frameTime);
+            }
+            lock.lock();
+
+            m_simAlpha = alpha;
+            m_bSimBusy = false;
+            m_pipeCond.notify_all();
+        }
+    }
+
+
+// makes what the updates since the last call wrote visible to Render(),
+// only while no update is running
+
+    void App::publish_snapshot()
+    {
+        if (m_bSnapshotDirty)
+        {
+            m_snapshot ^= 1;
+            m_bSnapshotDirty = false;
+        }
     }
 
 
@@ -280,8 +533,13 @@ namespace ff {
         g_Log.write(LOG_EVENT, "Exiting Game...");
         Exit();
 
-        // shutdown each subsystem
+        // shutdown each subsystem, the trace covers the last few seconds
         m_timer.stop();
+        if (g_Profiler.IsEnabled())
+            g_Profiler.ExportTrace(FF_PROFILE_FILE);
+        g_Profiler.Shutdown();
+        g_Shader.StopWatching();
+        g_Job.Shutdown();
 
         glfwTerminate();
         g_Log.write(LOG_INTERNAL, " ");
@@ -296,6 +554,13 @@ namespace ff {
         g_Log.write(LOG_CONFIG, "%.5f ms/F high, %.5f ms/F low. "
                     "(Avg: %.5f ms/F)", m_msPerFrameMax,
                     m_msPerFrameMin, m_msPerFrameAvg);
+        g_Log.write(LOG_CONFIG, "%.3f ms/F p50, %.3f ms/F p95, %.3f ms/F p99. "
+                    "(Last %u frames)", m_pacer.percentile(50),
+                    m_pacer.percentile(95), m_pacer.percentile(99),
+                    m_pacer.count());
+        if (m_skippedUpdates)
+            g_Log.write(LOG_CONFIG, "%u fixed updates skipped to keep up.",
+                        m_skippedUpdates);
         g_Log.write(LOG_INTERNAL, " ");
     }
 
@@ -304,48 +569,84 @@ namespace ff {
 
     void App::frame_update(const delta_t dt, const delta_t elapsed)
     {
-        bool active = (glfwGetWindowParam(GLFW_ACTIVE) != 0);
-        if (m_bActive != active)
-        {
-            if (active) on_active();
-            else on_inactive();
-        }
+        FF_PROFILE_SCOPE("Update");
         Update(dt, elapsed);
+        m_bSnapshotDirty = true;
     }
 
 
 // render the current frame
 
-    void App::frame_render(const delta_t dt, const delta_t elapsed)
+    void App::frame_render(const delta_t dt, const delta_t elapsed, const delta_t alpha)
     {
-        Render(dt, elapsed);
-        glfwSwapBuffers();
+        {
+            FF_PROFILE_GPU("Render");
+            g_GLState.ResetStats();
+            g_Shader.Update();
+            g_Texture.Update();
+            Render(dt, elapsed, alpha);
+        }
+        apply_window_changes();
+
+        // time blocked here is the driver waiting on the gpu or vsync
+        {
+            FF_PROFILE_SCOPE("Swap");
+            glfwSwapBuffers();
+        }
         m_frameTime = 0;
     }
 
 
+// window changes asked for since the last frame
+
+    void App::apply_window_changes()
+    {
+        string title;
+        bool titleChanged, mouseMoved;
+        int x, y;
+        {
+            std::lock_guard<std::mutex> lock(m_windowLock);
+            titleChanged = m_bTitleChanged;
+            mouseMoved = m_bMouseMoved;
+            title = m_windowTitle;
+            x = m_mouseX;
+            y = m_mouseY;
+            m_bTitleChanged = m_bMouseMoved = false;
+        }
+
+        // moving the mouse calls back into Input(), so not under the lock
+        if (titleChanged)
+            glfwSetWindowTitle(title.c_str());
+        if (mouseMoved)
+            glfwSetMousePos(x, y);
+    }
+
+
 // update fps information
 
     void App::update_timer()
     {
         static delta_t counter = 0;
         static int frames = 0;
+        static uint64 totalFrames = 0;
 
-        m_frameTime = m_timer.elapsed();
-        m_runTime += m_frameTime;
+        // waits out the rest of the frame when pacing
+        m_frameTime = m_pacer.frame();
+        m_runTime = m_timer.elapsed();
         counter += m_frameTime;
-        m_timer.start();
+
+        // frame time stats in ms, the percentiles are kept by the pacer
+        delta_t ms = m_frameTime * 1000.0;
+        m_msPerFrameAvg = m_runTime * 1000.0 / ++totalFrames;
+        if (ms < m_msPerFrameMin)
+            m_msPerFrameMin = ms;
+        if (ms > m_msPerFrameMax)
+            m_msPerFrameMax = ms;
 
         // update fps calculations
         if (counter < 1.0)
         {
             ++frames;
-            m_msPerFrameAvg += m_frameTime;
-            m_msPerFrameAvg *= .5;
-            if (m_frameTime < m_msPerFrameMin)
-                m_msPerFrameMin = m_frameTime;
-            if (m_frameTime > m_msPerFrameMax)
-                m_msPerFrameMax = m_frameTime;
         }
         else
         {
@@ -384,24 +685,80 @@ namespace ff {
     }
 
 
-// pass glfw mouse/keyboard input callbacks to the main application
+// pass glfw mouse/keyboard input callbacks to the main application. With
+// updates off the GL thread they are queued rather than waiting on the
+// state lock, which would hold the frame up behind a whole update
 
     void App::on_input(const input & msg)
     {
+        if (m_updateThread.joinable())
+        {
+            std::lock_guard<std::mutex> lock(m_inputLock);
+            m_inputQueue.push_back(msg);
+            return;
+        }
         Input(msg);
     }
 
 
-// return current mouse state
+// takes this frame's mouse and key state for the update thread
 
-    const mouse_info & App::GetMouse()
+    void App::poll_input()
     {
-        static mouse_info info;
+        if (!m_updateThread.joinable())
+            return;
+
         int i = GLFW_PRESS;
-        info.LMB = glfwGetMouseButton(GLFW_MOUSE_BUTTON_LEFT) == i;
-        info.MMB = glfwGetMouseButton(GLFW_MOUSE_BUTTON_MIDDLE) == i;
-        info.RMB = glfwGetMouseButton(GLFW_MOUSE_BUTTON_RIGHT) == i;
-        glfwGetMousePos(&info.x, &info.y);
+        std::lock_guard<std::mutex> lock(m_inputLock);
+        m_polledMouse.LMB = glfwGetMouseButton(GLFW_MOUSE_BUTTON_LEFT) == i;
+        m_polledMouse.MMB = glfwGetMouseButton(GLFW_MOUSE_BUTTON_MIDDLE) == i;
+        m_polledMouse.RMB = glfwGetMouseButton(GLFW_MOUSE_BUTTON_RIGHT) == i;
+        glfwGetMousePos(&m_polledMouse.x, &m_polledMouse.y);
+        for (int key = 0; key <= GLFW_KEY_LAST; ++key)
+            m_polledKeys[key] = glfwGetKey(key) == i;
+    }
+
+
+// hands the queued input to Input() and the polled state to GetMouse() /
+// GetKey(), on the update thread with the state lock held
+
+    void App::drain_input()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_inputLock);
+            m_inputBatch.swap(m_inputQueue);
+            m_simMouse = m_polledMouse;
+            std::copy(m_polledKeys, m_polledKeys + GLFW_KEY_LAST + 1, m_simKeys);
+        }
+        for (size_t i = 0; i < m_inputBatch.size(); ++i)
+            Input(m_inputBatch[i]);
+        m_inputBatch.clear();
+    }
+
+
+// return current mouse state, as of the start of the step on the update
+// thread
+
+    const mouse_info & App::GetMouse()
+    {
+        bool glThread = (std::this_thread::get_id() == m_glThread);
+        mouse_info & info = glThread ? m_mouse : m_simMouse;
+        if (glThread)
+        {
+            int i = GLFW_PRESS;
+            info.LMB = glfwGetMouseButton(GLFW_MOUSE_BUTTON_LEFT) == i;
+            info.MMB = glfwGetMouseButton(GLFW_MOUSE_BUTTON_MIDDLE) == i;
+            info.RMB = glfwGetMouseButton(GLFW_MOUSE_BUTTON_RIGHT) == i;
+            glfwGetMousePos(&info.x, &info.y);
+        }
+
+        // glfw only sees the move once it is applied after the frame
+        std::lock_guard<std::mutex> lock(m_windowLock);
+        if (m_bMouseMoved)
+        {
+            info.x = m_mouseX;
+            info.y = m_mouseY;
+        }
         return info;
     }
 
@@ -410,6 +767,8 @@ namespace ff {
 
     bool App::GetKey(int code)
     {
+        if (std::this_thread::get_id() != m_glThread)
+            return (code >= 0 && code <= GLFW_KEY_LAST) ? m_simKeys[code] : false;
         return (glfwGetKey(code) == GLFW_PRESS) ? true : false;
     }
 
@@ -8,11 +8,18 @@
 #include <firefly/core/timer.hpp>
 #include <firefly/core/singleton.hpp>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #define FF_EXIT_SUCCESS 0
 #define FF_EXIT_FAILURE -1
 #define FF_CONFIG_FILE  "firefly.ini"
 #define FF_LOG_FILE     "firefly.log"
 #define FF_SCREENSHOT_DIR "data/screenshots/"
+#define FF_MAX_UPDATES    5 // fixed updates per frame before the simulation falls behind
 
 // forward declaration of main
 int main(int,char*[]);
@@ -43,11 +50,14 @@ namespace ff {
         // private members
         Window    m_window;
         timer     m_timer;
+        frame_pacer m_pacer;
         int       m_numProcessors;
         string    m_appTitle;
-        bool      m_bRunning;
+        std::atomic<bool> m_bRunning;
         bool      m_bActive;
         bool      m_bAutoPause;
+        bool      m_bShaderReload;
+        bool      m_bProfile;
         delta_t   m_frameTime;
         delta_t   m_gameTime;
         delta_t   m_runTime;
@@ -58,13 +68,58 @@ namespace ff {
         delta_t   m_msPerFrameMin;
         delta_t   m_msPerFrameMax;
 
+        // fixed timestep simulation, m_updateStep is 0 for one update per frame
+        delta_t   m_updateStep;
+        delta_t   m_accumulator;
+        int       m_maxUpdates;
+        uint32    m_skippedUpdates;
+        bool      m_bUpdateThread;
+        std::thread m_updateThread;
+        std::mutex  m_stateLock;
+        std::chrono::steady_clock::time_point m_lastUpdate;
+
+        // pipelined mode, the next frame's updates run on m_updateThread while
+        // this one renders and the two meet once a frame to swap snapshots
+        bool      m_bPipeline;
+        std::mutex m_pipeLock;
+        std::condition_variable m_pipeCond;
+        bool      m_bSimBusy;
+        delta_t   m_simFrameTime;
+        delta_t   m_simAlpha;
+        uint32    m_snapshot;
+        bool      m_bSnapshotDirty;
+
+        // window changes asked for off the GL thread, applied after each frame
+        std::mutex m_windowLock;
+        string    m_windowTitle;
+        bool      m_bTitleChanged;
+        int       m_mouseX;
+        int       m_mouseY;
+        bool      m_bMouseMoved;
+
+        // input from the GL thread while updates run off it, handed to
+        // Input() on the update thread at the start of its next step
+        std::mutex m_inputLock;
+        vector<input> m_inputQueue;
+        vector<input> m_inputBatch; // update thread only
+
+        // GLFW can only be polled on the GL thread, so it takes the mouse
+        // and keys once a frame (under m_inputLock) and GetMouse() / GetKey()
+        // on the update thread read the copy taken at the start of its step
+        std::thread::id m_glThread;
+        mouse_info m_mouse;    // GL thread
+        mouse_info m_polledMouse;
+        bool      m_polledKeys[GLFW_KEY_LAST + 1];
+        mouse_info m_simMouse; // update thread
+        bool      m_simKeys[GLFW_KEY_LAST + 1];
+
     public:
 
         // state-based app functions
         bool Load();
         void Exit();
         void Update(const delta_t dt, const delta_t elapsed);
-        void Render(const delta_t dt, const delta_t elapsed);
+        void Render(const delta_t dt, const delta_t elapsed, const delta_t alpha);
 
         // event-based app functions
         void Input(const input & msg);
@@ -88,11 +143,21 @@ namespace ff {
         delta_t GetGameTime() const { return m_gameTime; }
         delta_t GetRunTime() const { return m_runTime; }
         delta_t GetFPS() const { return m_fpsAvg; }
+        double GetFrameTimePercentile(double p) const { return m_pacer.percentile(p); }
+        delta_t GetUpdateStep() const { return m_updateStep; }
+        bool HasUpdateThread() const { return m_updateThread.joinable(); }
+        bool IsPipelined() const { return m_bPipeline; }
+        uint32 GetSnapshotIndex() const { return m_snapshot; }
         bool GetKey(int code);
         const mouse_info & GetMouse();
 
-        // setters
+        // held by the framework around Update() and Input() when updates run
+        // off the GL thread, Render() should draw from Snapshots instead
+        std::mutex & GetStateLock() { return m_stateLock; }
+
+        // setters, safe to call from Update() on the update thread
         void SetWindowTitle(const char * title, ...);
+        void SetMousePos(int x, int y);
 
     private:
 
@@ -110,8 +175,15 @@ namespace ff {
 
         // main loop functions
         void frame_update(const delta_t dt, const delta_t elapsed);
-        void frame_render(const delta_t dt, const delta_t elapsed);
+        void frame_render(const delta_t dt, const delta_t elapsed, const delta_t alpha);
         void update_timer();
+        delta_t step_simulation(const delta_t frameTime);
+        void update_loop();
+        void pipeline_loop();
+        void publish_snapshot();
+        void poll_input();
+        void drain_input();
+        void apply_window_changes();
 
         // app event handlers
         void on_active();
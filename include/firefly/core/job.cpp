@@ -0,0 +1,354 @@
+#include <firefly/core/job.hpp>
+#include <firefly/debug/log.hpp>
+#include <firefly/debug/profiler.hpp>
+
+// per-thread worker state
+static thread_local int                 t_workerIndex = -1;
+static thread_local ff::JobCounter *    t_activeCounter = NULL;
+static thread_local ff::uint32          t_stealSeed = 0x9e3779b9;
+
+////////////////////////////////////////////////////////////////////////
+
+namespace ff {
+
+// create global instance
+
+    JobSystem GlobalJobSystem;
+
+
+// adds a job to the back of the queue, fails if the queue is full
+
+    bool JobQueue::Push(const Job & job)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_back - m_front >= FF_JOB_QUEUE_SIZE)
+            return false;
+
+        m_jobs[m_back & (FF_JOB_QUEUE_SIZE - 1)] = job;
+        ++m_back;
+        return true;
+    }
+
+
+// owner takes the most recently pushed job
+
+    bool JobQueue::Pop(Job & job)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_back == m_front)
+            return false;
+
+        --m_back;
+        job = m_jobs[m_back & (FF_JOB_QUEUE_SIZE - 1)];
+        return true;
+    }
+
+
+// another worker takes the oldest job
+
+    bool JobQueue::Steal(Job & job)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_back == m_front)
+            return false;
+
+        job = m_jobs[m_front & (FF_JOB_QUEUE_SIZE - 1)];
+        ++m_front;
+        return true;
+    }
+
+
+// ctor / dtor
+
+    JobSystem::JobSystem()
+        : m_numWorkers(0), m_bRunning(false), m_pending(0), m_sleeping(0)
+    {
+    }
+
+    JobSystem::~JobSystem()
+    {
+        Shutdown();
+    }
+
+
+// spawns the worker threads, the calling thread becomes worker 0
+
+    bool JobSystem::Init(int numWorkers)
+    {
+        assert(!m_bRunning);
+
+        if (numWorkers <= 0)
+            numWorkers = (int)std::thread::hardware_concurrency();
+        if (numWorkers <= 0)
+            numWorkers = 1;
+        if (numWorkers > FF_JOB_MAX_WORKERS)
+            numWorkers = FF_JOB_MAX_WORKERS;
+
+        m_numWorkers = numWorkers;
+        for (int i = 0; i < m_numWorkers; ++i)
+            m_queues.push_back(unique_ptr<JobQueue>(new JobQueue()));
+
+        t_workerIndex = 0;
+        m_bRunning = true;
+        for (int i = 1; i < m_numWorkers; ++i)
+            m_threads.push_back(std::thread(&JobSystem::worker_loop, this, i));
+
+        g_Log.write(LOG_CONFIG, "JobSystem > started %i worker(s).", m_numWorkers);
+        return true;
+    }
+
+
+// stops the workers, any jobs still queued are run on the calling thread
+
+    void JobSystem::Shutdown()
+    {
+        if (!m_bRunning)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(m_wakeLock);
+            m_bRunning = false;
+        }
+        m_wake.notify_all();
+
+        for (auto it = m_threads.begin(); it != m_threads.end(); ++it)
+            it->join();
+        m_threads.clear();
+
+        Job job;
+        while (get_job(job))
+            execute(job);
+
+        m_queues.clear();
+        m_numWorkers = 0;
+        t_workerIndex = -1;
+    }
+
+
+// queues a single job
+
+    void JobSystem::Run(JobFunction function, void * data, JobCounter * counter)
+    {
+        Job job = { function, data, counter };
+        Run(&job, 1);
+    }
+
+
+// queues a batch of jobs on the calling worker's deque
+
+    void JobSystem::Run(const Job * jobs, int count)
+    {
+        assert(jobs && count >= 0);
+        for (int i = 0; i < count; ++i)
+        {
+            if (jobs[i].counter)
+                jobs[i].counter->m_count.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // without workers (or from a foreign thread when every queue is
+        // full) there is no one else to run the job, so do it now
+        int index = (t_workerIndex >= 0) ? t_workerIndex : 0;
+        for (int i = 0; i < count; ++i)
+        {
+            if (!m_bRunning || !m_queues[index]->Push(jobs[i]))
+            {
+                execute(jobs[i]);
+                continue;
+            }
+            m_pending.fetch_add(1);
+        }
+
+        // wake sleeping workers, taking the lock avoids a lost wake up
+        if (m_sleeping.load() > 0)
+        {
+            { std::lock_guard<std::mutex> lock(m_wakeLock); }
+            if (count > 1) m_wake.notify_all();
+            else           m_wake.notify_one();
+        }
+    }
+
+
+// helps execute jobs instead of blocking until the counter hits zero
+
+    void JobSystem::WaitFor(JobCounter & counter)
+    {
+        Job job;
+        while (!counter.IsDone())
+        {
+            if (get_job(job))
+                execute(job);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+
+// internal job that runs one slice of a ParallelFor
+
+    struct JobRange
+    {
+        RangeFunction function;
+        void *        data;
+        uint32        begin;
+        uint32        end;
+    };
+
+    static void run_range(void * data)
+    {
+        JobRange * range = static_cast<JobRange *>(data);
+        range->function(range->begin, range->end, range->data);
+    }
+
+
+// splits a loop across the workers and waits for it to complete
+
+    void JobSystem::ParallelFor(uint32 count, uint32 grain, RangeFunction function, void * data)
+    {
+        if (count == 0)
+            return;
+
+        // nobody to share the loop with
+        if (m_numWorkers <= 1)
+        {
+            function(0, count, data);
+            return;
+        }
+
+        // aim for a few ranges per worker so stealing can balance the load
+        if (grain == 0)
+            grain = count / (uint32)(m_numWorkers * 4);
+        if (grain == 0)
+            grain = 1;
+
+        uint32 ranges = (count + grain - 1) / grain;
+        if (ranges == 1)
+        {
+            function(0, count, data);
+            return;
+        }
+
+        vector<JobRange> slices(ranges);
+        vector<Job> jobs(ranges - 1);
+        JobCounter counter;
+
+        for (uint32 i = 0; i < ranges; ++i)
+        {
+            slices[i].function = function;
+            slices[i].data = data;
+            slices[i].begin = i * grain;
+            slices[i].end = (i + 1 == ranges) ? count : (i + 1) * grain;
+        }
+
+        // queue all but the first range, which runs on this thread
+        for (uint32 i = 1; i < ranges; ++i)
+        {
+            Job job = { run_range, &slices[i], &counter };
+            jobs[i - 1] = job;
+        }
+
+        Run(&jobs[0], (int)jobs.size());
+        run_range(&slices[0]);
+        WaitFor(counter);
+    }
+
+
+// returns the counter of the job being executed by this thread
+
+    JobCounter * JobSystem::GetActiveCounter() const
+    {
+        return t_activeCounter;
+    }
+
+
+// returns the calling thread's worker index, or -1 for foreign threads
+
+    int JobSystem::GetWorkerIndex() const
+    {
+        return t_workerIndex;
+    }
+
+
+// pops local work first, then tries to steal from the other workers
+
+    bool JobSystem::get_job(Job & job)
+    {
+        if (m_queues.empty() || m_pending.load() <= 0)
+            return false;
+
+        int index = t_workerIndex;
+        if (index >= 0 && m_queues[index]->Pop(job))
+        {
+            m_pending.fetch_sub(1);
+            return true;
+        }
+
+        // xorshift to pick where to start stealing
+        t_stealSeed ^= t_stealSeed << 13;
+        t_stealSeed ^= t_stealSeed >> 17;
+        t_stealSeed ^= t_stealSeed << 5;
+
+        int start = (int)(t_stealSeed % (uint32)m_numWorkers);
+        for (int i = 0; i < m_numWorkers; ++i)
+        {
+            int victim = (start + i) % m_numWorkers;
+            if (victim == index)
+                continue;
+
+            if (m_queues[victim]->Steal(job))
+            {
+                m_pending.fetch_sub(1);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+
+// runs a job and signals its counter
+
+    void JobSystem::execute(const Job & job)
+    {
+        JobCounter * parent = t_activeCounter;
+        t_activeCounter = job.counter;
+        {
+            FF_PROFILE_SCOPE("Job");
+            job.function(job.data);
+        }
+        t_activeCounter = parent;
+
+        if (job.counter)
+            job.counter->m_count.fetch_sub(1, std::memory_order_release);
+    }
+
+
+// background worker thread, sleeps while there is nothing to do
+
+    void JobSystem::worker_loop(int index)
+    {
+        t_workerIndex = index;
+        t_stealSeed += (uint32)index * 0x45d9f3b;
+
+        char name[32];
+        snprintf(name, sizeof(name), "Worker %d", index);
+        g_Profiler.SetThreadName(name);
+
+        Job job;
+        while (m_bRunning)
+        {
+            if (get_job(job))
+            {
+                execute(job);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_wakeLock);
+            m_sleeping.fetch_add(1);
+            m_wake.wait(lock, [this] { return m_pending.load() > 0 || !m_bRunning; });
+            m_sleeping.fetch_sub(1);
+        }
+    }
+
+} // exiting namespace ff
+
+////////////////////////////////////////////////////////////////////////
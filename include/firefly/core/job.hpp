@@ -0,0 +1,130 @@
+#ifndef FIREFLY_JOB_HPP
+#define FIREFLY_JOB_HPP
+
+#include <firefly/common.hpp>
+#include <firefly/core/singleton.hpp>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#define FF_JOB_MAX_WORKERS 64
+#define FF_JOB_QUEUE_SIZE  4096 // per worker, must be a power of two
+
+////////////////////////////////////////////////////////////////////////
+
+namespace ff {
+
+// job entry points
+
+    typedef void (*JobFunction)(void * data);
+    typedef void (*RangeFunction)(uint32 begin, uint32 end, void * data);
+
+
+// counts the outstanding jobs attached to it, reaches zero once they
+// (and any children they spawned against it) have all finished
+
+    class JobCounter
+    {
+    public:
+        JobCounter() : m_count(0) { }
+
+        bool IsDone() const { return m_count.load(std::memory_order_acquire) == 0; }
+        int  GetCount() const { return m_count.load(std::memory_order_relaxed); }
+
+    private:
+        JobCounter(const JobCounter &);
+        JobCounter & operator = (const JobCounter &);
+
+        friend class JobSystem;
+        std::atomic<int> m_count;
+    };
+
+
+// a single unit of work
+
+    struct Job
+    {
+        JobFunction  function;
+        void *       data;
+        JobCounter * counter;
+    };
+
+
+// bounded per-worker deque, the owner works from the back (LIFO) while
+// idle workers steal from the front (FIFO)
+
+    class JobQueue
+    {
+    public:
+        JobQueue() : m_front(0), m_back(0) { }
+
+        bool Push(const Job & job);
+        bool Pop(Job & job);
+        bool Steal(Job & job);
+
+    private:
+        std::mutex m_lock;
+        uint32     m_front;
+        uint32     m_back;
+        Job        m_jobs[FF_JOB_QUEUE_SIZE];
+    };
+
+
+// work-stealing job system, one worker per logical core (the thread
+// that calls Init() acts as worker 0)
+
+    class JobSystem : public singleton<JobSystem>
+    {
+    public:
+        JobSystem();
+        ~JobSystem();
+
+        // start / stop the worker threads
+        bool Init(int numWorkers = 0);
+        void Shutdown();
+
+        // queue work, counter (if any) is incremented before the job is queued
+        void Run(JobFunction function, void * data, JobCounter * counter = NULL);
+        void Run(const Job * jobs, int count);
+
+        // executes queued jobs on the calling thread until counter reaches zero
+        void WaitFor(JobCounter & counter);
+
+        // splits [0, count) into ranges of 'grain' items (0 picks a size) and waits
+        void ParallelFor(uint32 count, uint32 grain, RangeFunction function, void * data);
+
+        // counter of the job running on the calling thread, used to add children
+        JobCounter * GetActiveCounter() const;
+
+        int  GetWorkerCount() const { return m_numWorkers; }
+        int  GetWorkerIndex() const;
+        bool IsRunning() const { return m_bRunning; }
+
+    private:
+        bool get_job(Job & job);
+        void execute(const Job & job);
+        void worker_loop(int index);
+
+        vector<unique_ptr<JobQueue>> m_queues;
+        vector<std::thread>          m_threads;
+        int                          m_numWorkers;
+        std::atomic<bool>            m_bRunning;
+        std::atomic<int>             m_pending;
+        std::atomic<int>             m_sleeping;
+        std::mutex                   m_wakeLock;
+        std::condition_variable      m_wake;
+    };
+
+// global access
+
+    extern JobSystem GlobalJobSystem;
+
+#define g_Job ff::JobSystem::get_singleton()
+
+} // exiting namespace ff
+
+////////////////////////////////////////////////////////////////////////
+
+#endif
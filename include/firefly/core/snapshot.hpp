@@ -0,0 +1,36 @@
+#ifndef FIREFLY_SNAPSHOT_HPP
+#define FIREFLY_SNAPSHOT_HPP
+
+#include <firefly/common.hpp>
+#include <firefly/core/app.hpp>
+
+////////////////////////////////////////////////////////////////////////
+
+namespace ff {
+
+// double buffered state handed from Update() to Render(). Update() fills
+// in the write side (all of it, every update), Render() draws from the
+// read side, and the app swaps every snapshot at once between frames
+// while neither is running. This is what lets Update() run on another
+// thread, a frame ahead of Render(), without locking.
+
+    template <typename T> class Snapshot
+    {
+    public:
+        Snapshot() { }
+
+        T & Write() { return m_state[g_App.GetSnapshotIndex()]; }
+        const T & Read() const { return m_state[g_App.GetSnapshotIndex() ^ 1]; }
+
+    private:
+        Snapshot(const Snapshot &);
+        Snapshot & operator = (const Snapshot &);
+
+        T m_state[2];
+    };
+
+} // exiting namespace ff
+
+////////////////////////////////////////////////////////////////////////
+
+#endif
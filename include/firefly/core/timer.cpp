@@ -1,5 +1,17 @@
 #include <firefly/core/timer.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdlib>
+#include <thread>
+
+// platform-specific headers
+#ifdef WIN32
+    #include <Windows.h>
+    #include <mmsystem.h>
+#else
+    #include <time.h>
+#endif
 
 ////////////////////////////////////////////////////////////////////////
 
@@ -9,19 +21,6 @@ namespace ff {
 
     timer::timer()
     {
-        #ifdef WIN32
-
-            QueryPerformanceFrequency(&li_freq);
-            li_start.QuadPart = 0;
-            li_end.QuadPart = 0;
-
-        #else
-
-            tv_start.tv_sec = tv_start.tv_usec = 0;
-            tv_end.tv_sec = tv_end.tv_usec = 0;
-
-        #endif
-
         m_running = false;
         m_start = 0;
         m_end = 0;
@@ -40,76 +39,187 @@ namespace ff {
     void timer::start()
     {
         m_running = true;
+        m_start = now();
+    }
 
-        #ifdef WIN32
 
-            QueryPerformanceCounter(&li_start);
+// stop the timer
 
-        #else
+    void timer::stop()
+    {
+        m_running = false;
+        m_end = now();
+    }
 
-            gettimeofday(&tv_start, NULL);
 
-        #endif
+// return timer count in seconds
+
+    double timer::elapsed()
+    {
+        return this->elapsed_ns() * 0.000000001;
     }
 
 
-// stop the timer
+// return timer count in milliseconds
 
-    void timer::stop()
+    double timer::elapsed_ms()
     {
-        m_running = false;
+        return this->elapsed_ns() * 0.000001;
+    }
+
+
+// return timer count in microseconds
+
+    double timer::elapsed_micro()
+    {
+        return this->elapsed_ns() * 0.001;
+    }
+
 
+// return timer count in nanoseconds
+
+    uint64 timer::elapsed_ns()
+    {
+        if (m_running)
+            m_end = now();
+
+        return (m_end - m_start);
+    }
+
+
+// monotonic clock, the performance counter on windows and
+// CLOCK_MONOTONIC elsewhere (read through the vdso, so about as cheap
+// as rdtsc without needing it calibrated or synchronised across cores)
+
+    uint64 timer::now()
+    {
         #ifdef WIN32
 
-            QueryPerformanceCounter(&li_end);
+            static LARGE_INTEGER freq = { 0 };
+            if (!freq.QuadPart)
+                QueryPerformanceFrequency(&freq);
+
+            // split so the multiply can't overflow
+            LARGE_INTEGER count;
+            QueryPerformanceCounter(&count);
+            uint64 seconds = (uint64)(count.QuadPart / freq.QuadPart);
+            uint64 rest = (uint64)(count.QuadPart % freq.QuadPart);
+            return seconds * 1000000000ull + rest * 1000000000ull / (uint64)freq.QuadPart;
 
         #else
 
-            gettimeofday(&tv_end, NULL);
+            timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return (uint64)ts.tv_sec * 1000000000ull + (uint64)ts.tv_nsec;
 
         #endif
     }
 
 
-// return timer count in seconds
+// ctor
 
-    double timer::elapsed()
+    frame_pacer::frame_pacer()
     {
-        return this->elapsed_micro() * 0.000001;
+        m_period = 0;
+        m_deadline = 0;
+        m_last = timer::now();
+        m_next = 0;
+        m_count = 0;
     }
 
 
-// return timer count in milliseconds
+// dtor
 
-    double timer::elapsed_ms()
+    frame_pacer::~frame_pacer()
     {
-        return this->elapsed_micro() * 0.001;
+        set_rate(0);
     }
 
 
-// return timer count in microseconds
+// start the first frame
 
-    double timer::elapsed_micro()
+    void frame_pacer::start()
+    {
+        m_last = timer::now();
+        m_deadline = m_last + m_period;
+    }
+
+
+// set / get the target frame rate
+
+    void frame_pacer::set_rate(double fps)
     {
         #ifdef WIN32
 
-            if (m_running)
-                QueryPerformanceCounter(&li_end);
+            // sleeps are only as fine as the system timer, 15.6ms by default
+            if (fps > 0 && !m_period)
+                timeBeginPeriod(1);
+            else if (fps <= 0 && m_period)
+                timeEndPeriod(1);
 
-            m_start = li_start.QuadPart * (1000000. / li_freq.QuadPart);
-            m_end = li_end.QuadPart * (1000000.0 / li_freq.QuadPart);
+        #endif
 
-        #else
+        m_period = (fps > 0) ? (uint64)(1000000000.0 / fps) : 0;
+        m_deadline = m_last + m_period;
+    }
+
+    double frame_pacer::get_rate() const
+    {
+        return m_period ? 1000000000.0 / m_period : 0;
+    }
 
-            if (m_running)
-                gettimeofday(&tv_end, NULL);
 
-            m_start = (tv_start.tv_sec * 1000000.) + tv_start.tv_usec;
-            m_end = (tv_end.tv_sec * 1000000.) + tv_end.tv_usec;
+// end the current frame
 
-        #endif
+    double frame_pacer::frame()
+    {
+        uint64 now = timer::now();
+        if (m_period)
+        {
+            // sleep most of the way, the scheduler may wake us late
+            if (now + FF_PACER_SPIN < m_deadline)
+            {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(m_deadline - now - FF_PACER_SPIN));
+                now = timer::now();
+            }
+
+            while (now < m_deadline)
+            {
+                std::this_thread::yield();
+                now = timer::now();
+            }
+
+            // keep to the rate's grid, unless a frame ran so long that
+            // catching up would mean a burst of short ones
+            m_deadline += m_period;
+            if (m_deadline < now)
+                m_deadline = now + m_period;
+        }
+
+        double seconds = (now - m_last) * 0.000000001;
+        m_last = now;
+
+        m_times[m_next] = (float)(seconds * 1000.0);
+        m_next = (m_next + 1) % FF_PACER_HISTORY;
+        if (m_count < FF_PACER_HISTORY)
+            ++m_count;
+
+        return seconds;
+    }
 
-        return (m_end - m_start);
+
+// nearest rank percentile of the frames in the history
+
+    double frame_pacer::percentile(double p) const
+    {
+        if (!m_count)
+            return 0;
+
+        m_sorted.assign(m_times, m_times + m_count);
+        uint32 rank = (uint32)std::ceil(p / 100.0 * m_count);
+        rank = std::min(std::max(rank, 1u), m_count) - 1;
+        std::nth_element(m_sorted.begin(), m_sorted.begin() + rank, m_sorted.end());
+        return m_sorted[rank];
     }
 
 } // exiting namespace ff
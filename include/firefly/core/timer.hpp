@@ -1,18 +1,17 @@
 #ifndef FIREFLY_TIMER_HPP
 #define FIREFLY_TIMER_HPP
 
-// platform-specific headers
-#ifdef WIN32
-    #include <Windows.h>
-#else
-    #include <sys/time.h>
-#endif
+#include <firefly/common.hpp>
+
+#define FF_PACER_HISTORY 1024    // frame times kept for the percentiles
+#define FF_PACER_SPIN    2000000 // ns before a deadline spent spinning instead of sleeping
 
 ////////////////////////////////////////////////////////////////////////
 
 namespace ff {
 
-// base timer class
+// base timer class, on a monotonic nanosecond clock so it never jumps
+// with the wall clock
 
     class timer
     {
@@ -25,24 +24,53 @@ namespace ff {
         double elapsed();
         double elapsed_ms();
         double elapsed_micro();
+        uint64 elapsed_ns();
+
+        // the clock itself, nanoseconds since an arbitrary point
+        static uint64 now();
 
     private:
-        double m_start;
-        double m_end;
+        uint64 m_start;
+        uint64 m_end;
         bool   m_running;
+    };
+
+
+// marks out frames, optionally holding each one back to a target rate,
+// and keeps the recent frame times for percentiles. Waits sleep until
+// close to the deadline and spin the rest, sleeps alone overshoot by
+// the scheduler's granularity.
 
-        #ifdef WIN32
+    class frame_pacer
+    {
+    public:
+        frame_pacer();
+        ~frame_pacer();
+
+        // starts the first frame now
+        void start();
+
+        // frames per second to hold to, 0 to run free
+        void set_rate(double fps);
+        double get_rate() const;
 
-        LARGE_INTEGER li_freq;
-        LARGE_INTEGER li_start;
-        LARGE_INTEGER li_end;
+        // ends the current frame, waiting out its time first when pacing,
+        // and returns how long it took in seconds
+        double frame();
 
-        #else
+        // frame time in milliseconds that p percent of recent frames beat
+        double percentile(double p) const;
+        uint32 count() const { return m_count; }
 
-        timeval tv_start;
-        timeval tv_end;
+    private:
+        uint64 m_period;
+        uint64 m_deadline;
+        uint64 m_last;
 
-        #endif
+        float  m_times[FF_PACER_HISTORY];
+        uint32 m_next;
+        uint32 m_count;
+        mutable vector<float> m_sorted;
     };
 
 } // exiting namespace ff
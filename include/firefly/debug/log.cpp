@@ -1,5 +1,7 @@
 #include <firefly/debug/log.hpp>
-#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 
 // variety of log entry prefixes
 string prefix[7] = { ": ", "# ", "", "* ", ">> ", "+ ", "- " };
@@ -11,9 +13,27 @@ namespace ff {
 // constructor
 
     log::log(string outFile)
+        : m_Ring(new log_record[FF_LOG_RING])
     {
+        // a slot is free for the write numbered i when its sequence is i,
+        // and published for the writer when it is i + 1
+        for (uint32_t i = 0; i < FF_LOG_RING; ++i)
+            m_Ring[i].sequence.store(i, std::memory_order_relaxed);
+
+        m_Head.store(0);
+        m_Dropped.store(0);
+        m_Valid.store(!outFile.empty());
+        m_Tail = 0;
+        m_Reported = 0;
+        m_OpenFailed = false;
+        m_LastTime = 0;
         m_Filename = outFile;
         m_Created = false;
+        m_Reopen = false;
+        m_Flush = false;
+        m_Stop = false;
+        m_Written = 0;
+        m_Writer = std::thread(&log::writer_loop, this);
     }
 
 
@@ -22,7 +42,24 @@ namespace ff {
     log::~log()
     {
         write(LOG_INTERNAL, "EOF");
-        flush();
+        {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            m_Stop = true;
+        }
+        m_Wake.notify_one();
+        m_Writer.join();
+    }
+
+
+// changes the file, it is started afresh on the next write
+
+    void log::set(string file)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Filename = file;
+        m_Created = false;
+        m_Reopen = true;
+        m_Valid.store(!file.empty());
     }
 
 
@@ -33,104 +70,371 @@ namespace ff {
         if ( !valid() )
             return;
 
-        static double lastTime = 0;
-        stringstream buffer;
+        log_record * record = claim();
+        if (!record)
+            return;
+
+        size_t length = msg.size() < FF_LOG_MAX ? msg.size() : FF_LOG_MAX;
+        memcpy(record->text, msg.data(), length);
+        record->length = (uint32_t)length;
+        publish(record, elapsed);
+    }
 
-        if (elapsed < 0)
+
+// allows variable parameters like printf, formatted straight into the ring
+
+    void log::write(double elapsed, const char * format, ...)
+    {
+        if ( !valid() )
+            return;
+
+        log_record * record = claim();
+        if (!record)
+            return;
+
+        va_list va;
+        va_start(va, format);
+        int length = vsnprintf(record->text, FF_LOG_MAX, format, va);
+        va_end(va);
+
+        if (length < 0)
+            length = 0;
+        else if (length >= FF_LOG_MAX)
         {
-            int index = ((int)elapsed + 1) * -1;
-            buffer << prefix[index] << msg;
+            length = FF_LOG_MAX - 1;
+            memcpy(record->text + length, "...", 3);
+            length += 3;
         }
-        else
-        {
-            if (elapsed < lastTime)
-                elapsed = lastTime;
-            else
-                lastTime = elapsed;
 
-            double temp = elapsed * .01666666667 * .01666666667;
-            int hours = (int)temp;
-            temp -= (double)hours;
-            temp *= 60;
+        record->length = (uint32_t)length;
+        publish(record, elapsed);
+    }
 
-            int mins = (int)temp;
-            temp -= (double)mins;
-            temp *= 60;
 
-            int secs = (int)temp;
-            temp -= (double)secs;
-            temp *= 1000;
+// takes the next free slot, NULL when the ring is full. Writers race for
+// the head with a CAS, a slot whose sequence lags the head has not been
+// written out yet
 
-            int ms = (int)temp;
+    log_record * log::claim()
+    {
+        uint32_t pos = m_Head.load(std::memory_order_relaxed);
+        while (true)
+        {
+            log_record & record = m_Ring[pos & (FF_LOG_RING - 1)];
+            uint32_t sequence = record.sequence.load(std::memory_order_acquire);
+            int32_t diff = (int32_t)(sequence - pos);
 
-            if (hours > 0)
-                buffer << hours << ":";
-            buffer << mins << ":" << secs << ":" << ms << " " << msg;
+            if (diff == 0)
+            {
+                if (m_Head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    return &record;
+            }
+            else if (diff < 0)
+            {
+                m_Dropped.fetch_add(1, std::memory_order_relaxed);
+                return NULL;
+            }
+            else
+            {
+                pos = m_Head.load(std::memory_order_relaxed);
+            }
         }
+    }
+
 
-        m_Entries.push_back(buffer.str());
+// hands a filled slot to the writer, errors and every so many records
+// wake it rather than waiting for the next flush
 
-        if (m_Entries.size() >= LOG_MAX_BUFFER || elapsed == LOG_ERROR)
-            flush();
+    void log::publish(log_record * record, double elapsed)
+    {
+        record->elapsed = elapsed;
+        uint32_t pos = record->sequence.load(std::memory_order_relaxed);
+        record->sequence.store(pos + 1, std::memory_order_release);
+
+        if (elapsed == LOG_ERROR || (pos + 1) % LOG_MAX_BUFFER == 0)
+            m_Wake.notify_one();
     }
 
 
-// allows variable parameters like printf
+// waits until everything written so far is in the file
 
-    void log::write(double elapsed, const char * format, ...)
+    void log::flush()
     {
-		static string strbuf;
         if ( !valid() )
             return;
 
-		strbuf.clear();
-        char buffer[FF_LOG_MAX + 1];
-		buffer[FF_LOG_MAX - 1] = '\0';
-        va_list va;
-        va_start(va, format);
-        vsnprintf(buffer, FF_LOG_MAX, format, va);
-        va_end(va);
-		
-		buffer[FF_LOG_MAX] = '\0';
-		strbuf = buffer;
-		if (buffer[FF_LOG_MAX - 1] != '\0') {
-			strbuf += "...";
-		}
-
-        write(elapsed, strbuf);
+        uint32_t target = m_Head.load(std::memory_order_acquire);
+        std::unique_lock<std::mutex> lock(m_Lock);
+        m_Flush = true;
+        m_Wake.notify_one();
+        while ((int32_t)(m_Written - target) < 0 && !m_Stop)
+            m_Done.wait(lock);
     }
 
 
-// writes the buffer to the file
+// formats the published records in order into out, returns how many
 
-    void log::flush()
+    uint32_t log::drain(string & out)
     {
-        if ( !valid() )
-            return;
+        char stamp[64];
+        uint32_t count = 0;
 
-        ofstream logFile;
+        uint32_t dropped = m_Dropped.load(std::memory_order_relaxed) - m_Reported;
+        if (dropped)
+        {
+            m_Reported += dropped;
+            snprintf(stamp, sizeof(stamp), "%u log entries dropped, the log was full", dropped);
+            out += prefix[((int)LOG_WARNING + 1) * -1];
+            out += stamp;
+            out += '\n';
+        }
 
-        if (!m_Created)
+        while (true)
         {
-            logFile.open(m_Filename.c_str(), ios::out | ios::binary);
-            m_Created = true;
+            log_record & record = m_Ring[m_Tail & (FF_LOG_RING - 1)];
+            if (record.sequence.load(std::memory_order_acquire) != m_Tail + 1)
+                break;
+
+            double elapsed = record.elapsed;
+            if (elapsed < 0)
+            {
+                int index = ((int)elapsed + 1) * -1;
+                out += prefix[index];
+            }
+            else
+            {
+                if (elapsed < m_LastTime)
+                    elapsed = m_LastTime;
+                else
+                    m_LastTime = elapsed;
+
+                double temp = elapsed * .01666666667 * .01666666667;
+                int hours = (int)temp;
+                temp -= (double)hours;
+                temp *= 60;
+
+                int mins = (int)temp;
+                temp -= (double)mins;
+                temp *= 60;
+
+                int secs = (int)temp;
+                temp -= (double)secs;
+                temp *= 1000;
+
+                int ms = (int)temp;
+
+                if (hours > 0)
+                    snprintf(stamp, sizeof(stamp), "%i:%i:%i:%i ", hours, mins, secs, ms);
+                else
+                    snprintf(stamp, sizeof(stamp), "%i:%i:%i ", mins, secs, ms);
+                out += stamp;
+            }
+
+            if (record.length == FF_LOG_DEFERRED)
+                format_args(record.args, out);
+            else
+                out.append(record.text, record.length);
+            out += '\n';
+
+            // free the slot for the write a lap of the ring later
+            record.sequence.store(m_Tail + FF_LOG_RING, std::memory_order_release);
+            ++m_Tail;
+            ++count;
         }
-        else
+
+        return count;
+    }
+
+
+// formats a deferred entry. Each conversion in the format is handed to
+// snprintf on its own with its argument read back as the type the
+// conversion wants, so a mismatch prints a converted value rather than
+// garbage. Conversions without an argument are copied as they are.
+
+    void log::format_args(const log_args & args, string & out)
+    {
+        char spec[32], buffer[FF_LOG_MAX];
+        uint32_t next = 0;
+
+        for (const char * c = args.format; *c; ++c)
         {
-            logFile.open(m_Filename.c_str(), ios::app | ios::binary);
+            if (*c != '%')
+            {
+                out += *c;
+                continue;
+            }
+            if (c[1] == '%')
+            {
+                out += '%';
+                ++c;
+                continue;
+            }
+
+            // flags, width and precision are kept, * takes an int argument
+            const char * start = c++;
+            int stars[2] = { 0, 0 };
+            int starCount = 0;
+            size_t length = 1;
+            spec[0] = '%';
+            while (*c && strchr("-+ #0123456789.*", *c))
+            {
+                if (*c == '*')
+                {
+                    int value = 0;
+                    if (next < args.count)
+                    {
+                        const log_args::value_type & v = args.values[next];
+                        value = args.types[next] == LOG_ARG_DOUBLE ? (int)v.d : (int)v.i;
+                        ++next;
+                    }
+                    if (starCount < 2)
+                        stars[starCount++] = value;
+                }
+                if (length < sizeof(spec) - 4)
+                    spec[length++] = *c;
+                ++c;
+            }
+
+            // the length modifier is replaced by one matching what was stored
+            while (*c && strchr("hljztLq", *c))
+                ++c;
+            if (!*c)
+            {
+                out.append(start);
+                break;
+            }
+            if (next >= args.count || *c == 'n')
+            {
+                out.append(start, c + 1 - start);
+                continue;
+            }
+
+            const log_args::value_type & v = args.values[next];
+            const uint8_t type = args.types[next++];
+            const char conversion = *c;
+            int written = 0;
+
+            #define FF_LOG_FORMAT(value) \
+                (starCount == 0 ? snprintf(buffer, sizeof(buffer), spec, value) : \
+                 starCount == 1 ? snprintf(buffer, sizeof(buffer), spec, stars[0], value) : \
+                                  snprintf(buffer, sizeof(buffer), spec, stars[0], stars[1], value))
+
+            if (strchr("di", conversion))
+            {
+                spec[length++] = 'l'; spec[length++] = 'l';
+                spec[length++] = conversion; spec[length] = '\0';
+                long long value = type == LOG_ARG_DOUBLE ? (long long)v.d : (long long)v.i;
+                written = FF_LOG_FORMAT(value);
+            }
+            else if (strchr("ouxX", conversion))
+            {
+                spec[length++] = 'l'; spec[length++] = 'l';
+                spec[length++] = conversion; spec[length] = '\0';
+                unsigned long long value = type == LOG_ARG_DOUBLE ? (unsigned long long)v.d : (unsigned long long)v.u;
+                written = FF_LOG_FORMAT(value);
+            }
+            else if (conversion == 'c')
+            {
+                spec[length++] = conversion; spec[length] = '\0';
+                int value = type == LOG_ARG_DOUBLE ? (int)v.d : (int)v.i;
+                written = FF_LOG_FORMAT(value);
+            }
+            else if (strchr("eEfFgGaA", conversion))
+            {
+                spec[length++] = conversion; spec[length] = '\0';
+                double value = type == LOG_ARG_DOUBLE ? v.d :
+                               type == LOG_ARG_UINT ? (double)v.u : (double)v.i;
+                written = FF_LOG_FORMAT(value);
+            }
+            else if (conversion == 's')
+            {
+                spec[length++] = conversion; spec[length] = '\0';
+                const char * value = type == LOG_ARG_STRING ? args.strings + v.u : "(not a string)";
+                written = FF_LOG_FORMAT(value);
+            }
+            else if (conversion == 'p')
+            {
+                spec[length++] = conversion; spec[length] = '\0';
+                const void * value = type == LOG_ARG_STRING ? (const void *)(args.strings + v.u) : v.p;
+                written = FF_LOG_FORMAT(value);
+            }
+            else
+            {
+                out.append(start, c + 1 - start);
+                continue;
+            }
+
+            #undef FF_LOG_FORMAT
+
+            if (written > 0)
+                out.append(buffer, (size_t)written < sizeof(buffer) ? written : sizeof(buffer) - 1);
         }
+    }
+
+
+// background writer, drains the ring when woken or every FF_LOG_FLUSH_MS
+// and writes the batch with one call. A file that can't be opened loses
+// its batches, the ring keeps draining so writers never stall on it
 
-        assert(logFile.is_open());
-        if (!m_Entries.empty())
+    void log::writer_loop()
+    {
+        string out;
+        std::unique_lock<std::mutex> lock(m_Lock);
+
+        while (true)
         {
-            auto it = m_Entries.begin(), end = m_Entries.end();
-            for (; it != end; ++it)
+            if (!m_Flush && !m_Stop)
+                m_Wake.wait_for(lock, std::chrono::milliseconds(FF_LOG_FLUSH_MS));
+            bool stop = m_Stop;
+            m_Flush = false;
+
+            // the file is (re)opened on the first batch for it
+            bool reopen = m_Reopen || !m_File.is_open();
+            bool truncate = !m_Created;
+            string filename = m_Filename;
+            lock.unlock();
+
+            out.clear();
+            uint32_t count = drain(out);
+            bool written = false;
+            if (!out.empty() && !filename.empty())
+            {
+                if (reopen)
+                {
+                    if (m_File.is_open())
+                        m_File.close();
+                    m_File.clear();
+                    m_File.open(filename.c_str(), (truncate ? ios::out : ios::app) | ios::binary);
+                }
+
+                if (m_File.is_open())
+                {
+                    m_File.write(out.data(), out.size());
+                    m_File.flush();
+                    m_OpenFailed = false;
+                    written = true;
+                }
+                else if (!m_OpenFailed)
+                {
+                    fprintf(stderr, "log > unable to open '%s', entries are dropped until it can be\n", filename.c_str());
+                    m_OpenFailed = true;
+                }
+            }
+
+            lock.lock();
+            if (written && reopen && filename == m_Filename)
             {
-                logFile << *it << '\n';
+                m_Created = true;
+                m_Reopen = false;
             }
+            m_Written += count;
+            m_Done.notify_all();
+
+            if (stop && !count)
+                break;
         }
 
-        m_Entries.clear();
+        m_File.close();
     }
 
 } // exiting namespace ff
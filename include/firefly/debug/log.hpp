@@ -1,8 +1,15 @@
 #ifndef FIREFLY_LOG_HPP
 #define FIREFLY_LOG_HPP
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdarg>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include <fstream>
 #include <sstream>
@@ -15,8 +22,14 @@ using std::string;
 using std::vector;
 
 #define FF_LOG_MAX 512
+#define FF_LOG_RING     1024 // records waiting for the writer, power of two
+#define FF_LOG_FLUSH_MS 100  // longest a record waits before it is written
 
-#define LOG_MAX_BUFFER        (50)
+#define FF_LOG_ARGS     12   // arguments a deferred record can carry
+#define FF_LOG_STRINGS  256  // bytes of string arguments a deferred record can carry
+#define FF_LOG_DEFERRED 0xffffffff // record length of a deferred record
+
+#define LOG_MAX_BUFFER        (FF_LOG_RING / 4) // records queued before the writer is woken early
 #define LOG_DEFAULT_FILENAME  "firefly.log"
 #define LOG_CONFIG   -1
 #define LOG_ERROR    -2
@@ -30,6 +43,92 @@ using std::vector;
 
 namespace ff {
 
+// the arguments of a deferred entry, kept raw until the writer formats
+// them. Strings are copied in, everything else is stored by value.
+
+    enum log_arg_type
+    {
+        LOG_ARG_INT = 0,
+        LOG_ARG_UINT,
+        LOG_ARG_DOUBLE,
+        LOG_ARG_POINTER,
+        LOG_ARG_STRING, // offset into strings
+    };
+
+    struct log_args
+    {
+        const char * format;
+        uint8_t      count;
+        uint8_t      types[FF_LOG_ARGS];
+        uint16_t     used;
+        union value_type
+        {
+            int64_t      i;
+            uint64_t     u;
+            double       d;
+            const void * p;
+        };
+        value_type   values[FF_LOG_ARGS];
+        char         strings[FF_LOG_STRINGS];
+
+        void add(int v)                { add_int(v); }
+        void add(long v)               { add_int(v); }
+        void add(long long v)          { add_int(v); }
+        void add(unsigned int v)       { add_uint(v); }
+        void add(unsigned long v)      { add_uint(v); }
+        void add(unsigned long long v) { add_uint(v); }
+        void add(double v)             { types[count] = LOG_ARG_DOUBLE; values[count++].d = v; }
+        void add(const void * v)       { types[count] = LOG_ARG_POINTER; values[count++].p = v; }
+        void add(const char * v)       { add_string(v, v ? strlen(v) : 0); }
+        void add(char * v)             { add(static_cast<const char *>(v)); }
+        void add(const string & v)     { add_string(v.data(), v.size()); }
+
+        void add_int(int64_t v)   { types[count] = LOG_ARG_INT; values[count++].i = v; }
+        void add_uint(uint64_t v) { types[count] = LOG_ARG_UINT; values[count++].u = v; }
+        void add_string(const char * v, size_t length)
+        {
+            // once strings is full the rest come out empty, they point at
+            // the terminator in its last byte
+            types[count] = LOG_ARG_STRING;
+            if (used >= FF_LOG_STRINGS)
+            {
+                values[count++].u = FF_LOG_STRINGS - 1;
+                return;
+            }
+
+            size_t room = FF_LOG_STRINGS - 1 - used;
+            if (length > room)
+                length = room;
+            memcpy(strings + used, v, length);
+            strings[used + length] = '\0';
+            values[count++].u = used;
+            used += (uint16_t)(length + 1);
+        }
+    };
+
+
+// an entry waiting for the writer, formatted apart from its prefix, or
+// with length FF_LOG_DEFERRED, still in pieces. elapsed is the time
+// stamp or one of the LOG_ prefixes above.
+
+    struct log_record
+    {
+        std::atomic<uint32_t> sequence; // slot is free or published, see log.cpp
+        uint32_t              length;
+        double                elapsed;
+        union
+        {
+            char              text[FF_LOG_MAX + 4];
+            log_args          args;
+        };
+    };
+
+
+// log file writer. Any thread may write, entries are formatted by the
+// caller into a lock-free ring and a background thread writes them out
+// in batches to a file it keeps open. A full ring drops entries (and
+// says how many) rather than stalling the caller.
+
     class log : public singleton<log>
     {
     public:
@@ -38,15 +137,77 @@ namespace ff {
 
         void write(double elapsed, string & msg);
         void write(double elapsed, const char * format, ...);
-        void set(string file) { m_Filename = file; m_Created = false; }
+        void set(string file);
+
+        // like write() but only the arguments are copied, the writer thread
+        // formats them later. For per-frame logging from hot code, the
+        // format must be a string literal and %n is not supported.
+        template <typename... Args>
+        void trace(double elapsed, const char * format, const Args &... args)
+        {
+            static_assert(sizeof...(Args) <= FF_LOG_ARGS, "log::trace > too many arguments");
+            if ( !valid() )
+                return;
+
+            log_record * record = claim();
+            if (!record)
+                return;
+
+            record->length = FF_LOG_DEFERRED;
+            record->args.format = format;
+            record->args.count = 0;
+            record->args.used = 0;
+            add_args(record->args, args...);
+            publish(record, elapsed);
+        }
+
+        // waits until everything written so far is in the file
         void flush();
 
+        // entries lost to a full ring since the log was created
+        uint32_t get_dropped() const { return m_Dropped.load(std::memory_order_relaxed); }
+
     private:
-        bool valid() { return (!m_Filename.empty()); }
+        bool valid() const { return m_Valid.load(std::memory_order_relaxed); }
+
+        static void add_args(log_args &) { }
+        template <typename T, typename... Rest>
+        static void add_args(log_args & args, const T & value, const Rest &... rest)
+        {
+            args.add(value);
+            add_args(args, rest...);
+        }
+        static void format_args(const log_args & args, string & out);
+
+        log_record * claim();
+        void publish(log_record * record, double elapsed);
+        uint32_t drain(string & out);
+        void writer_loop();
+
+        // ring, shared by the writing threads and the writer
+        std::unique_ptr<log_record[]> m_Ring;
+        std::atomic<uint32_t>   m_Head;
+        std::atomic<uint32_t>   m_Dropped;
+        std::atomic<bool>       m_Valid;
+
+        // writer thread only
+        uint32_t                m_Tail;
+        uint32_t                m_Reported; // drops already noted in the file
+        bool                    m_OpenFailed; // already said so on stderr
+        double                  m_LastTime;
+        ofstream                m_File;
 
-        vector<string> m_Entries;
-        string         m_Filename;
-        bool           m_Created;
+        // guarded by m_Lock
+        std::mutex              m_Lock;
+        std::condition_variable m_Wake;
+        std::condition_variable m_Done;
+        string                  m_Filename;
+        bool                    m_Created;
+        bool                    m_Reopen;
+        bool                    m_Flush;
+        bool                    m_Stop;
+        uint32_t                m_Written;
+        std::thread             m_Writer;
     };
 
 } // exiting namespace ff
@@ -0,0 +1,468 @@
+#include <firefly/debug/profiler.hpp>
+#include <firefly/debug/log.hpp>
+#include <firefly/core/timer.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+////////////////////////////////////////////////////////////////////////
+
+namespace ff {
+
+// one scope begin (name) or end (NULL name) as its thread recorded it
+
+    struct ProfileRecord
+    {
+        const char * name;
+        uint64       time;
+    };
+
+
+// single producer / single consumer ring, the owning thread writes at
+// head and the main thread reads up to it in NextFrame()
+
+    struct ProfileThread
+    {
+        ProfileRecord         records[FF_PROFILE_RING];
+        std::atomic<uint32>   head;  // written by the owner
+        std::atomic<uint32>   tail;  // written by the collector
+        uint32                depth; // scopes the owner has open
+        vector<ProfileSample> open;  // scopes the collector has seen begin but not end
+        string                name;
+        uint16                index;
+    };
+
+} // exiting namespace ff
+
+// the calling thread's ring and the name it gets when it is created
+static thread_local ff::ProfileThread * t_profileThread = NULL;
+static thread_local char                t_profileName[32] = "";
+
+////////////////////////////////////////////////////////////////////////
+
+namespace ff {
+
+// create global instance
+
+    Profiler GlobalProfiler;
+
+
+// ctor / dtor
+
+    Profiler::Profiler()
+        : m_enabled(false), m_frames(FF_PROFILE_HISTORY), m_frameIndex(0),
+          m_gpuTimers(false), m_gpuDepth(0), m_gpuDropped(0)
+    {
+        m_epoch = m_frameStart = Now();
+        memset(m_gpu, 0, sizeof(m_gpu));
+    }
+
+    Profiler::~Profiler()
+    {
+    }
+
+
+// creates the gpu queries, the first frame starts now
+
+    void Profiler::Init(bool enabled)
+    {
+        m_gpuTimers = (GLEW_VERSION_3_3 || GLEW_ARB_timer_query);
+        if (m_gpuTimers)
+        {
+            for (int i = 0; i < FF_PROFILE_GPU_LATENCY; ++i)
+            {
+                GL_DEBUG(glGenQueries(FF_PROFILE_GPU_SCOPES * 2, m_gpu[i].queries));
+                m_gpu[i].count = 0;
+                m_gpu[i].last = 0;
+            }
+
+            GLint64 gpuNow = 0;
+            GL_DEBUG(glGetInteger64v(GL_TIMESTAMP, &gpuNow));
+            GpuFrame & gpu = m_gpu[m_frameIndex % FF_PROFILE_GPU_LATENCY];
+            gpu.frame = m_frameIndex;
+            gpu.offset = (int64)Now() - (int64)gpuNow;
+        }
+
+        SetThreadName("Main");
+        m_frameStart = Now();
+        SetEnabled(enabled);
+
+        g_Log.write(LOG_CONFIG, "Profiler > %s, gpu timers %s.", enabled ? "enabled" : "disabled",
+                    m_gpuTimers ? "available" : "not available");
+    }
+
+
+// releases the gpu queries, needs the GL context still
+
+    void Profiler::Shutdown()
+    {
+        SetEnabled(false);
+        if (!m_gpuTimers)
+            return;
+
+        for (int i = 0; i < FF_PROFILE_GPU_LATENCY; ++i)
+        {
+            GL_DEBUG(glDeleteQueries(FF_PROFILE_GPU_SCOPES * 2, m_gpu[i].queries));
+            m_gpu[i].count = 0;
+        }
+        m_gpuTimers = false;
+
+        if (m_gpuDropped)
+            g_Log.write(LOG_WARNING, "Profiler > %u frames of gpu timings were not ready in time.", m_gpuDropped);
+    }
+
+
+// finish the frame: drain every thread's ring, pick up the gpu timings
+// of the frame whose queries are about to be reused and start the next
+
+    void Profiler::NextFrame()
+    {
+        assert(m_gpuDepth == 0);
+        uint64 now = Now();
+
+        ProfileFrame & frame = m_frames[m_frameIndex % FF_PROFILE_HISTORY];
+        frame.index = m_frameIndex;
+        frame.start = m_frameStart;
+        frame.end = now;
+        frame.cpu.clear();
+        frame.gpu.clear();
+        frame.gpuReady = false;
+        collect_cpu(frame);
+
+        ++m_frameIndex;
+        m_frameStart = now;
+
+        if (m_gpuTimers)
+        {
+            GpuFrame & gpu = m_gpu[m_frameIndex % FF_PROFILE_GPU_LATENCY];
+            collect_gpu(gpu);
+
+            // the gpu clock is only comparable with ours through the offset
+            GLint64 gpuNow = 0;
+            GL_DEBUG(glGetInteger64v(GL_TIMESTAMP, &gpuNow));
+            gpu.frame = m_frameIndex;
+            gpu.offset = (int64)Now() - (int64)gpuNow;
+        }
+    }
+
+
+// name shown for the calling thread, before or after it records anything
+
+    void Profiler::SetThreadName(const char * name)
+    {
+        strncpy(t_profileName, name, sizeof(t_profileName) - 1);
+        t_profileName[sizeof(t_profileName) - 1] = '\0';
+
+        if (t_profileThread)
+        {
+            std::lock_guard<std::mutex> lock(m_threadLock);
+            t_profileThread->name = t_profileName;
+        }
+    }
+
+
+// the calling thread's ring, created the first time it records a scope
+
+    ProfileThread * Profiler::get_thread()
+    {
+        if (t_profileThread)
+            return t_profileThread;
+
+        std::lock_guard<std::mutex> lock(m_threadLock);
+        if (m_threads.size() >= FF_PROFILE_FRAME_THREAD)
+            return NULL;
+
+        ProfileThread * thread = new ProfileThread();
+        thread->head = 0;
+        thread->tail = 0;
+        thread->depth = 0;
+        thread->index = (uint16)m_threads.size();
+        if (t_profileName[0])
+        {
+            thread->name = t_profileName;
+        }
+        else
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "Thread %u", (uint32)thread->index);
+            thread->name = name;
+        }
+
+        m_threads.push_back(unique_ptr<ProfileThread>(thread));
+        t_profileThread = thread;
+        return thread;
+    }
+
+
+// a begin only goes in if there is room left for it and the end of every
+// open scope, so ends can never be dropped
+
+    bool Profiler::Begin(const char * name)
+    {
+        if (!IsEnabled())
+            return false;
+
+        ProfileThread * thread = get_thread();
+        if (!thread)
+            return false;
+
+        uint32 head = thread->head.load(std::memory_order_relaxed);
+        uint32 tail = thread->tail.load(std::memory_order_acquire);
+        if (head - tail + thread->depth + 2 > FF_PROFILE_RING)
+            return false;
+
+        ProfileRecord & record = thread->records[head & (FF_PROFILE_RING - 1)];
+        record.name = name;
+        record.time = Now();
+        thread->head.store(head + 1, std::memory_order_release);
+        ++thread->depth;
+        return true;
+    }
+
+    void Profiler::End()
+    {
+        ProfileThread * thread = t_profileThread;
+        assert(thread && thread->depth > 0);
+
+        uint32 head = thread->head.load(std::memory_order_relaxed);
+        ProfileRecord & record = thread->records[head & (FF_PROFILE_RING - 1)];
+        record.name = NULL;
+        record.time = Now();
+        thread->head.store(head + 1, std::memory_order_release);
+        --thread->depth;
+    }
+
+
+// gpu scopes are a pair of timestamps, unlike GL_TIME_ELAPSED queries
+// they can nest. Only valid on the GL thread within one frame.
+
+    int Profiler::BeginGpu(const char * name)
+    {
+        if (!m_gpuTimers || !IsEnabled())
+            return -1;
+
+        GpuFrame & gpu = m_gpu[m_frameIndex % FF_PROFILE_GPU_LATENCY];
+        if (gpu.count >= FF_PROFILE_GPU_SCOPES)
+            return -1;
+
+        int query = (int)gpu.count++;
+        gpu.names[query] = name;
+        gpu.depths[query] = (uint16)m_gpuDepth++;
+        gpu.ended[query] = false;
+        gpu.last = query * 2;
+        GL_DEBUG(glQueryCounter(gpu.queries[query * 2], GL_TIMESTAMP));
+        return query;
+    }
+
+    void Profiler::EndGpu(int query)
+    {
+        GpuFrame & gpu = m_gpu[m_frameIndex % FF_PROFILE_GPU_LATENCY];
+        assert(query >= 0 && query < (int)gpu.count && m_gpuDepth > 0);
+
+        GL_DEBUG(glQueryCounter(gpu.queries[query * 2 + 1], GL_TIMESTAMP));
+        gpu.ended[query] = true;
+        gpu.last = query * 2 + 1;
+        --m_gpuDepth;
+    }
+
+
+// pair up each thread's begins and ends, scopes still open carry over
+// into the next frame
+
+    void Profiler::collect_cpu(ProfileFrame & frame)
+    {
+        std::lock_guard<std::mutex> lock(m_threadLock);
+        for (size_t t = 0; t < m_threads.size(); ++t)
+        {
+            ProfileThread & thread = *m_threads[t];
+            uint32 head = thread.head.load(std::memory_order_acquire);
+            uint32 tail = thread.tail.load(std::memory_order_relaxed);
+
+            for (; tail != head; ++tail)
+            {
+                const ProfileRecord & record = thread.records[tail & (FF_PROFILE_RING - 1)];
+                if (record.name)
+                {
+                    ProfileSample sample = { record.name, record.time, 0, (uint16)thread.open.size(), thread.index };
+                    thread.open.push_back(sample);
+                }
+                else if (!thread.open.empty())
+                {
+                    ProfileSample sample = thread.open.back();
+                    thread.open.pop_back();
+                    sample.end = record.time;
+                    frame.cpu.push_back(sample);
+                }
+            }
+
+            thread.tail.store(head, std::memory_order_release);
+        }
+
+        // scopes end inner first, put parents back in front of their children
+        std::sort(frame.cpu.begin(), frame.cpu.end(), [](const ProfileSample & a, const ProfileSample & b) {
+            if (a.thread != b.thread) return a.thread < b.thread;
+            if (a.start != b.start) return a.start < b.start;
+            return a.depth < b.depth;
+        });
+    }
+
+
+// reads back a frame's gpu timestamps if they have landed, otherwise the
+// frame goes without rather than waiting for them
+
+    void Profiler::collect_gpu(GpuFrame & gpu)
+    {
+        if (gpu.count == 0)
+            return;
+
+        uint32 count = gpu.count;
+        gpu.count = 0;
+
+        // the gpu works in order, once the last timestamp issued is in so
+        // are the rest. That is the end of the outermost scope, not of the
+        // last one to begin
+        GLuint available = 0;
+        GL_DEBUG(glGetQueryObjectuiv(gpu.queries[gpu.last], GL_QUERY_RESULT_AVAILABLE, &available));
+
+        ProfileFrame & frame = m_frames[gpu.frame % FF_PROFILE_HISTORY];
+        if (!available || frame.index != gpu.frame)
+        {
+            ++m_gpuDropped;
+            return;
+        }
+
+        for (uint32 i = 0; i < count; ++i)
+        {
+            // a scope left open never issued its end query
+            if (!gpu.ended[i])
+                continue;
+
+            GLuint64 start = 0, end = 0;
+            GL_DEBUG(glGetQueryObjectui64v(gpu.queries[i * 2], GL_QUERY_RESULT, &start));
+            GL_DEBUG(glGetQueryObjectui64v(gpu.queries[i * 2 + 1], GL_QUERY_RESULT, &end));
+
+            ProfileSample sample = { gpu.names[i], (uint64)((int64)start + gpu.offset),
+                                     (uint64)((int64)end + gpu.offset), gpu.depths[i], FF_PROFILE_GPU_THREAD };
+            frame.gpu.push_back(sample);
+        }
+        frame.gpuReady = true;
+    }
+
+
+// history access
+
+    const ProfileFrame * Profiler::GetFrame(uint32 ago) const
+    {
+        if (ago >= FF_PROFILE_HISTORY || ago >= m_frameIndex)
+            return NULL;
+        return &m_frames[(m_frameIndex - 1 - ago) % FF_PROFILE_HISTORY];
+    }
+
+    double Profiler::GetTime(const char * name, bool gpu, uint32 ago) const
+    {
+        const ProfileFrame * frame = GetFrame(ago);
+        if (!frame)
+            return 0.0;
+
+        const vector<ProfileSample> & samples = gpu ? frame->gpu : frame->cpu;
+        uint64 total = 0;
+        for (size_t i = 0; i < samples.size(); ++i)
+        {
+            if (strcmp(samples[i].name, name) == 0)
+                total += samples[i].end - samples[i].start;
+        }
+        return total * 0.000001;
+    }
+
+
+// Chrome trace event helpers, times are microseconds since the epoch
+
+    static string json_string(const char * text)
+    {
+        string out = "\"";
+        for (; *text; ++text)
+        {
+            if (*text == '"' || *text == '\\')
+                out += '\\';
+            out += *text;
+        }
+        return out + "\"";
+    }
+
+    static void write_event(std::ofstream & out, bool & first, const char * name, uint32 thread,
+                            uint64 start, uint64 end, uint64 epoch)
+    {
+        char buffer[128];
+        snprintf(buffer, sizeof(buffer), "\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                 thread, (start - epoch) * 0.001, (end - start) * 0.001);
+        out << (first ? "\n" : ",\n") << "{\"name\":" << json_string(name) << "," << buffer;
+        first = false;
+    }
+
+    static void write_thread_name(std::ofstream & out, bool & first, uint32 thread, const char * name)
+    {
+        out << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+            << thread << ",\"args\":{\"name\":" << json_string(name) << "}}";
+        first = false;
+    }
+
+
+// every frame in the history, a track per thread plus one for the gpu and
+// one marking the frames themselves
+
+    bool Profiler::ExportTrace(const string & file) const
+    {
+        std::ofstream out(file.c_str());
+        if (!out)
+        {
+            g_Log.write(LOG_ERROR, "Profiler::ExportTrace > unable to write '%s'!", file.c_str());
+            return false;
+        }
+
+        bool first = true;
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        {
+            std::lock_guard<std::mutex> lock(m_threadLock);
+            for (size_t i = 0; i < m_threads.size(); ++i)
+                write_thread_name(out, first, m_threads[i]->index, m_threads[i]->name.c_str());
+        }
+        write_thread_name(out, first, FF_PROFILE_GPU_THREAD, "GPU");
+        write_thread_name(out, first, FF_PROFILE_FRAME_THREAD, "Frames");
+
+        uint64 count = std::min<uint64>(m_frameIndex, FF_PROFILE_HISTORY);
+        for (uint64 f = m_frameIndex - count; f < m_frameIndex; ++f)
+        {
+            const ProfileFrame & frame = m_frames[f % FF_PROFILE_HISTORY];
+            write_event(out, first, "Frame", FF_PROFILE_FRAME_THREAD, frame.start, frame.end, m_epoch);
+
+            for (size_t i = 0; i < frame.cpu.size(); ++i)
+                write_event(out, first, frame.cpu[i].name, frame.cpu[i].thread, frame.cpu[i].start, frame.cpu[i].end, m_epoch);
+            for (size_t i = 0; i < frame.gpu.size(); ++i)
+                write_event(out, first, frame.gpu[i].name, FF_PROFILE_GPU_THREAD, frame.gpu[i].start, frame.gpu[i].end, m_epoch);
+        }
+        out << "\n]}\n";
+        out.close();
+
+        if (out.fail())
+        {
+            g_Log.write(LOG_ERROR, "Profiler::ExportTrace > unable to write '%s'!", file.c_str());
+            return false;
+        }
+
+        g_Log.write(LOG_EVENT, "Profiler > wrote %u frames to '%s'.", (uint32)count, file.c_str());
+        return true;
+    }
+
+
+// the timer's monotonic clock, so samples line up with frame times
+
+    uint64 Profiler::Now()
+    {
+        return timer::now();
+    }
+
+} // exiting namespace ff
+
+////////////////////////////////////////////////////////////////////////
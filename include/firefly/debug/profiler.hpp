@@ -0,0 +1,180 @@
+#ifndef FIREFLY_PROFILER_HPP
+#define FIREFLY_PROFILER_HPP
+
+#include <firefly/opengl.hpp>
+#include <firefly/common.hpp>
+#include <firefly/core/singleton.hpp>
+
+#include <atomic>
+#include <mutex>
+
+// scopes compile away entirely with FF_PROFILE 0
+#ifndef FF_PROFILE
+    #define FF_PROFILE 1
+#endif
+
+#define FF_PROFILE_FILE         "profile.json"
+#define FF_PROFILE_RING         8192    // records per thread between frames, power of two
+#define FF_PROFILE_HISTORY      128     // frames kept for GetFrame() / ExportTrace()
+#define FF_PROFILE_GPU_SCOPES   64      // gpu scopes per frame
+#define FF_PROFILE_GPU_LATENCY  4       // frames before gpu results are read back
+#define FF_PROFILE_GPU_THREAD   0xffff  // thread index of gpu samples
+#define FF_PROFILE_FRAME_THREAD 0xfffe  // track the frames are drawn on in a trace
+
+////////////////////////////////////////////////////////////////////////
+
+namespace ff {
+
+// a finished scope, times are in nanoseconds on the profiler's clock
+
+    struct ProfileSample
+    {
+        const char * name;
+        uint64       start;
+        uint64       end;
+        uint16       depth;
+        uint16       thread; // FF_PROFILE_GPU_THREAD for gpu scopes
+    };
+
+
+// everything recorded during one frame. Cpu samples are sorted by thread
+// then start time, so each scope comes before the scopes nested in it.
+// Gpu samples arrive FF_PROFILE_GPU_LATENCY frames later.
+
+    struct ProfileFrame
+    {
+        uint64                index;
+        uint64                start;
+        uint64                end;
+        vector<ProfileSample> cpu;
+        vector<ProfileSample> gpu;
+        bool                  gpuReady;
+    };
+
+
+// per thread record ring, filled by its thread and drained by NextFrame()
+
+    struct ProfileThread;
+
+
+// frame profiler. Scopes are recorded per thread into lock-free rings that
+// the main thread collects into a hierarchical timeline once a frame, gpu
+// scopes are timestamp query pairs read back a few frames later so the
+// cpu never waits on them. The history can be written out as a Chrome
+// trace (chrome://tracing) to see cpu, gpu and swap time side by side.
+
+    class Profiler : public singleton<Profiler>
+    {
+    public:
+        Profiler();
+        ~Profiler();
+
+        // needs a GL context for the gpu queries, names the calling thread "Main"
+        void Init(bool enabled);
+        void Shutdown();
+
+        // closes the current frame and starts the next, call on the GL thread
+        void NextFrame();
+
+        void SetEnabled(bool enabled) { m_enabled.store(enabled, std::memory_order_relaxed); }
+        bool IsEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+        void SetThreadName(const char * name);
+
+        // scopes, names must outlive the profiler (string literals). Begin
+        // returns false if nothing was recorded, and End must then be skipped
+        bool Begin(const char * name);
+        void End();
+        int  BeginGpu(const char * name);
+        void EndGpu(int query);
+
+        // a finished frame, 0 being the last one (NULL if it has gone)
+        const ProfileFrame * GetFrame(uint32 ago = 0) const;
+
+        // total milliseconds spent in scopes called name in a frame
+        double GetTime(const char * name, bool gpu = false, uint32 ago = 0) const;
+
+        // writes the history out in Chrome's trace event format
+        bool ExportTrace(const string & file) const;
+
+        // monotonic clock the samples are taken with, in nanoseconds
+        static uint64 Now();
+
+    private:
+        struct GpuFrame
+        {
+            GLuint       queries[FF_PROFILE_GPU_SCOPES * 2];
+            const char * names[FF_PROFILE_GPU_SCOPES];
+            uint16       depths[FF_PROFILE_GPU_SCOPES];
+            bool         ended[FF_PROFILE_GPU_SCOPES];
+            uint32       count;
+            uint32       last;   // query issued last, outer scopes end after inner ones
+            uint64       frame;
+            int64        offset; // cpu clock - gpu clock
+        };
+
+        ProfileThread * get_thread();
+        void collect_cpu(ProfileFrame & frame);
+        void collect_gpu(GpuFrame & gpu);
+
+        std::atomic<bool>                 m_enabled;
+        mutable std::mutex                m_threadLock;
+        vector<unique_ptr<ProfileThread>> m_threads;
+
+        vector<ProfileFrame>              m_frames;
+        uint64                            m_frameIndex;
+        uint64                            m_frameStart;
+        uint64                            m_epoch;
+
+        bool                              m_gpuTimers;
+        GpuFrame                          m_gpu[FF_PROFILE_GPU_LATENCY];
+        uint32                            m_gpuDepth;
+        uint32                            m_gpuDropped;
+    };
+
+// global access
+
+    extern Profiler GlobalProfiler;
+
+#define g_Profiler ff::Profiler::get_singleton()
+
+
+// RAII helpers behind the macros
+
+    class ProfileScope
+    {
+    public:
+        explicit ProfileScope(const char * name) : m_recorded(g_Profiler.Begin(name)) { }
+        ~ProfileScope() { if (m_recorded) g_Profiler.End(); }
+
+    private:
+        bool m_recorded;
+    };
+
+    class ProfileGpuScope
+    {
+    public:
+        explicit ProfileGpuScope(const char * name) : m_cpu(name), m_query(g_Profiler.BeginGpu(name)) { }
+        ~ProfileGpuScope() { if (m_query >= 0) g_Profiler.EndGpu(m_query); }
+
+    private:
+        ProfileScope m_cpu;
+        int          m_query;
+    };
+
+} // exiting namespace ff
+
+////////////////////////////////////////////////////////////////////////
+
+// time the rest of the enclosing block, on the cpu / on the cpu and gpu
+#define FF_PROFILE_JOIN2(a, b) a##b
+#define FF_PROFILE_JOIN(a, b) FF_PROFILE_JOIN2(a, b)
+
+#if FF_PROFILE
+    #define FF_PROFILE_SCOPE(name) ff::ProfileScope FF_PROFILE_JOIN(ffProfileScope, __LINE__)(name)
+    #define FF_PROFILE_GPU(name) ff::ProfileGpuScope FF_PROFILE_JOIN(ffProfileGpu, __LINE__)(name)
+#else
+    #define FF_PROFILE_SCOPE(name)
+    #define FF_PROFILE_GPU(name)
+#endif
+
+#endif
@@ -0,0 +1,76 @@
+/*
+    checks that deferred log entries come out of the file the way they
+    went in, in particular string arguments that overflow the record, and
+    that a log file which can't be opened doesn't stop the log.
+    Kept out of the module directory so the makefile doesn't link it in.
+
+    g++ -std=c++0x -pthread -Iinclude include/firefly/debug/test/test_log.cpp include/firefly/debug/log.cpp -o test_log
+    ./test_log
+*/
+
+#include <firefly/debug/log.hpp>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#define TEST_LOG_FILE "test_log.log"
+
+static int failures = 0;
+
+
+// compares one line of the log with what it should be
+
+static void check_line(std::ifstream & in, const string & expected, const char * what)
+{
+    string line;
+    if (!std::getline(in, line))
+        line = "(missing)";
+
+    if (line != expected)
+    {
+        ++failures;
+        printf("FAIL: %s\n  expected \"%s\"\n  got      \"%s\"\n", what, expected.c_str(), line.c_str());
+    }
+}
+
+
+int main()
+{
+    const string a(300, 'a'), b(300, 'b'), c(200, 'c');
+    {
+        ff::log logger(TEST_LOG_FILE);
+
+        // a string of FF_LOG_STRINGS or more used to leave no room and
+        // the next one was copied past the end of the record
+        g_Log.trace(LOG_CONFIG, "%s|%s|%d", a, b, 7);
+        g_Log.trace(LOG_CONFIG, "%s|%s|%s|%d", c, a, b.c_str(), 8);
+        g_Log.trace(LOG_CONFIG, "next %s %d", "record", 9);
+        g_Log.flush();
+    }
+
+    std::ifstream in(TEST_LOG_FILE, ios::binary);
+    check_line(in, ": " + string(FF_LOG_STRINGS - 1, 'a') + "||7", "long string then another");
+    check_line(in, ": " + c + "|" + string(FF_LOG_STRINGS - 1 - c.size() - 1, 'a') + "||8", "strings past the end");
+    check_line(in, ": next record 9", "the record after");
+    in.close();
+    remove(TEST_LOG_FILE);
+
+    {
+        // a file that can't be opened loses what is written to it, and
+        // the log carries on once it is pointed somewhere that works
+        ff::log logger("no/such/directory/" TEST_LOG_FILE);
+        g_Log.write(LOG_CONFIG, "lost %d", 1);
+        g_Log.flush();
+        g_Log.set(TEST_LOG_FILE);
+        g_Log.write(LOG_CONFIG, "found %d", 2);
+        g_Log.flush();
+    }
+
+    in.open(TEST_LOG_FILE, ios::binary);
+    check_line(in, ": found 2", "after a file that couldn't be opened");
+    in.close();
+    remove(TEST_LOG_FILE);
+
+    printf(failures ? "%d checks failed\n" : "all checks passed\n", failures);
+    return failures ? 1 : 0;
+}
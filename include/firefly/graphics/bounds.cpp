@@ -0,0 +1,182 @@
+#include <firefly/graphics/bounds.hpp>
+
+////////////////////////////////////////////////////////////////////////
+
+namespace ff {
+
+// transform the center and sum the absolute axes for the new extents
+// (Arvo, "Transforming Axis-Aligned Bounding Boxes")
+
+	AABB AABB::Transform(const mat4 & m) const
+	{
+		if (IsEmpty())
+			return *this;
+
+		vec3 c = GetCenter();
+		vec3 e = GetExtents();
+
+		vec3 center = vec3(m * vec4(c, 1.0f));
+		vec3 extents = glm::abs(vec3(m[0])) * e.x +
+		               glm::abs(vec3(m[1])) * e.y +
+		               glm::abs(vec3(m[2])) * e.z;
+
+		return AABB(center - extents, center + extents);
+	}
+
+
+// start from the two points farthest apart along x, y or z and grow the
+// sphere for any point left outside
+
+	Sphere Sphere::FromPoints(const vec3 * points, uint32 count, uint32 stride)
+	{
+		if (count == 0)
+			return Sphere();
+
+		const ubyte * base = (const ubyte *)points;
+		#define FF_POINT(i) (*(const vec3 *)(base + (size_t)(i) * stride))
+
+		uint32 lo[3] = { 0, 0, 0 }, hi[3] = { 0, 0, 0 };
+		for (uint32 i = 1; i < count; ++i)
+		{
+			const vec3 & p = FF_POINT(i);
+			for (int a = 0; a < 3; ++a)
+			{
+				if (p[a] < FF_POINT(lo[a])[a]) lo[a] = i;
+				if (p[a] > FF_POINT(hi[a])[a]) hi[a] = i;
+			}
+		}
+
+		int axis = 0;
+		float best = -1.0f;
+		for (int a = 0; a < 3; ++a)
+		{
+			vec3 d = FF_POINT(hi[a]) - FF_POINT(lo[a]);
+			float length2 = glm::dot(d, d);
+			if (length2 > best)
+			{
+				best = length2;
+				axis = a;
+			}
+		}
+
+		vec3 center = (FF_POINT(lo[axis]) + FF_POINT(hi[axis])) * 0.5f;
+		float radius = sqrtf(best) * 0.5f;
+
+		for (uint32 i = 0; i < count; ++i)
+		{
+			vec3 d = FF_POINT(i) - center;
+			float dist2 = glm::dot(d, d);
+			if (dist2 > radius * radius)
+			{
+				float dist = sqrtf(dist2);
+				float grown = (radius + dist) * 0.5f;
+				center += d * ((grown - radius) / dist);
+				radius = grown;
+			}
+		}
+
+		#undef FF_POINT
+		return Sphere(center, radius);
+	}
+
+
+// each plane is a sum or difference of the matrix rows, normalised so
+// plane distances are real distances (needed for the sphere test)
+
+	void Frustum::Extract(const mat4 & m)
+	{
+		vec4 row[4];
+		for (int i = 0; i < 4; ++i)
+			row[i] = vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+
+		m_planes[0] = row[3] + row[0]; // left
+		m_planes[1] = row[3] - row[0]; // right
+		m_planes[2] = row[3] + row[1]; // bottom
+		m_planes[3] = row[3] - row[1]; // top
+		m_planes[4] = row[3] + row[2]; // near
+		m_planes[5] = row[3] - row[2]; // far
+
+		for (int i = 0; i < 8; ++i)
+		{
+			vec4 p(0.0f, 0.0f, 0.0f, 1.0f);
+			if (i < 6)
+			{
+				float length = glm::length(vec3(m_planes[i]));
+				if (length > 0.0f)
+					m_planes[i] /= length;
+				p = m_planes[i];
+			}
+
+			m_x[i] = p.x;
+			m_y[i] = p.y;
+			m_z[i] = p.z;
+			m_w[i] = p.w;
+		}
+	}
+
+
+// a box is outside if its nearest corner (center + projected radius) is
+// behind any plane, inside if its farthest corner is in front of all
+
+	FF_CULL_RESULT Frustum::TestAABB(const AABB & box) const
+	{
+		vec3 c = box.GetCenter();
+		vec3 e = box.GetExtents();
+		int outside = 0, intersect = 0;
+
+#ifdef FF_MATRIX_SIMD
+		const __m128 abs = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		const __m128 zero = _mm_setzero_ps();
+		__m128 cx = _mm_set1_ps(c.x), cy = _mm_set1_ps(c.y), cz = _mm_set1_ps(c.z);
+		__m128 ex = _mm_set1_ps(e.x), ey = _mm_set1_ps(e.y), ez = _mm_set1_ps(e.z);
+
+		for (int i = 0; i < 8; i += 4)
+		{
+			__m128 px = _mm_load_ps(m_x + i);
+			__m128 py = _mm_load_ps(m_y + i);
+			__m128 pz = _mm_load_ps(m_z + i);
+
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, cx), _mm_mul_ps(py, cy)),
+			                      _mm_add_ps(_mm_mul_ps(pz, cz), _mm_load_ps(m_w + i)));
+			__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_and_ps(px, abs), ex),
+			                                 _mm_mul_ps(_mm_and_ps(py, abs), ey)),
+			                      _mm_mul_ps(_mm_and_ps(pz, abs), ez));
+
+			outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(d, r), zero));
+			intersect |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(d, r), zero));
+		}
+#else
+		for (int i = 0; i < 6; ++i)
+		{
+			float d = m_x[i] * c.x + m_y[i] * c.y + m_z[i] * c.z + m_w[i];
+			float r = fabsf(m_x[i]) * e.x + fabsf(m_y[i]) * e.y + fabsf(m_z[i]) * e.z;
+			outside |= (d + r < 0.0f);
+			intersect |= (d - r < 0.0f);
+		}
+#endif
+
+		if (outside)
+			return FF_CULL_OUTSIDE;
+		return intersect ? FF_CULL_INTERSECT : FF_CULL_INSIDE;
+	}
+
+
+// same as the box test with the radius the same against every plane
+
+	FF_CULL_RESULT Frustum::TestSphere(const Sphere & sphere) const
+	{
+		FF_CULL_RESULT result = FF_CULL_INSIDE;
+		for (int i = 0; i < 6; ++i)
+		{
+			float d = glm::dot(vec3(m_planes[i]), sphere.center) + m_planes[i].w;
+			if (d < -sphere.radius)
+				return FF_CULL_OUTSIDE;
+			if (d < sphere.radius)
+				result = FF_CULL_INTERSECT;
+		}
+		return result;
+	}
+
+} // exiting namespace ff
+
+////////////////////////////////////////////////////////////////////////
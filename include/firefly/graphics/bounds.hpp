@@ -0,0 +1,111 @@
+#ifndef FIREFLY_BOUNDS_HPP
+#define FIREFLY_BOUNDS_HPP
+
+#include <firefly/common.hpp>
+#include <firefly/graphics/matrix.hpp>
+#include <cfloat>
+
+////////////////////////////////////////////////////////////////////////
+
+namespace ff {
+
+// axis aligned bounding box, empty when min > max
+
+	struct AABB
+	{
+		vec3 min;
+		vec3 max;
+
+		AABB() : min(FLT_MAX), max(-FLT_MAX) { }
+		AABB(const vec3 & lo, const vec3 & hi) : min(lo), max(hi) { }
+
+		bool IsEmpty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+		vec3 GetCenter() const { return (min + max) * 0.5f; }
+		vec3 GetExtents() const { return (max - min) * 0.5f; }
+
+		// half the surface area, the cost metric for tree building
+		float GetArea() const
+		{
+			vec3 d = max - min;
+			return d.x * d.y + d.y * d.z + d.z * d.x;
+		}
+
+		void Expand(const vec3 & p) { min = glm::min(min, p); max = glm::max(max, p); }
+		void Expand(const AABB & b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+		void Inflate(float margin) { min -= vec3(margin); max += vec3(margin); }
+
+		bool Contains(const AABB & b) const
+		{
+			return min.x <= b.min.x && min.y <= b.min.y && min.z <= b.min.z &&
+			       max.x >= b.max.x && max.y >= b.max.y && max.z >= b.max.z;
+		}
+
+		// box around this one after an affine transform
+		AABB Transform(const mat4 & m) const;
+
+		static AABB Merge(const AABB & a, const AABB & b)
+		{
+			return AABB(glm::min(a.min, b.min), glm::max(a.max, b.max));
+		}
+	};
+
+
+// bounding sphere
+
+	struct Sphere
+	{
+		vec3  center;
+		float radius;
+
+		Sphere() : center(0.0f), radius(0.0f) { }
+		Sphere(const vec3 & c, float r) : center(c), radius(r) { }
+
+		// sphere around a box / around a set of points (Ritter's, within
+		// ~5% of the smallest)
+		static Sphere FromAABB(const AABB & box) { return Sphere(box.GetCenter(), glm::length(box.GetExtents())); }
+		static Sphere FromPoints(const vec3 * points, uint32 count, uint32 stride = sizeof(vec3));
+	};
+
+
+// result of a frustum test
+
+	enum FF_CULL_RESULT {
+		FF_CULL_OUTSIDE,
+		FF_CULL_INTERSECT,
+		FF_CULL_INSIDE,
+	};
+
+
+// six planes pointing inwards, extracted from a projection * view matrix
+// (Gribb / Hartmann). The planes are also kept four to a register so a box
+// is tested against all of them with two sets of SIMD operations
+
+	class Frustum
+	{
+	public:
+		Frustum() { }
+		explicit Frustum(const mat4 & viewProj) { Extract(viewProj); }
+
+		void Extract(const mat4 & viewProj);
+
+		FF_CULL_RESULT TestAABB(const AABB & box) const;
+		FF_CULL_RESULT TestSphere(const Sphere & sphere) const;
+		bool IsVisible(const AABB & box) const { return TestAABB(box) != FF_CULL_OUTSIDE; }
+
+		const vec4 & GetPlane(int i) const { return m_planes[i]; }
+
+	private:
+		vec4 m_planes[6];
+
+		// x, y, z, w of each plane, padded to 8 with a plane everything is inside
+		FF_ALIGN(16) float m_x[8];
+		FF_ALIGN(16) float m_y[8];
+		FF_ALIGN(16) float m_z[8];
+		FF_ALIGN(16) float m_w[8];
+	};
+
+} // exiting namespace ff
+
+////////////////////////////////////////////////////////////////////////
+
+#endif
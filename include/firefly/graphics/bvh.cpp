@@ -0,0 +1,497 @@
+#include <firefly/graphics/bvh.hpp>
+#include <firefly/core/job.hpp>
+#include <algorithm>
+
+////////////////////////////////////////////////////////////////////////
+
+namespace ff {
+
+// node storage, freed nodes are chained through their parent index
+
+	uint32 BVH::allocate()
+	{
+		uint32 node = m_free;
+		if (node == FF_BVH_NULL)
+		{
+			node = (uint32)m_nodes.size();
+			m_nodes.push_back(BVHNode());
+		}
+		else
+		{
+			m_free = m_nodes[node].parent;
+		}
+
+		BVHNode & n = m_nodes[node];
+		n.box = AABB();
+		n.parent = n.left = n.right = FF_BVH_NULL;
+		n.data = 0;
+		n.height = 0;
+		return node;
+	}
+
+	void BVH::release(uint32 node)
+	{
+		m_nodes[node].parent = m_free;
+		m_nodes[node].height = -1;
+		m_free = node;
+	}
+
+
+// add / remove objects
+
+	uint32 BVH::Insert(const AABB & box, uint32 data)
+	{
+		uint32 leaf = allocate();
+		m_nodes[leaf].box = box;
+		m_nodes[leaf].box.Inflate(FF_BVH_MARGIN);
+		m_nodes[leaf].data = data;
+
+		insert_leaf(leaf);
+		++m_leafCount;
+		return leaf;
+	}
+
+	void BVH::Remove(uint32 proxy)
+	{
+		assert(proxy < m_nodes.size() && m_nodes[proxy].IsLeaf());
+		remove_leaf(proxy);
+		release(proxy);
+		--m_leafCount;
+	}
+
+	void BVH::Clear()
+	{
+		m_nodes.clear();
+		m_root = m_free = FF_BVH_NULL;
+		m_leafCount = 0;
+	}
+
+
+// only touches the tree once the object has left its fattened box
+
+	bool BVH::Move(uint32 proxy, const AABB & box)
+	{
+		assert(proxy < m_nodes.size() && m_nodes[proxy].IsLeaf());
+		if (m_nodes[proxy].box.Contains(box))
+			return false;
+
+		remove_leaf(proxy);
+		m_nodes[proxy].box = box;
+		m_nodes[proxy].box.Inflate(FF_BVH_MARGIN);
+		insert_leaf(proxy);
+		return true;
+	}
+
+
+// in place updates, the parents are fixed up by Refit()
+
+	void BVH::SetBounds(uint32 proxy, const AABB & box)
+	{
+		assert(proxy < m_nodes.size() && m_nodes[proxy].IsLeaf());
+		m_nodes[proxy].box = box;
+	}
+
+	void BVH::Refit()
+	{
+		if (m_root != FF_BVH_NULL)
+			refit(m_root);
+	}
+
+	void BVH::refit(uint32 node)
+	{
+		BVHNode & n = m_nodes[node];
+		if (n.IsLeaf())
+			return;
+
+		refit(n.left);
+		refit(n.right);
+		n.box = AABB::Merge(m_nodes[n.left].box, m_nodes[n.right].box);
+	}
+
+
+// descend towards the sibling that grows the tree's surface area the
+// least (Box2D's b2DynamicTree heuristic), pair the leaf up with it and
+// rebalance on the way back up
+
+	void BVH::insert_leaf(uint32 leaf)
+	{
+		if (m_root == FF_BVH_NULL)
+		{
+			m_root = leaf;
+			m_nodes[leaf].parent = FF_BVH_NULL;
+			return;
+		}
+
+		AABB box = m_nodes[leaf].box;
+		uint32 index = m_root;
+		while (!m_nodes[index].IsLeaf())
+		{
+			const BVHNode & n = m_nodes[index];
+			float area = n.box.GetArea();
+			float combinedArea = AABB::Merge(n.box, box).GetArea();
+
+			// cost of pairing with this node, and of pushing the leaf further down
+			float cost = 2.0f * combinedArea;
+			float inheritance = 2.0f * (combinedArea - area);
+
+			float childCost[2];
+			uint32 children[2] = { n.left, n.right };
+			for (int i = 0; i < 2; ++i)
+			{
+				const BVHNode & child = m_nodes[children[i]];
+				float merged = AABB::Merge(box, child.box).GetArea();
+				childCost[i] = (child.IsLeaf() ? merged : merged - child.box.GetArea()) + inheritance;
+			}
+
+			if (cost < childCost[0] && cost < childCost[1])
+				break;
+			index = (childCost[0] < childCost[1]) ? children[0] : children[1];
+		}
+
+		uint32 sibling = index;
+		uint32 oldParent = m_nodes[sibling].parent;
+		uint32 newParent = allocate();
+
+		BVHNode & p = m_nodes[newParent];
+		p.parent = oldParent;
+		p.box = AABB::Merge(box, m_nodes[sibling].box);
+		p.height = m_nodes[sibling].height + 1;
+		p.left = sibling;
+		p.right = leaf;
+		m_nodes[sibling].parent = newParent;
+		m_nodes[leaf].parent = newParent;
+
+		if (oldParent == FF_BVH_NULL)
+			m_root = newParent;
+		else if (m_nodes[oldParent].left == sibling)
+			m_nodes[oldParent].left = newParent;
+		else
+			m_nodes[oldParent].right = newParent;
+
+		// fix heights and boxes up to the root
+		for (index = m_nodes[leaf].parent; index != FF_BVH_NULL; index = m_nodes[index].parent)
+		{
+			index = balance(index);
+			BVHNode & n = m_nodes[index];
+			n.height = 1 + std::max(m_nodes[n.left].height, m_nodes[n.right].height);
+			n.box = AABB::Merge(m_nodes[n.left].box, m_nodes[n.right].box);
+		}
+	}
+
+
+// the leaf's sibling takes its parent's place
+
+	void BVH::remove_leaf(uint32 leaf)
+	{
+		if (leaf == m_root)
+		{
+			m_root = FF_BVH_NULL;
+			return;
+		}
+
+		uint32 parent = m_nodes[leaf].parent;
+		uint32 grandParent = m_nodes[parent].parent;
+		uint32 sibling = (m_nodes[parent].left == leaf) ? m_nodes[parent].right : m_nodes[parent].left;
+
+		m_nodes[sibling].parent = grandParent;
+		release(parent);
+
+		if (grandParent == FF_BVH_NULL)
+		{
+			m_root = sibling;
+			return;
+		}
+
+		if (m_nodes[grandParent].left == parent)
+			m_nodes[grandParent].left = sibling;
+		else
+			m_nodes[grandParent].right = sibling;
+
+		for (uint32 index = grandParent; index != FF_BVH_NULL; index = m_nodes[index].parent)
+		{
+			index = balance(index);
+			BVHNode & n = m_nodes[index];
+			n.height = 1 + std::max(m_nodes[n.left].height, m_nodes[n.right].height);
+			n.box = AABB::Merge(m_nodes[n.left].box, m_nodes[n.right].box);
+		}
+	}
+
+
+// if one side of a node is more than one level taller, rotate its taller
+// child up into the node's place. Returns the node now in that place.
+
+	uint32 BVH::balance(uint32 iA)
+	{
+		BVHNode & A = m_nodes[iA];
+		if (A.IsLeaf() || A.height < 2)
+			return iA;
+
+		uint32 iB = A.left;
+		uint32 iC = A.right;
+		BVHNode & B = m_nodes[iB];
+		BVHNode & C = m_nodes[iC];
+		int diff = C.height - B.height;
+
+		if (diff > 1)
+		{
+			// C goes up, A keeps B and the shorter of C's children
+			uint32 iF = C.left;
+			uint32 iG = C.right;
+			BVHNode & F = m_nodes[iF];
+			BVHNode & G = m_nodes[iG];
+
+			C.left = iA;
+			C.parent = A.parent;
+			A.parent = iC;
+
+			if (C.parent == FF_BVH_NULL)
+				m_root = iC;
+			else if (m_nodes[C.parent].left == iA)
+				m_nodes[C.parent].left = iC;
+			else
+				m_nodes[C.parent].right = iC;
+
+			if (F.height > G.height)
+			{
+				C.right = iF;
+				A.right = iG;
+				G.parent = iA;
+				A.box = AABB::Merge(B.box, G.box);
+				C.box = AABB::Merge(A.box, F.box);
+				A.height = 1 + std::max(B.height, G.height);
+				C.height = 1 + std::max(A.height, F.height);
+			}
+			else
+			{
+				C.right = iG;
+				A.right = iF;
+				F.parent = iA;
+				A.box = AABB::Merge(B.box, F.box);
+				C.box = AABB::Merge(A.box, G.box);
+				A.height = 1 + std::max(B.height, F.height);
+				C.height = 1 + std::max(A.height, G.height);
+			}
+			return iC;
+		}
+
+		if (diff < -1)
+		{
+			// B goes up, A keeps C and the shorter of B's children
+			uint32 iD = B.left;
+			uint32 iE = B.right;
+			BVHNode & D = m_nodes[iD];
+			BVHNode & E = m_nodes[iE];
+
+			B.left = iA;
+			B.parent = A.parent;
+			A.parent = iB;
+
+			if (B.parent == FF_BVH_NULL)
+				m_root = iB;
+			else if (m_nodes[B.parent].left == iA)
+				m_nodes[B.parent].left = iB;
+			else
+				m_nodes[B.parent].right = iB;
+
+			if (D.height > E.height)
+			{
+				B.right = iD;
+				A.left = iE;
+				E.parent = iA;
+				A.box = AABB::Merge(C.box, E.box);
+				B.box = AABB::Merge(A.box, D.box);
+				A.height = 1 + std::max(C.height, E.height);
+				B.height = 1 + std::max(A.height, D.height);
+			}
+			else
+			{
+				B.right = iE;
+				A.left = iD;
+				D.parent = iA;
+				A.box = AABB::Merge(C.box, D.box);
+				B.box = AABB::Merge(A.box, E.box);
+				A.height = 1 + std::max(C.height, D.height);
+				B.height = 1 + std::max(A.height, E.height);
+			}
+			return iB;
+		}
+
+		return iA;
+	}
+
+
+// throw the internal nodes away and build them again top down, the leaves
+// (and so the proxy ids) are kept
+
+	void BVH::Rebuild()
+	{
+		if (m_leafCount < 2)
+			return;
+
+		vector<uint32> leaves;
+		leaves.reserve(m_leafCount);
+		for (uint32 i = 0; i < m_nodes.size(); ++i)
+		{
+			if (m_nodes[i].height < 0)
+				continue;
+
+			if (m_nodes[i].IsLeaf())
+				leaves.push_back(i);
+			else
+				release(i);
+		}
+
+		m_root = build(&leaves[0], (uint32)leaves.size());
+		m_nodes[m_root].parent = FF_BVH_NULL;
+	}
+
+	uint32 BVH::build(uint32 * leaves, uint32 count)
+	{
+		if (count == 1)
+			return leaves[0];
+
+		// split across the longest axis of the leaf centers
+		AABB centers;
+		for (uint32 i = 0; i < count; ++i)
+			centers.Expand(m_nodes[leaves[i]].box.GetCenter());
+
+		vec3 size = centers.max - centers.min;
+		int axis = (size.x > size.y) ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+
+		uint32 half = count / 2;
+		const vector<BVHNode> & nodes = m_nodes;
+		std::nth_element(leaves, leaves + half, leaves + count,
+			[&nodes, axis](uint32 a, uint32 b) {
+				return nodes[a].box.min[axis] + nodes[a].box.max[axis] <
+				       nodes[b].box.min[axis] + nodes[b].box.max[axis];
+			});
+
+		uint32 node = allocate();
+		uint32 left = build(leaves, half);
+		uint32 right = build(leaves + half, count - half);
+
+		BVHNode & n = m_nodes[node];
+		n.left = left;
+		n.right = right;
+		n.box = AABB::Merge(m_nodes[left].box, m_nodes[right].box);
+		n.height = 1 + std::max(m_nodes[left].height, m_nodes[right].height);
+		m_nodes[left].parent = node;
+		m_nodes[right].parent = node;
+		return node;
+	}
+
+
+// sum of the internal node areas
+
+	float BVH::GetCost() const
+	{
+		float cost = 0.0f;
+		for (uint32 i = 0; i < m_nodes.size(); ++i)
+		{
+			if (m_nodes[i].height > 0)
+				cost += m_nodes[i].box.GetArea();
+		}
+		return cost;
+	}
+
+
+// frustum culling, whole subtrees are accepted or rejected by their box
+
+	void BVH::Cull(const Frustum & frustum, vector<uint32> & visible, bool parallel) const
+	{
+		visible.clear();
+		if (m_root == FF_BVH_NULL)
+			return;
+
+		if (!parallel || m_leafCount < FF_BVH_TASK_MIN || !g_Job.IsRunning())
+		{
+			cull_node(m_root, frustum, visible);
+			return;
+		}
+
+		// split the top of the tree into subtrees, the nodes above them go
+		// untested but their children's boxes are inside theirs anyway
+		m_tasks.assign(1, m_root);
+		vector<uint32> next;
+		while (m_tasks.size() < FF_BVH_TASKS)
+		{
+			next.clear();
+			for (size_t i = 0; i < m_tasks.size(); ++i)
+			{
+				const BVHNode & n = m_nodes[m_tasks[i]];
+				if (n.IsLeaf())
+				{
+					next.push_back(m_tasks[i]);
+				}
+				else
+				{
+					next.push_back(n.left);
+					next.push_back(n.right);
+				}
+			}
+
+			if (next.size() == m_tasks.size())
+				break;
+			m_tasks.swap(next);
+		}
+
+		uint32 count = (uint32)m_tasks.size();
+		if (m_results.size() < count)
+			m_results.resize(count);
+
+		m_frustum = &frustum;
+		g_Job.ParallelFor(count, 1, cull_range, (void *)this);
+
+		// gather in subtree order so the result doesn't depend on timing
+		for (uint32 i = 0; i < count; ++i)
+			visible.insert(visible.end(), m_results[i].begin(), m_results[i].end());
+	}
+
+	void BVH::cull_range(uint32 begin, uint32 end, void * data)
+	{
+		const BVH & tree = *static_cast<const BVH *>(data);
+		for (uint32 i = begin; i < end; ++i)
+		{
+			tree.m_results[i].clear();
+			tree.cull_node(tree.m_tasks[i], *tree.m_frustum, tree.m_results[i]);
+		}
+	}
+
+	void BVH::cull_node(uint32 node, const Frustum & frustum, vector<uint32> & visible) const
+	{
+		const BVHNode & n = m_nodes[node];
+		FF_CULL_RESULT result = frustum.TestAABB(n.box);
+		if (result == FF_CULL_OUTSIDE)
+			return;
+
+		if (n.IsLeaf())
+		{
+			visible.push_back(n.data);
+		}
+		else if (result == FF_CULL_INSIDE)
+		{
+			add_leaves(node, visible);
+		}
+		else
+		{
+			cull_node(n.left, frustum, visible);
+			cull_node(n.right, frustum, visible);
+		}
+	}
+
+	void BVH::add_leaves(uint32 node, vector<uint32> & visible) const
+	{
+		const BVHNode & n = m_nodes[node];
+		if (n.IsLeaf())
+		{
+			visible.push_back(n.data);
+			return;
+		}
+
+		add_leaves(n.left, visible);
+		add_leaves(n.right, visible);
+	}
+
+} // exiting namespace ff
+
+////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,99 @@
+#ifndef FIREFLY_BVH_HPP
+#define FIREFLY_BVH_HPP
+
+#include <firefly/common.hpp>
+#include <firefly/graphics/bounds.hpp>
+
+#define FF_BVH_NULL     0xffffffff
+#define FF_BVH_MARGIN   0.1f // leaves are fattened so small moves leave the tree alone
+#define FF_BVH_TASK_MIN 1024 // leaves before Cull() spreads the work over the job system
+#define FF_BVH_TASKS    32   // subtrees Cull() hands out
+
+////////////////////////////////////////////////////////////////////////
+
+namespace ff {
+
+// tree node, leaves have no children and carry the object's data
+
+	struct BVHNode
+	{
+		AABB   box;
+		uint32 parent; // next free node while on the free list
+		uint32 left;
+		uint32 right;
+		uint32 data;
+		int    height; // 0 for leaves
+
+		bool IsLeaf() const { return left == FF_BVH_NULL; }
+	};
+
+
+// dynamic bounding volume hierarchy over scene objects. Objects are
+// inserted where they add the least surface area and the tree is kept
+// balanced with rotations, so it stays usable as objects come and go and
+// move around. Moving objects either reinsert themselves (Move) or update
+// their box in place and Refit() the tree once, Rebuild() starts over
+// from scratch when the tree has degraded.
+
+	class BVH
+	{
+	public:
+		BVH() : m_root(FF_BVH_NULL), m_free(FF_BVH_NULL), m_leafCount(0), m_frustum(NULL) { }
+		~BVH() { }
+
+		// returns a proxy id, stable until the object is removed
+		uint32 Insert(const AABB & box, uint32 data);
+		void Remove(uint32 proxy);
+		void Clear();
+
+		// reinserts the object if it left its fattened box, true if it did
+		bool Move(uint32 proxy, const AABB & box);
+
+		// changes the box without touching the tree, Refit() afterwards
+		void SetBounds(uint32 proxy, const AABB & box);
+		void Refit();
+
+		// rebuilds the tree top down, splitting at the median of the longest axis
+		void Rebuild();
+
+		// data of every object whose box touches the frustum, big trees
+		// split into subtrees culled on the job system. Not reentrant.
+		void Cull(const Frustum & frustum, vector<uint32> & visible, bool parallel = true) const;
+
+		uint32 GetData(uint32 proxy) const { return m_nodes[proxy].data; }
+		const AABB & GetBounds(uint32 proxy) const { return m_nodes[proxy].box; }
+		uint32 GetLeafCount() const { return m_leafCount; }
+		int GetHeight() const { return m_root == FF_BVH_NULL ? 0 : m_nodes[m_root].height; }
+
+		// surface area of the internal nodes, lower is a better tree
+		float GetCost() const;
+
+	private:
+		uint32 allocate();
+		void release(uint32 node);
+		void insert_leaf(uint32 leaf);
+		void remove_leaf(uint32 leaf);
+		uint32 balance(uint32 node);
+		void refit(uint32 node);
+		uint32 build(uint32 * leaves, uint32 count);
+
+		void cull_node(uint32 node, const Frustum & frustum, vector<uint32> & visible) const;
+		void add_leaves(uint32 node, vector<uint32> & visible) const;
+		static void cull_range(uint32 begin, uint32 end, void * data);
+
+		vector<BVHNode> m_nodes;
+		uint32          m_root;
+		uint32          m_free;
+		uint32          m_leafCount;
+
+		// parallel culling state
+		mutable vector<uint32>         m_tasks;
+		mutable vector<vector<uint32>> m_results;
+		mutable const Frustum *        m_frustum;
+	};
+
+} // exiting namespace ff
+
+////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,197 @@
+#include <firefly/graphics/matrix.hpp>
+#include <firefly/graphics/frame.hpp>
+#include <firefly/core/job.hpp>
+#include <cstring>
+
+#define FF_FRAME_PARALLEL_MIN 1024 // frames before Update() uses the job system
+#define FF_FRAME_GRAIN        64   // groups of 4 frames per job
+
+////////////////////////////////////////////////////////////////////////
+
+namespace ff {
+
+// ctor / dtor
+
+	FrameArray::FrameArray()
+		: m_count(0), m_capacity(0), m_memory(NULL), m_world(NULL), m_modelView(NULL), m_view(NULL)
+	{
+		for (int c = 0; c < FF_FRAME_COMPONENT_COUNT; ++c)
+			m_components[c] = NULL;
+	}
+
+	FrameArray::~FrameArray()
+	{
+		delete [] m_memory;
+	}
+
+
+// grows the storage in steps of 4 frames, the padding frames are kept
+// valid so the SIMD pass never needs a scalar tail
+
+	void FrameArray::Resize(uint32 count)
+	{
+		uint32 capacity = (count + 3) & ~3u;
+		if (capacity > m_capacity)
+		{
+			// components and both matrix buffers share one 16 byte aligned block
+			size_t floats = (size_t)capacity * FF_FRAME_COMPONENT_COUNT;
+			size_t bytes = floats * sizeof(float) + 2 * capacity * sizeof(mat4);
+			ubyte * memory = new ubyte[bytes + 15];
+			float * base = (float *)(((size_t)memory + 15) & ~(size_t)15);
+
+			for (int c = 0; c < FF_FRAME_COMPONENT_COUNT; ++c)
+			{
+				float * component = base + c * capacity;
+				if (m_count)
+					memcpy(component, m_components[c], m_count * sizeof(float));
+				m_components[c] = component;
+			}
+
+			m_world = (mat4 *)(base + floats);
+			m_modelView = m_world + capacity;
+
+			delete [] m_memory;
+			m_memory = memory;
+			m_capacity = capacity;
+		}
+
+		// new frames (and the padding) start out like a default Frame
+		for (uint32 i = m_count; i < m_capacity; ++i)
+		{
+			for (int c = 0; c < FF_FRAME_COMPONENT_COUNT; ++c)
+				m_components[c][i] = 0.0f;
+			m_components[FF_FRAME_FORWARD_Z][i] = -1.0f;
+			m_components[FF_FRAME_UP_Y][i] = 1.0f;
+		}
+
+		m_count = count;
+	}
+
+
+// copy a frame in / out
+
+	void FrameArray::SetFrame(uint32 index, Frame & frame)
+	{
+		assert(index < m_count);
+		set(FF_FRAME_ORIGIN_X, index, frame.GetOrigin());
+		set(FF_FRAME_FORWARD_X, index, frame.GetForward());
+		set(FF_FRAME_UP_X, index, frame.GetUp());
+	}
+
+	void FrameArray::GetFrame(uint32 index, Frame & frame) const
+	{
+		assert(index < m_count);
+		frame.SetOrigin(GetOrigin(index));
+		frame.SetForward(GetForward(index));
+		frame.SetUp(GetUp(index));
+	}
+
+
+// builds the matrices of every frame
+
+	void FrameArray::Update(const mat4 & view, bool parallel)
+	{
+		uint32 groups = m_capacity / 4;
+		m_view = &view;
+
+		if (parallel && m_count >= FF_FRAME_PARALLEL_MIN && g_Job.IsRunning())
+			g_Job.ParallelFor(groups, FF_FRAME_GRAIN, &FrameArray::update_range, this);
+		else
+			update_range(0, groups, this);
+	}
+
+
+// builds the matrices for groups [begin, end) of 4 frames, the
+// arithmetic matches Frame::GetMatrix() and glm's mat4 product exactly
+
+	void FrameArray::update_range(uint32 begin, uint32 end, void * data)
+	{
+		FrameArray * frames = static_cast<FrameArray *>(data);
+		const float * const * c = frames->m_components;
+		const float * view = glm::value_ptr(*frames->m_view);
+
+#ifdef FF_MATRIX_SIMD
+		// every element of the view matrix, splatted across the 4 lanes
+		__m128 v[16];
+		for (int i = 0; i < 16; ++i)
+			v[i] = _mm_set1_ps(view[i]);
+
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+
+		for (uint32 group = begin; group < end; ++group)
+		{
+			uint32 i = group * 4;
+
+			// world matrix columns, one frame per lane
+			__m128 w[4][4];
+			w[1][0] = _mm_load_ps(c[FF_FRAME_UP_X] + i);
+			w[1][1] = _mm_load_ps(c[FF_FRAME_UP_Y] + i);
+			w[1][2] = _mm_load_ps(c[FF_FRAME_UP_Z] + i);
+			w[1][3] = zero;
+			w[2][0] = _mm_load_ps(c[FF_FRAME_FORWARD_X] + i);
+			w[2][1] = _mm_load_ps(c[FF_FRAME_FORWARD_Y] + i);
+			w[2][2] = _mm_load_ps(c[FF_FRAME_FORWARD_Z] + i);
+			w[2][3] = zero;
+			w[3][0] = _mm_load_ps(c[FF_FRAME_ORIGIN_X] + i);
+			w[3][1] = _mm_load_ps(c[FF_FRAME_ORIGIN_Y] + i);
+			w[3][2] = _mm_load_ps(c[FF_FRAME_ORIGIN_Z] + i);
+			w[3][3] = one;
+
+			// x axis = cross(up, forward)
+			w[0][0] = _mm_sub_ps(_mm_mul_ps(w[1][1], w[2][2]), _mm_mul_ps(w[2][1], w[1][2]));
+			w[0][1] = _mm_sub_ps(_mm_mul_ps(w[1][2], w[2][0]), _mm_mul_ps(w[2][2], w[1][0]));
+			w[0][2] = _mm_sub_ps(_mm_mul_ps(w[1][0], w[2][1]), _mm_mul_ps(w[2][0], w[1][1]));
+			w[0][3] = zero;
+
+			float * world = glm::value_ptr(frames->m_world[i]);
+			float * modelView = glm::value_ptr(frames->m_modelView[i]);
+
+			for (int col = 0; col < 4; ++col)
+			{
+				// model view column, row by row
+				__m128 mv[4];
+				for (int row = 0; row < 4; ++row)
+				{
+					__m128 r = _mm_mul_ps(v[row], w[col][0]);
+					r = _mm_add_ps(r, _mm_mul_ps(v[4 + row], w[col][1]));
+					r = _mm_add_ps(r, _mm_mul_ps(v[8 + row], w[col][2]));
+					mv[row] = _mm_add_ps(r, _mm_mul_ps(v[12 + row], w[col][3]));
+				}
+
+				// lanes back into per frame columns
+				__m128 w0 = w[col][0], w1 = w[col][1], w2 = w[col][2], w3 = w[col][3];
+				_MM_TRANSPOSE4_PS(w0, w1, w2, w3);
+				_MM_TRANSPOSE4_PS(mv[0], mv[1], mv[2], mv[3]);
+
+				_mm_store_ps(world + col * 4, w0);
+				_mm_store_ps(world + 16 + col * 4, w1);
+				_mm_store_ps(world + 32 + col * 4, w2);
+				_mm_store_ps(world + 48 + col * 4, w3);
+				_mm_store_ps(modelView + col * 4, mv[0]);
+				_mm_store_ps(modelView + 16 + col * 4, mv[1]);
+				_mm_store_ps(modelView + 32 + col * 4, mv[2]);
+				_mm_store_ps(modelView + 48 + col * 4, mv[3]);
+			}
+		}
+#else
+		for (uint32 i = begin * 4; i < end * 4; ++i)
+		{
+			vec3 origin(c[FF_FRAME_ORIGIN_X][i], c[FF_FRAME_ORIGIN_Y][i], c[FF_FRAME_ORIGIN_Z][i]);
+			vec3 forward(c[FF_FRAME_FORWARD_X][i], c[FF_FRAME_FORWARD_Y][i], c[FF_FRAME_FORWARD_Z][i]);
+			vec3 up(c[FF_FRAME_UP_X][i], c[FF_FRAME_UP_Y][i], c[FF_FRAME_UP_Z][i]);
+
+			mat4 & world = frames->m_world[i];
+			world[0] = vec4(glm::cross(up, forward), 0.0f);
+			world[1] = vec4(up, 0.0f);
+			world[2] = vec4(forward, 0.0f);
+			world[3] = vec4(origin, 1.0f);
+
+			frames->m_modelView[i] = *frames->m_view * world;
+		}
+#endif
+	}
+
+} // exiting namespace ff
+
+////////////////////////////////////////////////////////////////////////
@@ -47,11 +47,21 @@ namespace ff {
 		// helper functions for movement
 		inline void MoveForward(float delta) { m_origin += m_forward * delta; }
 		inline void MoveUp(float delta)      { m_origin += m_up * delta; }
-		inline void MoveRight(float delta) 
-		{ 
+		inline void MoveRight(float delta)
+		{
 			m_origin += glm::cross(m_up, m_forward) * delta;
 		}
 
+		// blend between two frames (t = 0 gives from), for drawing between
+		// two fixed updates. Fine for the small turns made in one update.
+		void Interpolate(const Frame & from, const Frame & to, float t)
+		{
+			m_origin = glm::mix(from.m_origin, to.m_origin, t);
+			m_forward = glm::normalize(glm::mix(from.m_forward, to.m_forward, t));
+			m_up = glm::mix(from.m_up, to.m_up, t);
+			m_up = glm::normalize(m_up - m_forward * glm::dot(m_up, m_forward));
+		}
+
 
 // constructs the matrix for the frame
 
@@ -257,6 +267,84 @@ namespace ff {
 		vec3 m_up;
 	};
 
+
+// components of a frame, as stored by FrameArray
+
+	enum FF_FRAME_COMPONENT {
+		FF_FRAME_ORIGIN_X = 0,
+		FF_FRAME_ORIGIN_Y,
+		FF_FRAME_ORIGIN_Z,
+		FF_FRAME_FORWARD_X,
+		FF_FRAME_FORWARD_Y,
+		FF_FRAME_FORWARD_Z,
+		FF_FRAME_UP_X,
+		FF_FRAME_UP_Y,
+		FF_FRAME_UP_Z,
+		FF_FRAME_COMPONENT_COUNT,
+	};
+
+
+// structure-of-arrays set of frames, every component is a contiguous
+// float array so the matrices for all of them can be built in one SIMD
+// pass, into contiguous buffers ready for an instance VBO or UBO
+
+	class FrameArray
+	{
+	public:
+		FrameArray();
+		~FrameArray();
+
+		// new frames sit at the origin looking down -z, like Frame
+		void Resize(uint32 count);
+		uint32 GetCount() const { return m_count; }
+
+		void SetFrame(uint32 index, Frame & frame);
+		void GetFrame(uint32 index, Frame & frame) const;
+
+		void SetOrigin(uint32 index, const vec3 & fv)  { set(FF_FRAME_ORIGIN_X, index, fv); }
+		void SetForward(uint32 index, const vec3 & fv) { set(FF_FRAME_FORWARD_X, index, fv); }
+		void SetUp(uint32 index, const vec3 & fv)      { set(FF_FRAME_UP_X, index, fv); }
+		vec3 GetOrigin(uint32 index) const  { return get(FF_FRAME_ORIGIN_X, index); }
+		vec3 GetForward(uint32 index) const { return get(FF_FRAME_FORWARD_X, index); }
+		vec3 GetUp(uint32 index) const      { return get(FF_FRAME_UP_X, index); }
+
+		// one component of every frame, for updating them in bulk
+		float * GetComponent(FF_FRAME_COMPONENT c) { return m_components[c]; }
+
+		// builds each world matrix (same as Frame::GetMatrix(m, true)) and
+		// view * world, spread over the job system when there are enough
+		void Update(const mat4 & view, bool parallel = true);
+
+		const mat4 * GetWorldMatrices() const { return m_world; }
+		const mat4 * GetModelViewMatrices() const { return m_modelView; }
+
+	private:
+		FrameArray(const FrameArray &);
+		FrameArray & operator = (const FrameArray &);
+
+		void set(int c, uint32 index, const vec3 & fv)
+		{
+			m_components[c][index] = fv.x;
+			m_components[c + 1][index] = fv.y;
+			m_components[c + 2][index] = fv.z;
+		}
+
+		vec3 get(int c, uint32 index) const
+		{
+			return vec3(m_components[c][index], m_components[c + 1][index], m_components[c + 2][index]);
+		}
+
+		static void update_range(uint32 begin, uint32 end, void * data);
+
+		uint32  m_count;
+		uint32  m_capacity; // multiple of 4
+		ubyte * m_memory;
+		float * m_components[FF_FRAME_COMPONENT_COUNT];
+		mat4 *  m_world;
+		mat4 *  m_modelView;
+		const mat4 * m_view;
+	};
+
 } // exiting namespace ff
 
 ////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,137 @@
+#include <firefly/graphics/instance.hpp>
+#include <firefly/graphics/state.hpp>
+#include <algorithm>
+
+////////////////////////////////////////////////////////////////////////
+
+namespace ff {
+
+// advance an attribute once per instance instead of once per vertex
+
+	static void instance_divisor(GLuint attrib)
+	{
+		if (GLEW_VERSION_3_3)
+		{
+			GL_DEBUG(glVertexAttribDivisor(attrib, 1));
+		}
+		else
+		{
+			GL_DEBUG(glVertexAttribDivisorARB(attrib, 1));
+		}
+	}
+
+
+// create the buffer objects
+
+	void InstanceBuffer::Create(GLuint capacity)
+	{
+		if (!GLEW_VERSION_3_3 && !GLEW_ARB_instanced_arrays)
+			g_Log.write(LOG_ERROR, "InstanceBuffer > instanced arrays are not supported.");
+
+		GL_DEBUG(glGenBuffers(1, &m_matrixBuffer));
+		GL_DEBUG(glGenBuffers(1, &m_colorBuffer));
+		m_capacity = 0;
+		m_count = 0;
+		m_colors.clear();
+		reserve(capacity);
+	}
+
+
+// delete the buffer objects
+
+	void InstanceBuffer::Delete()
+	{
+		g_GLState.DeleteBuffers(1, &m_matrixBuffer);
+		g_GLState.DeleteBuffers(1, &m_colorBuffer);
+		m_matrixBuffer = m_colorBuffer = 0;
+		m_capacity = m_count = 0;
+		m_colors.clear();
+	}
+
+
+// point the instance attributes of a vertex array at our buffers, the
+// buffer names never change so this only has to happen once per vao
+
+	void InstanceBuffer::Attach(GLuint vao)
+	{
+		g_GLState.BindVertexArray(vao);
+
+		// one vec4 attribute per matrix column
+		g_GLState.BindBuffer(GL_ARRAY_BUFFER, m_matrixBuffer);
+		for (GLuint i = 0; i < 4; ++i)
+		{
+			GLuint attrib = FF_ATTRIBUTE_INSTANCE_MATRIX + i;
+			GL_DEBUG(glEnableVertexAttribArray(attrib));
+			GL_DEBUG(glVertexAttribPointer(attrib, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (GLvoid*)(sizeof(vec4) * i)));
+			instance_divisor(attrib);
+		}
+
+		g_GLState.BindBuffer(GL_ARRAY_BUFFER, m_colorBuffer);
+		GL_DEBUG(glEnableVertexAttribArray(FF_ATTRIBUTE_INSTANCE_COLOR));
+		GL_DEBUG(glVertexAttribPointer(FF_ATTRIBUTE_INSTANCE_COLOR, 4, GL_FLOAT, GL_FALSE, sizeof(vec4), (GLvoid*)0));
+		instance_divisor(FF_ATTRIBUTE_INSTANCE_COLOR);
+
+		g_GLState.BindVertexArray(0);
+		g_GLState.BindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+
+// stream this frame's matrices, orphaning the old storage so the driver
+// does not have to wait for draws still reading it
+
+	void InstanceBuffer::SetMatrices(const mat4 * matrices, GLuint count)
+	{
+		reserve(count);
+		m_count = count;
+
+		g_GLState.BindBuffer(GL_ARRAY_BUFFER, m_matrixBuffer);
+		GL_DEBUG(glBufferData(GL_ARRAY_BUFFER, m_capacity * sizeof(mat4), NULL, GL_STREAM_DRAW));
+		if (count)
+		{
+			GL_DEBUG(glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(mat4), matrices));
+		}
+		g_GLState.BindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+
+// update the colors of the first count instances
+
+	void InstanceBuffer::SetColors(const vec4 * colors, GLuint count)
+	{
+		if (count == 0)
+			return;
+
+		reserve(count);
+		std::copy(colors, colors + count, m_colors.begin());
+
+		g_GLState.BindBuffer(GL_ARRAY_BUFFER, m_colorBuffer);
+		GL_DEBUG(glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(vec4), &m_colors[0]));
+		g_GLState.BindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+
+// grow both buffers to hold at least count instances
+
+	void InstanceBuffer::reserve(GLuint count)
+	{
+		if (count <= m_capacity)
+			return;
+
+		GLuint capacity = m_capacity ? m_capacity : FF_INSTANCE_CAPACITY;
+		while (capacity < count)
+			capacity *= 2;
+
+		// the matrices are refilled every frame, the colors have to survive
+		m_colors.resize(capacity, vec4(1.0f));
+		g_GLState.BindBuffer(GL_ARRAY_BUFFER, m_matrixBuffer);
+		GL_DEBUG(glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(mat4), NULL, GL_STREAM_DRAW));
+		g_GLState.BindBuffer(GL_ARRAY_BUFFER, m_colorBuffer);
+		GL_DEBUG(glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(vec4), &m_colors[0], GL_DYNAMIC_DRAW));
+		g_GLState.BindBuffer(GL_ARRAY_BUFFER, 0);
+
+		m_capacity = capacity;
+	}
+
+} // exiting namespace ff
+
+////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,51 @@
+#ifndef FIREFLY_INSTANCE_HPP
+#define FIREFLY_INSTANCE_HPP
+
+#include <firefly/opengl.hpp>
+#include <firefly/common.hpp>
+
+#define FF_INSTANCE_CAPACITY 64 // initial number of instances
+
+////////////////////////////////////////////////////////////////////////
+
+namespace ff {
+
+// per instance attributes for drawing many copies of a mesh with one
+// call, a matrix (FF_ATTRIBUTE_INSTANCE_MATRIX) and a color
+// (FF_ATTRIBUTE_INSTANCE_COLOR) for every instance
+
+	class InstanceBuffer
+	{
+	public:
+		InstanceBuffer() : m_matrixBuffer(0), m_colorBuffer(0), m_capacity(0), m_count(0) { }
+		~InstanceBuffer() { }
+
+		// create / delete the buffer objects, they grow as needed
+		void Create(GLuint capacity = FF_INSTANCE_CAPACITY);
+		void Delete();
+
+		// adds the instance attributes to the vertex array of a batch or mesh
+		void Attach(GLuint vao);
+
+		// matrices are streamed every frame, colors only when they change
+		// (instances without a color are white)
+		void SetMatrices(const mat4 * matrices, GLuint count);
+		void SetColors(const vec4 * colors, GLuint count);
+
+		GLuint GetCount() const { return m_count; }
+
+	private:
+		void reserve(GLuint count);
+
+		GLuint       m_matrixBuffer;
+		GLuint       m_colorBuffer;
+		GLuint       m_capacity;
+		GLuint       m_count;
+		vector<vec4> m_colors; // kept to refill the color buffer when it grows
+	};
+
+} // exiting namespace ff
+
+////////////////////////////////////////////////////////////////////////
+
+#endif
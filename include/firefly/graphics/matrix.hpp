@@ -3,6 +3,7 @@
 
 #include <firefly/common.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
 //#include <glm/gtc/matrix_access.hpp>
 //#include <glm/gtc/matrix_inverse.hpp>
 
@@ -20,6 +21,11 @@ static const float identity_4x4[16] = { 1.0f, 0.0f, 0.0f, 0.0f,
 #define FF_MATRIX_MAX_DEPTH 64
 typedef glm::detail::tmat4x4<float> mat_t;
 
+// glm pulls in the intrinsics for whatever it was configured to use
+#if (GLM_ARCH != GLM_ARCH_PURE)
+	#define FF_MATRIX_SIMD
+#endif
+
 ////////////////////////////////////////////////////////////////////////
 
 namespace ff {
@@ -38,7 +44,139 @@ namespace ff {
 	using glm::perspective;
 	using glm::perspectiveFov;
 
-// helper class to handle matrix stacks
+
+// column-major 4x4 helpers, operations happen in the same order as glm
+// so results are identical to the glm versions
+
+#ifdef FF_MATRIX_SIMD
+
+	// out = a * b, a and out must be 16 byte aligned, out may alias a or b
+	inline void mat4_multiply(const float * a, const float * b, float * out)
+	{
+		__m128 a0 = _mm_load_ps(a);
+		__m128 a1 = _mm_load_ps(a + 4);
+		__m128 a2 = _mm_load_ps(a + 8);
+		__m128 a3 = _mm_load_ps(a + 12);
+
+		for (int i = 0; i < 16; i += 4)
+		{
+			__m128 r = _mm_mul_ps(a0, _mm_set1_ps(b[i]));
+			r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(b[i + 1])));
+			r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(b[i + 2])));
+			r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(b[i + 3])));
+			_mm_store_ps(out + i, r);
+		}
+	}
+
+	// out = m, both 16 byte aligned
+	inline void mat4_copy(const float * m, float * out)
+	{
+		_mm_store_ps(out,      _mm_load_ps(m));
+		_mm_store_ps(out + 4,  _mm_load_ps(m + 4));
+		_mm_store_ps(out + 8,  _mm_load_ps(m + 8));
+		_mm_store_ps(out + 12, _mm_load_ps(m + 12));
+	}
+
+	// m[3] = m[0] * x + m[1] * y + m[2] * z + m[3]
+	inline void mat4_translate(float * m, float x, float y, float z)
+	{
+		__m128 r = _mm_mul_ps(_mm_load_ps(m), _mm_set1_ps(x));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(m + 4), _mm_set1_ps(y)));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(m + 8), _mm_set1_ps(z)));
+		_mm_store_ps(m + 12, _mm_add_ps(r, _mm_load_ps(m + 12)));
+	}
+
+	// m[0..2] = m[0..2] * r, where r is a column-major 3x3 rotation
+	inline void mat4_rotate(float * m, const float * r)
+	{
+		__m128 m0 = _mm_load_ps(m);
+		__m128 m1 = _mm_load_ps(m + 4);
+		__m128 m2 = _mm_load_ps(m + 8);
+
+		for (int i = 0; i < 3; ++i)
+		{
+			__m128 c = _mm_mul_ps(m0, _mm_set1_ps(r[i * 3]));
+			c = _mm_add_ps(c, _mm_mul_ps(m1, _mm_set1_ps(r[i * 3 + 1])));
+			c = _mm_add_ps(c, _mm_mul_ps(m2, _mm_set1_ps(r[i * 3 + 2])));
+			_mm_store_ps(m + i * 4, c);
+		}
+	}
+
+	// m[0..2] *= x, y, z
+	inline void mat4_scale(float * m, float x, float y, float z)
+	{
+		_mm_store_ps(m,     _mm_mul_ps(_mm_load_ps(m),     _mm_set1_ps(x)));
+		_mm_store_ps(m + 4, _mm_mul_ps(_mm_load_ps(m + 4), _mm_set1_ps(y)));
+		_mm_store_ps(m + 8, _mm_mul_ps(_mm_load_ps(m + 8), _mm_set1_ps(z)));
+	}
+
+#else
+
+	inline void mat4_multiply(const float * a, const float * b, float * out)
+	{
+		mat_t r = glm::make_mat4(a) * glm::make_mat4(b);
+		memcpy(out, value_ptr(r), 16 * sizeof(float));
+	}
+
+	inline void mat4_copy(const float * m, float * out)
+	{
+		memcpy(out, m, 16 * sizeof(float));
+	}
+
+	inline void mat4_translate(float * m, float x, float y, float z)
+	{
+		for (int i = 0; i < 4; ++i)
+			m[12 + i] = m[i] * x + m[4 + i] * y + m[8 + i] * z + m[12 + i];
+	}
+
+	inline void mat4_rotate(float * m, const float * r)
+	{
+		float c[12];
+		for (int col = 0; col < 3; ++col)
+			for (int i = 0; i < 4; ++i)
+				c[col * 4 + i] = m[i] * r[col * 3] + m[4 + i] * r[col * 3 + 1] + m[8 + i] * r[col * 3 + 2];
+		memcpy(m, c, 12 * sizeof(float));
+	}
+
+	inline void mat4_scale(float * m, float x, float y, float z)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			m[i] *= x;
+			m[4 + i] *= y;
+			m[8 + i] *= z;
+		}
+	}
+
+#endif
+
+	// builds the 3x3 part of glm::rotate() (degrees, any length axis)
+	inline void mat3_rotation(float degrees, const vec3 & v, float * r)
+	{
+		float a = glm::radians(degrees);
+		float c = std::cos(a);
+		float s = std::sin(a);
+
+		vec3 axis = normalize(v);
+		vec3 temp = (1.0f - c) * axis;
+
+		r[0] = c + temp[0] * axis[0];
+		r[1] = 0 + temp[0] * axis[1] + s * axis[2];
+		r[2] = 0 + temp[0] * axis[2] - s * axis[1];
+
+		r[3] = 0 + temp[1] * axis[0] - s * axis[2];
+		r[4] = c + temp[1] * axis[1];
+		r[5] = 0 + temp[1] * axis[2] + s * axis[0];
+
+		r[6] = 0 + temp[2] * axis[0] + s * axis[1];
+		r[7] = 0 + temp[2] * axis[1] - s * axis[0];
+		r[8] = c + temp[2] * axis[2];
+	}
+
+// helper class to handle matrix stacks, a fixed array of aligned matrices
+// so push/pop never allocate and the SIMD helpers can use aligned loads.
+// each level carries a version, bumped whenever its matrix changes, and
+// whether it only holds rotations and translations (rigid)
 
 	class MatrixStack
 	{
@@ -49,10 +187,10 @@ namespace ff {
 		inline void LoadIdentity(void);
 		inline void LoadMatrix(const mat4 & m);
 		inline void LoadMatrix(const float * fv);
-		inline void MultMatrix(const mat4 & m);
+		inline void MultMatrix(const mat4 & m, bool rigid = false);
 
 		inline void PushMatrix(void);
-		inline void PushMatrix(const mat4 & m);
+		inline void PushMatrix(const mat4 & m, bool rigid = false);
 		inline void PopMatrix(void);
 
 		inline void Translate(const float x, const float y, const float z);
@@ -63,30 +201,78 @@ namespace ff {
 		inline void Rotate(const float degrees, const vec3 & fv);
 		inline void Scale(const vec3 & fv);
 
-		inline vec4 Transform(const vec4 & fv) { return fv * m_stack.top(); }
+		inline vec4 Transform(const vec4 & fv) { return fv * *m_top; }
 
 		inline const mat4 & top(void);
 		inline const float * ptr(void);
 		inline void GetMatrix(mat4 & m);
 
+		inline uint32 GetVersion(void) const { return m_level->version; }
+		inline bool IsRigid(void) const { return m_level->rigid; }
+
 		inline const glm::mat3 mat3(void);
 
-		operator mat_t () { return m_stack.top(); }
-		mat_t operator * (MatrixStack & other) { return m_stack.top() * other.top(); }
-		mat_t operator * (mat_t & other) { return m_stack.top() * other; }
+		operator mat_t () { return *m_top; }
+		mat_t operator * (MatrixStack & other) { return *m_top * other.top(); }
+		mat_t operator * (mat_t & other) { return *m_top * other; }
+
+		MatrixStack(const MatrixStack & other);
+		MatrixStack & operator = (const MatrixStack & other);
 
 	private:
-		stack<glm::detail::tmat4x4<float>> m_stack;
+		struct Level
+		{
+			uint32 version;
+			bool   rigid;
+		};
+
+		// the top matrix changed, it stays rigid only if it was and the change is
+		inline void changed(bool rigid) {
+			m_level->version = ++m_version;
+			m_level->rigid = m_level->rigid && rigid;
+		}
+
+		FF_ALIGN(16) mat_t m_stack[FF_MATRIX_MAX_DEPTH];
+		mat_t * m_top;
+		Level   m_levels[FF_MATRIX_MAX_DEPTH];
+		Level * m_level;
+		uint32  m_version;
 	};
 
 
 // matrix stack implementation, ctor/dtor
 
-	MatrixStack::MatrixStack() {
-		m_stack.push(mat4());
+	inline MatrixStack::MatrixStack() {
+		m_top = m_stack;
+		m_level = m_levels;
+		m_level->version = m_version = 1;
+		m_level->rigid = true;
 	}
 
-	MatrixStack::~MatrixStack() {
+	inline MatrixStack::~MatrixStack() {
+	}
+
+
+// copies only the used part of the stack, keeping the depth (the copied
+// levels get new versions so they can't be mistaken for older matrices)
+
+	inline MatrixStack::MatrixStack(const MatrixStack & other) {
+		m_version = 0;
+		*this = other;
+	}
+
+	inline MatrixStack & MatrixStack::operator = (const MatrixStack & other) {
+		ptrdiff_t depth = other.m_top - other.m_stack;
+		m_version = std::max(m_version, other.m_version);
+		for (ptrdiff_t i = 0; i <= depth; ++i)
+		{
+			m_stack[i] = other.m_stack[i];
+			m_levels[i].version = ++m_version;
+			m_levels[i].rigid = other.m_levels[i].rigid;
+		}
+		m_top = m_stack + depth;
+		m_level = m_levels + depth;
+		return *this;
 	}
 
 
@@ -94,7 +280,9 @@ namespace ff {
 
 	inline void MatrixStack::LoadIdentity(void)
 	{
-		memcpy(value_ptr(m_stack.top()), identity_4x4, 16 * sizeof(float));
+		memcpy(value_ptr(*m_top), identity_4x4, 16 * sizeof(float));
+		m_level->rigid = true;
+		changed(true);
 	}
 
 
@@ -102,7 +290,8 @@ namespace ff {
 
 	inline void MatrixStack::LoadMatrix(const mat4 & m)
 	{
-		memcpy(value_ptr(m_stack.top()), value_ptr(m), 16 * sizeof(float));
+		memcpy(value_ptr(*m_top), value_ptr(m), 16 * sizeof(float));
+		changed(false);
 	}
 
 
@@ -110,47 +299,55 @@ namespace ff {
 
 	inline void MatrixStack::LoadMatrix(const float * fv)
 	{
-		memcpy(value_ptr(m_stack.top()), fv, 16 * sizeof(float));
+		memcpy(value_ptr(*m_top), fv, 16 * sizeof(float));
+		changed(false);
 	}
 
 
-// multiplies current matrix with provided one
+// multiplies current matrix with provided one, pass rigid if it only
+// rotates and translates
 
-	inline void MatrixStack::MultMatrix(const mat4 & m)
+	inline void MatrixStack::MultMatrix(const mat4 & m, bool rigid)
 	{
-		m_stack.top() *= m;
+		mat4_multiply(value_ptr(*m_top), value_ptr(m), value_ptr(*m_top));
+		changed(rigid);
 	}
 
 
-// pushes on another copy of top matrix
+// pushes on another copy of top matrix, a full stack stays as it is
 
 	inline void MatrixStack::PushMatrix(void)
 	{
-		if (m_stack.size() < FF_MATRIX_MAX_DEPTH) {
-			m_stack.push(m_stack.top());
-		} 	
-		#ifdef FF_DEBUG_MATRIX_CHECKS
-		else {
+		if (m_top == &m_stack[FF_MATRIX_MAX_DEPTH - 1]) {
+			#ifdef FF_DEBUG_MATRIX_CHECKS
 			g_Log.write(LOG_ERROR, 
 				"MatrixStack > stack overflow!");
+			#endif
+			return;
 		}
-		#endif
+		mat4_copy(value_ptr(*m_top), value_ptr(m_top[1]));
+		m_level[1] = m_level[0];
+		++m_top;
+		++m_level;
 	}
 
 
 // pushes specified matrix onto the stack
 
-	inline void MatrixStack::PushMatrix(const mat4 & m)
+	inline void MatrixStack::PushMatrix(const mat4 & m, bool rigid)
 	{
-		if (m_stack.size() < FF_MATRIX_MAX_DEPTH) {
-			m_stack.push(m);
-		} 	
-		#ifdef FF_DEBUG_MATRIX_CHECKS
-		else {
+		if (m_top == &m_stack[FF_MATRIX_MAX_DEPTH - 1]) {
+			#ifdef FF_DEBUG_MATRIX_CHECKS
 			g_Log.write(LOG_ERROR, 
 				"MatrixStack > stack overflow!");
+			#endif
+			return;
 		}
-		#endif
+		++m_top;
+		++m_level;
+		memcpy(value_ptr(*m_top), value_ptr(m), 16 * sizeof(float));
+		m_level->rigid = rigid;
+		changed(rigid);
 	}
 
 
@@ -158,15 +355,15 @@ namespace ff {
 
 	inline void MatrixStack::PopMatrix(void)
 	{
-		if (m_stack.size() > 1) {
-			m_stack.pop();
-		} 
-		#ifdef FF_DEBUG_MATRIX_CHECKS
-		else {
+		if (m_top == m_stack) {
+			#ifdef FF_DEBUG_MATRIX_CHECKS
 			g_Log.write(LOG_ERROR, 
 				"MatrixStack > stack underflow!");
+			#endif
+			return;
 		}
-		#endif
+		--m_top;
+		--m_level;
 	}
 
 
@@ -174,8 +371,8 @@ namespace ff {
 
 	inline void MatrixStack::Translate(const float x, const float y, const float z)
 	{
-		mat_t & top = m_stack.top();
-		top = translate(top, vec3(x, y, z));
+		mat4_translate(value_ptr(*m_top), x, y, z);
+		changed(true);
 	}
 
 
@@ -183,8 +380,10 @@ namespace ff {
 
 	inline void MatrixStack::Rotate(const float degrees, const float x, const float y, const float z)
 	{
-		mat_t & top = m_stack.top();
-		top = rotate(top, degrees, vec3(x, y, z));
+		float r[9];
+		mat3_rotation(degrees, vec3(x, y, z), r);
+		mat4_rotate(value_ptr(*m_top), r);
+		changed(true);
 	}
 
 
@@ -192,8 +391,8 @@ namespace ff {
 
 	inline void MatrixStack::Scale(const float x_scale, const float y_scale, const float z_scale)
 	{
-		mat_t & top = m_stack.top();
-		top = scale(top, vec3(x_scale, y_scale, z_scale));
+		mat4_scale(value_ptr(*m_top), x_scale, y_scale, z_scale);
+		changed(x_scale == 1.0f && y_scale == 1.0f && z_scale == 1.0f);
 	}
 
 
@@ -201,8 +400,8 @@ namespace ff {
 
 	inline void MatrixStack::Translate(const vec3 & fv)
 	{
-		mat_t & top = m_stack.top();
-		top = translate(top, fv);
+		mat4_translate(value_ptr(*m_top), fv.x, fv.y, fv.z);
+		changed(true);
 	}
 
 
@@ -210,8 +409,10 @@ namespace ff {
 
 	inline void MatrixStack::Rotate(const float degrees, const vec3 & fv)
 	{
-		mat_t & top = m_stack.top();
-		top = rotate(top, degrees, fv);
+		float r[9];
+		mat3_rotation(degrees, fv, r);
+		mat4_rotate(value_ptr(*m_top), r);
+		changed(true);
 	}
 
 
@@ -219,8 +420,8 @@ namespace ff {
 
 	inline void MatrixStack::Scale(const vec3 & fv) 
 	{
-		mat_t & top = m_stack.top();
-		top = scale(top, fv);
+		mat4_scale(value_ptr(*m_top), fv.x, fv.y, fv.z);
+		changed(fv.x == 1.0f && fv.y == 1.0f && fv.z == 1.0f);
 	}
 
 
@@ -228,7 +429,7 @@ namespace ff {
 
 	inline const mat4 & MatrixStack::top(void)
 	{
-		return m_stack.top();
+		return *m_top;
 	}
 
 
@@ -236,7 +437,7 @@ namespace ff {
 
 	inline const float * MatrixStack::ptr(void)
 	{
-		return value_ptr(m_stack.top());
+		return value_ptr(*m_top);
 	}
 
 
@@ -244,7 +445,7 @@ namespace ff {
 
 	inline void MatrixStack::GetMatrix(mat4 & m) 
 	{
-		memcpy(value_ptr(m), value_ptr(m_stack.top()), 16 * sizeof(float));
+		memcpy(value_ptr(m), value_ptr(*m_top), 16 * sizeof(float));
 	}
 
 
@@ -252,7 +453,7 @@ namespace ff {
 
 	inline const mat3 MatrixStack::mat3(void)
 	{
-		return glm::mat3(m_stack.top());
+		return glm::mat3(*m_top);
 	}
 
 } // exiting namespace ff
@@ -1,12 +1,374 @@
 #include <firefly/graphics/mesh.hpp>
+#include <firefly/graphics/optimizer.hpp>
+#include <firefly/graphics/state.hpp>
+#include <firefly/debug/gl_debug.hpp>
+#include <firefly/debug/log.hpp>
+#include <fstream>
+#include <cstdio>
+
+#ifndef WIN32
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+using std::ofstream;
+using std::ios;
 
 ////////////////////////////////////////////////////////////////////////
 
 namespace ff {
 
+// layout of each vertex attribute, in interleaved order
+
+	struct VertexAttribute
+	{
+		uint32    flag;
+		GLuint    attrib;
+		GLint     size;
+		GLenum    type;
+		GLboolean normalized;
+		uint32    bytes;
+	};
+
+	static const VertexAttribute s_vertexAttributes[] =
+	{
+		{ FF_VERTEX_POSITION, FF_ATTRIBUTE_VERTEX,   3, GL_FLOAT,         GL_FALSE, 12 },
+		{ FF_VERTEX_NORMAL,   FF_ATTRIBUTE_NORMAL,   3, GL_FLOAT,         GL_FALSE, 12 },
+		{ FF_VERTEX_TEXTURE0, FF_ATTRIBUTE_TEXTURE0, 2, GL_FLOAT,         GL_FALSE, 8 },
+		{ FF_VERTEX_COLOR,    FF_ATTRIBUTE_COLOR,    4, GL_UNSIGNED_BYTE, GL_TRUE,  4 },
+	};
+
+	static const uint32 s_vertexAttributeCount = sizeof(s_vertexAttributes) / sizeof(s_vertexAttributes[0]);
+	static const uint32 s_vertexFormatMask = FF_VERTEX_POSITION | FF_VERTEX_NORMAL | FF_VERTEX_TEXTURE0 | FF_VERTEX_COLOR;
+
+
+// maps a whole file read only, returns NULL on failure
+
+	static const ubyte * map_file(const string & path, size_t & size)
+	{
+#ifdef WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return NULL;
+
+		LARGE_INTEGER length;
+		HANDLE mapping = NULL;
+		if (GetFileSizeEx(file, &length) && length.QuadPart > 0)
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+		// the view keeps the mapping alive once the handles are closed
+		const ubyte * data = mapping ? (const ubyte *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+		if (mapping) CloseHandle(mapping);
+		CloseHandle(file);
+
+		size = data ? (size_t)length.QuadPart : 0;
+		return data;
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return NULL;
+
+		struct stat info;
+		void * data = MAP_FAILED;
+		if (fstat(fd, &info) == 0 && info.st_size > 0)
+			data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+
+		if (data == MAP_FAILED)
+			return NULL;
+
+		size = (size_t)info.st_size;
+		return (const ubyte *)data;
+#endif
+	}
+
+	static void unmap_file(const ubyte * data, size_t size)
+	{
+#ifdef WIN32
+		UnmapViewOfFile(data);
+#else
+		munmap((void *)data, size);
+#endif
+	}
+
+
+// true if a section lies inside the file and is 4 byte aligned
+
+	static bool in_file(uint32 offset, uint64 bytes, size_t size)
+	{
+		return (offset & 3) == 0 && offset <= size && bytes <= (uint64)(size - offset);
+	}
+
+
+// bytes per vertex for a combination of FF_VERTEX_* flags
+
+	uint32 Mesh::GetVertexStride(uint32 format)
+	{
+		uint32 stride = 0;
+		for (uint32 i = 0; i < s_vertexAttributeCount; ++i)
+		{
+			if (format & s_vertexAttributes[i].flag)
+				stride += s_vertexAttributes[i].bytes;
+		}
+		return stride;
+	}
+
+
+// upload the mesh, one glBufferData for each buffer. Meshes that were
+// not optimised offline can be run through OptimizeMesh() first.
+
+	bool Mesh::Create(const MeshData & source, bool optimize)
+	{
+		if (!validate(source, "Mesh::Create"))
+			return false;
+
+		Delete();
+
+		uint32 stride = GetVertexStride(source.format);
+		MeshData data = source;
+		vector<ubyte> vertices, indices;
+		if (optimize && source.indexCount)
+		{
+			vertices.resize(source.vertexCount * stride);
+			indices.resize(source.indexCount * source.indexSize);
+			data.vertexCount = OptimizeMesh(source, &vertices[0], &indices[0]);
+			data.vertices = &vertices[0];
+			data.indices = &indices[0];
+		}
+
+		GL_DEBUG(glGenVertexArrays(1, &m_vao));
+		GL_DEBUG(glGenBuffers(1, &m_vbo));
+		GL_DEBUG(glGenBuffers(1, &m_ibo));
+		g_GLState.BindVertexArray(m_vao);
+
+		// the index buffer binding is stored in the vao
+		g_GLState.BindBuffer(GL_ARRAY_BUFFER, m_vbo);
+		GL_DEBUG(glBufferData(GL_ARRAY_BUFFER, data.vertexCount * stride, data.vertices, GL_STATIC_DRAW));
+		g_GLState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+		GL_DEBUG(glBufferData(GL_ELEMENT_ARRAY_BUFFER, data.indexCount * data.indexSize, data.indices, GL_STATIC_DRAW));
+
+		// point each attribute at its place in the interleaved vertex
+		uint32 offset = 0;
+		for (uint32 i = 0; i < s_vertexAttributeCount; ++i)
+		{
+			const VertexAttribute & va = s_vertexAttributes[i];
+			if (!(data.format & va.flag))
+				continue;
+
+			GL_DEBUG(glEnableVertexAttribArray(va.attrib));
+			GL_DEBUG(glVertexAttribPointer(va.attrib, va.size, va.type, va.normalized, stride, (GLvoid*)(size_t)offset));
+			offset += va.bytes;
+		}
+
+		g_GLState.BindVertexArray(0);
+		g_GLState.BindBuffer(GL_ARRAY_BUFFER, 0);
+
+		m_format = data.format;
+		m_vertexCount = data.vertexCount;
+		m_indexType = (data.indexSize == 2) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		m_indexSize = data.indexSize;
+		m_indexCount = data.indexCount;
+
+		// bounds of the positions, always the first attribute
+		m_bounds = AABB();
+		const ubyte * position = (const ubyte *)data.vertices;
+		for (uint32 i = 0; i < data.vertexCount; ++i, position += stride)
+			m_bounds.Expand(*(const vec3 *)position);
+		m_sphere = Sphere::FromPoints((const vec3 *)data.vertices, data.vertexCount, stride);
 
+		if (data.subMeshCount)
+		{
+			m_subMeshes.assign(data.subMeshes, data.subMeshes + data.subMeshCount);
+		}
+		else
+		{
+			SubMesh all = { 0, data.indexCount, 0 };
+			m_subMeshes.assign(1, all);
+		}
+
+		return true;
+	}
+
+
+// maps a binary mesh file and uploads straight from the mapping
+
+	bool Mesh::Load(const string & file, bool optimize)
+	{
+		string path = FF_MESH_PATH + file;
+		size_t size = 0;
+		const ubyte * memory = map_file(path, size);
+		if (!memory)
+		{
+			g_Log.write(LOG_ERROR, "Mesh::Load > unable to open '%s'!", path.c_str());
+			return false;
+		}
+
+		const MeshFileHeader * header = (const MeshFileHeader *)memory;
+		const char * error = NULL;
+		if (size < sizeof(MeshFileHeader) || header->magic != FF_MESH_MAGIC)
+			error = "not a mesh file";
+		else if (header->version != FF_MESH_VERSION)
+			error = "unsupported version";
+		else if (!in_file(header->subMeshOffset, (uint64)header->subMeshCount * sizeof(SubMesh), size) ||
+		         !in_file(header->vertexOffset, (uint64)header->vertexCount * GetVertexStride(header->format), size) ||
+		         !in_file(header->indexOffset, (uint64)header->indexCount * header->indexSize, size))
+			error = "truncated file";
+
+		bool loaded = false;
+		if (error)
+		{
+			g_Log.write(LOG_ERROR, "Mesh::Load > failed to load '%s' (%s)", path.c_str(), error);
+		}
+		else
+		{
+			MeshData data = {
+				header->format,
+				header->vertexCount, memory + header->vertexOffset,
+				header->indexSize, header->indexCount, memory + header->indexOffset,
+				header->subMeshCount, (const SubMesh *)(memory + header->subMeshOffset)
+			};
+			loaded = Create(data, optimize);
+		}
+
+		unmap_file(memory, size);
+
+		if (loaded)
+			g_Log.write(LOG_LOAD, "Mesh loaded > '%s' (%u vertices, %u indices, %u sub meshes)",
+			            path.c_str(), m_vertexCount, m_indexCount, GetSubMeshCount());
+		return loaded;
+	}
+
+
+// release the gl objects
+
+	void Mesh::Delete()
+	{
+		g_GLState.DeleteVertexArrays(1, &m_vao);
+		g_GLState.DeleteBuffers(1, &m_vbo);
+		g_GLState.DeleteBuffers(1, &m_ibo);
+		m_vao = m_vbo = m_ibo = 0;
+		m_vertexCount = m_indexCount = 0;
+		m_subMeshes.clear();
+		m_bounds = AABB();
+		m_sphere = Sphere();
+	}
+
+
+// write mesh data out in the binary format
+
+	bool Mesh::Save(const string & file, const MeshData & data)
+	{
+		if (!validate(data, "Mesh::Save"))
+			return false;
+
+		uint32 vertexBytes = data.vertexCount * GetVertexStride(data.format);
+		uint32 indexBytes = data.indexCount * data.indexSize;
+
+		// sections follow the header in order, the indices are the only one
+		// whose size may not be a multiple of 4 so they go last
+		MeshFileHeader header;
+		header.magic = FF_MESH_MAGIC;
+		header.version = FF_MESH_VERSION;
+		header.format = data.format;
+		header.vertexCount = data.vertexCount;
+		header.indexSize = data.indexSize;
+		header.indexCount = data.indexCount;
+		header.subMeshCount = data.subMeshCount;
+		header.subMeshOffset = sizeof(MeshFileHeader);
+		header.vertexOffset = header.subMeshOffset + data.subMeshCount * sizeof(SubMesh);
+		header.indexOffset = header.vertexOffset + vertexBytes;
+
+		// write to a temporary file first so readers never see half a file
+		string path = FF_MESH_PATH + file;
+		string temp = path + ".tmp";
+		ofstream out(temp.c_str(), ios::out | ios::binary | ios::trunc);
+		if (!out.good())
+		{
+			g_Log.write(LOG_ERROR, "Mesh::Save > unable to write '%s'!", path.c_str());
+			return false;
+		}
+
+		out.write((const char *)&header, sizeof(header));
+		if (data.subMeshCount)
+			out.write((const char *)data.subMeshes, data.subMeshCount * sizeof(SubMesh));
+		out.write((const char *)data.vertices, vertexBytes);
+		out.write((const char *)data.indices, indexBytes);
+		out.close();
+
+		if (out.fail() || rename(temp.c_str(), path.c_str()) != 0)
+		{
+			remove(temp.c_str());
+			g_Log.write(LOG_ERROR, "Mesh::Save > unable to write '%s'!", path.c_str());
+			return false;
+		}
+
+		return true;
+	}
+
+
+// draw calls, the vao is left bound so drawing the same mesh again
+// doesn't rebind it
+
+	void Mesh::Draw()
+	{
+		g_GLState.BindVertexArray(m_vao);
+		GL_DEBUG(glDrawElements(GL_TRIANGLES, m_indexCount, m_indexType, (GLvoid*)0));
+	}
+
+	void Mesh::DrawSubMesh(uint32 index)
+	{
+		assert(index < m_subMeshes.size());
+		const SubMesh & sub = m_subMeshes[index];
+
+		g_GLState.BindVertexArray(m_vao);
+		GL_DEBUG(glDrawElements(GL_TRIANGLES, sub.indexCount, m_indexType, (GLvoid*)((size_t)sub.firstIndex * m_indexSize)));
+	}
+
+	void Mesh::DrawInstanced(GLsizei count)
+	{
+		g_GLState.BindVertexArray(m_vao);
+		GL_DEBUG(glDrawElementsInstanced(GL_TRIANGLES, m_indexCount, m_indexType, (GLvoid*)0, count));
+	}
+
+
+// checks mesh data before it goes anywhere near the gpu
+
+	bool Mesh::validate(const MeshData & data, const char * name)
+	{
+		const char * error = NULL;
+		if (!(data.format & FF_VERTEX_POSITION) || (data.format & ~s_vertexFormatMask))
+			error = "bad vertex format";
+		else if (!data.vertexCount || !data.vertices || !data.indexCount || !data.indices)
+			error = "no geometry";
+		else if (data.indexSize != 2 && data.indexSize != 4)
+			error = "indices must be 16 or 32 bit";
+		else if (data.subMeshCount && !data.subMeshes)
+			error = "missing sub meshes";
+
+		// every index must refer to a vertex
+		for (uint32 i = 0; !error && i < data.indexCount; ++i)
+		{
+			uint32 index = (data.indexSize == 2) ? ((const uint16 *)data.indices)[i]
+			                                     : ((const uint32 *)data.indices)[i];
+			if (index >= data.vertexCount)
+				error = "index out of range";
+		}
+
+		for (uint32 i = 0; !error && i < data.subMeshCount; ++i)
+		{
+			const SubMesh & sub = data.subMeshes[i];
+			if (sub.firstIndex > data.indexCount || sub.indexCount > data.indexCount - sub.firstIndex)
+				error = "sub mesh out of range";
+		}
+
+		if (error)
+			g_Log.write(LOG_ERROR, "%s > %s!", name, error);
+		return !error;
+	}
 
 } // exiting namespace ff
 
 ////////////////////////////////////////////////////////////////////////
-
@@ -1,13 +1,124 @@
 #ifndef FIREFLY_MESH_HPP
 #define FIREFLY_MESH_HPP
 
+#include <firefly/opengl.hpp>
 #include <firefly/common.hpp>
+#include <firefly/graphics/bounds.hpp>
+
+#define FF_MESH_PATH    "data/mesh/"
+#define FF_MESH_MAGIC   0x4d534646 // 'FFSM'
+#define FF_MESH_VERSION 1          // bump when the file layout changes
 
 ////////////////////////////////////////////////////////////////////////
 
 namespace ff {
 
+// vertex attributes a mesh can have, interleaved in this order
+
+	enum FF_VERTEX_FORMAT {
+		FF_VERTEX_POSITION = 1 << 0, // 3 floats
+		FF_VERTEX_NORMAL   = 1 << 1, // 3 floats
+		FF_VERTEX_TEXTURE0 = 1 << 2, // 2 floats
+		FF_VERTEX_COLOR    = 1 << 3, // 4 normalized unsigned bytes
+	};
+
+
+// a range of the index buffer drawn with its own material
+
+	struct SubMesh
+	{
+		uint32 firstIndex;
+		uint32 indexCount;
+		uint32 material; // application defined
+	};
+
+
+// mesh data in system memory, as uploaded by Create() and written by Save()
+
+	struct MeshData
+	{
+		uint32          format;       // FF_VERTEX_* flags
+		uint32          vertexCount;
+		const void *    vertices;     // interleaved, GetVertexStride(format) bytes each
+		uint32          indexSize;    // 2 or 4 bytes
+		uint32          indexCount;
+		const void *    indices;
+		uint32          subMeshCount; // 0 for a single sub mesh covering every index
+		const SubMesh * subMeshes;
+	};
+
+
+// binary mesh file, the header is followed by the sub meshes, vertices
+// and indices, each section 4 byte aligned so a mapped file can be
+// handed to glBufferData as is
+
+	struct MeshFileHeader
+	{
+		uint32 magic;
+		uint32 version;
+		uint32 format;
+		uint32 vertexCount;
+		uint32 indexSize;
+		uint32 indexCount;
+		uint32 subMeshCount;
+		uint32 subMeshOffset;
+		uint32 vertexOffset;
+		uint32 indexOffset;
+	};
+
+
+// indexed mesh with interleaved vertices, one vbo and one ibo in a vao
+
+	class Mesh
+	{
+	public:
+		Mesh() : m_vao(0), m_vbo(0), m_ibo(0), m_format(0), m_vertexCount(0),
+		         m_indexType(GL_UNSIGNED_SHORT), m_indexSize(2), m_indexCount(0) { }
+		~Mesh() { }
+
+		// upload from memory / load a binary mesh from FF_MESH_PATH / release,
+		// optimize runs the mesh through OptimizeMesh() before uploading
+		bool Create(const MeshData & data, bool optimize = false);
+		bool Load(const string & file, bool optimize = false);
+		void Delete();
+
+		// write mesh data out in the binary format
+		static bool Save(const string & file, const MeshData & data);
+
+		// draw every index, one sub mesh, or many instances of the whole mesh
+		void Draw();
+		void DrawSubMesh(uint32 index);
+		void DrawInstanced(GLsizei count);
+
+		GLuint GetVertexArray() const { return m_vao; }
+		uint32 GetFormat() const { return m_format; }
+		uint32 GetVertexCount() const { return m_vertexCount; }
+		uint32 GetIndexCount() const { return m_indexCount; }
+		uint32 GetSubMeshCount() const { return (uint32)m_subMeshes.size(); }
+		const SubMesh & GetSubMesh(uint32 index) const { return m_subMeshes[index]; }
+
+		// object space bounds of the vertices
+		const AABB & GetBounds() const { return m_bounds; }
+		const Sphere & GetSphere() const { return m_sphere; }
+
+		// bytes per vertex for a combination of FF_VERTEX_* flags
+		static uint32 GetVertexStride(uint32 format);
+
+	private:
+		static bool validate(const MeshData & data, const char * name);
 
+		GLuint          m_vao;
+		GLuint          m_vbo;
+		GLuint          m_ibo;
+		uint32          m_format;
+		uint32          m_vertexCount;
+		GLenum          m_indexType;
+		uint32          m_indexSize;
+		uint32          m_indexCount;
+		vector<SubMesh> m_subMeshes;
+		AABB            m_bounds;
+		Sphere          m_sphere;
+	};
 
 } // exiting namespace ff
 
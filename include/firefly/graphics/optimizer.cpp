@@ -0,0 +1,481 @@
+#include <firefly/graphics/optimizer.hpp>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#define FF_OPTIMIZER_VALENCE_TABLE 32 // valences with a precomputed score
+
+////////////////////////////////////////////////////////////////////////
+
+namespace ff {
+
+// vertex scoring from Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+
+	static const float s_cacheDecayPower    = 1.5f;
+	static const float s_lastTriangleScore  = 0.75f;
+	static const float s_valenceBoostScale  = 2.0f;
+	static const float s_valenceBoostPower  = 0.5f;
+
+	struct VertexScoreTable
+	{
+		float cache[FF_OPTIMIZER_CACHE_SIZE];
+		float valence[FF_OPTIMIZER_VALENCE_TABLE];
+
+		VertexScoreTable()
+		{
+			// the last triangle's vertices score the same so there is no
+			// preference for the winding order it was emitted in
+			for (int i = 0; i < FF_OPTIMIZER_CACHE_SIZE; ++i)
+			{
+				if (i < 3)
+					cache[i] = s_lastTriangleScore;
+				else
+					cache[i] = std::pow(1.0f - (i - 3) * (1.0f / (FF_OPTIMIZER_CACHE_SIZE - 3)), s_cacheDecayPower);
+			}
+
+			// vertices with few triangles left are worth finishing off
+			valence[0] = 0.0f;
+			for (int i = 1; i < FF_OPTIMIZER_VALENCE_TABLE; ++i)
+				valence[i] = s_valenceBoostScale * std::pow((float)i, -s_valenceBoostPower);
+		}
+
+		float Score(int cachePosition, uint32 liveTriangles) const
+		{
+			if (liveTriangles == 0)
+				return -1.0f;
+
+			float score = (cachePosition >= 0) ? cache[cachePosition] : 0.0f;
+			if (liveTriangles < FF_OPTIMIZER_VALENCE_TABLE)
+				return score + valence[liveTriangles];
+			return score + s_valenceBoostScale * std::pow((float)liveTriangles, -s_valenceBoostPower);
+		}
+	};
+
+	static const VertexScoreTable s_scores;
+
+
+// fnv-1a over the bytes of a vertex
+
+	static uint32 hash_vertex(const ubyte * vertex, uint32 stride)
+	{
+		uint32 hash = 2166136261u;
+		for (uint32 i = 0; i < stride; ++i)
+			hash = (hash ^ vertex[i]) * 16777619u;
+		return hash;
+	}
+
+
+// merges identical vertices, compacting them towards the front
+
+	template <typename T>
+	static uint32 weld_vertices(void * vertices, uint32 vertexCount, uint32 stride, T * indices, uint32 indexCount)
+	{
+		ubyte * data = static_cast<ubyte *>(vertices);
+
+		// open addressing table of compacted vertex positions, at most half full
+		uint32 tableSize = 1;
+		while (tableSize < vertexCount * 2)
+			tableSize *= 2;
+
+		vector<uint32> table(tableSize, ~0u);
+		vector<uint32> remap(vertexCount);
+		uint32 unique = 0;
+
+		for (uint32 v = 0; v < vertexCount; ++v)
+		{
+			const ubyte * vertex = data + v * stride;
+			uint32 slot = hash_vertex(vertex, stride) & (tableSize - 1);
+
+			while (table[slot] != ~0u && memcmp(data + table[slot] * stride, vertex, stride) != 0)
+				slot = (slot + 1) & (tableSize - 1);
+
+			if (table[slot] == ~0u)
+			{
+				// new vertex, everything before 'unique' has already been read
+				if (unique != v)
+					memcpy(data + unique * stride, vertex, stride);
+				table[slot] = unique++;
+			}
+
+			remap[v] = table[slot];
+		}
+
+		for (uint32 i = 0; i < indexCount; ++i)
+			indices[i] = (T)remap[indices[i]];
+		return unique;
+	}
+
+
+// greedy triangle ordering, always emits the best scoring triangle that
+// uses a vertex in the simulated lru cache
+
+	template <typename T>
+	static void optimize_vertex_cache(T * indices, uint32 indexCount, uint32 vertexCount)
+	{
+		uint32 triangleCount = indexCount / 3;
+		if (triangleCount < 2)
+			return;
+
+		// triangles using each vertex, the live ones are kept at the front
+		vector<uint32> liveTriangles(vertexCount, 0);
+		vector<uint32> offsets(vertexCount + 1, 0);
+		vector<uint32> adjacency(triangleCount * 3);
+
+		for (uint32 i = 0; i < triangleCount * 3; ++i)
+			++liveTriangles[indices[i]];
+		for (uint32 v = 0; v < vertexCount; ++v)
+			offsets[v + 1] = offsets[v] + liveTriangles[v];
+
+		vector<uint32> fill(offsets.begin(), offsets.end() - 1);
+		for (uint32 i = 0; i < triangleCount * 3; ++i)
+			adjacency[fill[indices[i]]++] = i / 3;
+
+		vector<float> vertexScore(vertexCount);
+		vector<int>   cachePosition(vertexCount, -1);
+		for (uint32 v = 0; v < vertexCount; ++v)
+			vertexScore[v] = s_scores.Score(-1, liveTriangles[v]);
+
+		vector<float> triangleScore(triangleCount);
+		vector<bool>  emitted(triangleCount, false);
+		for (uint32 t = 0; t < triangleCount; ++t)
+		{
+			triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]]
+			                 + vertexScore[indices[t * 3 + 2]];
+		}
+
+		// room for the new triangle's vertices before the oldest fall out
+		uint32 cache[FF_OPTIMIZER_CACHE_SIZE + 3];
+		uint32 cacheSize = 0;
+
+		vector<T> output(triangleCount * 3);
+		uint32 cursor = 0;
+		int best = (int)(std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin());
+
+		for (uint32 out = 0; out < triangleCount; ++out)
+		{
+			// nothing in the cache is connected to anything left, take the
+			// next triangle in input order
+			if (best < 0)
+			{
+				while (emitted[cursor])
+					++cursor;
+				best = (int)cursor;
+			}
+
+			const T * tri = indices + best * 3;
+			output[out * 3] = tri[0];
+			output[out * 3 + 1] = tri[1];
+			output[out * 3 + 2] = tri[2];
+			emitted[best] = true;
+
+			// drop the triangle from its vertices' live lists
+			for (int k = 0; k < 3; ++k)
+			{
+				uint32 v = tri[k];
+				uint32 * list = &adjacency[offsets[v]];
+				uint32 live = liveTriangles[v];
+				for (uint32 j = 0; j < live; ++j)
+				{
+					if (list[j] == (uint32)best)
+					{
+						std::swap(list[j], list[live - 1]);
+						break;
+					}
+				}
+				--liveTriangles[v];
+			}
+
+			// move the triangle's vertices to the front of the cache
+			uint32 newCache[FF_OPTIMIZER_CACHE_SIZE + 3];
+			uint32 newSize = 0;
+			for (int k = 0; k < 3; ++k)
+				newCache[newSize++] = tri[k];
+			for (uint32 i = 0; i < cacheSize; ++i)
+			{
+				uint32 v = cache[i];
+				if (v != tri[0] && v != tri[1] && v != tri[2])
+					newCache[newSize++] = v;
+			}
+
+			// rescore everything that moved, including what fell out
+			for (uint32 i = 0; i < newSize; ++i)
+			{
+				uint32 v = newCache[i];
+				int position = (i < FF_OPTIMIZER_CACHE_SIZE) ? (int)i : -1;
+				cachePosition[v] = position;
+
+				float score = s_scores.Score(position, liveTriangles[v]);
+				float delta = score - vertexScore[v];
+				vertexScore[v] = score;
+
+				const uint32 * list = &adjacency[offsets[v]];
+				for (uint32 j = 0; j < liveTriangles[v]; ++j)
+					triangleScore[list[j]] += delta;
+			}
+
+			cacheSize = std::min(newSize, (uint32)FF_OPTIMIZER_CACHE_SIZE);
+			memcpy(cache, newCache, cacheSize * sizeof(uint32));
+
+			// next triangle is the best one touching the cache
+			best = -1;
+			float bestScore = -1.0f;
+			for (uint32 i = 0; i < cacheSize; ++i)
+			{
+				uint32 v = cache[i];
+				const uint32 * list = &adjacency[offsets[v]];
+				for (uint32 j = 0; j < liveTriangles[v]; ++j)
+				{
+					if (triangleScore[list[j]] > bestScore)
+					{
+						bestScore = triangleScore[list[j]];
+						best = (int)list[j];
+					}
+				}
+			}
+		}
+
+		std::copy(output.begin(), output.end(), indices);
+	}
+
+
+// fifo cache simulation, calls miss(triangle, misses) for each triangle
+
+	template <typename T, typename F>
+	static void simulate_fifo(const T * indices, uint32 indexCount, uint32 vertexCount, uint32 cacheSize, F miss)
+	{
+		// a vertex is cached while fewer than cacheSize misses happened since
+		vector<uint32> stamp(vertexCount, 0);
+		uint32 time = cacheSize + 1;
+
+		for (uint32 t = 0; t < indexCount / 3; ++t)
+		{
+			uint32 misses = 0;
+			for (int k = 0; k < 3; ++k)
+			{
+				uint32 v = indices[t * 3 + k];
+				if (time - stamp[v] > cacheSize)
+				{
+					stamp[v] = time++;
+					++misses;
+				}
+			}
+			miss(t, misses);
+		}
+	}
+
+
+// splits the cache optimised order where the cache starts cold (all three
+// vertices miss) and sorts those clusters by how much they face outwards
+// (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex
+// Locality and Reduced Overdraw")
+
+	template <typename T>
+	static void optimize_overdraw(T * indices, uint32 indexCount, const void * vertices, uint32 vertexCount, uint32 stride)
+	{
+		uint32 triangleCount = indexCount / 3;
+		if (triangleCount < 2)
+			return;
+
+		vector<uint32> clusters;
+		simulate_fifo(indices, indexCount, vertexCount, FF_OPTIMIZER_FIFO_SIZE,
+			[&clusters](uint32 t, uint32 misses) {
+				if (t == 0 || misses == 3)
+					clusters.push_back(t);
+			});
+		if (clusters.size() < 2)
+			return;
+		clusters.push_back(triangleCount);
+
+		// area weighted centroid and normal of each cluster
+		const ubyte * data = static_cast<const ubyte *>(vertices);
+		uint32 clusterCount = (uint32)clusters.size() - 1;
+		vector<vec3> centroid(clusterCount), normal(clusterCount);
+		vec3 meshCentroid(0.0f);
+		float meshArea = 0.0f;
+
+		for (uint32 c = 0; c < clusterCount; ++c)
+		{
+			vec3 sum(0.0f), n(0.0f);
+			float area = 0.0f;
+			for (uint32 t = clusters[c]; t < clusters[c + 1]; ++t)
+			{
+				vec3 p[3];
+				for (int k = 0; k < 3; ++k)
+				{
+					const float * position = (const float *)(data + indices[t * 3 + k] * stride);
+					p[k] = vec3(position[0], position[1], position[2]);
+				}
+
+				vec3 cross = glm::cross(p[1] - p[0], p[2] - p[0]);
+				float a = glm::length(cross);
+				sum += (p[0] + p[1] + p[2]) * (a / 3.0f);
+				n += cross;
+				area += a;
+			}
+
+			centroid[c] = (area > 0.0f) ? sum / area : vec3(0.0f);
+			normal[c] = n;
+			meshCentroid += sum;
+			meshArea += area;
+		}
+
+		if (meshArea > 0.0f)
+			meshCentroid /= meshArea;
+
+		// clusters facing away from the middle of the mesh are drawn first
+		vector<float> key(clusterCount);
+		vector<uint32> order(clusterCount);
+		for (uint32 c = 0; c < clusterCount; ++c)
+		{
+			float length = glm::length(normal[c]);
+			key[c] = (length > 0.0f) ? glm::dot(centroid[c] - meshCentroid, normal[c] / length) : 0.0f;
+			order[c] = c;
+		}
+
+		std::stable_sort(order.begin(), order.end(),
+			[&key](uint32 a, uint32 b) { return key[a] > key[b]; });
+
+		vector<T> output;
+		output.reserve(triangleCount * 3);
+		for (uint32 i = 0; i < clusterCount; ++i)
+		{
+			uint32 c = order[i];
+			output.insert(output.end(), indices + clusters[c] * 3, indices + clusters[c + 1] * 3);
+		}
+
+		std::copy(output.begin(), output.end(), indices);
+	}
+
+
+// renumbers vertices in the order the indices first use them
+
+	template <typename T>
+	static uint32 optimize_vertex_fetch(void * vertices, uint32 vertexCount, uint32 stride, T * indices, uint32 indexCount)
+	{
+		vector<uint32> remap(vertexCount, ~0u);
+		uint32 next = 0;
+		for (uint32 i = 0; i < indexCount; ++i)
+		{
+			uint32 & v = remap[indices[i]];
+			if (v == ~0u)
+				v = next++;
+			indices[i] = (T)v;
+		}
+
+		ubyte * data = static_cast<ubyte *>(vertices);
+		vector<ubyte> copy(data, data + vertexCount * stride);
+		for (uint32 v = 0; v < vertexCount; ++v)
+		{
+			if (remap[v] != ~0u)
+				memcpy(data + remap[v] * stride, &copy[v * stride], stride);
+		}
+		return next;
+	}
+
+
+// misses per triangle for a fifo cache
+
+	template <typename T>
+	static float analyze_vertex_cache(const T * indices, uint32 indexCount, uint32 vertexCount, uint32 cacheSize)
+	{
+		if (indexCount < 3)
+			return 0.0f;
+
+		uint32 total = 0;
+		simulate_fifo(indices, indexCount, vertexCount, cacheSize,
+			[&total](uint32, uint32 misses) { total += misses; });
+		return (float)total / (float)(indexCount / 3);
+	}
+
+
+// every pass in order, each sub mesh keeps its own index range
+
+	template <typename T>
+	static uint32 optimize_mesh(const MeshData & data, void * vertices, T * indices)
+	{
+		uint32 stride = Mesh::GetVertexStride(data.format);
+		uint32 vertexCount = weld_vertices(vertices, data.vertexCount, stride, indices, data.indexCount);
+
+		SubMesh all = { 0, data.indexCount, 0 };
+		const SubMesh * subMeshes = data.subMeshCount ? data.subMeshes : &all;
+		uint32 subMeshCount = data.subMeshCount ? data.subMeshCount : 1;
+
+		for (uint32 i = 0; i < subMeshCount; ++i)
+		{
+			T * range = indices + subMeshes[i].firstIndex;
+			optimize_vertex_cache(range, subMeshes[i].indexCount, vertexCount);
+			optimize_overdraw(range, subMeshes[i].indexCount, vertices, vertexCount, stride);
+		}
+
+		return optimize_vertex_fetch(vertices, vertexCount, stride, indices, data.indexCount);
+	}
+
+
+// public entry points for both index sizes
+
+	uint32 WeldVertices(void * vertices, uint32 vertexCount, uint32 stride, uint16 * indices, uint32 indexCount)
+	{
+		return weld_vertices(vertices, vertexCount, stride, indices, indexCount);
+	}
+
+	uint32 WeldVertices(void * vertices, uint32 vertexCount, uint32 stride, uint32 * indices, uint32 indexCount)
+	{
+		return weld_vertices(vertices, vertexCount, stride, indices, indexCount);
+	}
+
+	void OptimizeVertexCache(uint16 * indices, uint32 indexCount, uint32 vertexCount)
+	{
+		optimize_vertex_cache(indices, indexCount, vertexCount);
+	}
+
+	void OptimizeVertexCache(uint32 * indices, uint32 indexCount, uint32 vertexCount)
+	{
+		optimize_vertex_cache(indices, indexCount, vertexCount);
+	}
+
+	void OptimizeOverdraw(uint16 * indices, uint32 indexCount, const void * vertices, uint32 vertexCount, uint32 stride)
+	{
+		optimize_overdraw(indices, indexCount, vertices, vertexCount, stride);
+	}
+
+	void OptimizeOverdraw(uint32 * indices, uint32 indexCount, const void * vertices, uint32 vertexCount, uint32 stride)
+	{
+		optimize_overdraw(indices, indexCount, vertices, vertexCount, stride);
+	}
+
+	uint32 OptimizeVertexFetch(void * vertices, uint32 vertexCount, uint32 stride, uint16 * indices, uint32 indexCount)
+	{
+		return optimize_vertex_fetch(vertices, vertexCount, stride, indices, indexCount);
+	}
+
+	uint32 OptimizeVertexFetch(void * vertices, uint32 vertexCount, uint32 stride, uint32 * indices, uint32 indexCount)
+	{
+		return optimize_vertex_fetch(vertices, vertexCount, stride, indices, indexCount);
+	}
+
+	float AnalyzeVertexCache(const uint16 * indices, uint32 indexCount, uint32 vertexCount, uint32 cacheSize)
+	{
+		return analyze_vertex_cache(indices, indexCount, vertexCount, cacheSize);
+	}
+
+	float AnalyzeVertexCache(const uint32 * indices, uint32 indexCount, uint32 vertexCount, uint32 cacheSize)
+	{
+		return analyze_vertex_cache(indices, indexCount, vertexCount, cacheSize);
+	}
+
+	uint32 OptimizeMesh(const MeshData & data, void * vertices, void * indices)
+	{
+		uint32 stride = Mesh::GetVertexStride(data.format);
+		if (vertices != data.vertices)
+			memcpy(vertices, data.vertices, data.vertexCount * stride);
+		if (indices != data.indices)
+			memcpy(indices, data.indices, data.indexCount * data.indexSize);
+
+		if (data.indexSize == 2)
+			return optimize_mesh(data, vertices, static_cast<uint16 *>(indices));
+		return optimize_mesh(data, vertices, static_cast<uint32 *>(indices));
+	}
+
+} // exiting namespace ff
+
+////////////////////////////////////////////////////////////////////////
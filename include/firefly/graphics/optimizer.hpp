@@ -0,0 +1,51 @@
+#ifndef FIREFLY_OPTIMIZER_HPP
+#define FIREFLY_OPTIMIZER_HPP
+
+#include <firefly/common.hpp>
+#include <firefly/graphics/mesh.hpp>
+
+#define FF_OPTIMIZER_CACHE_SIZE 32 // lru cache modelled by the vertex cache pass
+#define FF_OPTIMIZER_FIFO_SIZE  16 // fifo cache used for analysis / overdraw clusters
+
+////////////////////////////////////////////////////////////////////////
+
+namespace ff {
+
+// mesh optimisation passes, run offline before Mesh::Save() or at load
+// time through Mesh::Create(data, true). Every pass works on triangle
+// lists with 16 or 32 bit indices.
+
+	// merges bitwise identical vertices in place and remaps the indices,
+	// returns the new vertex count
+	uint32 WeldVertices(void * vertices, uint32 vertexCount, uint32 stride, uint16 * indices, uint32 indexCount);
+	uint32 WeldVertices(void * vertices, uint32 vertexCount, uint32 stride, uint32 * indices, uint32 indexCount);
+
+	// reorders triangles for the post transform vertex cache (Forsyth)
+	void OptimizeVertexCache(uint16 * indices, uint32 indexCount, uint32 vertexCount);
+	void OptimizeVertexCache(uint32 * indices, uint32 indexCount, uint32 vertexCount);
+
+	// reorders clusters of a cache optimised index list so outward facing
+	// ones are drawn first, positions are 3 floats at the start of a vertex
+	void OptimizeOverdraw(uint16 * indices, uint32 indexCount, const void * vertices, uint32 vertexCount, uint32 stride);
+	void OptimizeOverdraw(uint32 * indices, uint32 indexCount, const void * vertices, uint32 vertexCount, uint32 stride);
+
+	// reorders vertices into first use order and drops unused ones,
+	// returns the new vertex count
+	uint32 OptimizeVertexFetch(void * vertices, uint32 vertexCount, uint32 stride, uint16 * indices, uint32 indexCount);
+	uint32 OptimizeVertexFetch(void * vertices, uint32 vertexCount, uint32 stride, uint32 * indices, uint32 indexCount);
+
+	// average cache misses per triangle (ACMR) for a fifo cache
+	float AnalyzeVertexCache(const uint16 * indices, uint32 indexCount, uint32 vertexCount, uint32 cacheSize = FF_OPTIMIZER_FIFO_SIZE);
+	float AnalyzeVertexCache(const uint32 * indices, uint32 indexCount, uint32 vertexCount, uint32 cacheSize = FF_OPTIMIZER_FIFO_SIZE);
+
+	// runs every pass over a mesh laid out as described by data, writing
+	// into vertices / indices (copies of data's arrays, or the same memory
+	// when it is writable), sub meshes are optimised separately. Returns
+	// the new vertex count.
+	uint32 OptimizeMesh(const MeshData & data, void * vertices, void * indices);
+
+} // exiting namespace ff
+
+////////////////////////////////////////////////////////////////////////
+
+#endif
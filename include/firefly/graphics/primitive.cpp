@@ -1,186 +1,64 @@
 #include <firefly/graphics/primitive.hpp>
+#include <algorithm>
+#include <cmath>
 
 ////////////////////////////////////////////////////////////////////////
 
 namespace ff {
 
-// create and populate the cubes vbo/vao
+// create the cube mesh, 4 vertices and 2 triangles per face
 
 	void Cube::Create(float size) 
 	{
-		static const GLfloat vertices[] =
-		{ 
-			// top
-			size,  size,  size,
-			size,  size, -size,
-		   -size,  size, -size,
-			size,  size,  size,
-		   -size,  size, -size,
-		   -size,  size,  size,
-
-			// bottom
-	       -size, -size, -size,
-			size, -size, -size,
-			size, -size,  size,
-		   -size, -size,  size,
-		   -size, -size, -size,
-			size, -size,  size,
-
-			// left
-		   -size,  size,  size,
-		   -size,  size, -size,
-		   -size, -size, -size,
-		   -size,  size,  size,
-		   -size, -size, -size,
-		   -size, -size,  size,
-
-			// right
-			size, -size, -size,
-			size,  size, -size,
-			size,  size,  size,
-			size,  size,  size,
-			size, -size,  size,
-			size, -size, -size,
-
-			// front
-			size, -size,  size,
-			size,  size,  size,
-		   -size,  size,  size,
-		   -size,  size,  size,
-		   -size, -size,  size,
-			size, -size,  size,
-
-			// back
-			size, -size, -size,
-		   -size, -size, -size,
-		   -size,  size, -size,
-		   -size,  size, -size,
-			size,  size, -size,
-			size, -size, -size
+		struct Vertex
+		{
+			vec3 position;
+			vec3 normal;
+			vec2 texcoord;
 		};
 
-		static const GLfloat normals[] =
-		{ 
-			// top
-			0.0f,  1.0f,  0.0f,
-			0.0f,  1.0f,  0.0f,
-			0.0f,  1.0f,  0.0f,
-			0.0f,  1.0f,  0.0f,
-			0.0f,  1.0f,  0.0f,
-			0.0f,  1.0f,  0.0f,
-
-			// bottom
-			0.0f, -1.0f,  0.0f,
-			0.0f, -1.0f,  0.0f,
-			0.0f, -1.0f,  0.0f,
-			0.0f, -1.0f,  0.0f,
-			0.0f, -1.0f,  0.0f,
-			0.0f, -1.0f,  0.0f,
-
-			// left
-		   -1.0f,  0.0f,  0.0f,
-		   -1.0f,  0.0f,  0.0f,
-		   -1.0f,  0.0f,  0.0f,
-		   -1.0f,  0.0f,  0.0f,
-		   -1.0f,  0.0f,  0.0f,
-		   -1.0f,  0.0f,  0.0f,
-
-			// right
-			1.0f,  0.0f,  0.0f,
-			1.0f,  0.0f,  0.0f,
-			1.0f,  0.0f,  0.0f,
-			1.0f,  0.0f,  0.0f,
-			1.0f,  0.0f,  0.0f,
-			1.0f,  0.0f,  0.0f,
-
-			// front
-			0.0f,  0.0f,  1.0f,
-			0.0f,  0.0f,  1.0f,
-			0.0f,  0.0f,  1.0f,
-			0.0f,  0.0f,  1.0f,
-			0.0f,  0.0f,  1.0f,
-			0.0f,  0.0f,  1.0f,
-
-			// back
-			0.0f,  0.0f, -1.0f,
-			0.0f,  0.0f, -1.0f,
-			0.0f,  0.0f, -1.0f,
-			0.0f,  0.0f, -1.0f,
-			0.0f,  0.0f, -1.0f,
-			0.0f,  0.0f, -1.0f,
+		// face normal plus the two edges spanning it, u x v = normal so
+		// the triangles wind counter clockwise when seen from outside
+		static const float faces[6][9] =
+		{
+			{  0,  1,  0,    1, 0,  0,    0, 0, -1 }, // top
+			{  0, -1,  0,    1, 0,  0,    0, 0,  1 }, // bottom
+			{ -1,  0,  0,    0, 0,  1,    0, 1,  0 }, // left
+			{  1,  0,  0,    0, 0, -1,    0, 1,  0 }, // right
+			{  0,  0,  1,    1, 0,  0,    0, 1,  0 }, // front
+			{  0,  0, -1,   -1, 0,  0,    0, 1,  0 }, // back
 		};
 
-		static const GLfloat texcoords[] =
-		{ 
-			// top
-			1.0f, 1.0f,
-			1.0f, 0.0f,
-			0.0f, 0.0f,
-			1.0f, 1.0f,
-			0.0f, 0.0f,
-			0.0f, 1.0f,
-
-			// bottom
-			0.0f, 0.0f,
-			1.0f, 0.0f,
-			1.0f, 1.0f,
-			0.0f, 1.0f,
-			0.0f, 0.0f,
-			1.0f, 1.0f,
-
-			// left
-			1.0f, 1.0f,
-			1.0f, 0.0f,
-			0.0f, 0.0f,
-			1.0f, 1.0f,
-			0.0f, 0.0f,
-			0.0f, 1.0f,
-
-			// right
-			0.0f, 0.0f,
-			1.0f, 0.0f,
-			1.0f, 1.0f,
-			1.0f, 1.0f,
-			0.0f, 1.0f,
-			0.0f, 0.0f,
-
-			// front
-			1.0f, 0.0f,
-			1.0f, 1.0f,
-			0.0f, 1.0f,
-			0.0f, 1.0f,
-			0.0f, 0.0f,
-			1.0f, 0.0f,
-
-			// back
-			1.0f, 0.0f,
-			0.0f, 0.0f,
-			0.0f, 1.0f,
-			0.0f, 1.0f,
-			1.0f, 1.0f,
-			1.0f, 0.0f
+		static const float corners[4][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+
+		Vertex vertices[24];
+		uint16 indices[36];
+		for (int f = 0; f < 6; ++f)
+		{
+			vec3 normal(faces[f][0], faces[f][1], faces[f][2]);
+			vec3 u(faces[f][3], faces[f][4], faces[f][5]);
+			vec3 v(faces[f][6], faces[f][7], faces[f][8]);
+
+			for (int c = 0; c < 4; ++c)
+			{
+				Vertex & vertex = vertices[f * 4 + c];
+				vertex.position = (normal + u * corners[c][0] + v * corners[c][1]) * size;
+				vertex.normal = normal;
+				vertex.texcoord = vec2((corners[c][0] + 1) / 2, (corners[c][1] + 1) / 2);
+			}
+
+			static const uint16 quad[6] = { 0, 1, 2, 0, 2, 3 };
+			for (int i = 0; i < 6; ++i)
+				indices[f * 6 + i] = (uint16)(f * 4 + quad[i]);
+		}
+
+		MeshData data = {
+			FF_VERTEX_POSITION | FF_VERTEX_NORMAL | FF_VERTEX_TEXTURE0,
+			24, vertices,
+			sizeof(uint16), 36, indices,
+			0, NULL
 		};
-
-		// create the buffer object and array
-		GL_DEBUG(glGenBuffers(1, &vbo));
-		GL_DEBUG(glGenVertexArrays(1, &vao));
-		GL_DEBUG(glBindVertexArray(vao));
-		GL_DEBUG(glBindBuffer(GL_ARRAY_BUFFER, vbo));
-
-		// store sizes
-		vertSize = sizeof(vertices);
-		normalSize = sizeof(normals);
-		textureSize = sizeof(texcoords);
-
-		// load data into the buffer
-		GL_DEBUG(glBufferData(GL_ARRAY_BUFFER, vertSize + normalSize + textureSize, NULL, GL_STATIC_DRAW));
-		GL_DEBUG(glBufferSubData(GL_ARRAY_BUFFER, 0, vertSize, normals));
-		GL_DEBUG(glBufferSubData(GL_ARRAY_BUFFER, vertSize, normalSize, normals));
-		GL_DEBUG(glBufferSubData(GL_ARRAY_BUFFER, vertSize + normalSize, textureSize, texcoords));
-
-		// and unbind VAO and its parent buffer object
-		GL_DEBUG(glBindBuffer(GL_ARRAY_BUFFER, 0));
-		GL_DEBUG(glBindVertexArray(0));
+		mesh.Create(data);
 	}
 
 
@@ -188,33 +66,130 @@ namespace ff {
 
 	void Cube::Render()
 	{	
-		GL_DEBUG(glEnable(GL_VERTEX_ARRAY));
+		mesh.Draw();
+	}
+
+
+// vertex of the shapes built from a grid of rows x columns quads
+
+	struct GridVertex
+	{
+		vec3 position;
+		vec3 normal;
+		vec2 texcoord;
+	};
+
 
-		// bind the buffer object / and its VAO with pointer information
-		GL_DEBUG(glBindVertexArray(vao));	
-		GL_DEBUG(glBindBuffer(GL_ARRAY_BUFFER, vbo));		
+// indexes a (rows + 1) x (columns + 1) grid of vertices, row by row, and
+// uploads it through OptimizeMesh() so the triangles come out in cache
+// order rather than strips
 
-		// ensure our attrib pointers are enabled.
-		GL_DEBUG(glEnableVertexAttribArray(FF_ATTRIBUTE_VERTEX));
-		GL_DEBUG(glEnableVertexAttribArray(FF_ATTRIBUTE_NORMAL));
-		GL_DEBUG(glEnableVertexAttribArray(FF_ATTRIBUTE_TEXTURE0));
+	static void create_grid(Mesh & mesh, const vector<GridVertex> & vertices, int rows, int columns)
+	{
+		vector<uint32> indices;
+		indices.reserve(rows * columns * 6);
+		for (int i = 0; i < rows; ++i)
+		{
+			for (int j = 0; j < columns; ++j)
+			{
+				uint32 a = i * (columns + 1) + j;
+				uint32 b = a + 1;
+				uint32 c = b + columns + 1;
+				uint32 d = a + columns + 1;
+
+				indices.push_back(a); indices.push_back(b); indices.push_back(c);
+				indices.push_back(a); indices.push_back(c); indices.push_back(d);
+			}
+		}
+
+		// 16 bit indices whenever they will do
+		vector<uint16> shortIndices;
+		const void * indexData = &indices[0];
+		uint32 indexSize = sizeof(uint32);
+		if (vertices.size() <= 0x10000)
+		{
+			shortIndices.assign(indices.begin(), indices.end());
+			indexData = &shortIndices[0];
+			indexSize = sizeof(uint16);
+		}
+
+		MeshData data = {
+			FF_VERTEX_POSITION | FF_VERTEX_NORMAL | FF_VERTEX_TEXTURE0,
+			(uint32)vertices.size(), &vertices[0],
+			indexSize, (uint32)indices.size(), indexData,
+			0, NULL
+		};
+		mesh.Create(data, true);
+	}
 
-		// define the Vertex/UV pointer informatin
-		GL_DEBUG(glVertexAttribPointer(FF_ATTRIBUTE_VERTEX, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*)0));
-		GL_DEBUG(glVertexAttribPointer(FF_ATTRIBUTE_NORMAL, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*)0));
-		GL_DEBUG(glVertexAttribPointer(FF_ATTRIBUTE_TEXTURE0, 2, GL_FLOAT, GL_FALSE, 0, (GLvoid*)0));
 
-		// draw the primitive
-		GL_DEBUG(glDrawArrays(GL_TRIANGLES, 0, 36));
+// create the sphere, a ring of slices + 1 vertices for each stack so the
+// texture seam gets its own column
+
+	void UVSphere::Create(float radius, int slices, int stacks)
+	{
+		slices = std::max(slices, 3);
+		stacks = std::max(stacks, 2);
+
+		vector<GridVertex> vertices((stacks + 1) * (slices + 1));
+		for (int i = 0; i <= stacks; ++i)
+		{
+			float rho = (float)FF_PI * i / stacks;
+			for (int j = 0; j <= slices; ++j)
+			{
+				float theta = 2.0f * (float)FF_PI * j / slices;
+
+				GridVertex & vertex = vertices[i * (slices + 1) + j];
+				vertex.normal = vec3(-std::sin(theta) * std::sin(rho), std::cos(theta) * std::sin(rho), -std::cos(rho));
+				vertex.position = vertex.normal * radius;
+				vertex.texcoord = vec2((float)j / slices, (float)i / stacks);
+			}
+		}
+
+		create_grid(mesh, vertices, stacks, slices);
+	}
 
-		// disable to be clean
-		GL_DEBUG(glDisableVertexAttribArray(FF_ATTRIBUTE_VERTEX));
-		GL_DEBUG(glDisableVertexAttribArray(FF_ATTRIBUTE_NORMAL));
-		GL_DEBUG(glDisableVertexAttribArray(FF_ATTRIBUTE_TEXTURE0));
 
-		// and unbind VAO and its parent buffer object
-		GL_DEBUG(glBindBuffer(GL_ARRAY_BUFFER, 0));
-		GL_DEBUG(glBindVertexArray(0));
+// pass the draw call to OpenGL
+
+	void UVSphere::Render()
+	{
+		mesh.Draw();
+	}
+
+
+// create the torus, the same grid wrapped around the ring and the tube
+
+	void Torus::Create(float majorRadius, float minorRadius, int majorCount, int minorCount)
+	{
+		majorCount = std::max(majorCount, 3);
+		minorCount = std::max(minorCount, 3);
+
+		vector<GridVertex> vertices((minorCount + 1) * (majorCount + 1));
+		for (int i = 0; i <= minorCount; ++i)
+		{
+			float phi = 2.0f * (float)FF_PI * i / minorCount;
+			for (int j = 0; j <= majorCount; ++j)
+			{
+				float theta = 2.0f * (float)FF_PI * j / majorCount;
+				vec3 ring(std::cos(theta), std::sin(theta), 0.0f);
+
+				GridVertex & vertex = vertices[i * (majorCount + 1) + j];
+				vertex.normal = ring * std::cos(phi) + vec3(0.0f, 0.0f, std::sin(phi));
+				vertex.position = ring * majorRadius + vertex.normal * minorRadius;
+				vertex.texcoord = vec2((float)j / majorCount, (float)i / minorCount);
+			}
+		}
+
+		create_grid(mesh, vertices, minorCount, majorCount);
+	}
+
+
+// pass the draw call to OpenGL
+
+	void Torus::Render()
+	{
+		mesh.Draw();
 	}
 
 } // exiting namespace ff
@@ -3,6 +3,7 @@
 
 #include <firefly/opengl.hpp>
 #include <firefly/common.hpp>
+#include <firefly/graphics/mesh.hpp>
 
 ////////////////////////////////////////////////////////////////////////
 
@@ -18,9 +19,11 @@ namespace ff {
 		virtual void Create(float size) = 0;
 		virtual void Render() = 0;
 
+		void Delete() { mesh.Delete(); }
+		Mesh & GetMesh() { return mesh; }
+
 	protected:
-		GLuint vbo;
-		GLuint vao;
+		Mesh mesh;
 	};
 
 
@@ -34,11 +37,35 @@ namespace ff {
 
 		virtual void Create(float size);
 		virtual void Render();
+	};
+
+
+// sphere around the z axis, slices around it and stacks from pole to
+// pole. Optimised for the vertex cache when created.
+
+	class UVSphere : public Primitive
+	{
+	public:
+		UVSphere() {}
+		~UVSphere() {}
+
+		virtual void Create(float size) { Create(size, 32, 16); }
+		void Create(float radius, int slices, int stacks);
+		virtual void Render();
+	};
+
+
+// torus around the z axis, optimised for the vertex cache when created
 
-	private:
-		GLuint vertSize;
-		GLuint normalSize;
-		GLuint textureSize;
+	class Torus : public Primitive
+	{
+	public:
+		Torus() {}
+		~Torus() {}
+
+		virtual void Create(float size) { Create(size, size * 0.25f, 48, 24); }
+		void Create(float majorRadius, float minorRadius, int majorCount, int minorCount);
+		virtual void Render();
 	};
 
 } // exiting namespace ff
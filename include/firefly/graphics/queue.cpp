@@ -0,0 +1,239 @@
+#include <firefly/graphics/queue.hpp>
+#include <firefly/graphics/shader.hpp>
+#include <firefly/graphics/state.hpp>
+#include <firefly/debug/gl_debug.hpp>
+#include <firefly/debug/log.hpp>
+#include <cstring>
+#include <algorithm>
+
+#define FF_QUEUE_LAYER_BITS    4
+#define FF_QUEUE_PROGRAM_BITS  12
+#define FF_QUEUE_MATERIAL_BITS 24
+#define FF_QUEUE_DEPTH_BITS    24
+
+////////////////////////////////////////////////////////////////////////
+
+namespace ff {
+
+// positive floats order the same as their bits, so the top bits of the
+// float make a depth key without knowing the depth range
+
+	static uint64 depth_bits(float depth)
+	{
+		if (!(depth > 0.0f))
+			return 0;
+
+		uint32 bits;
+		memcpy(&bits, &depth, sizeof(bits));
+		return bits >> (32 - FF_QUEUE_DEPTH_BITS);
+	}
+
+
+// size of one index, for turning a first index into a buffer offset
+
+	static size_t index_bytes(GLenum type)
+	{
+		switch (type)
+		{
+		case GL_UNSIGNED_INT:   return 4;
+		case GL_UNSIGNED_SHORT: return 2;
+		default:                return 1;
+		}
+	}
+
+
+// mark a layer as transparent (back to front) or opaque (state first)
+
+	void RenderQueue::SetBackToFront(uint32 layer, bool enable)
+	{
+		if (layer >= FF_QUEUE_LAYERS)
+		{
+			g_Log.write(LOG_WARNING, "RenderQueue > layer %u out of range.", layer);
+			return;
+		}
+
+		if (enable)
+			m_backToFront |= (1u << layer);
+		else
+			m_backToFront &= ~(1u << layer);
+	}
+
+
+// pack the state of a draw into its sort key
+
+	uint64 RenderQueue::MakeKey(uint32 layer, uint32 program, uint32 material, float depth) const
+	{
+		const uint64 programMask  = (1ull << FF_QUEUE_PROGRAM_BITS) - 1;
+		const uint64 materialMask = (1ull << FF_QUEUE_MATERIAL_BITS) - 1;
+		const uint64 depthMask    = (1ull << FF_QUEUE_DEPTH_BITS) - 1;
+
+		uint64 key = (uint64)(layer & (FF_QUEUE_LAYERS - 1)) << (64 - FF_QUEUE_LAYER_BITS);
+		uint64 z = depth_bits(depth);
+
+		if (m_backToFront & (1u << (layer & (FF_QUEUE_LAYERS - 1))))
+		{
+			// farthest first, then state
+			key |= ((~z) & depthMask) << (FF_QUEUE_PROGRAM_BITS + FF_QUEUE_MATERIAL_BITS);
+			key |= (program & programMask) << FF_QUEUE_MATERIAL_BITS;
+			key |= (material & materialMask);
+		}
+		else
+		{
+			// state first, nearest first within the same state
+			key |= (program & programMask) << (FF_QUEUE_MATERIAL_BITS + FF_QUEUE_DEPTH_BITS);
+			key |= (material & materialMask) << FF_QUEUE_DEPTH_BITS;
+			key |= z;
+		}
+
+		return key;
+	}
+
+
+// add a draw for this frame
+
+	void RenderQueue::Submit(uint32 layer, uint32 material, float depth, const RenderCommand & command)
+	{
+		if (m_commands.capacity() == 0)
+		{
+			m_commands.reserve(FF_QUEUE_CAPACITY);
+			m_entries.reserve(FF_QUEUE_CAPACITY);
+		}
+
+		SortEntry entry = { MakeKey(layer, command.program, material, depth), (uint32)m_commands.size() };
+		m_entries.push_back(entry);
+		m_commands.push_back(command);
+	}
+
+
+// forget this frame's draws, keeping the memory
+
+	void RenderQueue::Clear()
+	{
+		m_commands.clear();
+		m_entries.clear();
+	}
+
+
+// least significant digit radix sort on the keys, a byte at a time. Bytes
+// every key shares (most of the layer and program bits, usually) are
+// skipped, so a frame typically only pays for a few passes
+
+	void RenderQueue::sort()
+	{
+		uint32 count = (uint32)m_entries.size();
+		if (count < 2)
+			return;
+
+		m_scratch.resize(count);
+		SortEntry * src = &m_entries[0];
+		SortEntry * dst = &m_scratch[0];
+
+		for (uint32 shift = 0; shift < 64; shift += 8)
+		{
+			uint32 histogram[256] = { 0 };
+			for (uint32 i = 0; i < count; ++i)
+				++histogram[(src[i].key >> shift) & 0xff];
+
+			if (histogram[(src[0].key >> shift) & 0xff] == count)
+				continue;
+
+			uint32 offset = 0;
+			for (uint32 b = 0; b < 256; ++b)
+			{
+				uint32 n = histogram[b];
+				histogram[b] = offset;
+				offset += n;
+			}
+
+			for (uint32 i = 0; i < count; ++i)
+				dst[histogram[(src[i].key >> shift) & 0xff]++] = src[i];
+
+			std::swap(src, dst);
+		}
+
+		if (src != &m_entries[0])
+			memcpy(&m_entries[0], src, count * sizeof(SortEntry));
+	}
+
+
+// draw everything in key order, only binding what changed since the
+// previous draw
+
+	void RenderQueue::Execute()
+	{
+		memset(&m_stats, 0, sizeof(m_stats));
+		sort();
+
+		// the shader manager has to know about program changes for its
+		// uniform setters, start with whatever the first draw uses
+		GLuint program = FF_STATE_UNKNOWN;
+
+		for (size_t i = 0; i < m_entries.size(); ++i)
+		{
+			const RenderCommand & cmd = m_commands[m_entries[i].index];
+
+			if (cmd.program != program)
+			{
+				g_Shader.UseProgram(cmd.program);
+				program = cmd.program;
+				++m_stats.programs;
+			}
+			else
+			{
+				++m_stats.skipped;
+			}
+
+			for (GLuint t = 0; t < FF_QUEUE_TEXTURES; ++t)
+			{
+				if (!cmd.textures[t])
+					continue;
+
+				if (g_GLState.BindTexture(t, cmd.textures[t]))
+					++m_stats.textures;
+				else
+					++m_stats.skipped;
+			}
+
+			if (cmd.setup)
+				cmd.setup(cmd.data);
+
+			if (cmd.draw)
+			{
+				// custom draws (GLTools batches) bind vertex arrays behind
+				// the state cache's back
+				cmd.draw(cmd.data);
+				g_GLState.InvalidateVertexArray();
+			}
+			else
+			{
+				if (g_GLState.BindVertexArray(cmd.vao))
+					++m_stats.vertexArrays;
+				else
+					++m_stats.skipped;
+
+				const GLvoid * offset = (const GLvoid *)(cmd.first * index_bytes(cmd.indexType));
+				if (cmd.indexType && cmd.instances > 1)
+				{
+					GL_DEBUG(glDrawElementsInstanced(cmd.mode, cmd.count, cmd.indexType, offset, cmd.instances));
+				}
+				else if (cmd.indexType)
+				{
+					GL_DEBUG(glDrawElements(cmd.mode, cmd.count, cmd.indexType, offset));
+				}
+				else if (cmd.instances > 1)
+				{
+					GL_DEBUG(glDrawArraysInstanced(cmd.mode, cmd.first, cmd.count, cmd.instances));
+				}
+				else
+				{
+					GL_DEBUG(glDrawArrays(cmd.mode, cmd.first, cmd.count));
+				}
+			}
+
+			++m_stats.draws;
+		}
+	}
+
+} // exiting namespace ff
+
+////////////////////////////////////////////////////////////////////////
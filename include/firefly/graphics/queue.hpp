@@ -0,0 +1,103 @@
+#ifndef FIREFLY_QUEUE_HPP
+#define FIREFLY_QUEUE_HPP
+
+#include <firefly/opengl.hpp>
+#include <firefly/common.hpp>
+
+#define FF_QUEUE_CAPACITY 1024 // initial number of draws
+#define FF_QUEUE_TEXTURES 4    // texture units a draw can bind
+#define FF_QUEUE_LAYERS   16   // layers are drawn in order, 0 first
+
+////////////////////////////////////////////////////////////////////////
+
+namespace ff {
+
+// per draw hooks, called with the draw's program and textures bound
+
+	typedef void (*RenderFunction)(void * data);
+
+
+// everything needed to issue one draw
+
+	struct RenderCommand
+	{
+		GLuint         program;
+		GLuint         textures[FF_QUEUE_TEXTURES]; // per unit, 0 leaves the unit alone
+		GLuint         vao;
+		GLenum         mode;
+		GLenum         indexType;  // 0 for glDrawArrays
+		GLint          first;      // first vertex, or first index
+		GLsizei        count;
+		GLsizei        instances;  // more than 1 draws instanced
+		RenderFunction setup;      // optional, sets per draw uniforms
+		RenderFunction draw;       // optional, replaces the glDraw* call
+		void *         data;       // passed to setup and draw
+	};
+
+
+// what executing the queue cost, and what it saved
+
+	struct RenderQueueStats
+	{
+		uint32 draws;
+		uint32 programs;     // glUseProgram calls
+		uint32 textures;     // glBindTexture calls
+		uint32 vertexArrays; // glBindVertexArray calls
+		uint32 skipped;      // binds left out because the state was already set
+	};
+
+
+// draws are submitted in any order as a 64 bit sort key plus a command,
+// then sorted and executed with redundant binds left out (through
+// g_GLState, so state carries over between frames). Keys are laid
+// out most significant first as
+//
+//   layer:4 | program:12 | material:24 | depth:24      front to back
+//   layer:4 | depth:24   | program:12  | material:24   back to front
+//
+// so opaque layers group by state and transparent ones sort by distance
+
+	class RenderQueue
+	{
+	public:
+		RenderQueue() : m_backToFront(0), m_stats() { }
+		~RenderQueue() { }
+
+		// transparent layers are drawn back to front
+		void SetBackToFront(uint32 layer, bool enable);
+
+		// material is any id for the textures a draw binds, depth is the view
+		// space distance (only the ordering matters)
+		void Submit(uint32 layer, uint32 material, float depth, const RenderCommand & command);
+		void Clear();
+
+		// sorts and draws everything submitted, leaves the queue intact
+		void Execute();
+
+		uint32 GetCount() const { return (uint32)m_commands.size(); }
+		const RenderQueueStats & GetStats() const { return m_stats; }
+
+		// builds a key without submitting, for custom ordering
+		uint64 MakeKey(uint32 layer, uint32 program, uint32 material, float depth) const;
+
+	private:
+		struct SortEntry
+		{
+			uint64 key;
+			uint32 index;
+		};
+
+		void sort();
+
+		vector<RenderCommand> m_commands;
+		vector<SortEntry>     m_entries;
+		vector<SortEntry>     m_scratch; // radix sort ping-pong buffer
+		uint32                m_backToFront; // one bit per layer
+		RenderQueueStats      m_stats;
+	};
+
+} // exiting namespace ff
+
+////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -7,6 +7,12 @@
 #include <firefly/graphics/shader.hpp>
 #include <firefly/graphics/texture.hpp>
 #include <firefly/graphics/mesh.hpp>
+#include <firefly/graphics/optimizer.hpp>
+#include <firefly/graphics/instance.hpp>
+#include <firefly/graphics/queue.hpp>
+#include <firefly/graphics/state.hpp>
+#include <firefly/graphics/bounds.hpp>
+#include <firefly/graphics/bvh.hpp>
 #include <firefly/graphics/primitive.hpp>
 
 ////////////////////////////////////////////////////////////////////////
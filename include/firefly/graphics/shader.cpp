@@ -1,11 +1,53 @@
 #include <firefly/graphics/shader.hpp>
+#include <firefly/graphics/state.hpp>
 #include <firefly/debug/gl_debug.hpp>
 #include <firefly/debug/log.hpp>
 #include <fstream>
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <algorithm>
 
 using std::ifstream;
+using std::ofstream;
 using std::ios;
 
+// platform-specific headers
+#ifdef WIN32
+    #include <direct.h>
+    #include <process.h>
+    #define ff_mkdir(path) _mkdir(path)
+    #define ff_getpid() _getpid()
+#else
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #define ff_mkdir(path) mkdir(path, 0755)
+    #define ff_getpid() getpid()
+#endif
+
+#ifdef __linux__
+    #include <sys/inotify.h>
+    #include <poll.h>
+    #include <unistd.h>
+#endif
+
+// GL_KHR_parallel_shader_compile, newer than the bundled glew
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+    #define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+    #define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+typedef void (GLAPIENTRY * PFNFFMAXSHADERCOMPILERTHREADSPROC)(GLuint count);
+
+// 32-bit FNV-1a of a uniform or attribute name
+static ff::uint32 hash_name(const char * name, size_t length)
+{
+    ff::uint32 hash = 2166136261U;
+    for (size_t i = 0; i < length; ++i)
+        hash = (hash ^ (ff::ubyte)name[i]) * 16777619U;
+    return hash;
+}
+
 ////////////////////////////////////////////////////////////////////////
 
 namespace ff {
@@ -15,71 +57,405 @@ namespace ff {
     ShaderMgr GlobalShaderMgr;
 
 
+// header written in front of each cached program binary
+
+	struct ProgramBinaryHeader
+	{
+		uint32 magic;
+		uint32 format;
+		uint32 length;
+	};
+
+#define FF_SHADER_CACHE_MAGIC 0x42504646 // 'FFPB'
+
+
+// queries driver for program binary support
+
+	void ShaderMgr::Init()
+	{
+		GLint formats = 0;
+		if (GLEW_ARB_get_program_binary)
+		{
+			GL_DEBUG(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats));
+		}
+
+		// binaries are only valid for the driver that created them
+		binarySupported = formats > 0;
+		m_driver = string((const char *)glGetString(GL_VENDOR)) + "|" +
+		           (const char *)glGetString(GL_RENDERER) + "|" +
+		           (const char *)glGetString(GL_VERSION);
+
+		g_Log.write(LOG_CONFIG, "ShaderMgr > program binaries %s.",
+		            binarySupported ? "supported" : "NOT supported");
+
+		// let the driver compile on as many threads as it likes
+		PFNFFMAXSHADERCOMPILERTHREADSPROC maxThreads = NULL;
+		if (glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+			maxThreads = (PFNFFMAXSHADERCOMPILERTHREADSPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+		else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile"))
+			maxThreads = (PFNFFMAXSHADERCOMPILERTHREADSPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+
+		parallelSupported = maxThreads != NULL;
+		if (parallelSupported)
+		{
+			GL_DEBUG(maxThreads(0xFFFFFFFF));
+		}
+
+		g_Log.write(LOG_CONFIG, "ShaderMgr > parallel shader compile %s.",
+		            parallelSupported ? "supported" : "NOT supported");
+
+		if (binarySupported && !m_cachePath.empty())
+			ff_mkdir(m_cachePath.c_str());
+	}
+
+
 // create a shader program from specified vert/fragment shaders
 
 	GLuint ShaderMgr::CreateProgram(string vert, string frag, ...) 
 	{
-		// generate handles
-		GLuint hProgram = 0;
-		GLuint hVert = GL_DEBUG(glCreateShader(GL_VERTEX_SHADER));
-		GLuint hFrag = GL_DEBUG(glCreateShader(GL_FRAGMENT_SHADER));
+		// collect the attribute locations
+		va_list args;
+		va_start(args, frag);
 
-		// load shaders
-		if (!LoadShader(hVert, vert) ||
-		    !LoadShader(hFrag, frag)) 
+		vector<pair<int, string>> bindings;
+		int argCount = va_arg(args, int);
+		for (int i = 0; i < argCount; ++i) 
 		{
-			GL_DEBUG(glDeleteShader(hVert));
-			GL_DEBUG(glDeleteShader(hFrag));
+			int index = va_arg(args, int);
+			char * arg = va_arg(args, char *);
+			bindings.push_back(make_pair(index, string(arg)));
+		}
+
+		va_end(args);
+
+		ShaderRequest req;
+		if (!submit_request(vert, frag, bindings, req))
 			return 0;
+
+		// inside a batch the status checks wait for EndBatch()
+		if (m_batching)
+		{
+			m_requests.push_back(req);
+			return req.program;
+		}
+
+		return finish_request(req) ? req.program : 0;
+	}
+
+
+// starts a batch, programs created from now on are compiled together
+
+	void ShaderMgr::BeginBatch()
+	{
+		assert(!m_batching);
+		m_batching = true;
+	}
+
+
+// checks every program in the batch, deleting the ones that failed
+
+	bool ShaderMgr::EndBatch()
+	{
+		assert(m_batching);
+		m_batching = false;
+
+		bool success = true;
+		while (!m_requests.empty())
+		{
+			// take whichever program the driver has finished first, and
+			// block on the oldest one if none of them are done yet
+			size_t next = 0;
+			for (size_t i = 0; i < m_requests.size(); ++i)
+			{
+				if (parallelSupported && is_complete(m_requests[i]))
+				{
+					next = i;
+					break;
+				}
+			}
+
+			if (!finish_request(m_requests[next]))
+				success = false;
+			m_requests.erase(m_requests.begin() + next);
 		}
 
-		// compile shaders
-		GL_DEBUG(glCompileShader(hVert));
-		GL_DEBUG(glCompileShader(hFrag));
-		if (!CheckShaderCompile(hVert, vert) ||
-		    !CheckShaderCompile(hFrag, frag)) 
+		return success;
+	}
+
+
+// swaps in reloaded programs and starts reloading any that changed,
+// call once per frame on the GL thread before rendering
+
+	void ShaderMgr::Update()
+	{
+		// reloads the driver is still compiling wait for the next frame
+		for (size_t i = 0; i < m_reloads.size(); )
 		{
-			GL_DEBUG(glDeleteShader(hVert));
-			GL_DEBUG(glDeleteShader(hFrag));
-			return 0;
+			if (parallelSupported && !is_complete(m_reloads[i]))
+			{
+				++i;
+				continue;
+			}
+
+			finish_request(m_reloads[i]);
+			m_reloads.erase(m_reloads.begin() + i);
 		}
 
-		// create the shader program
-		hProgram = GL_DEBUG(glCreateProgram());
-		GL_DEBUG(glAttachShader(hProgram, hVert));
-		GL_DEBUG(glAttachShader(hProgram, hFrag));
+		vector<string> changed;
+		{
+			std::lock_guard<std::mutex> lock(m_changedLock);
+			changed.swap(m_changed);
+		}
 
-		// bind attributes to their locations
-		va_list attributes;
-		va_start(attributes, frag);
+		// resubmit every program built from one of the changed files
+		vector<string> deferred;
+		for (auto it = changed.begin(); it != changed.end(); ++it)
+		{
+			for (auto prog = m_programs.begin(); prog != m_programs.end(); ++prog)
+			{
+				const ShaderProgram & info = prog->second;
+				if (info.vertFile != *it && info.fragFile != *it)
+					continue;
+
+				// one reload per program at a time, try again next frame
+				bool pending = false;
+				for (auto reload = m_reloads.begin(); reload != m_reloads.end(); ++reload)
+					pending |= (reload->handle == prog->first);
+				if (pending)
+				{
+					deferred.push_back(*it);
+					continue;
+				}
+
+				ShaderRequest req;
+				if (submit_request(info.vertFile, info.fragFile, info.bindings, req))
+				{
+					req.handle = prog->first;
+					m_reloads.push_back(req);
+				}
+			}
+		}
 
-		char * arg;
-		int argCount = va_arg(attributes, int);
-		for (int i = 0; i < argCount; ++i) 
+		if (!deferred.empty())
 		{
-			int index = va_arg(attributes, int);
-			arg = va_arg(attributes, char *);
-			GL_DEBUG(glBindAttribLocation(hProgram, index, arg));
+			std::lock_guard<std::mutex> lock(m_changedLock);
+			m_changed.insert(m_changed.end(), deferred.begin(), deferred.end());
 		}
+	}
 
-		va_end(attributes);
 
-		// finish linking the program, and clean up shaders
-		GL_DEBUG(glLinkProgram(hProgram));
-		GL_DEBUG(glDeleteShader(hVert));
-		GL_DEBUG(glDeleteShader(hFrag));
+// starts a thread watching FF_SHADER_PATH for modified files
 
-		if (!CheckProgramLink(hProgram))
+	bool ShaderMgr::StartWatching()
+	{
+#ifdef __linux__
+		if (m_watching)
+			return true;
+
+		m_watchFd = inotify_init();
+		if (m_watchFd < 0 || inotify_add_watch(m_watchFd, FF_SHADER_PATH, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
 		{
-			GL_DEBUG(glDeleteProgram(hProgram));
-			return 0;
-		}		
+			g_Log.write(LOG_ERROR, "ShaderMgr::StartWatching > unable to watch '%s'!", FF_SHADER_PATH);
+			if (m_watchFd >= 0)
+				close(m_watchFd);
+			m_watchFd = -1;
+			return false;
+		}
+
+		m_watching = true;
+		m_watcher = std::thread(&ShaderMgr::watch_loop, this);
+		g_Log.write(LOG_CONFIG, "ShaderMgr > watching '%s' for changes.", FF_SHADER_PATH);
+		return true;
+#else
+		g_Log.write(LOG_CONFIG, "ShaderMgr > shader reloading NOT supported.");
+		return false;
+#endif
+	}
 
-		g_Log.write(LOG_LOAD, "Shader program created > [%d] ('%s, '%s')",
-								hProgram, vert.c_str(), frag.c_str());
 
-		m_shaders.push_back(hProgram);
-		return hProgram;
+// stops the watcher thread
+
+	void ShaderMgr::StopWatching()
+	{
+		if (!m_watching)
+			return;
+
+		m_watching = false;
+		m_watcher.join();
+
+#ifdef __linux__
+		close(m_watchFd);
+		m_watchFd = -1;
+#endif
+	}
+
+
+// watcher thread, queues the name of every file written in FF_SHADER_PATH
+// so Update() can pick them up at the start of the next frame
+
+	void ShaderMgr::watch_loop()
+	{
+#ifdef __linux__
+		uint32 buffer[1024]; // aligned for inotify_event
+		while (m_watching)
+		{
+			// wake up regularly to notice StopWatching()
+			pollfd fd = { m_watchFd, POLLIN, 0 };
+			if (poll(&fd, 1, 100) <= 0)
+				continue;
+
+			ssize_t size = read(m_watchFd, buffer, sizeof(buffer));
+			if (size <= 0)
+				continue;
+
+			std::lock_guard<std::mutex> lock(m_changedLock);
+			const char * data = (const char *)buffer;
+			for (ssize_t offset = 0; offset < size; )
+			{
+				const inotify_event * event = (const inotify_event *)(data + offset);
+				offset += sizeof(inotify_event) + event->len;
+				if (event->len == 0)
+					continue;
+
+				// editors tend to write a file more than once per save
+				string name(event->name);
+				if (std::find(m_changed.begin(), m_changed.end(), name) == m_changed.end())
+					m_changed.push_back(name);
+			}
+		}
+#endif
+	}
+
+
+// looks up a reflected variable by name in a table sorted by hash
+
+	static bool variable_less(const ShaderVariable & var, uint32 hash)
+	{
+		return var.hash < hash;
+	}
+
+	static const ShaderVariable * find_variable(const vector<ShaderVariable> & table, const char * name)
+	{
+		uint32 hash = hash_name(name, strlen(name));
+		auto it = std::lower_bound(table.begin(), table.end(), hash, variable_less);
+		return (it != table.end() && it->hash == hash) ? &*it : NULL;
+	}
+
+
+// reflection queries, no driver round trip
+
+	GLint ShaderMgr::GetUniformLocation(GLuint program, const char * name) const
+	{
+		const ShaderProgram * info = GetProgramInfo(program);
+		const ShaderVariable * var = info ? find_variable(info->uniforms, name) : NULL;
+		return var ? var->location : -1;
+	}
+
+	GLint ShaderMgr::GetAttribLocation(GLuint program, const char * name) const
+	{
+		const ShaderProgram * info = GetProgramInfo(program);
+		const ShaderVariable * var = info ? find_variable(info->attributes, name) : NULL;
+		return var ? var->location : -1;
+	}
+
+	GLuint ShaderMgr::GetUniformBlockIndex(GLuint program, const char * name) const
+	{
+		const ShaderProgram * info = GetProgramInfo(program);
+		const ShaderVariable * var = info ? find_variable(info->blocks, name) : NULL;
+		return var ? (GLuint)var->location : GL_INVALID_INDEX;
+	}
+
+	const ShaderProgram * ShaderMgr::GetProgramInfo(GLuint program) const
+	{
+		auto it = m_programs.find(program);
+		return it != m_programs.end() ? &it->second : NULL;
+	}
+
+
+// binds a program, the uniform setters apply to it until the next call
+
+	void ShaderMgr::UseProgram(GLuint program)
+	{
+		// a reloaded program keeps its original handle
+		auto it = m_programs.find(program);
+		m_current = (it != m_programs.end()) ? &it->second : NULL;
+		g_GLState.UseProgram(m_current ? m_current->program : program);
+	}
+
+
+// typed uniform setters, skip the upload when nothing has changed
+
+	void ShaderMgr::SetUniform(const char * name, GLint value)
+	{
+		ShaderVariable * var = changed_uniform(name, GL_INT, &value, sizeof(value));
+		if (var)
+		{
+			GL_DEBUG(glUniform1i(var->location, value));
+		}
+	}
+
+	void ShaderMgr::SetUniform(const char * name, GLfloat value)
+	{
+		ShaderVariable * var = changed_uniform(name, GL_FLOAT, &value, sizeof(value));
+		if (var)
+		{
+			GL_DEBUG(glUniform1f(var->location, value));
+		}
+	}
+
+	void ShaderMgr::SetUniform(const char * name, const vec2 & value)
+	{
+		ShaderVariable * var = changed_uniform(name, GL_FLOAT_VEC2, &value[0], sizeof(vec2));
+		if (var)
+		{
+			GL_DEBUG(glUniform2fv(var->location, 1, &value[0]));
+		}
+	}
+
+	void ShaderMgr::SetUniform(const char * name, const vec3 & value)
+	{
+		ShaderVariable * var = changed_uniform(name, GL_FLOAT_VEC3, &value[0], sizeof(vec3));
+		if (var)
+		{
+			GL_DEBUG(glUniform3fv(var->location, 1, &value[0]));
+		}
+	}
+
+	void ShaderMgr::SetUniform(const char * name, const vec4 & value)
+	{
+		ShaderVariable * var = changed_uniform(name, GL_FLOAT_VEC4, &value[0], sizeof(vec4));
+		if (var)
+		{
+			GL_DEBUG(glUniform4fv(var->location, 1, &value[0]));
+		}
+	}
+
+	void ShaderMgr::SetUniform(const char * name, const mat3 & value)
+	{
+		SetUniformMatrix3(name, value_ptr(value));
+	}
+
+	void ShaderMgr::SetUniform(const char * name, const mat4 & value)
+	{
+		SetUniformMatrix4(name, value_ptr(value));
+	}
+
+	void ShaderMgr::SetUniformMatrix3(const char * name, const GLfloat * value)
+	{
+		ShaderVariable * var = changed_uniform(name, GL_FLOAT_MAT3, value, 9 * sizeof(GLfloat));
+		if (var)
+		{
+			GL_DEBUG(glUniformMatrix3fv(var->location, 1, GL_FALSE, value));
+		}
+	}
+
+	void ShaderMgr::SetUniformMatrix4(const char * name, const GLfloat * value)
+	{
+		ShaderVariable * var = changed_uniform(name, GL_FLOAT_MAT4, value, 16 * sizeof(GLfloat));
+		if (var)
+		{
+			GL_DEBUG(glUniformMatrix4fv(var->location, 1, GL_FALSE, value));
+		}
 	}
 
 
@@ -87,43 +463,379 @@ namespace ff {
 
 	void ShaderMgr::DeletePrograms()
 	{
+		// drop any reloads still in flight
+		for (auto it = m_reloads.begin(); it != m_reloads.end(); ++it)
+			discard_request(*it);
+		m_reloads.clear();
+
 		if (m_shaders.empty())
             return;
 
         auto it = m_shaders.begin(), end = m_shaders.end();
         for (; it != end; ++it)
         {
-            GL_DEBUG(glUseProgram(*it));
-            GL_DEBUG(glDeleteProgram(*it));
+			// reloaded programs live on under their original handle
+			GLuint live = m_programs[*it].program;
+			if (live != *it)
+				g_GLState.DeleteProgram(live);
+
+            g_GLState.DeleteProgram(*it);
         }
 
         m_shaders.clear();
+		m_programs.clear();
+		m_current = NULL;
+	}
+
+
+// reads both sources and hands the compile and link to the driver
+// without waiting on either, cached binaries come back already linked
+
+	bool ShaderMgr::submit_request(const string & vert, const string & frag,
+	                               const vector<pair<int, string>> & bindings,
+	                               ShaderRequest & req)
+	{
+		// read in both sources
+		string vertSrc, fragSrc;
+		if (!LoadShader(vert, vertSrc) ||
+		    !LoadShader(frag, fragSrc))
+			return false;
+
+		req.program = req.vert = req.frag = req.handle = 0;
+		req.vertFile = vert;
+		req.fragFile = frag;
+		req.bindings = bindings;
+		req.cacheFile.clear();
+		req.cached = false;
+
+		// skip compiling if this driver has linked the same program before
+		if (binarySupported && !m_cachePath.empty())
+		{
+			req.cacheFile = cache_file(vertSrc, fragSrc, bindings);
+			req.program = load_binary(req.cacheFile);
+			if (req.program)
+			{
+				req.cached = true;
+				return true;
+			}
+		}
+
+		req.vert = GL_DEBUG(glCreateShader(GL_VERTEX_SHADER));
+		req.frag = GL_DEBUG(glCreateShader(GL_FRAGMENT_SHADER));
+
+		const GLchar * src = vertSrc.c_str();
+		GLint srcSize = (GLint)vertSrc.size();
+		GL_DEBUG(glShaderSource(req.vert, 1, &src, &srcSize));
+		src = fragSrc.c_str();
+		srcSize = (GLint)fragSrc.size();
+		GL_DEBUG(glShaderSource(req.frag, 1, &src, &srcSize));
+
+		GL_DEBUG(glCompileShader(req.vert));
+		GL_DEBUG(glCompileShader(req.frag));
+
+		// create the shader program
+		req.program = GL_DEBUG(glCreateProgram());
+		GL_DEBUG(glAttachShader(req.program, req.vert));
+		GL_DEBUG(glAttachShader(req.program, req.frag));
+
+		// bind attributes to their locations
+		auto it = bindings.begin(), end = bindings.end();
+		for (; it != end; ++it)
+		{
+			GL_DEBUG(glBindAttribLocation(req.program, it->first, it->second.c_str()));
+		}
+
+		// ask the driver to keep the binary around so it can be cached
+		if (!req.cacheFile.empty())
+		{
+			GL_DEBUG(glProgramParameteri(req.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+		}
+
+		GL_DEBUG(glLinkProgram(req.program));
+		return true;
+	}
+
+
+// true once the driver has finished compiling and linking a request
+
+	bool ShaderMgr::is_complete(const ShaderRequest & req) const
+	{
+		if (req.cached)
+			return true;
+
+		GLint done = GL_FALSE;
+		GL_DEBUG(glGetProgramiv(req.program, GL_COMPLETION_STATUS_KHR, &done));
+		return done == GL_TRUE;
+	}
+
+
+// checks a submitted program, cleans up its shaders and caches its binary,
+// a reload that fails leaves the old program in place
+
+	bool ShaderMgr::finish_request(const ShaderRequest & req)
+	{
+		bool linked = req.cached ||
+		              (CheckShaderCompile(req.vert, req.vertFile) &&
+		               CheckShaderCompile(req.frag, req.fragFile) &&
+		               CheckProgramLink(req.program));
+
+		if (!linked)
+		{
+			if (req.handle)
+				g_Log.write(LOG_WARNING, "ShaderMgr::Update > reload of [%d] failed,"
+				            " keeping the old program.", req.handle);
+			discard_request(req);
+			return false;
+		}
+
+		if (!req.cached)
+		{
+			GL_DEBUG(glDeleteShader(req.vert));
+			GL_DEBUG(glDeleteShader(req.frag));
+			if (!req.cacheFile.empty())
+				save_binary(req.program, req.cacheFile);
+		}
+
+		// swap the new program in under the original handle
+		if (req.handle)
+		{
+			ShaderProgram & info = m_programs[req.handle];
+			if (info.program != req.handle)
+				g_GLState.DeleteProgram(info.program);
+			info.program = req.program;
+			reflect(info);
+
+			g_Log.write(LOG_LOAD, "Shader program reloaded > [%d] ('%s, '%s')%s",
+									req.handle, req.vertFile.c_str(), req.fragFile.c_str(),
+									req.cached ? " [cached]" : "");
+			return true;
+		}
+
+		ShaderProgram & info = m_programs[req.program];
+		info.program = req.program;
+		info.vertFile = req.vertFile;
+		info.fragFile = req.fragFile;
+		info.bindings = req.bindings;
+		reflect(info);
+
+		g_Log.write(LOG_LOAD, "Shader program created > [%d] ('%s, '%s')%s",
+								req.program, req.vertFile.c_str(), req.fragFile.c_str(),
+								req.cached ? " [cached]" : "");
+
+		m_shaders.push_back(req.program);
+		return true;
+	}
+
+
+// deletes everything a request created
+
+	void ShaderMgr::discard_request(const ShaderRequest & req)
+	{
+		if (!req.cached)
+		{
+			GL_DEBUG(glDeleteShader(req.vert));
+			GL_DEBUG(glDeleteShader(req.frag));
+		}
+		GL_DEBUG(glDeleteProgram(req.program));
+	}
+
+
+// bytes needed to shadow one element of a uniform, samplers are ints
+
+	static uint32 uniform_bytes(GLenum type)
+	{
+		switch (type)
+		{
+		case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_BOOL_VEC2:
+			return 8;
+		case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_BOOL_VEC3:
+			return 12;
+		case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_BOOL_VEC4: case GL_FLOAT_MAT2:
+			return 16;
+		case GL_FLOAT_MAT3:
+			return 36;
+		case GL_FLOAT_MAT4:
+			return 64;
+		default:
+			return 4;
+		}
+	}
+
+	// whether a setter for type can write a uniform declared as declared,
+	// glUniform1i also sets bools and samplers
+	static bool uniform_matches(GLenum type, GLenum declared)
+	{
+		if (type == declared)
+			return true;
+		if (type != GL_INT)
+			return false;
+
+		switch (declared)
+		{
+		case GL_BOOL:
+		case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+		case GL_SAMPLER_1D_SHADOW: case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_CUBE_SHADOW:
+		case GL_SAMPLER_1D_ARRAY: case GL_SAMPLER_2D_ARRAY:
+		case GL_SAMPLER_1D_ARRAY_SHADOW: case GL_SAMPLER_2D_ARRAY_SHADOW:
+		case GL_SAMPLER_2D_RECT: case GL_SAMPLER_2D_RECT_SHADOW: case GL_SAMPLER_BUFFER:
+		case GL_SAMPLER_2D_MULTISAMPLE: case GL_SAMPLER_2D_MULTISAMPLE_ARRAY:
+		case GL_INT_SAMPLER_1D: case GL_INT_SAMPLER_2D: case GL_INT_SAMPLER_3D: case GL_INT_SAMPLER_CUBE:
+		case GL_INT_SAMPLER_1D_ARRAY: case GL_INT_SAMPLER_2D_ARRAY:
+		case GL_INT_SAMPLER_2D_RECT: case GL_INT_SAMPLER_BUFFER:
+		case GL_INT_SAMPLER_2D_MULTISAMPLE: case GL_INT_SAMPLER_2D_MULTISAMPLE_ARRAY:
+		case GL_UNSIGNED_INT_SAMPLER_1D: case GL_UNSIGNED_INT_SAMPLER_2D:
+		case GL_UNSIGNED_INT_SAMPLER_3D: case GL_UNSIGNED_INT_SAMPLER_CUBE:
+		case GL_UNSIGNED_INT_SAMPLER_1D_ARRAY: case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+		case GL_UNSIGNED_INT_SAMPLER_2D_RECT: case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+		case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE: case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE_ARRAY:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	static bool variable_sort(const ShaderVariable & a, const ShaderVariable & b)
+	{
+		return a.hash < b.hash;
+	}
+
+
+// fills a table from one of the glGetActive* queries
+
+	typedef void (GLAPIENTRY * ActiveFunction)(GLuint, GLuint, GLsizei, GLsizei *, GLint *, GLenum *, GLchar *);
+
+	static void reflect_variables(GLuint program, GLenum countQuery, GLenum lengthQuery,
+	                              ActiveFunction active, bool uniforms, ShaderProgram & info)
+	{
+		GLint count = 0, maxLength = 0;
+		GL_DEBUG(glGetProgramiv(program, countQuery, &count));
+		GL_DEBUG(glGetProgramiv(program, lengthQuery, &maxLength));
+
+		vector<ShaderVariable> & table = uniforms ? info.uniforms : info.attributes;
+		vector<GLchar> name(maxLength + 1);
+		for (GLint i = 0; i < count; ++i)
+		{
+			GLsizei length = 0;
+			ShaderVariable var = { 0, -1, 0, 0, 0, 0, false };
+			GL_DEBUG(active(program, (GLuint)i, (GLsizei)name.size(), &length, &var.size, &var.type, &name[0]));
+
+			// built-ins and uniform block members have no location
+			var.location = uniforms ? glGetUniformLocation(program, &name[0])
+			                        : glGetAttribLocation(program, &name[0]);
+			if (var.location < 0)
+				continue;
+
+			// arrays are reported as "name[0]", look them up by "name"
+			if (length > 3 && strcmp(&name[length - 3], "[0]") == 0)
+				length -= 3;
+
+			var.hash = hash_name(&name[0], length);
+			if (uniforms)
+			{
+				var.bytes = uniform_bytes(var.type);
+				var.offset = (uint32)info.values.size();
+				info.values.resize(info.values.size() + var.bytes);
+			}
+			table.push_back(var);
+		}
+	}
+
+
+// reflects a linked program's uniforms, uniform blocks and attributes
+
+	void ShaderMgr::reflect(ShaderProgram & info)
+	{
+		GLuint program = info.program;
+		info.uniforms.clear();
+		info.attributes.clear();
+		info.blocks.clear();
+		info.values.clear();
+
+		reflect_variables(program, GL_ACTIVE_UNIFORMS, GL_ACTIVE_UNIFORM_MAX_LENGTH,
+		                  glGetActiveUniform, true, info);
+		reflect_variables(program, GL_ACTIVE_ATTRIBUTES, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH,
+		                  glGetActiveAttrib, false, info);
+
+		if (GLEW_ARB_uniform_buffer_object)
+		{
+			GLint count = 0, maxLength = 0;
+			GL_DEBUG(glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count));
+			GL_DEBUG(glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength));
+
+			vector<GLchar> name(maxLength + 1);
+			for (GLint i = 0; i < count; ++i)
+			{
+				GLsizei length = 0;
+				ShaderVariable var = { 0, i, 0, 0, 0, 0, false };
+				GL_DEBUG(glGetActiveUniformBlockName(program, (GLuint)i, (GLsizei)name.size(), &length, &name[0]));
+				GL_DEBUG(glGetActiveUniformBlockiv(program, (GLuint)i, GL_UNIFORM_BLOCK_DATA_SIZE, &var.size));
+				var.hash = hash_name(&name[0], length);
+				info.blocks.push_back(var);
+			}
+		}
+
+		std::sort(info.uniforms.begin(), info.uniforms.end(), variable_sort);
+		std::sort(info.attributes.begin(), info.attributes.end(), variable_sort);
+		std::sort(info.blocks.begin(), info.blocks.end(), variable_sort);
+
+		for (size_t i = 1; i < info.uniforms.size(); ++i)
+		{
+			if (info.uniforms[i].hash == info.uniforms[i - 1].hash)
+				g_Log.write(LOG_WARNING, "ShaderMgr::CreateProgram > uniform name hash"
+				            " collision in program [%d]!", program);
+		}
+	}
+
+
+// finds a uniform of the bound program, and updates its shadow copy if
+// the value is different, returns NULL when there is nothing to upload
+// or the uniform was declared with another type
+
+	ShaderVariable * ShaderMgr::changed_uniform(const char * name, GLenum type, const void * value, uint32 bytes)
+	{
+		if (!m_current)
+			return NULL;
+
+		// inactive uniforms are ignored, the same as location -1
+		ShaderVariable * var = const_cast<ShaderVariable *>(find_variable(m_current->uniforms, name));
+		if (!var)
+			return NULL;
+
+		if (!uniform_matches(type, var->type) || var->bytes != bytes)
+		{
+			g_Log.write(LOG_ERROR, "ShaderMgr::SetUniform > wrong type for '%s'!", name);
+			return NULL;
+		}
+
+		ubyte * shadow = &m_current->values[var->offset];
+		if (var->valid && memcmp(shadow, value, bytes) == 0)
+			return NULL;
+
+		memcpy(shadow, value, bytes);
+		var->valid = true;
+		return var;
 	}
 
 
 // internal helper function to retrieve shader source from file
 
-    bool ShaderMgr::LoadShader(GLuint shader, string filename) 
+    bool ShaderMgr::LoadShader(const string & filename, string & source) 
 	{
-		vector<byte> buffer;
 		string path(FF_SHADER_PATH + filename);
 		ifstream file(path.c_str(), ios::in | ios::binary); 
 
 		if (file.good())
         {
 			// calculate file size in  bytes
-			GLint fileSize = (GLint)file.tellg();
+			std::streamoff fileSize = file.tellg();
 			file.seekg(0, ios::end);
-            fileSize = (GLint)file.tellg() - fileSize;
+            fileSize = file.tellg() - fileSize;
 
-			// resize byte buffer and read in data
+			// resize the source string and read in data
 			file.seekg(0, ios::beg);
-			buffer.resize(fileSize);
-			file.read(&buffer[0], fileSize);
-
-			// pass the shader source to open gl
-			const GLchar * src = &buffer[0];
-			GL_DEBUG(glShaderSource(shader, 1, &src, &fileSize));
+			source.resize((size_t)fileSize);
+			if (fileSize > 0)
+				file.read(&source[0], fileSize);
 			return true;
         } 
 		else 
@@ -183,6 +895,114 @@ namespace ff {
         return success == GL_TRUE ? true : false;
     }
 
+
+// names the cache entry after a hash of the sources, attributes and driver
+
+	string ShaderMgr::cache_file(const string & vertSrc, const string & fragSrc,
+	                             const vector<pair<int, string>> & attributes) const
+	{
+		// 64-bit FNV-1a, strings are hashed with their terminator to keep
+		// neighbouring fields from running into each other
+		uint64 hash = 14695981039346656037ULL;
+		auto mix = [&hash](const void * data, size_t size) {
+			const ubyte * key = static_cast<const ubyte *>(data);
+			for (size_t i = 0; i < size; ++i)
+				hash = (hash ^ key[i]) * 1099511628211ULL;
+		};
+
+		const uint32 version = FF_SHADER_CACHE_VERSION;
+		mix(&version, sizeof(version));
+		mix(m_driver.c_str(), m_driver.size() + 1);
+		mix(vertSrc.c_str(), vertSrc.size() + 1);
+		mix(fragSrc.c_str(), fragSrc.size() + 1);
+		for (auto it = attributes.begin(); it != attributes.end(); ++it)
+		{
+			const int32 index = it->first;
+			mix(&index, sizeof(index));
+			mix(it->second.c_str(), it->second.size() + 1);
+		}
+
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.prog", (unsigned long long)hash);
+		return m_cachePath + name;
+	}
+
+
+// creates a program from a cached binary, returns 0 if it's missing or
+// the driver rejects it (e.g. after a driver update)
+
+	GLuint ShaderMgr::load_binary(const string & path)
+	{
+		ifstream file(path.c_str(), ios::in | ios::binary);
+		if (!file.good())
+			return 0;
+
+		file.seekg(0, ios::end);
+		std::streamoff size = file.tellg();
+		file.seekg(0, ios::beg);
+
+		// a length that doesn't match the file is a truncated or foreign file
+		ProgramBinaryHeader header;
+		if (!file.read((char *)&header, sizeof(header)) ||
+		    header.magic != FF_SHADER_CACHE_MAGIC || header.length == 0 ||
+		    (std::streamoff)header.length != size - (std::streamoff)sizeof(header))
+			return 0;
+
+		vector<byte> buffer(header.length);
+		if (!file.read(&buffer[0], header.length))
+			return 0;
+
+		GLuint hProgram = GL_DEBUG(glCreateProgram());
+		GL_DEBUG(glProgramBinary(hProgram, header.format, &buffer[0], (GLsizei)header.length));
+
+		GLint success = GL_FALSE;
+		GL_DEBUG(glGetProgramiv(hProgram, GL_LINK_STATUS, &success));
+		if (success == GL_FALSE)
+		{
+			g_Log.write(LOG_WARNING, "ShaderMgr::CreateProgram > cached binary"
+			            " '%s' rejected, recompiling.", path.c_str());
+			GL_DEBUG(glDeleteProgram(hProgram));
+			remove(path.c_str());
+			return 0;
+		}
+
+		return hProgram;
+	}
+
+
+// writes a linked program's binary out to the cache
+
+	void ShaderMgr::save_binary(GLuint program, const string & path)
+	{
+		GLint length = 0;
+		GL_DEBUG(glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length));
+		if (length <= 0)
+			return;
+
+		vector<byte> buffer(length);
+		GLenum format = 0;
+		GL_DEBUG(glGetProgramBinary(program, length, &length, &format, &buffer[0]));
+
+		ProgramBinaryHeader header = { FF_SHADER_CACHE_MAGIC, format, (uint32)length };
+
+		// write to a temporary file first so readers never see half a file,
+		// named per process and per save so concurrent writers don't mix
+		static uint32 saves = 0;
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), ".%d.%u.tmp", (int)ff_getpid(), saves++);
+		string temp = path + suffix;
+		ofstream file(temp.c_str(), ios::out | ios::binary | ios::trunc);
+		if (!file.good())
+			return;
+
+		file.write((const char *)&header, sizeof(header));
+		file.write(&buffer[0], length);
+		file.close();
+
+		if (file.fail() || rename(temp.c_str(), path.c_str()) != 0)
+			remove(temp.c_str());
+	}
+
 } // exiting namespace ff
 
 ////////////////////////////////////////////////////////////////////////
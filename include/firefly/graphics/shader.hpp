@@ -5,29 +5,147 @@
 #include <firefly/common.hpp>
 #include <firefly/core/singleton.hpp>
 
+#include <atomic>
+#include <mutex>
+#include <thread>
+
 #define FF_SHADER_PATH "data/shader/"
+#define FF_SHADER_CACHE_PATH "data/cache/"
+#define FF_SHADER_CACHE_VERSION 1 // bump when the cache file layout changes
 
 ////////////////////////////////////////////////////////////////////////
 
 namespace ff {
 
+// program submitted to the driver, waiting for its status to be checked
+
+	struct ShaderRequest
+	{
+		GLuint program;
+		GLuint vert;
+		GLuint frag;
+		GLuint handle; // program being reloaded, 0 for a new program
+		bool   cached; // loaded from a binary, already linked
+		string vertFile;
+		string fragFile;
+		string cacheFile;
+		vector<pair<int, string>> bindings;
+	};
+
+
+// a reflected uniform, attribute or uniform block, found by name hash
+
+	struct ShaderVariable
+	{
+		uint32 hash;
+		GLint  location; // block index for uniform blocks
+		GLenum type;
+		GLint  size;     // array length, or data size in bytes for blocks
+		uint32 offset;   // uniforms only, last uploaded value in ShaderProgram::values
+		uint32 bytes;
+		bool   valid;
+	};
+
+
+// a program and where it came from, plus everything reflected from it
+// (each table sorted by hash)
+
+	struct ShaderProgram
+	{
+		GLuint                    program;  // live program, replaced on reload
+		string                    vertFile;
+		string                    fragFile;
+		vector<pair<int, string>> bindings;
+
+		vector<ShaderVariable> uniforms;
+		vector<ShaderVariable> attributes;
+		vector<ShaderVariable> blocks;
+		vector<ubyte>          values;
+	};
+
+
 // shader manager singleton
 
     class ShaderMgr : public singleton<ShaderMgr>
     {
     public:
-        ShaderMgr() { }
-        ~ShaderMgr() { }
+        ShaderMgr() : m_current(NULL), m_watchFd(-1), m_watching(false),
+		              m_cachePath(FF_SHADER_CACHE_PATH), m_batching(false),
+		              binarySupported(false), parallelSupported(false) { }
+        ~ShaderMgr() { StopWatching(); }
+
+		// query driver for program binary support
+		void Init();
       
 		GLuint CreateProgram(string vert, string frag, ...);
 		void DeletePrograms();
 
+		// programs created inside a batch return their handle straight away,
+		// their status is checked by EndBatch() which deletes any that failed
+		void BeginBatch();
+		bool EndBatch();
+
+		// hot reloading, programs whose files change are recompiled and
+		// swapped in by Update() (once per frame), keeping their handle
+		bool StartWatching();
+		void StopWatching();
+		void Update();
+
+		// reflection, -1 (or GL_INVALID_INDEX) if the name isn't active
+		GLint GetUniformLocation(GLuint program, const char * name) const;
+		GLint GetAttribLocation(GLuint program, const char * name) const;
+		GLuint GetUniformBlockIndex(GLuint program, const char * name) const;
+		const ShaderProgram * GetProgramInfo(GLuint program) const;
+
+		// binds a program (or its reloaded replacement) for the setters below,
+		// which only call glUniform* when the value differs from the last one
+		void UseProgram(GLuint program);
+		void SetUniform(const char * name, GLint value);
+		void SetUniform(const char * name, GLfloat value);
+		void SetUniform(const char * name, const vec2 & value);
+		void SetUniform(const char * name, const vec3 & value);
+		void SetUniform(const char * name, const vec4 & value);
+		void SetUniform(const char * name, const mat3 & value);
+		void SetUniform(const char * name, const mat4 & value);
+		void SetUniformMatrix3(const char * name, const GLfloat * value);
+		void SetUniformMatrix4(const char * name, const GLfloat * value);
+
+		// config parameters
+		void SetCachePath(const string & path) { m_cachePath = path; } // empty disables
+
     protected:
         vector<GLuint> m_shaders;
+		map<GLuint, ShaderProgram> m_programs;
+		ShaderProgram * m_current;
+		vector<ShaderRequest> m_requests;
+		vector<ShaderRequest> m_reloads;
+		vector<string> m_changed;
+		std::mutex m_changedLock;
+		std::thread m_watcher;
+		int m_watchFd;
+		std::atomic<bool> m_watching;
+		string m_cachePath;
+		string m_driver;
+		bool m_batching;
+		bool binarySupported;
+		bool parallelSupported;
 
-		bool LoadShader(GLuint shader, string filename);
+		bool LoadShader(const string & filename, string & source);
 		bool CheckShaderCompile(GLint shader, const string & file);
 		bool CheckProgramLink(GLint program);
+		bool submit_request(const string & vert, const string & frag,
+		                    const vector<pair<int, string>> & bindings, ShaderRequest & req);
+		bool is_complete(const ShaderRequest & req) const;
+		bool finish_request(const ShaderRequest & req);
+		void discard_request(const ShaderRequest & req);
+		void reflect(ShaderProgram & info);
+		void watch_loop();
+		ShaderVariable * changed_uniform(const char * name, GLenum type, const void * value, uint32 bytes);
+
+		string cache_file(const string & vertSrc, const string & fragSrc,
+		                  const vector<pair<int, string>> & attributes) const;
+		GLuint load_binary(const string & path);
+		void save_binary(GLuint program, const string & path);
     };
 
 // global access
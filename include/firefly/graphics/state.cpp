@@ -0,0 +1,283 @@
+#include <firefly/graphics/state.hpp>
+#include <firefly/debug/gl_debug.hpp>
+#include <firefly/debug/log.hpp>
+
+////////////////////////////////////////////////////////////////////////
+
+namespace ff {
+
+// create global instance
+
+	GLState GlobalGLState;
+
+
+// shadow slot of a buffer target / capability, -1 if it isn't shadowed
+
+	static int buffer_slot(GLenum target)
+	{
+		switch (target)
+		{
+		case GL_ARRAY_BUFFER:         return FF_STATE_ARRAY_BUFFER;
+		case GL_ELEMENT_ARRAY_BUFFER: return FF_STATE_ELEMENT_ARRAY_BUFFER;
+		case GL_PIXEL_PACK_BUFFER:    return FF_STATE_PIXEL_PACK_BUFFER;
+		case GL_PIXEL_UNPACK_BUFFER:  return FF_STATE_PIXEL_UNPACK_BUFFER;
+		case GL_UNIFORM_BUFFER:       return FF_STATE_UNIFORM_BUFFER;
+		default:                      return -1;
+		}
+	}
+
+	static int capability_slot(GLenum cap)
+	{
+		switch (cap)
+		{
+		case GL_BLEND:        return FF_STATE_BLEND;
+		case GL_DEPTH_TEST:   return FF_STATE_DEPTH_TEST;
+		case GL_CULL_FACE:    return FF_STATE_CULL_FACE;
+		case GL_SCISSOR_TEST: return FF_STATE_SCISSOR_TEST;
+		case GL_STENCIL_TEST: return FF_STATE_STENCIL_TEST;
+		default:              return -1;
+		}
+	}
+
+
+// find out how many texture units there are to shadow
+
+	void GLState::Init()
+	{
+		GLint units = 0;
+		GL_DEBUG(glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &units));
+		m_units = (units > 0 && units < FF_STATE_TEXTURE_UNITS) ? (GLuint)units : FF_STATE_TEXTURE_UNITS;
+		g_Log.write(LOG_CONFIG, "GLState > %d texture units, %u shadowed.", units, m_units);
+
+		Invalidate();
+		ResetStats();
+	}
+
+
+// forget everything, the next call of each kind goes through
+
+	void GLState::Invalidate()
+	{
+		m_program = FF_STATE_UNKNOWN;
+		m_activeUnit = FF_STATE_UNKNOWN;
+		m_blendSrc = m_blendDst = FF_STATE_UNKNOWN;
+		m_depthFunc = FF_STATE_UNKNOWN;
+		m_depthMask = FF_STATE_UNKNOWN;
+		m_cullFace = FF_STATE_UNKNOWN;
+
+		for (int i = 0; i < FF_STATE_TEXTURE_UNITS; ++i)
+			m_textures[i] = FF_STATE_UNKNOWN;
+		for (int i = 0; i < FF_STATE_CAPABILITY_COUNT; ++i)
+			m_capabilities[i] = FF_STATE_UNKNOWN;
+
+		InvalidateVertexArray();
+		for (int i = 0; i < FF_STATE_BUFFER_COUNT; ++i)
+			m_buffers[i] = FF_STATE_UNKNOWN;
+	}
+
+
+// the element array binding belongs to the vertex array, so it goes too
+
+	void GLState::InvalidateVertexArray()
+	{
+		m_vao = FF_STATE_UNKNOWN;
+		m_buffers[FF_STATE_ELEMENT_ARRAY_BUFFER] = FF_STATE_UNKNOWN;
+	}
+
+
+// compare against the shadow and update it, counting the result
+
+	bool GLState::changed(GLuint & shadow, GLuint value)
+	{
+		if (shadow == value)
+		{
+			++m_stats.skipped;
+			return false;
+		}
+
+		shadow = value;
+		++m_stats.issued;
+		return true;
+	}
+
+
+// bindings
+
+	bool GLState::UseProgram(GLuint program)
+	{
+		if (!changed(m_program, program))
+			return false;
+
+		GL_DEBUG(glUseProgram(program));
+		return true;
+	}
+
+	bool GLState::BindVertexArray(GLuint vao)
+	{
+		if (!changed(m_vao, vao))
+			return false;
+
+		// whatever the new vertex array has bound isn't known
+		m_buffers[FF_STATE_ELEMENT_ARRAY_BUFFER] = FF_STATE_UNKNOWN;
+		GL_DEBUG(glBindVertexArray(vao));
+		return true;
+	}
+
+	bool GLState::BindBuffer(GLenum target, GLuint buffer)
+	{
+		int slot = buffer_slot(target);
+		if (slot < 0)
+			++m_stats.issued;
+		else if (!changed(m_buffers[slot], buffer))
+			return false;
+
+		GL_DEBUG(glBindBuffer(target, buffer));
+		return true;
+	}
+
+	bool GLState::ActiveTexture(GLuint unit)
+	{
+		if (!changed(m_activeUnit, unit))
+			return false;
+
+		GL_DEBUG(glActiveTexture(GL_TEXTURE0 + unit));
+		return true;
+	}
+
+	bool GLState::BindTexture(GLuint unit, GLuint texture, GLenum target)
+	{
+		bool shadowed = (target == GL_TEXTURE_2D && unit < m_units);
+		if (shadowed && m_textures[unit] == texture)
+		{
+			++m_stats.skipped;
+			return false;
+		}
+
+		ActiveTexture(unit);
+		GL_DEBUG(glBindTexture(target, texture));
+		++m_stats.issued;
+
+		if (shadowed)
+			m_textures[unit] = texture;
+		return true;
+	}
+
+
+// fixed function state
+
+	bool GLState::SetCapability(GLenum cap, bool enable)
+	{
+		int slot = capability_slot(cap);
+		if (slot < 0)
+			++m_stats.issued;
+		else if (!changed(m_capabilities[slot], enable ? 1 : 0))
+			return false;
+
+		if (enable)
+		{
+			GL_DEBUG(glEnable(cap));
+		}
+		else
+		{
+			GL_DEBUG(glDisable(cap));
+		}
+		return true;
+	}
+
+	bool GLState::BlendFunc(GLenum src, GLenum dst)
+	{
+		if (m_blendSrc == src && m_blendDst == dst)
+		{
+			++m_stats.skipped;
+			return false;
+		}
+
+		m_blendSrc = src;
+		m_blendDst = dst;
+		++m_stats.issued;
+		GL_DEBUG(glBlendFunc(src, dst));
+		return true;
+	}
+
+	bool GLState::DepthFunc(GLenum func)
+	{
+		if (!changed(m_depthFunc, func))
+			return false;
+
+		GL_DEBUG(glDepthFunc(func));
+		return true;
+	}
+
+	bool GLState::DepthMask(bool write)
+	{
+		if (!changed(m_depthMask, write ? 1 : 0))
+			return false;
+
+		GL_DEBUG(glDepthMask(write ? GL_TRUE : GL_FALSE));
+		return true;
+	}
+
+	bool GLState::CullFace(GLenum mode)
+	{
+		if (!changed(m_cullFace, mode))
+			return false;
+
+		GL_DEBUG(glCullFace(mode));
+		return true;
+	}
+
+
+// deleting a bound object leaves 0 bound in its place, and its name may
+// be handed out again, so the shadow has to follow
+
+	void GLState::DeleteProgram(GLuint program)
+	{
+		// a deleted program stays current until something else is bound,
+		// so the next UseProgram (even of 0) has to reach GL
+		if (program && m_program == program)
+			m_program = FF_STATE_UNKNOWN;
+		GL_DEBUG(glDeleteProgram(program));
+	}
+
+	void GLState::DeleteVertexArrays(GLsizei count, const GLuint * vaos)
+	{
+		for (GLsizei i = 0; i < count; ++i)
+		{
+			if (vaos[i] && m_vao == vaos[i])
+			{
+				m_vao = 0;
+				m_buffers[FF_STATE_ELEMENT_ARRAY_BUFFER] = 0;
+			}
+		}
+		GL_DEBUG(glDeleteVertexArrays(count, vaos));
+	}
+
+	void GLState::DeleteBuffers(GLsizei count, const GLuint * buffers)
+	{
+		for (GLsizei i = 0; i < count; ++i)
+		{
+			for (int b = 0; b < FF_STATE_BUFFER_COUNT; ++b)
+			{
+				if (buffers[i] && m_buffers[b] == buffers[i])
+					m_buffers[b] = 0;
+			}
+		}
+		GL_DEBUG(glDeleteBuffers(count, buffers));
+	}
+
+	void GLState::DeleteTextures(GLsizei count, const GLuint * textures)
+	{
+		for (GLsizei i = 0; i < count; ++i)
+		{
+			for (GLuint u = 0; u < m_units; ++u)
+			{
+				if (textures[i] && m_textures[u] == textures[i])
+					m_textures[u] = 0;
+			}
+		}
+		GL_DEBUG(glDeleteTextures(count, textures));
+	}
+
+} // exiting namespace ff
+
+////////////////////////////////////////////////////////////////////////
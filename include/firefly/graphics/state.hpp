@@ -0,0 +1,121 @@
+#ifndef FIREFLY_STATE_HPP
+#define FIREFLY_STATE_HPP
+
+#include <firefly/opengl.hpp>
+#include <firefly/common.hpp>
+#include <firefly/core/singleton.hpp>
+
+#define FF_STATE_TEXTURE_UNITS 16         // units shadowed, higher ones go straight to GL
+#define FF_STATE_UNKNOWN       0xffffffff // shadow value that matches nothing
+
+////////////////////////////////////////////////////////////////////////
+
+namespace ff {
+
+// buffer targets and capabilities that are shadowed, anything else is
+// passed straight through
+
+	enum FF_STATE_BUFFER {
+		FF_STATE_ARRAY_BUFFER,
+		FF_STATE_ELEMENT_ARRAY_BUFFER, // part of the vertex array
+		FF_STATE_PIXEL_PACK_BUFFER,
+		FF_STATE_PIXEL_UNPACK_BUFFER,
+		FF_STATE_UNIFORM_BUFFER,
+		FF_STATE_BUFFER_COUNT,
+	};
+
+	enum FF_STATE_CAPABILITY {
+		FF_STATE_BLEND,
+		FF_STATE_DEPTH_TEST,
+		FF_STATE_CULL_FACE,
+		FF_STATE_SCISSOR_TEST,
+		FF_STATE_STENCIL_TEST,
+		FF_STATE_CAPABILITY_COUNT,
+	};
+
+
+// GL calls that went to the driver, and ones left out as redundant
+
+	struct GLStateStats
+	{
+		uint32 issued;
+		uint32 skipped;
+	};
+
+
+// shadow of the GL state the engine touches, so setting something that is
+// already set costs a compare instead of a driver call. Everything that
+// binds, enables or deletes these objects should go through here, code
+// that bypasses it (GLTools batches) must Invalidate() what it touched.
+
+	class GLState : public singleton<GLState>
+	{
+	public:
+		GLState() : m_units(FF_STATE_TEXTURE_UNITS), m_stats() { Invalidate(); }
+		~GLState() { }
+
+		// query limits and forget everything, needs a context
+		void Init();
+
+		// the next call of each kind goes to GL whatever its value
+		void Invalidate();
+		void InvalidateVertexArray();
+
+		// bindings, each returns true if the call was issued
+		bool UseProgram(GLuint program);
+		bool BindVertexArray(GLuint vao);
+		bool BindBuffer(GLenum target, GLuint buffer);
+		bool ActiveTexture(GLuint unit);
+		bool BindTexture(GLuint unit, GLuint texture, GLenum target = GL_TEXTURE_2D); // only 2D is shadowed
+
+		// fixed function state
+		bool Enable(GLenum cap) { return SetCapability(cap, true); }
+		bool Disable(GLenum cap) { return SetCapability(cap, false); }
+		bool SetCapability(GLenum cap, bool enable);
+		bool BlendFunc(GLenum src, GLenum dst);
+		bool DepthFunc(GLenum func);
+		bool DepthMask(bool write);
+		bool CullFace(GLenum mode);
+
+		// deleting a bound object resets its binding to 0
+		void DeleteProgram(GLuint program);
+		void DeleteVertexArrays(GLsizei count, const GLuint * vaos);
+		void DeleteBuffers(GLsizei count, const GLuint * buffers);
+		void DeleteTextures(GLsizei count, const GLuint * textures);
+
+		GLuint GetProgram() const { return m_program; }
+		GLuint GetVertexArray() const { return m_vao; }
+
+		// counters since the last reset (the app resets them every frame)
+		const GLStateStats & GetStats() const { return m_stats; }
+		void ResetStats() { m_stats.issued = m_stats.skipped = 0; }
+
+	private:
+		bool changed(GLuint & shadow, GLuint value);
+
+		GLuint       m_program;
+		GLuint       m_vao;
+		GLuint       m_buffers[FF_STATE_BUFFER_COUNT];
+		GLuint       m_activeUnit;
+		GLuint       m_textures[FF_STATE_TEXTURE_UNITS];
+		GLuint       m_capabilities[FF_STATE_CAPABILITY_COUNT];
+		GLuint       m_blendSrc;
+		GLuint       m_blendDst;
+		GLuint       m_depthFunc;
+		GLuint       m_depthMask;
+		GLuint       m_cullFace;
+		GLuint       m_units;
+		GLStateStats m_stats;
+	};
+
+// global access
+
+	extern GLState GlobalGLState;
+
+#define g_GLState ff::GLState::get_singleton()
+
+} // exiting namespace ff
+
+////////////////////////////////////////////////////////////////////////
+
+#endif
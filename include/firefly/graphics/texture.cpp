@@ -1,7 +1,28 @@
 #include <firefly/graphics/texture.hpp>
+#include <firefly/graphics/state.hpp>
 #include <firefly/debug/log.hpp>
 #include <firefly/debug/gl_debug.hpp>
 #include <firefly/io/SOIL/SOIL.h>
+#include <firefly/io/SOIL/stb_image_aug.h>
+#include <firefly/io/SOIL/image_helper.h>
+
+extern "C" {
+	#include <firefly/io/SOIL/image_DXT.h>
+}
+
+#include <cstdio>
+#include <algorithm>
+
+// platform-specific headers
+#ifdef WIN32
+    #include <direct.h>
+    #define ff_mkdir(path) _mkdir(path)
+#else
+    #include <sys/stat.h>
+    #define ff_mkdir(path) mkdir(path, 0755)
+#endif
+
+#define DDS_FOURCC(a, b, c, d) ((a) | ((b) << 8) | ((c) << 16) | ((d) << 24))
 
 ////////////////////////////////////////////////////////////////////////
 
@@ -14,7 +35,7 @@ namespace ff {
 
 // queries hardware vendor for texture support
 
-	void TextureMgr::Init() 
+	void TextureMgr::Init()
 	{
 		GLfloat maxAnisotropy = 0.f;
 		if (glewIsSupported("GL_EXT_texture_filter_anisotropic")) {
@@ -26,35 +47,101 @@ namespace ff {
 
 		// use max anisotropic filtering by default
 		afLevel = afMax = (GLint) maxAnisotropy;
+
+		// the worker threads can't ask OpenGL, so cache what they need
+		GL_DEBUG(glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize));
+		dxtSupported = glewIsSupported("GL_EXT_texture_compression_s3tc") ? true : false;
+		g_Log.write(LOG_CONFIG, "TextureMgr > max size %d, DXT compression %s.",
+		            maxSize, dxtSupported ? "supported" : "NOT supported");
+
+		// the loader threads only ever read the sRGB mipmap tables
+		mipmap_init_sRGB_tables();
+
+		// compressed textures are cached between runs
+		if (!m_cachePath.empty())
+			ff_mkdir(m_cachePath.c_str());
 	}
 
 
-// loads an image file into OpenGL using SOIL
+// loads an image file into OpenGL, blocking until it is uploaded
 
 	GLuint TextureMgr::LoadTexture(string file, bool repeats, bool compress)
 	{
-		// extende filename
-		file = FF_TEXTURE_PATH + file;
+		TextureRequest * req = create_request(file, repeats, compress);
+		prepare(*req);
 
-		uint32 tFlags = SOIL_FLAG_MIPMAPS;
-		if (repeats)  tFlags |= SOIL_FLAG_TEXTURE_REPEATS;
-		if (compress) tFlags |= SOIL_FLAG_COMPRESS_TO_DXT;
+		while (req->nextLevel < req->levels.size())
+			upload_level(*req);
 
-		// create texture using SOIL
-		GLuint handle = SOIL_load_OGL_texture(file.c_str(), 0, 0, tFlags);
+		GLuint handle = req->handle;
+		finish_request(*req);
+		m_pending.pop_back();
+		return handle;
+	}
 
-		// set texture parameters (fixed at max quality currently)
-		GL_DEBUG(glBindTexture(GL_TEXTURE_2D, handle));
-		GL_DEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
-		GL_DEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
-		GL_DEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, afLevel));
 
-		g_Log.write(LOG_LOAD, "Texture loaded > [%d] '%s'%s%s",	handle, file.c_str(), 
-			                       repeats ? " [wrap] " : "", compress ? " [compress]" : "");
+// queues an image file to be decoded on the job system, the returned
+// handle is valid straight away but stays empty until Update() uploads it
 
-		// store handle
-		m_textures.push_back(handle);
-		return handle;
+	GLuint TextureMgr::LoadTextureAsync(string file, bool repeats, bool compress)
+	{
+		TextureRequest * req = create_request(file, repeats, compress);
+		g_Job.Run(prepare_job, req, &m_loading);
+		return req->handle;
+	}
+
+
+// uploads decoded textures, bounded by a per-frame byte budget
+
+	void TextureMgr::Update(uint32 budget)
+	{
+		uint32 uploaded = 0;
+		auto it = m_pending.begin();
+		while (it != m_pending.end() && uploaded < budget)
+		{
+			TextureRequest & req = **it;
+			if (!req.ready.load(std::memory_order_acquire))
+			{
+				++it;
+				continue;
+			}
+
+			// one level at a time so large textures spread over frames
+			while (req.nextLevel < req.levels.size() && uploaded < budget)
+			{
+				uploaded += req.levels[req.nextLevel].size;
+				upload_level(req);
+			}
+
+			if (req.nextLevel < req.levels.size())
+				break;
+
+			finish_request(req);
+			it = m_pending.erase(it);
+		}
+	}
+
+
+// blocks (helping the workers) until every queued texture is uploaded
+
+	void TextureMgr::FinishLoading()
+	{
+		g_Job.WaitFor(m_loading);
+		Update(0xffffffff);
+		assert(m_pending.empty());
+	}
+
+
+// returns true while a texture is still being decoded or uploaded
+
+	bool TextureMgr::IsLoading(GLuint handle) const
+	{
+		for (auto it = m_pending.begin(); it != m_pending.end(); ++it)
+		{
+			if ((*it)->handle == handle)
+				return true;
+		}
+		return false;
 	}
 
 
@@ -62,27 +149,421 @@ namespace ff {
 
 	void TextureMgr::DeleteTextures()
 	{
+		// let in-flight decodes finish before their memory goes away
+		g_Job.WaitFor(m_loading);
+		for (auto it = m_pending.begin(); it != m_pending.end(); ++it)
+			free_request(**it);
+		m_pending.clear();
+
 		if (m_textures.empty())
             return;
 
-        GL_DEBUG(glDeleteTextures(m_textures.size(), &m_textures[0]));
+        g_GLState.DeleteTextures((GLsizei)m_textures.size(), &m_textures[0]);
         m_textures.clear();
 	}
 
 
 // sets anisotropic filtering level for all textures (current and future)
 
-	void TextureMgr::SetAnisotropic(GLint level) 
+	void TextureMgr::SetAnisotropic(GLint level)
 	{
 		afLevel = (level >= 0 && level <= afMax) ? level : afMax;
 		for (auto it = m_textures.begin(); it != m_textures.end(); ++it)
 		{
-			GL_DEBUG(glBindTexture(GL_TEXTURE_2D, *it));
+			g_GLState.BindTexture(0, *it);
 			GL_DEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, afLevel));
 		}
 	}
 
+
+// creates the GL handle and tracks the request (GL thread only)
+
+	TextureRequest * TextureMgr::create_request(const string & file, bool repeats, bool compress)
+	{
+		TextureRequest * req = new TextureRequest();
+		req->file = FF_TEXTURE_PATH + file;
+		req->repeats = repeats;
+		req->compress = compress && dxtSupported;
+		req->cached = false;
+		req->channels = 0;
+		req->error = NULL;
+		req->nextLevel = 0;
+		req->ready = false;
+
+		GL_DEBUG(glGenTextures(1, &req->handle));
+		m_textures.push_back(req->handle);
+		m_pending.push_back(unique_ptr<TextureRequest>(req));
+		return req;
+	}
+
+
+// sends the next mip level to OpenGL
+
+	void TextureMgr::upload_level(TextureRequest & req)
+	{
+		static const GLenum formats[] = { 0, GL_LUMINANCE, GL_LUMINANCE_ALPHA, GL_RGB, GL_RGBA };
+		GLint level = (GLint)req.nextLevel++;
+		TextureLevel & mip = req.levels[level];
+
+		g_GLState.BindTexture(0, req.handle);
+		if (req.compress)
+		{
+			GLenum format = (req.channels & 1) ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+			                                   : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+			GL_DEBUG(glCompressedTexImage2D(GL_TEXTURE_2D, level, format, mip.width, mip.height,
+			                                0, mip.size, mip.data));
+		}
+		else
+		{
+			// small RGB mips have rows that are not 4 byte aligned
+			GLenum format = formats[req.channels];
+			GL_DEBUG(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+			GL_DEBUG(glTexImage2D(GL_TEXTURE_2D, level, format, mip.width, mip.height, 0,
+			                      format, GL_UNSIGNED_BYTE, mip.data));
+			GL_DEBUG(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+		}
+
+		SOIL_free_image_data(mip.data);
+		mip.data = NULL;
+	}
+
+
+// sets texture parameters once every level has been uploaded
+
+	void TextureMgr::finish_request(TextureRequest & req)
+	{
+		if (req.levels.empty())
+		{
+			g_Log.write(LOG_ERROR, "TextureMgr > failed to load '%s' (%s)",
+			            req.file.c_str(), req.error ? req.error : "unknown error");
+			return;
+		}
+
+		GLint wrap = req.repeats ? GL_REPEAT : GL_CLAMP_TO_EDGE;
+
+		// set texture parameters (fixed at max quality currently)
+		g_GLState.BindTexture(0, req.handle);
+		GL_DEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)req.levels.size() - 1));
+		GL_DEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap));
+		GL_DEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap));
+		GL_DEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+		GL_DEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
+		GL_DEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, afLevel));
+
+		g_Log.write(LOG_LOAD, "Texture loaded > [%d] '%s'%s%s%s", req.handle, req.file.c_str(),
+			                       req.repeats ? " [wrap] " : "", req.compress ? " [compress]" : "",
+			                       req.cached ? " [cached]" : "");
+	}
+
+
+// releases any pixel data that was never uploaded
+
+	void TextureMgr::free_request(TextureRequest & req)
+	{
+		for (auto it = req.levels.begin(); it != req.levels.end(); ++it)
+		{
+			if (it->data)
+				SOIL_free_image_data(it->data);
+		}
+		req.levels.clear();
+	}
+
+
+// job entry point for decoding a texture
+
+	void TextureMgr::prepare_job(void * data)
+	{
+		TextureRequest * req = static_cast<TextureRequest *>(data);
+		g_Texture.prepare(*req);
+		req->ready.store(true, std::memory_order_release);
+	}
+
+
+// reads a whole file into memory
+
+	static bool read_file(const string & path, vector<ubyte> & buffer)
+	{
+		FILE * file = fopen(path.c_str(), "rb");
+		if (!file)
+			return false;
+
+		fseek(file, 0, SEEK_END);
+		long size = ftell(file);
+		fseek(file, 0, SEEK_SET);
+
+		buffer.resize(size > 0 ? size : 0);
+		bool ok = size > 0 && fread(&buffer[0], 1, size, file) == (size_t)size;
+		fclose(file);
+		return ok;
+	}
+
+
+// size in bytes of a DXT1 (8 byte blocks) or DXT5 (16 byte blocks) image
+
+	static int dxt_size(int width, int height, int blockBytes)
+	{
+		return ((width + 3) / 4) * ((height + 3) / 4) * blockBytes;
+	}
+
+
+// loads a cached, fully mipmapped DXT1/DXT5 dds file into the request
+
+	static bool load_cached(const string & path, TextureRequest & req)
+	{
+		vector<ubyte> buffer;
+		if (!read_file(path, buffer) || buffer.size() < sizeof(DDS_header))
+			return false;
+
+		DDS_header header;
+		memcpy(&header, &buffer[0], sizeof(DDS_header));
+
+		int blockBytes;
+		if (header.sPixelFormat.dwFourCC == DDS_FOURCC('D', 'X', 'T', '1'))
+			blockBytes = 8;
+		else if (header.sPixelFormat.dwFourCC == DDS_FOURCC('D', 'X', 'T', '5'))
+			blockBytes = 16;
+		else
+			return false;
+
+		if (header.dwMagic != DDS_FOURCC('D', 'D', 'S', ' ') || header.dwMipMapCount < 1)
+			return false;
+
+		// verify the file holds every level before handing any out
+		int width = header.dwWidth, height = header.dwHeight;
+		size_t offset = sizeof(DDS_header);
+		for (uint32 i = 0; i < header.dwMipMapCount; ++i)
+		{
+			offset += dxt_size(width, height, blockBytes);
+			width = (width + 1) / 2;
+			height = (height + 1) / 2;
+		}
+		if (offset != buffer.size())
+			return false;
+
+		req.channels = (blockBytes == 8) ? 3 : 4;
+		width = header.dwWidth;
+		height = header.dwHeight;
+		offset = sizeof(DDS_header);
+		for (uint32 i = 0; i < header.dwMipMapCount; ++i)
+		{
+			TextureLevel level = { width, height, dxt_size(width, height, blockBytes), NULL };
+			level.data = (ubyte *)malloc(level.size);
+			memcpy(level.data, &buffer[offset], level.size);
+			req.levels.push_back(level);
+
+			offset += level.size;
+			width = (width + 1) / 2;
+			height = (height + 1) / 2;
+		}
+		return true;
+	}
+
+
+// writes the compressed mip chain out as a dds file
+
+	static void save_cached(const string & path, const TextureRequest & req)
+	{
+		const TextureLevel & base = req.levels[0];
+		DDS_header header;
+		memset(&header, 0, sizeof(DDS_header));
+		header.dwMagic = DDS_FOURCC('D', 'D', 'S', ' ');
+		header.dwSize = 124;
+		header.dwFlags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT |
+		                 DDSD_LINEARSIZE | DDSD_MIPMAPCOUNT;
+		header.dwWidth = base.width;
+		header.dwHeight = base.height;
+		header.dwPitchOrLinearSize = base.size;
+		header.dwMipMapCount = (uint32)req.levels.size();
+		header.sPixelFormat.dwSize = 32;
+		header.sPixelFormat.dwFlags = DDPF_FOURCC;
+		header.sPixelFormat.dwFourCC = (req.channels & 1) ? DDS_FOURCC('D', 'X', 'T', '1')
+		                                                  : DDS_FOURCC('D', 'X', 'T', '5');
+		header.sCaps.dwCaps1 = DDSCAPS_TEXTURE | DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+
+		// write to a temporary file first so readers never see half a file
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), ".%d.tmp", g_Job.GetWorkerIndex() + 1);
+		string temp = path + suffix;
+
+		FILE * file = fopen(temp.c_str(), "wb");
+		if (!file)
+			return;
+
+		bool ok = fwrite(&header, sizeof(DDS_header), 1, file) == 1;
+		for (auto it = req.levels.begin(); ok && it != req.levels.end(); ++it)
+			ok = fwrite(it->data, 1, it->size, file) == (size_t)it->size;
+		fclose(file);
+
+		if (!ok || rename(temp.c_str(), path.c_str()) != 0)
+			remove(temp.c_str());
+	}
+
+
+// names the cache entry after a hash of the source file and load settings
+
+	string TextureMgr::cache_file(const vector<ubyte> & source) const
+	{
+		// 64-bit FNV-1a
+		uint64 hash = 14695981039346656037ULL;
+		const uint32 settings[] = { FF_TEXTURE_CACHE_VERSION, (uint32)maxSize, (uint32)srgbMips, (uint32)source.size() };
+		const ubyte * key = reinterpret_cast<const ubyte *>(settings);
+		for (size_t i = 0; i < sizeof(settings); ++i)
+			hash = (hash ^ key[i]) * 1099511628211ULL;
+		for (size_t i = 0; i < source.size(); ++i)
+			hash = (hash ^ source[i]) * 1099511628211ULL;
+
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.dds", (unsigned long long)hash);
+		return m_cachePath + name;
+	}
+
+
+// wraps a mip level for upload, compressing it if required
+
+	struct CompressJob
+	{
+		const ubyte * image;
+		ubyte *       output;
+		int           width;
+		int           height;
+		int           channels;
+	};
+
+	static void compress_rows(uint32 begin, uint32 end, void * data)
+	{
+		const CompressJob * job = static_cast<const CompressJob *>(data);
+		if (job->channels & 1)
+			convert_image_rows_to_DXT1(job->image, job->width, job->height, job->channels,
+			                           (int)begin, (int)(end - begin), job->output);
+		else
+			convert_image_rows_to_DXT5(job->image, job->width, job->height, job->channels,
+			                           (int)begin, (int)(end - begin), job->output);
+	}
+
+	static TextureLevel make_level(const TextureRequest & req, ubyte * img, int width, int height)
+	{
+		TextureLevel level = { width, height, width * height * req.channels, img };
+		if (req.compress)
+		{
+			// block rows are independent, so large levels are split across the workers
+			int rows = (height + 3) / 4;
+			level.size = dxt_size(width, height, (req.channels & 1) ? 8 : 16);
+			level.data = (ubyte *)malloc(level.size);
+
+			CompressJob job = { img, level.data, width, height, req.channels };
+			g_Job.ParallelFor((uint32)rows, FF_TEXTURE_COMPRESS_GRAIN, compress_rows, &job);
+			SOIL_free_image_data(img);
+		}
+		return level;
+	}
+
+
+// builds one band of base image rows worth of mips
+
+	struct MipJob
+	{
+		const ubyte * image;
+		ubyte **      levels;
+		int           width;
+		int           height;
+		int           channels;
+		int           flags;
+		void *        scratch;
+	};
+
+	static void mip_bands(uint32 begin, uint32 end, void * data)
+	{
+		const MipJob * job = static_cast<const MipJob *>(data);
+		for (uint32 band = begin; band < end; ++band)
+			mipmap_image_chain_band(job->image, job->width, job->height, job->channels,
+			                        job->levels, job->scratch, job->flags, (int)band);
+	}
+
+
+// decodes, resizes, mipmaps and compresses an image (any thread)
+
+	void TextureMgr::prepare(TextureRequest & req) const
+	{
+		vector<ubyte> source;
+		if (!read_file(req.file, source))
+		{
+			req.error = "unable to read file";
+			return;
+		}
+
+		// warm starts skip decoding and compression entirely
+		string cacheFile;
+		if (req.compress && !m_cachePath.empty())
+		{
+			cacheFile = cache_file(source);
+			if (load_cached(cacheFile, req))
+			{
+				req.cached = true;
+				return;
+			}
+		}
+
+		int width, height, channels;
+		ubyte * img = stbi_load_from_memory(&source[0], (int)source.size(), &width, &height, &channels, 0);
+		if (!img)
+		{
+			req.error = stbi_failure_reason();
+			return;
+		}
+		req.channels = channels;
+
+		// mipmaps require power of two dimensions
+		int potWidth = 1, potHeight = 1;
+		while (potWidth < width)   potWidth *= 2;
+		while (potHeight < height) potHeight *= 2;
+		if (potWidth != width || potHeight != height)
+		{
+			ubyte * resampled = (ubyte *)malloc(channels * potWidth * potHeight);
+			up_scale_image(img, width, height, channels, resampled, potWidth, potHeight);
+			SOIL_free_image_data(img);
+			img = resampled;
+			width = potWidth;
+			height = potHeight;
+		}
+
+		// reduce the image to the largest size the hardware supports
+		if (maxSize > 0 && (width > maxSize || height > maxSize))
+		{
+			int blockX = (width > maxSize) ? width / maxSize : 1;
+			int blockY = (height > maxSize) ? height / maxSize : 1;
+			ubyte * resampled = (ubyte *)malloc(channels * (width / blockX) * (height / blockY));
+			mipmap_image(img, width, height, channels, resampled, blockX, blockY);
+			SOIL_free_image_data(img);
+			img = resampled;
+			width /= blockX;
+			height /= blockY;
+		}
+
+		// build the whole mip chain in one pass, bands of rows run in parallel
+		int count = mipmap_chain_levels(width, height);
+		vector<ubyte *> mips(count + 1);
+		for (int level = 1; level <= count; ++level)
+			mips[level - 1] = (ubyte *)malloc(channels * std::max(width >> level, 1) * std::max(height >> level, 1));
+
+		MipJob job = { img, &mips[0], width, height, channels, srgbMips ? MIPMAP_SRGB : 0, NULL };
+		int scratchSize = 0;
+		int bands = mipmap_chain_bands(width, height, channels, job.flags, &scratchSize);
+		job.scratch = malloc(scratchSize);
+		g_Job.ParallelFor((uint32)bands, 0, mip_bands, &job);
+		mipmap_image_chain_finish(width, height, channels, &mips[0], job.scratch, job.flags);
+		free(job.scratch);
+
+		// base level is filled in once the mips have been built from it
+		req.levels.resize(1);
+		for (int level = 1; level <= count; ++level)
+			req.levels.push_back(make_level(req, mips[level - 1], std::max(width >> level, 1), std::max(height >> level, 1)));
+
+		req.levels[0] = make_level(req, img, width, height);
+
+		if (!cacheFile.empty())
+			save_cached(cacheFile, req);
+	}
+
 } // exiting namespace ff
 
 ////////////////////////////////////////////////////////////////////////
-
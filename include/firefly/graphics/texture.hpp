@@ -4,9 +4,14 @@
 #include <firefly/opengl.hpp>
 #include <firefly/common.hpp>
 #include <firefly/core/singleton.hpp>
+#include <firefly/core/job.hpp>
 
 #define FF_TEXTURE_PATH "data/texture/"
+#define FF_TEXTURE_CACHE_PATH "data/cache/"
+#define FF_TEXTURE_CACHE_VERSION 1 // bump when the cached data changes
 #define FF_MAX_ANISOTROPY 16
+#define FF_TEXTURE_UPLOAD_BUDGET (4 * MEGABYTE) // bytes uploaded per frame
+#define FF_TEXTURE_COMPRESS_GRAIN 16 // dxt block rows per compression job
 
 enum FF_TEXTURE_TYPE {
 	FF_TEXTURE_TGA,
@@ -34,28 +39,81 @@ enum FF_TEXTURE_TYPE {
 
 namespace ff {
 
+// a single mip level, either raw pixels or a block compressed image
+
+	struct TextureLevel
+	{
+		int     width;
+		int     height;
+		int     size;
+		ubyte * data;
+	};
+
+
+// texture decoded off the GL thread, waiting to be uploaded
+
+	struct TextureRequest
+	{
+		GLuint               handle;
+		string               file;
+		bool                 repeats;
+		bool                 compress;
+		bool                 cached;
+		int                  channels;
+		const char *         error;
+		vector<TextureLevel> levels;
+		size_t               nextLevel;
+		std::atomic<bool>    ready;
+	};
+
+
 // texture manager singleton
 
     class TextureMgr : public singleton<TextureMgr>
     {
     public:
-        TextureMgr() : afLevel(0), afMax(0) { }
+        TextureMgr() : m_cachePath(FF_TEXTURE_CACHE_PATH), afLevel(0), afMax(0),
+		               maxSize(0), dxtSupported(false), srgbMips(false) { }
         ~TextureMgr() { }
-      
+
 		// query vendor for texture support
 		void Init();
 
 		// load / delete
 		GLuint LoadTexture(string file, bool repeats = false, bool compress = true);
+		GLuint LoadTextureAsync(string file, bool repeats = false, bool compress = true);
 		void DeleteTextures();
 
+		// streaming, Update() is called once per frame on the GL thread
+		void Update(uint32 budget = FF_TEXTURE_UPLOAD_BUDGET);
+		void FinishLoading();
+		bool IsLoading(GLuint handle) const;
+		size_t GetPendingCount() const { return m_pending.size(); }
+
 		// config parameters
 		void SetAnisotropic(GLint level = FF_MAX_ANISOTROPY);
+		void SetCachePath(const string & path) { m_cachePath = path; } // empty disables
+		void SetSRGBMipmaps(bool enable) { srgbMips = enable; } // filter colors in linear space
 
     protected:
         vector<GLuint> m_textures;
+		vector<unique_ptr<TextureRequest>> m_pending;
+		JobCounter m_loading;
+		string m_cachePath;
 		GLint afLevel;
 		GLint afMax;
+		GLint maxSize;
+		bool dxtSupported;
+		bool srgbMips;
+
+		TextureRequest * create_request(const string & file, bool repeats, bool compress);
+		void upload_level(TextureRequest & req);
+		void finish_request(TextureRequest & req);
+		void free_request(TextureRequest & req);
+
+		void prepare(TextureRequest & req) const;
+		string cache_file(const vector<ubyte> & source) const;
+		static void prepare_job(void * data);
     };
 
 // global access
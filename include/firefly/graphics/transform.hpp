@@ -8,14 +8,17 @@
 
 namespace ff {
 
+// derived matrices are cached against the versions of the stacks they
+// came from, so asking again without touching the stacks is free
+
 	class Transform 
 	{
 	public:
-		Transform() {}
+		Transform() : m_modelView(NULL), m_projection(NULL) { invalidate(); }
 		~Transform() {}
 
-		inline void SetModelView(MatrixStack & mv)    { m_modelView = &mv; }
-		inline void SetProjection(MatrixStack & proj) { m_projection = &proj; }
+		inline void SetModelView(MatrixStack & mv)    { m_modelView = &mv; invalidate(); }
+		inline void SetProjection(MatrixStack & proj) { m_projection = &proj; invalidate(); }
 		inline void SetMatrices(MatrixStack & mv, MatrixStack & proj)
 				              { SetModelView(mv); SetProjection(proj); }
 
@@ -24,17 +27,35 @@ namespace ff {
 
 		inline const float * GetMVP(void)
 		{
-			m_MVP = m_projection->top() * m_modelView->top();
+			uint32 mvVersion = m_modelView->GetVersion();
+			uint32 projVersion = m_projection->GetVersion();
+			if (m_mvpVersion != mvVersion || m_mvpProjVersion != projVersion)
+			{
+				mat4_multiply(m_projection->ptr(), m_modelView->ptr(), value_ptr(m_MVP));
+				m_mvpVersion = mvVersion;
+				m_mvpProjVersion = projVersion;
+			}
 			return value_ptr(m_MVP);
 		}
 
 		void GetNormalMatrix(mat3 & m, bool normalize = false) 
 		{
-			m_normalMatrix = glm::transpose( glm::inverse(m_modelView->mat3()) );
-			if (normalize) {
-				m_normalMatrix[0] = glm::normalize(m_normalMatrix[0]);
-				m_normalMatrix[1] = glm::normalize(m_normalMatrix[1]);
-				m_normalMatrix[2] = glm::normalize(m_normalMatrix[2]);
+			uint32 version = m_modelView->GetVersion();
+			if (m_normalVersion != version || m_normalized != normalize)
+			{
+				// the inverse transpose of a rotation is the rotation itself
+				if (m_modelView->IsRigid()) {
+					m_normalMatrix = m_modelView->mat3();
+				} else {
+					m_normalMatrix = glm::transpose( glm::inverse(m_modelView->mat3()) );
+					if (normalize) {
+						m_normalMatrix[0] = glm::normalize(m_normalMatrix[0]);
+						m_normalMatrix[1] = glm::normalize(m_normalMatrix[1]);
+						m_normalMatrix[2] = glm::normalize(m_normalMatrix[2]);
+					}
+				}
+				m_normalVersion = version;
+				m_normalized = normalize;
 			}
 			m = m_normalMatrix;
 		}
@@ -45,11 +66,43 @@ namespace ff {
 			return value_ptr(m_normalMatrix);
 		}
 
+		const float * GetInverseModelView(void)
+		{
+			uint32 version = m_modelView->GetVersion();
+			if (m_inverseVersion != version)
+			{
+				const mat4 & mv = m_modelView->top();
+				if (m_modelView->IsRigid()) {
+					// transpose the rotation, and rotate the translation back
+					glm::mat3 r = glm::transpose(m_modelView->mat3());
+					m_inverse = mat4(r);
+					m_inverse[3] = vec4(r * -vec3(mv[3]), 1.0f);
+				} else {
+					m_inverse = glm::inverse(mv);
+				}
+				m_inverseVersion = version;
+			}
+			return value_ptr(m_inverse);
+		}
+
 	private:
-		mat_t m_MVP;
+		inline void invalidate(void)
+		{
+			m_mvpVersion = m_mvpProjVersion = 0;
+			m_normalVersion = m_inverseVersion = 0;
+			m_normalized = false;
+		}
+
+		FF_ALIGN(16) mat_t m_MVP;
+		mat_t m_inverse;
 		mat3 m_normalMatrix;
 		MatrixStack * m_modelView;
 		MatrixStack * m_projection;
+		uint32 m_mvpVersion;
+		uint32 m_mvpProjVersion;
+		uint32 m_normalVersion;
+		uint32 m_inverseVersion;
+		bool m_normalized;
 	};
 
 } // exiting namespace ff
@@ -1261,14 +1261,24 @@ unsigned int
 			int MIPlevel = 1;
 			int MIPwidth = (width+1) / 2;
 			int MIPheight = (height+1) / 2;
-			unsigned char *resampled = (unsigned char*)malloc( channels*MIPwidth*MIPheight );
+			int MIPcount = mipmap_chain_levels( width, height );
+			unsigned char **MIPchain = (unsigned char**)malloc( (MIPcount+1)*sizeof(unsigned char*) );
+			unsigned char *resampled;
+			/*	build all the MIPmap levels in one go	*/
+			for( MIPlevel = 1; MIPlevel <= MIPcount; ++MIPlevel )
+			{
+				MIPchain[MIPlevel-1] = (unsigned char*)malloc( channels*MIPwidth*MIPheight );
+				MIPwidth = (MIPwidth + 1) / 2;
+				MIPheight = (MIPheight + 1) / 2;
+			}
+			mipmap_image_chain( img, width, height, channels, MIPchain, 0 );
+			MIPlevel = 1;
+			MIPwidth = (width+1) / 2;
+			MIPheight = (height+1) / 2;
 			while( ((1<<MIPlevel) <= width) || ((1<<MIPlevel) <= height) )
 			{
 				/*	do this MIPmap level	*/
-				mipmap_image(
-						img, width, height, channels,
-						resampled,
-						(1 << MIPlevel), (1 << MIPlevel) );
+				resampled = MIPchain[MIPlevel-1];
 				/*  upload the MIPmaps	*/
 				if( DXT_mode == SOIL_CAPABILITY_PRESENT )
 				{
@@ -1313,11 +1323,12 @@ unsigned int
 					check_for_GL_errors( "glTexImage2D" );
 				}
 				/*	prep for the next level	*/
+				SOIL_free_image_data( resampled );
 				++MIPlevel;
 				MIPwidth = (MIPwidth + 1) / 2;
 				MIPheight = (MIPheight + 1) / 2;
 			}
-			SOIL_free_image_data( resampled );
+			free( MIPchain );
 			/*	instruct OpenGL to use the MIPmaps	*/
 			glTexParameteri( opengl_texture_type, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
 			glTexParameteri( opengl_texture_type, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
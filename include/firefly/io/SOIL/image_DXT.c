@@ -19,6 +19,16 @@
 	method fails for finding the largest eigenvector	*/
 #define USE_COV_MAT	1
 
+/*	the SSE2 path compresses 4 color blocks at a time, giving
+	exactly the same output as the scalar path	*/
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DXT_HAS_SSE2
+#include <emmintrin.h>
+static int DXT_compressor = DXT_COMPRESSOR_SSE2;
+#else
+static int DXT_compressor = DXT_COMPRESSOR_SCALAR;
+#endif
+
 /********* Function Prototypes *********/
 /*
 	Takes a 4x4 block of pixels and compresses it into 8 bytes
@@ -37,6 +47,26 @@ void compress_DDS_color_block(
 void compress_DDS_alpha_block(
 				const unsigned char *const uncompressed,
 				unsigned char compressed[8] );
+#ifdef DXT_HAS_SSE2
+/*
+	Same as compress_DDS_color_block, but for 4 RGBA blocks at once.
+*/
+void compress_DDS_color_blocks_SSE2(
+				const unsigned char *const block0,
+				const unsigned char *const block1,
+				const unsigned char *const block2,
+				const unsigned char *const block3,
+				unsigned char *compressed[4] );
+#endif
+/*
+	Copies the 4x4 block at (i,j) into RGB or RGBA pixels,
+	replicating the first pixel past the edges of the image.
+*/
+void extract_block(
+				const unsigned char *const uncompressed,
+				int width, int height, int channels,
+				int i, int j, int out_channels,
+				unsigned char *ublock );
 
 /********* Actual Exposed Functions *********/
 int
@@ -104,11 +134,6 @@ unsigned char* convert_image_to_DXT1(
 		int *out_size )
 {
 	unsigned char *compressed;
-	int i, j, x, y;
-	unsigned char ublock[16*3];
-	unsigned char cblock[8];
-	int index = 0, chan_step = 1;
-	int block_count = 0;
 	/*	error check	*/
 	*out_size = 0;
 	if( (width < 1) || (height < 1) ||
@@ -117,65 +142,13 @@ unsigned char* convert_image_to_DXT1(
 	{
 		return NULL;
 	}
-	/*	for channels == 1 or 2, I do not step forward for R,G,B values	*/
-	if( channels < 3 )
-	{
-		chan_step = 0;
-	}
 	/*	get the RAM for the compressed image
 		(8 bytes per 4x4 pixel block)	*/
 	*out_size = ((width+3) >> 2) * ((height+3) >> 2) * 8;
 	compressed = (unsigned char*)malloc( *out_size );
-	/*	go through each block	*/
-	for( j = 0; j < height; j += 4 )
-	{
-		for( i = 0; i < width; i += 4 )
-		{
-			/*	copy this block into a new one	*/
-			int idx = 0;
-			int mx = 4, my = 4;
-			if( j+4 >= height )
-			{
-				my = height - j;
-			}
-			if( i+4 >= width )
-			{
-				mx = width - i;
-			}
-			for( y = 0; y < my; ++y )
-			{
-				for( x = 0; x < mx; ++x )
-				{
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels];
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels+chan_step];
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels+chan_step+chan_step];
-				}
-				for( x = mx; x < 4; ++x )
-				{
-					ublock[idx++] = ublock[0];
-					ublock[idx++] = ublock[1];
-					ublock[idx++] = ublock[2];
-				}
-			}
-			for( y = my; y < 4; ++y )
-			{
-				for( x = 0; x < 4; ++x )
-				{
-					ublock[idx++] = ublock[0];
-					ublock[idx++] = ublock[1];
-					ublock[idx++] = ublock[2];
-				}
-			}
-			/*	compress the block	*/
-			++block_count;
-			compress_DDS_color_block( 3, ublock, cblock );
-			/*	copy the data from the block into the main block	*/
-			for( x = 0; x < 8; ++x )
-			{
-				compressed[index++] = cblock[x];
-			}
-		}
-	}
+	/*	and do every block row	*/
+	convert_image_rows_to_DXT1( uncompressed, width, height, channels,
+			0, (height+3) >> 2, compressed );
 	return compressed;
 }
 
@@ -185,11 +158,6 @@ unsigned char* convert_image_to_DXT5(
 		int *out_size )
 {
 	unsigned char *compressed;
-	int i, j, x, y;
-	unsigned char ublock[16*4];
-	unsigned char cblock[8];
-	int index = 0, chan_step = 1;
-	int block_count = 0, has_alpha;
 	/*	error check	*/
 	*out_size = 0;
 	if( (width < 1) || (height < 1) ||
@@ -198,83 +166,180 @@ unsigned char* convert_image_to_DXT5(
 	{
 		return NULL;
 	}
-	/*	for channels == 1 or 2, I do not step forward for R,G,B vales	*/
-	if( channels < 3 )
-	{
-		chan_step = 0;
-	}
-	/*	# channels = 1 or 3 have no alpha, 2 & 4 do have alpha	*/
-	has_alpha = 1 - (channels & 1);
 	/*	get the RAM for the compressed image
 		(16 bytes per 4x4 pixel block)	*/
 	*out_size = ((width+3) >> 2) * ((height+3) >> 2) * 16;
 	compressed = (unsigned char*)malloc( *out_size );
-	/*	go through each block	*/
-	for( j = 0; j < height; j += 4 )
+	/*	and do every block row	*/
+	convert_image_rows_to_DXT5( uncompressed, width, height, channels,
+			0, (height+3) >> 2, compressed );
+	return compressed;
+}
+
+int set_DXT_compressor( int mode )
+{
+	int previous = DXT_compressor;
+	#ifdef DXT_HAS_SSE2
+	DXT_compressor = mode;
+	#else
+	/*	no SIMD support compiled in, stay with the scalar version	*/
+	(void)mode;
+	#endif
+	return previous;
+}
+
+void convert_image_rows_to_DXT1(
+		const unsigned char *const uncompressed,
+		int width, int height, int channels,
+		int first_row, int row_count,
+		unsigned char *compressed )
+{
+	int i, j, k;
+	int blocks_x = (width + 3) >> 2;
+	/*	RGBA, the SSE2 path reads whole pixels	*/
+	unsigned char ublock[4][16*4];
+	unsigned char *cblock[4];
+	/*	skip to the first block of the first row	*/
+	compressed += first_row * blocks_x * 8;
+	for( j = first_row * 4; j < (first_row + row_count) * 4; j += 4 )
 	{
-		for( i = 0; i < width; i += 4 )
+		i = 0;
+		#ifdef DXT_HAS_SSE2
+		/*	four blocks at a time	*/
+		if( DXT_compressor == DXT_COMPRESSOR_SSE2 )
 		{
-			/*	local variables, and my block counter	*/
-			int idx = 0;
-			int mx = 4, my = 4;
-			if( j+4 >= height )
+			for( ; i + 16 <= width; i += 16 )
 			{
-				my = height - j;
-			}
-			if( i+4 >= width )
-			{
-				mx = width - i;
-			}
-			for( y = 0; y < my; ++y )
-			{
-				for( x = 0; x < mx; ++x )
-				{
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels];
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels+chan_step];
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels+chan_step+chan_step];
-					ublock[idx++] =
-						has_alpha * uncompressed[(j+y)*width*channels+(i+x)*channels+channels-1]
-						+ (1-has_alpha)*255;
-				}
-				for( x = mx; x < 4; ++x )
+				for( k = 0; k < 4; ++k )
 				{
-					ublock[idx++] = ublock[0];
-					ublock[idx++] = ublock[1];
-					ublock[idx++] = ublock[2];
-					ublock[idx++] = ublock[3];
+					extract_block( uncompressed, width, height, channels,
+							i + 4*k, j, 4, ublock[k] );
+					cblock[k] = compressed + 8*k;
 				}
+				compress_DDS_color_blocks_SSE2( ublock[0], ublock[1],
+						ublock[2], ublock[3], cblock );
+				compressed += 32;
 			}
-			for( y = my; y < 4; ++y )
+		}
+		#endif
+		/*	and whatever is left one block at a time	*/
+		for( ; i < width; i += 4 )
+		{
+			extract_block( uncompressed, width, height, channels,
+					i, j, 3, ublock[0] );
+			compress_DDS_color_block( 3, ublock[0], compressed );
+			compressed += 8;
+		}
+	}
+}
+
+void convert_image_rows_to_DXT5(
+		const unsigned char *const uncompressed,
+		int width, int height, int channels,
+		int first_row, int row_count,
+		unsigned char *compressed )
+{
+	int i, j, k;
+	int blocks_x = (width + 3) >> 2;
+	unsigned char ublock[4][16*4];
+	unsigned char *cblock[4];
+	/*	skip to the first block of the first row	*/
+	compressed += first_row * blocks_x * 16;
+	for( j = first_row * 4; j < (first_row + row_count) * 4; j += 4 )
+	{
+		i = 0;
+		#ifdef DXT_HAS_SSE2
+		/*	four blocks at a time (alpha is cheap, it stays scalar)	*/
+		if( DXT_compressor == DXT_COMPRESSOR_SSE2 )
+		{
+			for( ; i + 16 <= width; i += 16 )
 			{
-				for( x = 0; x < 4; ++x )
+				for( k = 0; k < 4; ++k )
 				{
-					ublock[idx++] = ublock[0];
-					ublock[idx++] = ublock[1];
-					ublock[idx++] = ublock[2];
-					ublock[idx++] = ublock[3];
+					extract_block( uncompressed, width, height, channels,
+							i + 4*k, j, 4, ublock[k] );
+					compress_DDS_alpha_block( ublock[k], compressed + 16*k );
+					cblock[k] = compressed + 16*k + 8;
 				}
+				compress_DDS_color_blocks_SSE2( ublock[0], ublock[1],
+						ublock[2], ublock[3], cblock );
+				compressed += 64;
 			}
-			/*	now compress the alpha block	*/
-			compress_DDS_alpha_block( ublock, cblock );
-			/*	copy the data from the compressed alpha block into the main buffer	*/
-			for( x = 0; x < 8; ++x )
+		}
+		#endif
+		/*	and whatever is left one block at a time	*/
+		for( ; i < width; i += 4 )
+		{
+			extract_block( uncompressed, width, height, channels,
+					i, j, 4, ublock[0] );
+			/*	the alpha block comes first, then the color block	*/
+			compress_DDS_alpha_block( ublock[0], compressed );
+			compress_DDS_color_block( 4, ublock[0], compressed + 8 );
+			compressed += 16;
+		}
+	}
+}
+
+/********* Helper Functions *********/
+void extract_block(
+		const unsigned char *const uncompressed,
+		int width, int height, int channels,
+		int i, int j, int out_channels,
+		unsigned char *ublock )
+{
+	int x, y, c;
+	int idx = 0, chan_step = 1;
+	int mx = 4, my = 4;
+	/*	# channels = 1 or 3 have no alpha, 2 & 4 do have alpha	*/
+	int has_alpha = 1 - (channels & 1);
+	/*	for channels == 1 or 2, I do not step forward for R,G,B values	*/
+	if( channels < 3 )
+	{
+		chan_step = 0;
+	}
+	if( j+4 >= height )
+	{
+		my = height - j;
+	}
+	if( i+4 >= width )
+	{
+		mx = width - i;
+	}
+	for( y = 0; y < my; ++y )
+	{
+		const unsigned char *src = uncompressed + ((j+y)*width + i)*channels;
+		for( x = 0; x < mx; ++x )
+		{
+			ublock[idx++] = src[0];
+			ublock[idx++] = src[chan_step];
+			ublock[idx++] = src[chan_step+chan_step];
+			if( out_channels == 4 )
 			{
-				compressed[index++] = cblock[x];
+				ublock[idx++] = has_alpha * src[channels-1] + (1-has_alpha)*255;
 			}
-			/*	then compress the color block	*/
-			++block_count;
-			compress_DDS_color_block( 4, ublock, cblock );
-			/*	copy the data from the compressed color block into the main buffer	*/
-			for( x = 0; x < 8; ++x )
+			src += channels;
+		}
+		/*	pad out the block with the first pixel	*/
+		for( x = mx; x < 4; ++x )
+		{
+			for( c = 0; c < out_channels; ++c )
 			{
-				compressed[index++] = cblock[x];
+				ublock[idx++] = ublock[c];
+			}
+		}
+	}
+	for( y = my; y < 4; ++y )
+	{
+		for( x = 0; x < 4; ++x )
+		{
+			for( c = 0; c < out_channels; ++c )
+			{
+				ublock[idx++] = ublock[c];
 			}
 		}
 	}
-	return compressed;
 }
 
-/********* Helper Functions *********/
 int convert_bit_range( int c, int from_bits, int to_bits )
 {
 	int b = (1 << (from_bits - 1)) + c * ((1 << to_bits) - 1);
@@ -574,6 +639,262 @@ void
 	/*	done compressing to DXT1	*/
 }
 
+#ifdef DXT_HAS_SSE2
+/*	truncates to an int after clamping to [lo,hi]
+	(matches the scalar "(int)x then clamp", NaN becomes lo)	*/
+static __m128i clamp_truncate( __m128 x, float lo, float hi )
+{
+	x = _mm_max_ps( x, _mm_set1_ps( lo ) );
+	x = _mm_min_ps( x, _mm_set1_ps( hi ) );
+	return _mm_cvttps_epi32( x );
+}
+
+/*	convert_bit_range( c, 8, bits ), c in [0,255]	*/
+static __m128i bit_range_from_8( __m128i c, int bits )
+{
+	__m128i b = _mm_sub_epi32(
+			_mm_sll_epi32( c, _mm_cvtsi32_si128( bits ) ), c );
+	b = _mm_add_epi32( b, _mm_set1_epi32( 128 ) );
+	b = _mm_add_epi32( b, _mm_srli_epi32( b, 8 ) );
+	return _mm_srli_epi32( b, 8 );
+}
+
+/*	convert_bit_range( c, bits, 8 ), c in [0,2^bits)	*/
+static __m128i bit_range_to_8( __m128i c, int bits )
+{
+	__m128i shift = _mm_cvtsi32_si128( bits );
+	__m128i b = _mm_sub_epi32( _mm_slli_epi32( c, 8 ), c );
+	b = _mm_add_epi32( b, _mm_set1_epi32( 1 << (bits - 1) ) );
+	b = _mm_add_epi32( b, _mm_srl_epi32( b, shift ) );
+	return _mm_srl_epi32( b, shift );
+}
+
+/*	rgb_to_565 on ints in [0,255]	*/
+static __m128i rgb_to_565_SSE2( __m128i r, __m128i g, __m128i b )
+{
+	return _mm_or_si128(
+			_mm_or_si128(
+				_mm_slli_epi32( bit_range_from_8( r, 5 ), 11 ),
+				_mm_slli_epi32( bit_range_from_8( g, 6 ), 5 ) ),
+			bit_range_from_8( b, 5 ) );
+}
+
+void compress_DDS_color_blocks_SSE2(
+		const unsigned char *const block0,
+		const unsigned char *const block1,
+		const unsigned char *const block2,
+		const unsigned char *const block3,
+		unsigned char *compressed[4] )
+{
+	/*	one lane per block, the arithmetic is done in exactly the
+		same order as the scalar code so the output is identical	*/
+	__m128i rows[4], t[4];
+	__m128 px[16][3];
+	__m128 sum[3], sum_xx[6], dir[3], vec[3];
+	__m128 dot, dot_max, dot_min, vec_len2, dot_offset, mask;
+	__m128 half = _mm_set1_ps( 0.5f );
+	__m128i c[2][3], enc_c0, enc_c1, larger, indices, v;
+	__m128i one = _mm_set1_epi32( 1 ), three = _mm_set1_epi32( 3 );
+	__m128i byte_mask = _mm_set1_epi32( 255 );
+	int i, k, it;
+	/*	transpose the RGBA pixels, 4 at a time, so each
+		vector holds the same pixel from all 4 blocks	*/
+	for( i = 0; i < 16; i += 4 )
+	{
+		rows[0] = _mm_loadu_si128( (const __m128i *)(block0 + i*4) );
+		rows[1] = _mm_loadu_si128( (const __m128i *)(block1 + i*4) );
+		rows[2] = _mm_loadu_si128( (const __m128i *)(block2 + i*4) );
+		rows[3] = _mm_loadu_si128( (const __m128i *)(block3 + i*4) );
+		t[0] = _mm_unpacklo_epi32( rows[0], rows[1] );
+		t[1] = _mm_unpacklo_epi32( rows[2], rows[3] );
+		t[2] = _mm_unpackhi_epi32( rows[0], rows[1] );
+		t[3] = _mm_unpackhi_epi32( rows[2], rows[3] );
+		rows[0] = _mm_unpacklo_epi64( t[0], t[1] );
+		rows[1] = _mm_unpackhi_epi64( t[0], t[1] );
+		rows[2] = _mm_unpacklo_epi64( t[2], t[3] );
+		rows[3] = _mm_unpackhi_epi64( t[2], t[3] );
+		for( k = 0; k < 4; ++k )
+		{
+			px[i+k][0] = _mm_cvtepi32_ps( _mm_and_si128( rows[k], byte_mask ) );
+			px[i+k][1] = _mm_cvtepi32_ps( _mm_and_si128(
+					_mm_srli_epi32( rows[k], 8 ), byte_mask ) );
+			px[i+k][2] = _mm_cvtepi32_ps( _mm_and_si128(
+					_mm_srli_epi32( rows[k], 16 ), byte_mask ) );
+		}
+	}
+	/*	the sums are of integers (< 2^24), so they are exact in any order	*/
+	for( it = 0; it < 3; ++it )
+	{
+		sum[it] = _mm_setzero_ps();
+	}
+	for( it = 0; it < 6; ++it )
+	{
+		sum_xx[it] = _mm_setzero_ps();
+	}
+	for( i = 0; i < 16; ++i )
+	{
+		sum[0] = _mm_add_ps( sum[0], px[i][0] );
+		sum[1] = _mm_add_ps( sum[1], px[i][1] );
+		sum[2] = _mm_add_ps( sum[2], px[i][2] );
+		/*	rr, gg, bb, rg, rb, gb	*/
+		sum_xx[0] = _mm_add_ps( sum_xx[0], _mm_mul_ps( px[i][0], px[i][0] ) );
+		sum_xx[1] = _mm_add_ps( sum_xx[1], _mm_mul_ps( px[i][1], px[i][1] ) );
+		sum_xx[2] = _mm_add_ps( sum_xx[2], _mm_mul_ps( px[i][2], px[i][2] ) );
+		sum_xx[3] = _mm_add_ps( sum_xx[3], _mm_mul_ps( px[i][0], px[i][1] ) );
+		sum_xx[4] = _mm_add_ps( sum_xx[4], _mm_mul_ps( px[i][0], px[i][2] ) );
+		sum_xx[5] = _mm_add_ps( sum_xx[5], _mm_mul_ps( px[i][1], px[i][2] ) );
+	}
+	/*	averages, and the squares to the squares of the value - avg_value	*/
+	for( it = 0; it < 3; ++it )
+	{
+		sum[it] = _mm_mul_ps( sum[it], _mm_set1_ps( 1.0f / 16.0f ) );
+		vec[it] = _mm_mul_ps( _mm_set1_ps( 16.0f ), sum[it] );
+	}
+	sum_xx[0] = _mm_sub_ps( sum_xx[0], _mm_mul_ps( vec[0], sum[0] ) );
+	sum_xx[1] = _mm_sub_ps( sum_xx[1], _mm_mul_ps( vec[1], sum[1] ) );
+	sum_xx[2] = _mm_sub_ps( sum_xx[2], _mm_mul_ps( vec[2], sum[2] ) );
+	sum_xx[3] = _mm_sub_ps( sum_xx[3], _mm_mul_ps( vec[0], sum[1] ) );
+	sum_xx[4] = _mm_sub_ps( sum_xx[4], _mm_mul_ps( vec[0], sum[2] ) );
+	sum_xx[5] = _mm_sub_ps( sum_xx[5], _mm_mul_ps( vec[1], sum[2] ) );
+	/*	power method on the covariance matrix (see compute_color_line_STDEV)	*/
+	dir[0] = _mm_set1_ps( 1.0f );
+	dir[1] = _mm_set1_ps( 2.718281828f );
+	dir[2] = _mm_set1_ps( 3.141592654f );
+	for( it = 0; it < 3; ++it )
+	{
+		vec[0] = _mm_add_ps( _mm_add_ps(
+				_mm_mul_ps( dir[0], sum_xx[0] ),
+				_mm_mul_ps( dir[1], sum_xx[3] ) ),
+				_mm_mul_ps( dir[2], sum_xx[4] ) );
+		vec[1] = _mm_add_ps( _mm_add_ps(
+				_mm_mul_ps( dir[0], sum_xx[3] ),
+				_mm_mul_ps( dir[1], sum_xx[1] ) ),
+				_mm_mul_ps( dir[2], sum_xx[5] ) );
+		vec[2] = _mm_add_ps( _mm_add_ps(
+				_mm_mul_ps( dir[0], sum_xx[4] ),
+				_mm_mul_ps( dir[1], sum_xx[5] ) ),
+				_mm_mul_ps( dir[2], sum_xx[2] ) );
+		dir[0] = vec[0];
+		dir[1] = vec[1];
+		dir[2] = vec[2];
+	}
+	vec_len2 = _mm_div_ps( _mm_set1_ps( 1.0f ), _mm_add_ps( _mm_add_ps( _mm_add_ps(
+			_mm_set1_ps( 0.00001f ),
+			_mm_mul_ps( dir[0], dir[0] ) ),
+			_mm_mul_ps( dir[1], dir[1] ) ),
+			_mm_mul_ps( dir[2], dir[2] ) ) );
+	/*	finding the max and min vector values	*/
+	for( i = 0; i < 16; ++i )
+	{
+		dot = _mm_add_ps( _mm_add_ps(
+				_mm_mul_ps( dir[0], px[i][0] ),
+				_mm_mul_ps( dir[1], px[i][1] ) ),
+				_mm_mul_ps( dir[2], px[i][2] ) );
+		if( i == 0 )
+		{
+			dot_max = dot_min = dot;
+		} else
+		{
+			dot_max = _mm_max_ps( dot_max, dot );
+			dot_min = _mm_min_ps( dot_min, dot );
+		}
+	}
+	/*	and the offset (from the average location)	*/
+	dot = _mm_add_ps( _mm_add_ps(
+			_mm_mul_ps( dir[0], sum[0] ),
+			_mm_mul_ps( dir[1], sum[1] ) ),
+			_mm_mul_ps( dir[2], sum[2] ) );
+	dot_min = _mm_mul_ps( _mm_sub_ps( dot_min, dot ), vec_len2 );
+	dot_max = _mm_mul_ps( _mm_sub_ps( dot_max, dot ), vec_len2 );
+	/*	build the master colors	*/
+	for( it = 0; it < 3; ++it )
+	{
+		__m128 base = _mm_add_ps( half, sum[it] );
+		c[0][it] = clamp_truncate( _mm_add_ps( base,
+				_mm_mul_ps( dot_max, dir[it] ) ), 0.0f, 255.0f );
+		c[1][it] = clamp_truncate( _mm_add_ps( base,
+				_mm_mul_ps( dot_min, dir[it] ) ), 0.0f, 255.0f );
+	}
+	enc_c0 = rgb_to_565_SSE2( c[0][0], c[0][1], c[0][2] );
+	enc_c1 = rgb_to_565_SSE2( c[1][0], c[1][1], c[1][2] );
+	larger = _mm_cmpgt_epi32( enc_c0, enc_c1 );
+	v = _mm_or_si128( _mm_and_si128( larger, enc_c0 ),
+			_mm_andnot_si128( larger, enc_c1 ) );
+	enc_c1 = _mm_or_si128( _mm_and_si128( larger, enc_c1 ),
+			_mm_andnot_si128( larger, enc_c0 ) );
+	enc_c0 = v;
+	/*	reconstitute the master color vectors	*/
+	c[0][0] = bit_range_to_8( _mm_srli_epi32( enc_c0, 11 ), 5 );
+	c[0][1] = bit_range_to_8( _mm_and_si128( _mm_srli_epi32( enc_c0, 5 ),
+			_mm_set1_epi32( 63 ) ), 6 );
+	c[0][2] = bit_range_to_8( _mm_and_si128( enc_c0, _mm_set1_epi32( 31 ) ), 5 );
+	c[1][0] = bit_range_to_8( _mm_srli_epi32( enc_c1, 11 ), 5 );
+	c[1][1] = bit_range_to_8( _mm_and_si128( _mm_srli_epi32( enc_c1, 5 ),
+			_mm_set1_epi32( 63 ) ), 6 );
+	c[1][2] = bit_range_to_8( _mm_and_si128( enc_c1, _mm_set1_epi32( 31 ) ), 5 );
+	/*	the new vector	*/
+	for( it = 0; it < 3; ++it )
+	{
+		vec[it] = _mm_cvtepi32_ps( _mm_sub_epi32( c[1][it], c[0][it] ) );
+	}
+	vec_len2 = _mm_add_ps( _mm_add_ps(
+			_mm_mul_ps( vec[0], vec[0] ),
+			_mm_mul_ps( vec[1], vec[1] ) ),
+			_mm_mul_ps( vec[2], vec[2] ) );
+	mask = _mm_cmpgt_ps( vec_len2, _mm_setzero_ps() );
+	vec_len2 = _mm_or_ps( _mm_and_ps( mask,
+			_mm_div_ps( _mm_set1_ps( 1.0f ), vec_len2 ) ),
+			_mm_andnot_ps( mask, vec_len2 ) );
+	/*	pre-proform the scaling	*/
+	for( it = 0; it < 3; ++it )
+	{
+		vec[it] = _mm_mul_ps( vec[it], vec_len2 );
+		dir[it] = _mm_cvtepi32_ps( c[0][it] );
+	}
+	/*	compute the offset (constant) portion of the dot product	*/
+	dot_offset = _mm_add_ps( _mm_add_ps(
+			_mm_mul_ps( vec[0], dir[0] ),
+			_mm_mul_ps( vec[1], dir[1] ) ),
+			_mm_mul_ps( vec[2], dir[2] ) );
+	/*	2 bits per pixel, in the "stupid order" { 0, 2, 3, 1 }	*/
+	indices = _mm_setzero_si128();
+	for( i = 0; i < 16; ++i )
+	{
+		dot = _mm_sub_ps( _mm_add_ps( _mm_add_ps(
+				_mm_mul_ps( vec[0], px[i][0] ),
+				_mm_mul_ps( vec[1], px[i][1] ) ),
+				_mm_mul_ps( vec[2], px[i][2] ) ),
+				dot_offset );
+		v = clamp_truncate( _mm_add_ps( _mm_mul_ps( dot,
+				_mm_set1_ps( 3.0f ) ), half ), 0.0f, 3.0f );
+		v = _mm_add_epi32( _mm_add_epi32( v, one ), _mm_add_epi32(
+				_mm_cmpeq_epi32( v, _mm_setzero_si128() ),
+				_mm_and_si128( _mm_cmpeq_epi32( v, three ),
+					_mm_set1_epi32( -3 ) ) ) );
+		indices = _mm_or_si128( indices,
+				_mm_sll_epi32( v, _mm_cvtsi32_si128( 2*i ) ) );
+	}
+	/*	and store the blocks	*/
+	for( k = 0; k < 4; ++k )
+	{
+		unsigned int e0 = (unsigned int)_mm_cvtsi128_si32( enc_c0 );
+		unsigned int e1 = (unsigned int)_mm_cvtsi128_si32( enc_c1 );
+		unsigned int bits = (unsigned int)_mm_cvtsi128_si32( indices );
+		compressed[k][0] = (e0 >> 0) & 255;
+		compressed[k][1] = (e0 >> 8) & 255;
+		compressed[k][2] = (e1 >> 0) & 255;
+		compressed[k][3] = (e1 >> 8) & 255;
+		compressed[k][4] = (bits >> 0) & 255;
+		compressed[k][5] = (bits >> 8) & 255;
+		compressed[k][6] = (bits >> 16) & 255;
+		compressed[k][7] = (bits >> 24) & 255;
+		enc_c0 = _mm_srli_si128( enc_c0, 4 );
+		enc_c1 = _mm_srli_si128( enc_c1, 4 );
+		indices = _mm_srli_si128( indices, 4 );
+	}
+}
+#endif
+
 void
 	compress_DDS_alpha_block
 	(
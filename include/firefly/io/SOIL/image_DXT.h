@@ -45,6 +45,44 @@ convert_image_to_DXT5
     int *out_size
 );
 
+/**
+	compress block rows [first_row, first_row + row_count) of an image
+	straight into the output of convert_image_to_DXT1 / DXT5, so
+	different rows can be compressed on different threads
+**/
+void
+convert_image_rows_to_DXT1
+(
+    const unsigned char *const uncompressed,
+    int width, int height, int channels,
+    int first_row, int row_count,
+    unsigned char *compressed
+);
+
+void
+convert_image_rows_to_DXT5
+(
+    const unsigned char *const uncompressed,
+    int width, int height, int channels,
+    int first_row, int row_count,
+    unsigned char *compressed
+);
+
+/**
+	select the color block compressor, both give identical output
+	(SSE2 is the default when it is compiled in, otherwise this is
+	ignored).  Not thread safe, set it before compressing anything.
+	\return the previous mode
+**/
+#define DXT_COMPRESSOR_SCALAR	0
+#define DXT_COMPRESSOR_SSE2	1
+
+int
+set_DXT_compressor
+(
+    int mode
+);
+
 /**	A bunch of DirectDraw Surface structures and flags **/
 typedef struct
 {
@@ -10,6 +10,11 @@
 #include <stdlib.h>
 #include <math.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGE_HELPER_SSE2
+#include <emmintrin.h>
+#endif
+
 /*	Upscaling the image uses simple bilinear interpolation	*/
 int
 	up_scale_image
@@ -151,6 +156,437 @@ int
 	return 1;
 }
 
+/*	the MIPmap chain is built from exact block sums, so in linear mode
+	the results match mipmap_image() bit for bit.  Each band of base
+	image rows is filtered down to MIPMAP_BAND_LEVELS on its own, the
+	coarser levels are finished off from the sums the bands leave.	*/
+#define MIPMAP_BAND_LEVELS	4
+
+static unsigned short sRGB_to_linear_LUT[256];
+static double sRGB_midpoints[256];
+static unsigned char sRGB_buckets[4096];
+
+void
+	mipmap_init_sRGB_tables
+	(
+		void
+	)
+{
+	int i, j = 0;
+	double prev = 0.0;
+	for( i = 0; i < 256; ++i )
+	{
+		double c = i / 255.0;
+		double lin = (c <= 0.04045) ? c / 12.92 : pow( (c + 0.055) / 1.055, 2.4 );
+		lin *= 65535.0;
+		if( i > 0 )
+		{
+			sRGB_midpoints[i-1] = 0.5 * (prev + lin);
+		}
+		prev = lin;
+		sRGB_to_linear_LUT[i] = (unsigned short)(lin + 0.5);
+	}
+	sRGB_midpoints[255] = 65536.0;
+	/*	the first candidate for every 16 linear steps	*/
+	for( i = 0; i < 4096; ++i )
+	{
+		while( i * 16.0 >= sRGB_midpoints[j] )
+		{
+			++j;
+		}
+		sRGB_buckets[i] = (unsigned char)j;
+	}
+}
+
+/*	the sRGB value closest to this linear one (on the 0-65535 scale)	*/
+static unsigned char linear_to_sRGB( double lin )
+{
+	int i = sRGB_buckets[(int)lin >> 4];
+	while( lin >= sRGB_midpoints[i] )
+	{
+		++i;
+	}
+	return (unsigned char)i;
+}
+
+static int is_power_of_two( int x )
+{
+	return (x > 0) && ((x & (x - 1)) == 0);
+}
+
+/*	how many levels are filtered inside each band	*/
+static int mipmap_band_levels( int height )
+{
+	int m = 0;
+	while( (m < MIPMAP_BAND_LEVELS) && ((2 << m) <= height) )
+	{
+		++m;
+	}
+	return m;
+}
+
+/*	the alpha channel is never converted to linear	*/
+static int is_color_channel( int c, int channels )
+{
+	return ((channels & 1) == 1) || (c < channels - 1);
+}
+
+/*	sums 2 rows (and pairs of pixels when combine_x is set) of
+	"width" pixels, writing can be done in place over row0	*/
+static void sum_mip_rows(
+		unsigned int *dst,
+		const unsigned int *row0, const unsigned int *row1,
+		int width, int channels, int combine_x )
+{
+	int i = 0, c;
+	int count = width * channels;
+	if( !combine_x )
+	{
+		#ifdef IMAGE_HELPER_SSE2
+		for( ; i + 4 <= count; i += 4 )
+		{
+			_mm_storeu_si128( (__m128i*)(dst + i), _mm_add_epi32(
+					_mm_loadu_si128( (const __m128i*)(row0 + i) ),
+					_mm_loadu_si128( (const __m128i*)(row1 + i) ) ) );
+		}
+		#endif
+		for( ; i < count; ++i )
+		{
+			dst[i] = row0[i] + row1[i];
+		}
+		return;
+	}
+	#ifdef IMAGE_HELPER_SSE2
+	/*	8 source values at a time, for the channel counts
+		that split evenly into vectors	*/
+	if( channels != 3 )
+	{
+		for( ; i + 8 <= count; i += 8 )
+		{
+			__m128i a = _mm_add_epi32(
+					_mm_loadu_si128( (const __m128i*)(row0 + i) ),
+					_mm_loadu_si128( (const __m128i*)(row1 + i) ) );
+			__m128i b = _mm_add_epi32(
+					_mm_loadu_si128( (const __m128i*)(row0 + i + 4) ),
+					_mm_loadu_si128( (const __m128i*)(row1 + i + 4) ) );
+			__m128i s;
+			if( channels == 4 )
+			{
+				s = _mm_add_epi32( a, b );
+			} else if( channels == 2 )
+			{
+				s = _mm_add_epi32( _mm_unpacklo_epi64( a, b ), _mm_unpackhi_epi64( a, b ) );
+			} else
+			{
+				s = _mm_add_epi32(
+						_mm_castps_si128( _mm_shuffle_ps( _mm_castsi128_ps( a ),
+							_mm_castsi128_ps( b ), _MM_SHUFFLE( 2, 0, 2, 0 ) ) ),
+						_mm_castps_si128( _mm_shuffle_ps( _mm_castsi128_ps( a ),
+							_mm_castsi128_ps( b ), _MM_SHUFFLE( 3, 1, 3, 1 ) ) ) );
+			}
+			_mm_storeu_si128( (__m128i*)(dst + i/2), s );
+		}
+	}
+	#endif
+	for( ; i < count; i += 2*channels )
+	{
+		for( c = 0; c < channels; ++c )
+		{
+			dst[i/2 + c] = row0[i + c] + row0[i + channels + c]
+					+ row1[i + c] + row1[i + channels + c];
+		}
+	}
+}
+
+int
+	mipmap_chain_levels
+	(
+		int width, int height
+	)
+{
+	int count = 0;
+	while( ((2 << count) <= width) || ((2 << count) <= height) )
+	{
+		++count;
+	}
+	return count;
+}
+
+int
+	mipmap_chain_bands
+	(
+		int width, int height, int channels,
+		int flags, int *scratch_size
+	)
+{
+	int m;
+	/*	error check	*/
+	if( !is_power_of_two( width ) || !is_power_of_two( height ) ||
+		(channels < 1) || (channels > 4) )
+	{
+		return 0;
+	}
+	m = mipmap_band_levels( height );
+	if( NULL != scratch_size )
+	{
+		int w = width >> m;
+		if( w < 1 )
+		{
+			w = 1;
+		}
+		*scratch_size = w * (height >> m) * channels * (int)sizeof(unsigned int);
+	}
+	return height >> m;
+}
+
+int
+	mipmap_image_chain_band
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char** levels,
+		void *scratch,
+		int flags, int band
+	)
+{
+	int m = mipmap_band_levels( height );
+	int band_height = 1 << m;
+	int count = width * band_height * channels;
+	int cur_width = width, cur_height = band_height;
+	int area_shift = 0;
+	int i, j, k, c;
+	const unsigned char *src = orig + band * count;
+	unsigned int *sums = (unsigned int*)malloc( count * sizeof(unsigned int) );
+	if( NULL == sums )
+	{
+		return 0;
+	}
+	/*	widen the band of the base image to sums	*/
+	i = 0;
+	if( flags & MIPMAP_SRGB )
+	{
+		for( ; i < count; i += channels )
+		{
+			for( c = 0; c < channels; ++c )
+			{
+				sums[i+c] = is_color_channel( c, channels )
+						? sRGB_to_linear_LUT[src[i+c]] : src[i+c];
+			}
+		}
+	}
+	#ifdef IMAGE_HELPER_SSE2
+	for( ; i + 16 <= count; i += 16 )
+	{
+		__m128i zero = _mm_setzero_si128();
+		__m128i v = _mm_loadu_si128( (const __m128i*)(src + i) );
+		__m128i lo = _mm_unpacklo_epi8( v, zero );
+		__m128i hi = _mm_unpackhi_epi8( v, zero );
+		_mm_storeu_si128( (__m128i*)(sums + i +  0), _mm_unpacklo_epi16( lo, zero ) );
+		_mm_storeu_si128( (__m128i*)(sums + i +  4), _mm_unpackhi_epi16( lo, zero ) );
+		_mm_storeu_si128( (__m128i*)(sums + i +  8), _mm_unpacklo_epi16( hi, zero ) );
+		_mm_storeu_si128( (__m128i*)(sums + i + 12), _mm_unpackhi_epi16( hi, zero ) );
+	}
+	#endif
+	for( ; i < count; ++i )
+	{
+		sums[i] = src[i];
+	}
+	/*	then filter it down, in place	*/
+	for( k = 1; k <= m; ++k )
+	{
+		int combine_x = ((1 << k) <= width);
+		int next_width = combine_x ? cur_width / 2 : cur_width;
+		int next_height = cur_height / 2;
+		int row_size = next_width * channels;
+		unsigned char *out = levels[k-1] + band * next_height * row_size;
+		area_shift += combine_x ? 2 : 1;
+		for( j = 0; j < next_height; ++j )
+		{
+			sum_mip_rows( sums + j*row_size,
+					sums + (2*j)*cur_width*channels,
+					sums + (2*j+1)*cur_width*channels,
+					cur_width, channels, combine_x );
+		}
+		cur_width = next_width;
+		cur_height = next_height;
+		/*	and store this level, rounded	*/
+		count = next_height * row_size;
+		i = 0;
+		if( flags & MIPMAP_SRGB )
+		{
+			double scale = 1.0 / (1 << area_shift);
+			for( ; i < count; i += channels )
+			{
+				for( c = 0; c < channels; ++c )
+				{
+					out[i+c] = is_color_channel( c, channels )
+							? linear_to_sRGB( sums[i+c] * scale )
+							: (unsigned char)((sums[i+c] + ((1 << area_shift) >> 1)) >> area_shift);
+				}
+			}
+		}
+		#ifdef IMAGE_HELPER_SSE2
+		{
+			__m128i half = _mm_set1_epi32( (1 << area_shift) >> 1 );
+			__m128i shift = _mm_cvtsi32_si128( area_shift );
+			for( ; i + 8 <= count; i += 8 )
+			{
+				__m128i a = _mm_srl_epi32( _mm_add_epi32( half,
+						_mm_loadu_si128( (const __m128i*)(sums + i) ) ), shift );
+				__m128i b = _mm_srl_epi32( _mm_add_epi32( half,
+						_mm_loadu_si128( (const __m128i*)(sums + i + 4) ) ), shift );
+				a = _mm_packs_epi32( a, b );
+				_mm_storel_epi64( (__m128i*)(out + i), _mm_packus_epi16( a, a ) );
+			}
+		}
+		#endif
+		for( ; i < count; ++i )
+		{
+			out[i] = (unsigned char)((sums[i] + ((1 << area_shift) >> 1)) >> area_shift);
+		}
+	}
+	/*	leave the last level's sums for mipmap_image_chain_finish	*/
+	count = cur_width * channels;
+	for( i = 0; i < count; ++i )
+	{
+		((unsigned int*)scratch)[band * count + i] = sums[i];
+	}
+	free( sums );
+	return 1;
+}
+
+int
+	mipmap_image_chain_finish
+	(
+		int width, int height, int channels,
+		unsigned char** levels,
+		const void *scratch,
+		int flags
+	)
+{
+	int m = mipmap_band_levels( height );
+	int levels_count = mipmap_chain_levels( width, height );
+	int cur_width = width >> m, cur_height = height >> m;
+	double area;
+	int i, j, k, c, count;
+	double *sums;
+	if( cur_width < 1 )
+	{
+		cur_width = 1;
+	}
+	/*	the block covered by the sums so far	*/
+	area = (double)(width / cur_width) * (double)(height / cur_height);
+	count = cur_width * cur_height * channels;
+	/*	doubles keep the sums exact no matter how big the blocks get	*/
+	sums = (double*)malloc( count * sizeof(double) );
+	if( NULL == sums )
+	{
+		return 0;
+	}
+	for( i = 0; i < count; ++i )
+	{
+		sums[i] = ((const unsigned int*)scratch)[i];
+	}
+	for( k = m + 1; k <= levels_count; ++k )
+	{
+		int combine_x = ((1 << k) <= width);
+		int combine_y = ((1 << k) <= height);
+		int next_width = combine_x ? cur_width / 2 : cur_width;
+		int next_height = combine_y ? cur_height / 2 : cur_height;
+		int x_step = combine_x ? channels : 0;
+		int y_step = combine_y ? cur_width * channels : 0;
+		unsigned char *out = levels[k-1];
+		for( j = 0; j < next_height; ++j )
+		{
+			for( i = 0; i < next_width; ++i )
+			{
+				const double *s = sums + ((combine_y ? 2*j : j)*cur_width
+						+ (combine_x ? 2*i : i)) * channels;
+				double *d = sums + (j*next_width + i) * channels;
+				for( c = 0; c < channels; ++c )
+				{
+					double sum = s[c];
+					if( combine_x )
+					{
+						sum += s[x_step + c];
+					}
+					if( combine_y )
+					{
+						sum += s[y_step + c];
+						if( combine_x )
+						{
+							sum += s[y_step + x_step + c];
+						}
+					}
+					d[c] = sum;
+				}
+			}
+		}
+		area *= (combine_x ? 2.0 : 1.0) * (combine_y ? 2.0 : 1.0);
+		cur_width = next_width;
+		cur_height = next_height;
+		/*	store this level, rounded	*/
+		count = cur_width * cur_height * channels;
+		for( i = 0; i < count; i += channels )
+		{
+			for( c = 0; c < channels; ++c )
+			{
+				if( (flags & MIPMAP_SRGB) && is_color_channel( c, channels ) )
+				{
+					out[i+c] = linear_to_sRGB( sums[i+c] / area );
+				} else
+				{
+					out[i+c] = (unsigned char)floor( (sums[i+c] + 0.5 * area) / area );
+				}
+			}
+		}
+	}
+	free( sums );
+	return 1;
+}
+
+int
+	mipmap_image_chain
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char** levels,
+		int flags
+	)
+{
+	int scratch_size = 0;
+	int bands = mipmap_chain_bands( width, height, channels, flags, &scratch_size );
+	int count = mipmap_chain_levels( width, height );
+	int i;
+	void *scratch;
+	/*	error check	*/
+	if( (NULL == orig) || (NULL == levels) )
+	{
+		return 0;
+	}
+	if( bands == 0 )
+	{
+		/*	not a power of two, do it the old way	*/
+		for( i = 1; i <= count; ++i )
+		{
+			mipmap_image( orig, width, height, channels, levels[i-1], 1 << i, 1 << i );
+		}
+		return count;
+	}
+	scratch = malloc( scratch_size );
+	if( NULL == scratch )
+	{
+		return 0;
+	}
+	for( i = 0; i < bands; ++i )
+	{
+		mipmap_image_chain_band( orig, width, height, channels, levels, scratch, flags, i );
+	}
+	mipmap_image_chain_finish( width, height, channels, levels, scratch, flags );
+	free( scratch );
+	return count;
+}
+
 int
 	scale_image_RGB_to_NTSC_safe
 	(
@@ -43,6 +43,81 @@ int
 		int block_size_x, int block_size_y
 	);
 
+/**
+	This function builds a whole MIPmap chain in one pass
+	over the image.  MIPmap level k (1 <= k <= count) goes into
+	levels[k-1], which must hold max(width>>k,1) by max(height>>k,1)
+	pixels.  The results are identical to mipmap_image() with a
+	(1<<k) block, unless MIPMAP_SRGB is given, which averages the
+	color channels in linear space instead (alpha stays linear).
+	Images that aren't power-of-two sized fall back on mipmap_image().
+	MIPMAP_SRGB needs mipmap_init_sRGB_tables() to have been called.
+	\return the number of levels built (see mipmap_chain_levels)
+**/
+#define MIPMAP_SRGB	1
+
+/**
+	Builds the sRGB conversion tables MIPMAP_SRGB uses.  Call it
+	once, before any thread can build an sRGB MIPmap chain.
+**/
+void
+	mipmap_init_sRGB_tables
+	(
+		void
+	);
+
+int
+	mipmap_image_chain
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char** levels,
+		int flags
+	);
+
+/**
+	The number of MIPmap levels below the base image.
+**/
+int
+	mipmap_chain_levels
+	(
+		int width, int height
+	);
+
+/**
+	mipmap_image_chain() split up so the work can be spread across
+	threads.  mipmap_chain_bands() returns the number of bands (0 if
+	the image isn't power-of-two sized) and the size in bytes of the
+	scratch memory they share.  Every band can then be done in any
+	order or in parallel, and once they are all done
+	mipmap_image_chain_finish() fills in the remaining levels.
+**/
+int
+	mipmap_chain_bands
+	(
+		int width, int height, int channels,
+		int flags, int *scratch_size
+	);
+
+int
+	mipmap_image_chain_band
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char** levels,
+		void *scratch,
+		int flags, int band
+	);
+
+int
+	mipmap_image_chain_finish
+	(
+		int width, int height, int channels,
+		unsigned char** levels,
+		const void *scratch,
+		int flags
+	);
+
 /**
 	This function takes the RGB components of the image
 	and scales each channel from [0,255] to [16,235].
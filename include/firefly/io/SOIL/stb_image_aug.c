@@ -78,6 +78,17 @@
 #include <assert.h>
 #include <stdarg.h>
 
+#if STBI_SIMD && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define STBI_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+  #define STBI_ALIGN16(x)  __declspec(align(16)) x
+#else
+  #define STBI_ALIGN16(x)  x __attribute__((aligned(16)))
+#endif
+
 #ifndef _MSC_VER
   #ifdef __cplusplus
   #define __forceinline inline
@@ -976,7 +987,128 @@ static void idct_block(uint8 *out, int out_stride, short data[64], unsigned shor
       o[4] = clamp((x3-t0) >> 17);
    }
 }
+#ifdef STBI_SSE2
+// SSE2 version of idct_block. Each IDCT_1D output is rewritten as pmaddwd's
+// of (16-bit input pair) x (summed f2f constants), which is the same integer
+// math modulo 2^32, so the result is bit-identical whenever the inputs to
+// both passes fit in 16 bits. Blocks that don't (never for sane files) take
+// the scalar path.
+
+#define IDCT_SSE2_PAIR(a,b)   _mm_setr_epi16((a),(b),(a),(b),(a),(b),(a),(b))
+
+// 1D IDCT of 8 vectors of 8 lanes each, out[i] = (x +/- t + bias) >> shift
+static void idct_1d_sse2(__m128i out[8][2], const __m128i s[8], int bias, int shift)
+{
+   const int c5 = f2f( 1.175875602f), ca = f2f( 0.298631336f), cb = f2f( 2.053119869f);
+   const int cc = f2f( 3.072711026f), cd = f2f( 1.501321110f), ce = f2f(-0.899976223f);
+   const int cf = f2f(-2.562915447f), cg = f2f(-1.961570560f), ch = f2f(-0.390180644f);
+   const int c1 = f2f( 0.5411961f),   c2 = f2f(-1.847759065f), c3 = f2f( 0.765366865f);
+   __m128i s04[2],s26[2],s13[2],s57[2];
+   __m128i bias_v = _mm_set1_epi32(bias);
+   __m128i shift_v = _mm_cvtsi32_si128(shift);
+   int h;
+
+   s04[0] = _mm_unpacklo_epi16(s[0], s[4]); s04[1] = _mm_unpackhi_epi16(s[0], s[4]);
+   s26[0] = _mm_unpacklo_epi16(s[2], s[6]); s26[1] = _mm_unpackhi_epi16(s[2], s[6]);
+   s13[0] = _mm_unpacklo_epi16(s[1], s[3]); s13[1] = _mm_unpackhi_epi16(s[1], s[3]);
+   s57[0] = _mm_unpacklo_epi16(s[5], s[7]); s57[1] = _mm_unpackhi_epi16(s[5], s[7]);
+
+   for (h=0; h < 2; ++h) {
+      // even part
+      __m128i t0 = _mm_add_epi32(_mm_madd_epi16(s04[h], IDCT_SSE2_PAIR(4096, 4096)), bias_v);
+      __m128i t1 = _mm_add_epi32(_mm_madd_epi16(s04[h], IDCT_SSE2_PAIR(4096,-4096)), bias_v);
+      __m128i t2 = _mm_madd_epi16(s26[h], IDCT_SSE2_PAIR(c1, c1+c2));
+      __m128i t3 = _mm_madd_epi16(s26[h], IDCT_SSE2_PAIR(c1+c3, c1));
+      __m128i x0 = _mm_add_epi32(t0, t3);
+      __m128i x3 = _mm_sub_epi32(t0, t3);
+      __m128i x1 = _mm_add_epi32(t1, t2);
+      __m128i x2 = _mm_sub_epi32(t1, t2);
+      // odd part, the p1..p5 terms folded into the constants
+      __m128i o0 = _mm_add_epi32(_mm_madd_epi16(s13[h], IDCT_SSE2_PAIR(c5+ce, c5+cg)),
+                                 _mm_madd_epi16(s57[h], IDCT_SSE2_PAIR(c5, ca+c5+ce+cg)));
+      __m128i o1 = _mm_add_epi32(_mm_madd_epi16(s13[h], IDCT_SSE2_PAIR(c5+ch, c5+cf)),
+                                 _mm_madd_epi16(s57[h], IDCT_SSE2_PAIR(cb+c5+cf+ch, c5)));
+      __m128i o2 = _mm_add_epi32(_mm_madd_epi16(s13[h], IDCT_SSE2_PAIR(c5, cc+c5+cf+cg)),
+                                 _mm_madd_epi16(s57[h], IDCT_SSE2_PAIR(c5+cf, c5+cg)));
+      __m128i o3 = _mm_add_epi32(_mm_madd_epi16(s13[h], IDCT_SSE2_PAIR(cd+c5+ce+ch, c5)),
+                                 _mm_madd_epi16(s57[h], IDCT_SSE2_PAIR(c5+ch, c5+ce)));
+      out[0][h] = _mm_sra_epi32(_mm_add_epi32(x0, o3), shift_v);
+      out[7][h] = _mm_sra_epi32(_mm_sub_epi32(x0, o3), shift_v);
+      out[1][h] = _mm_sra_epi32(_mm_add_epi32(x1, o2), shift_v);
+      out[6][h] = _mm_sra_epi32(_mm_sub_epi32(x1, o2), shift_v);
+      out[2][h] = _mm_sra_epi32(_mm_add_epi32(x2, o1), shift_v);
+      out[5][h] = _mm_sra_epi32(_mm_sub_epi32(x2, o1), shift_v);
+      out[3][h] = _mm_sra_epi32(_mm_add_epi32(x3, o0), shift_v);
+      out[4][h] = _mm_sra_epi32(_mm_sub_epi32(x3, o0), shift_v);
+   }
+}
+
+// transposes 8 rows of 8 16-bit values
+static void transpose_8x8_sse2(__m128i v[8])
+{
+   __m128i a0,a1,a2,a3,a4,a5,a6,a7,b0,b1,b2,b3,b4,b5,b6,b7;
+   a0 = _mm_unpacklo_epi16(v[0], v[1]); a1 = _mm_unpackhi_epi16(v[0], v[1]);
+   a2 = _mm_unpacklo_epi16(v[2], v[3]); a3 = _mm_unpackhi_epi16(v[2], v[3]);
+   a4 = _mm_unpacklo_epi16(v[4], v[5]); a5 = _mm_unpackhi_epi16(v[4], v[5]);
+   a6 = _mm_unpacklo_epi16(v[6], v[7]); a7 = _mm_unpackhi_epi16(v[6], v[7]);
+   b0 = _mm_unpacklo_epi32(a0, a2); b1 = _mm_unpackhi_epi32(a0, a2);
+   b2 = _mm_unpacklo_epi32(a1, a3); b3 = _mm_unpackhi_epi32(a1, a3);
+   b4 = _mm_unpacklo_epi32(a4, a6); b5 = _mm_unpackhi_epi32(a4, a6);
+   b6 = _mm_unpacklo_epi32(a5, a7); b7 = _mm_unpackhi_epi32(a5, a7);
+   v[0] = _mm_unpacklo_epi64(b0, b4); v[1] = _mm_unpackhi_epi64(b0, b4);
+   v[2] = _mm_unpacklo_epi64(b1, b5); v[3] = _mm_unpackhi_epi64(b1, b5);
+   v[4] = _mm_unpacklo_epi64(b2, b6); v[5] = _mm_unpackhi_epi64(b2, b6);
+   v[6] = _mm_unpacklo_epi64(b3, b7); v[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+static void idct_block_sse2(uint8 *out, int out_stride, short data[64], unsigned short *dequantize)
+{
+   __m128i s[8], v[8][2], ok = _mm_set1_epi16(-1), range = _mm_setzero_si128();
+   __m128i half = _mm_set1_epi32(32768), bias = _mm_set1_epi32(128);
+   int i;
+
+   // dequantize, checking the products fit in 16 bits
+   for (i=0; i < 8; ++i) {
+      __m128i d  = _mm_loadu_si128((__m128i const *) (data + i*8));
+      __m128i dq = _mm_loadu_si128((__m128i const *) (dequantize + i*8));
+      __m128i lo = _mm_mullo_epi16(d, dq);
+      __m128i hi = _mm_mulhi_epi16(d, dq);
+      ok = _mm_and_si128(ok, _mm_cmpeq_epi16(hi, _mm_srai_epi16(lo, 15)));
+      s[i] = lo;
+   }
+   if (_mm_movemask_epi8(ok) != 0xffff) {
+      idct_block(out, out_stride, data, dequantize);
+      return;
+   }
+
+   // columns, keeping 2 extra bits of precision (see idct_block)
+   idct_1d_sse2(v, s, 512, 10);
+   for (i=0; i < 8; ++i) {
+      range = _mm_or_si128(range, _mm_srli_epi32(_mm_add_epi32(v[i][0], half), 16));
+      range = _mm_or_si128(range, _mm_srli_epi32(_mm_add_epi32(v[i][1], half), 16));
+      s[i] = _mm_packs_epi32(v[i][0], v[i][1]);
+   }
+   if (_mm_movemask_epi8(_mm_cmpeq_epi32(range, _mm_setzero_si128())) != 0xffff) {
+      idct_block(out, out_stride, data, dequantize);
+      return;
+   }
+
+   // rows, removing the 1<<17 scale and re-centering around 128
+   transpose_8x8_sse2(s);
+   idct_1d_sse2(v, s, 65536, 17);
+   for (i=0; i < 8; ++i)
+      s[i] = _mm_packs_epi32(_mm_add_epi32(v[i][0], bias), _mm_add_epi32(v[i][1], bias));
+   transpose_8x8_sse2(s);
+   for (i=0; i < 8; i += 2) {
+      __m128i p = _mm_packus_epi16(s[i], s[i+1]);
+      _mm_storel_epi64((__m128i *) (out + out_stride*i), p);
+      _mm_storel_epi64((__m128i *) (out + out_stride*(i+1)), _mm_srli_si128(p, 8));
+   }
+}
+static stbi_idct_8x8 stbi_idct_installed = idct_block_sse2;
+#else
 static stbi_idct_8x8 stbi_idct_installed = idct_block;
+#endif
 
 extern void stbi_install_idct(stbi_idct_8x8 func)
 {
@@ -1022,10 +1154,7 @@ static int parse_entropy_coded_data(jpeg *z)
    reset(z);
    if (z->scan_n == 1) {
       int i,j;
-      #if STBI_SIMD
-      __declspec(align(16))
-      #endif
-      short data[64];
+      STBI_ALIGN16(short data[64]);
       int n = z->order[0];
       // non-interleaved data, we just need to process one block at a time,
       // in trivial scanline order
@@ -1053,7 +1182,7 @@ static int parse_entropy_coded_data(jpeg *z)
       }
    } else { // interleaved!
       int i,j,k,x,y;
-      short data[64];
+      STBI_ALIGN16(short data[64]);
       for (j=0; j < z->img_mcu_y; ++j) {
          for (i=0; i < z->img_mcu_x; ++i) {
             // scan an interleaved mcu... process scan_n components in order
@@ -1116,7 +1245,7 @@ static int process_marker(jpeg *z, int m)
                z->dequant[t][dezigzag[i]] = get8u(&z->s);
             #if STBI_SIMD
             for (i=0; i < 64; ++i)
-               z->dequant2[t][i] = dequant[t][i];
+               z->dequant2[t][i] = z->dequant[t][i];
             #endif
             L -= 65;
          }
@@ -1378,11 +1507,101 @@ static uint8 *resample_row_generic(uint8 *out, uint8 *in_near, uint8 *in_far, in
    return out;
 }
 
+#ifdef STBI_SSE2
+// SSE2 versions of the 2x resamplers, same math in 16 bits, 8 input
+// samples at a time, with the edges and leftovers done by the scalar code
+
+// cleared to decode with the scalar resamplers, for comparing the two
+static int stbi_resample_sse2 = 1;
+
+#define load8_sse2(p)   _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const *) (p)), _mm_setzero_si128())
+
+static uint8* resample_row_v_2_sse2(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
+{
+   int i;
+   __m128i two = _mm_set1_epi16(2);
+   if (w < 8)
+      return resample_row_v_2(out, in_near, in_far, w, hs);
+   for (i=0; i+8 <= w; i += 8) {
+      __m128i n = load8_sse2(in_near + i);
+      __m128i f = load8_sse2(in_far + i);
+      __m128i v = _mm_add_epi16(_mm_add_epi16(n, _mm_add_epi16(n, n)), _mm_add_epi16(f, two));
+      v = _mm_srli_epi16(v, 2);
+      _mm_storel_epi64((__m128i *) (out + i), _mm_packus_epi16(v, v));
+   }
+   for (; i < w; ++i)
+      out[i] = div4(3*in_near[i] + in_far[i] + 2);
+   return out;
+}
+
+static uint8* resample_row_h_2_sse2(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
+{
+   int i;
+   uint8 *input = in_near;
+   __m128i two = _mm_set1_epi16(2);
+   if (w < 10)
+      return resample_row_h_2(out, in_near, in_far, w, hs);
+
+   out[0] = input[0];
+   out[1] = div4(input[0]*3 + input[1] + 2);
+   for (i=1; i+8 < w; i += 8) {
+      __m128i c = load8_sse2(input + i);
+      __m128i n = _mm_add_epi16(_mm_add_epi16(c, _mm_add_epi16(c, c)), two);
+      __m128i e = _mm_srli_epi16(_mm_add_epi16(n, load8_sse2(input + i-1)), 2);
+      __m128i o = _mm_srli_epi16(_mm_add_epi16(n, load8_sse2(input + i+1)), 2);
+      _mm_storeu_si128((__m128i *) (out + i*2), _mm_unpacklo_epi8(_mm_packus_epi16(e, e), _mm_packus_epi16(o, o)));
+   }
+   for (; i < w-1; ++i) {
+      int n = 3*input[i]+2;
+      out[i*2+0] = div4(n+input[i-1]);
+      out[i*2+1] = div4(n+input[i+1]);
+   }
+   out[i*2+0] = div4(input[w-2]*3 + input[w-1] + 2);
+   out[i*2+1] = input[w-1];
+   return out;
+}
+
+static uint8 *resample_row_hv_2_sse2(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
+{
+   int i,t0,t1;
+   __m128i eight = _mm_set1_epi16(8);
+   if (w < 10)
+      return resample_row_hv_2(out, in_near, in_far, w, hs);
+
+   t1 = 3*in_near[0] + in_far[0];
+   out[0] = div4(t1+2);
+   out[1] = div16(3*t1 + 3*in_near[1] + in_far[1] + 8);
+   for (i=1; i+8 < w; i += 8) {
+      // vertical pass for samples i-1, i and i+1, then horizontal
+      __m128i p = load8_sse2(in_near + i-1);
+      __m128i c = load8_sse2(in_near + i);
+      __m128i n = load8_sse2(in_near + i+1);
+      __m128i e, o;
+      p = _mm_add_epi16(_mm_add_epi16(p, _mm_add_epi16(p, p)), load8_sse2(in_far + i-1));
+      c = _mm_add_epi16(_mm_add_epi16(c, _mm_add_epi16(c, c)), load8_sse2(in_far + i));
+      n = _mm_add_epi16(_mm_add_epi16(n, _mm_add_epi16(n, n)), load8_sse2(in_far + i+1));
+      c = _mm_add_epi16(_mm_add_epi16(c, _mm_add_epi16(c, c)), eight);
+      e = _mm_srli_epi16(_mm_add_epi16(c, p), 4);
+      o = _mm_srli_epi16(_mm_add_epi16(c, n), 4);
+      _mm_storeu_si128((__m128i *) (out + i*2), _mm_unpacklo_epi8(_mm_packus_epi16(e, e), _mm_packus_epi16(o, o)));
+   }
+   t1 = 3*in_near[i-1] + in_far[i-1];
+   for (; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = div16(3*t0 + t1 + 8);
+      out[i*2  ] = div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = div4(t1+2);
+   return out;
+}
+#endif
+
 #define float2fixed(x)  ((int) ((x) * 65536 + 0.5))
 
 // 0.38 seconds on 3*anemones.jpg   (0.25 with processor = Pro)
 // VC6 without processor=Pro is generating multiple LEAs per multiply!
-static void YCbCr_to_RGB_row(uint8 *out, uint8 *y, uint8 *pcb, uint8 *pcr, int count, int step)
+static void YCbCr_to_RGB_row(uint8 *out, uint8 const *y, uint8 const *pcb, uint8 const *pcr, int count, int step)
 {
    int i;
    for (i=0; i < count; ++i) {
@@ -1408,7 +1627,66 @@ static void YCbCr_to_RGB_row(uint8 *out, uint8 *y, uint8 *pcb, uint8 *pcr, int c
 }
 
 #if STBI_SIMD
+#ifdef STBI_SSE2
+// SSE2 version of YCbCr_to_RGB_row, 8 pixels at a time. c*x is split into
+// (c&3)*x + (c>>2)*(4x) so both halves are 16-bit pmaddwd's, and since y is
+// an integer times 65536, ((y<<16) + 32768 + x) >> 16 == y + ((32768 + x) >> 16)
+static void YCbCr_to_RGB_row_sse2(uint8 *out, uint8 const *y, uint8 const *pcb, uint8 const *pcr, int count, int step)
+{
+   const int cr_r = float2fixed(1.40200f), cr_g = float2fixed(0.71414f);
+   const int cb_g = float2fixed(0.34414f), cb_b = float2fixed(1.77200f);
+   const __m128i k_r  = _mm_setr_epi16(cr_r&3, cr_r>>2, cr_r&3, cr_r>>2, cr_r&3, cr_r>>2, cr_r&3, cr_r>>2);
+   const __m128i k_gr = _mm_setr_epi16(-(cr_g&3), -(cr_g>>2), -(cr_g&3), -(cr_g>>2), -(cr_g&3), -(cr_g>>2), -(cr_g&3), -(cr_g>>2));
+   const __m128i k_gb = _mm_setr_epi16(-(cb_g&3), -(cb_g>>2), -(cb_g&3), -(cb_g>>2), -(cb_g&3), -(cb_g>>2), -(cb_g&3), -(cb_g>>2));
+   const __m128i k_b  = _mm_setr_epi16(cb_b&3, cb_b>>2, cb_b&3, cb_b>>2, cb_b&3, cb_b>>2, cb_b&3, cb_b>>2);
+   const __m128i half = _mm_set1_epi32(32768), bias = _mm_set1_epi16(128), alpha = _mm_set1_epi8(-1);
+   int i = 0, k;
+
+   // with 3 byte pixels each 4 byte store spills into the next pixel,
+   // so always leave the last pixel to the scalar code
+   for (; i+8 < count || (step == 4 && i+8 == count); i += 8) {
+      __m128i yv = load8_sse2(y + i);
+      __m128i cr = _mm_sub_epi16(load8_sse2(pcr + i), bias);
+      __m128i cb = _mm_sub_epi16(load8_sse2(pcb + i), bias);
+      __m128i cr4 = _mm_slli_epi16(cr, 2), cb4 = _mm_slli_epi16(cb, 2);
+      __m128i rgb[3], rg, ba, px[2];
+      for (k=0; k < 2; ++k) {
+         __m128i crp = k ? _mm_unpackhi_epi16(cr, cr4) : _mm_unpacklo_epi16(cr, cr4);
+         __m128i cbp = k ? _mm_unpackhi_epi16(cb, cb4) : _mm_unpacklo_epi16(cb, cb4);
+         __m128i y32 = k ? _mm_unpackhi_epi16(yv, _mm_setzero_si128()) : _mm_unpacklo_epi16(yv, _mm_setzero_si128());
+         __m128i r = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(crp, k_r), half), 16), y32);
+         __m128i g = _mm_add_epi32(_mm_madd_epi16(crp, k_gr), _mm_madd_epi16(cbp, k_gb));
+         __m128i b = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cbp, k_b), half), 16), y32);
+         g = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(g, half), 16), y32);
+         if (k == 0) { rgb[0] = r; rgb[1] = g; rgb[2] = b; }
+         else {
+            rgb[0] = _mm_packs_epi32(rgb[0], r);
+            rgb[1] = _mm_packs_epi32(rgb[1], g);
+            rgb[2] = _mm_packs_epi32(rgb[2], b);
+         }
+      }
+      rg = _mm_unpacklo_epi8(_mm_packus_epi16(rgb[0], rgb[0]), _mm_packus_epi16(rgb[1], rgb[1]));
+      ba = _mm_unpacklo_epi8(_mm_packus_epi16(rgb[2], rgb[2]), alpha);
+      px[0] = _mm_unpacklo_epi16(rg, ba);
+      px[1] = _mm_unpackhi_epi16(rg, ba);
+      if (step == 4) {
+         _mm_storeu_si128((__m128i *) (out     ), px[0]);
+         _mm_storeu_si128((__m128i *) (out + 16), px[1]);
+      } else {
+         for (k=0; k < 8; ++k) {
+            int p = _mm_cvtsi128_si32(px[k >> 2]);
+            memcpy(out + k*step, &p, 4);
+            px[k >> 2] = _mm_srli_si128(px[k >> 2], 4);
+         }
+      }
+      out += 8*step;
+   }
+   YCbCr_to_RGB_row(out, y+i, pcb+i, pcr+i, count-i, step);
+}
+static stbi_YCbCr_to_RGB_run stbi_YCbCr_installed = YCbCr_to_RGB_row_sse2;
+#else
 static stbi_YCbCr_to_RGB_run stbi_YCbCr_installed = YCbCr_to_RGB_row;
+#endif
 
 void stbi_install_YCbCr_to_RGB(stbi_YCbCr_to_RGB_run func)
 {
@@ -1490,6 +1768,13 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
          else if (r->hs == 2 && r->vs == 1) r->resample = resample_row_h_2;
          else if (r->hs == 2 && r->vs == 2) r->resample = resample_row_hv_2;
          else                               r->resample = resample_row_generic;
+         #ifdef STBI_SSE2
+         if (stbi_resample_sse2) {
+            if      (r->resample == resample_row_v_2)  r->resample = resample_row_v_2_sse2;
+            else if (r->resample == resample_row_h_2)  r->resample = resample_row_h_2_sse2;
+            else if (r->resample == resample_row_hv_2) r->resample = resample_row_hv_2_sse2;
+         }
+         #endif
       }
 
       // can't error after this so, this is safe
@@ -0,0 +1,180 @@
+/*
+    checks the SSE2 JPEG paths of stb_image_aug.c against the scalar ones
+    they replace: the IDCT, the 2x resamplers and the YCbCr conversion on
+    random input, then whole JPEG files decoded both ways. Every output
+    must match byte for byte.
+
+    gcc -O2 -msse2 -Iinclude include/firefly/io/SOIL/test_stbi_simd.c -o test_stbi_simd
+    ./test_stbi_simd [file.jpg ...]     (defaults to the repo's data/texture JPEGs)
+*/
+
+#include "stb_image_aug.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures = 0;
+
+#define CHECK(cond, ...) \
+   do { if (!(cond)) { ++failures; printf("FAIL: " __VA_ARGS__); printf("\n"); } } while (0)
+
+static const char *default_files[] = {
+   "data/texture/concrete.jpg",
+   "data/texture/concrete2.jpg",
+   "data/texture/4431-bump.jpg",
+   "data/texture/4431-normal.jpg",
+};
+
+#ifdef STBI_SSE2
+
+/* small values like real coefficients, now and then out of 16 bit range
+   so the SSE2 IDCT has to take its scalar fallback */
+static short random_coefficient(int big)
+{
+   if (big) return (short) (rand() % 65536 - 32768);
+   if (rand() % 3) return 0;
+   return (short) (rand() % 512 - 256);
+}
+
+static void test_idct(int blocks)
+{
+   STBI_ALIGN16(short data[64]);
+   STBI_ALIGN16(short copy[64]);
+   unsigned short dequant[64];
+   uint8 scalar[8*16], simd[8*16];
+   int b, i;
+
+   for (b=0; b < blocks; ++b) {
+      int big = (b % 50) == 0;
+      for (i=0; i < 64; ++i) {
+         data[i] = random_coefficient(big);
+         dequant[i] = (unsigned short) (1 + rand() % (big ? 255 : 64));
+      }
+      if (b % 7 == 0) /* dc only */
+         for (i=1; i < 64; ++i) data[i] = 0;
+
+      memset(scalar, 0xcd, sizeof(scalar));
+      memset(simd, 0xcd, sizeof(simd));
+      memcpy(copy, data, sizeof(copy));
+      idct_block(scalar, 16, copy, dequant);
+      memcpy(copy, data, sizeof(copy));
+      idct_block_sse2(simd, 16, copy, dequant);
+      CHECK(memcmp(scalar, simd, sizeof(scalar)) == 0, "idct block %d differs", b);
+   }
+}
+
+static void test_resample(int rows)
+{
+   static const char *names[] = { "v_2", "h_2", "hv_2" };
+   resample_row_func scalar_func[] = { resample_row_v_2, resample_row_h_2, resample_row_hv_2 };
+   resample_row_func simd_func[] = { resample_row_v_2_sse2, resample_row_h_2_sse2, resample_row_hv_2_sse2 };
+   uint8 near_row[160], far_row[160], scalar[320], simd[320];
+   int r, f, i;
+
+   for (r=0; r < rows; ++r) {
+      int w = 1 + r % 130;
+      for (i=0; i < (int) sizeof(near_row); ++i) {
+         near_row[i] = (uint8) rand();
+         far_row[i] = (uint8) rand();
+      }
+      for (f=0; f < 3; ++f) {
+         int hs = f == 0 ? 1 : 2;
+         uint8 *a, *b;
+         memset(scalar, 0xcd, sizeof(scalar));
+         memset(simd, 0xcd, sizeof(simd));
+         a = scalar_func[f](scalar, near_row, far_row, w, hs);
+         b = simd_func[f](simd, near_row, far_row, w, hs);
+         CHECK(memcmp(a, b, w * hs) == 0, "resample_row_%s width %d differs", names[f], w);
+      }
+   }
+}
+
+static void test_ycbcr(int rows)
+{
+   uint8 y[160], cb[160], cr[160], scalar[160*4 + 16], simd[160*4 + 16];
+   int r, i;
+
+   for (r=0; r < rows; ++r) {
+      int count = 1 + r % 130;
+      int step = (r & 1) ? 3 : 4;
+      for (i=0; i < count; ++i) {
+         y[i] = (uint8) rand();
+         cb[i] = (uint8) rand();
+         cr[i] = (uint8) rand();
+      }
+
+      /* also catches a write past the last pixel */
+      memset(scalar, 0xcd, sizeof(scalar));
+      memset(simd, 0xcd, sizeof(simd));
+      YCbCr_to_RGB_row(scalar, y, cb, cr, count, step);
+      YCbCr_to_RGB_row_sse2(simd, y, cb, cr, count, step);
+      CHECK(memcmp(scalar, simd, sizeof(scalar)) == 0, "YCbCr_to_RGB_row count %d step %d differs", count, step);
+   }
+}
+
+/* decodes with everything SSE2 on, then everything scalar */
+static void test_file(const char *file)
+{
+   int comp;
+
+   for (comp=0; comp <= 4; ++comp) {
+      int w[2], h[2], n[2];
+      uint8 *image[2];
+      int pass;
+
+      for (pass=0; pass < 2; ++pass) {
+         stbi_install_idct(pass ? idct_block : idct_block_sse2);
+         stbi_install_YCbCr_to_RGB(pass ? YCbCr_to_RGB_row : YCbCr_to_RGB_row_sse2);
+         stbi_resample_sse2 = !pass;
+         image[pass] = stbi_load(file, &w[pass], &h[pass], &n[pass], comp);
+      }
+
+      if (!image[0] || !image[1]) {
+         CHECK(0, "%s could not be loaded (%s)", file, stbi_failure_reason());
+      } else {
+         int channels = comp ? comp : n[0];
+         CHECK(w[0] == w[1] && h[0] == h[1] && n[0] == n[1], "%s header differs", file);
+         CHECK(memcmp(image[0], image[1], w[0] * h[0] * channels) == 0,
+               "%s decodes differently with req_comp %d", file, comp);
+         printf("%s %dx%dx%d req_comp %d\n", file, w[0], h[0], n[0], comp);
+      }
+      free(image[0]);
+      free(image[1]);
+      if (!image[0] || !image[1])
+         break;
+   }
+
+   stbi_install_idct(idct_block_sse2);
+   stbi_install_YCbCr_to_RGB(YCbCr_to_RGB_row_sse2);
+   stbi_resample_sse2 = 1;
+}
+
+int main(int argc, char *argv[])
+{
+   int i;
+   srand(1234);
+
+   test_idct(200000);
+   test_resample(20000);
+   test_ycbcr(20000);
+
+   if (argc > 1)
+      for (i=1; i < argc; ++i) test_file(argv[i]);
+   else
+      for (i=0; i < (int) (sizeof(default_files) / sizeof(default_files[0])); ++i)
+         test_file(default_files[i]);
+
+   printf(failures ? "%d checks failed\n" : "all checks passed\n", failures);
+   return failures ? 1 : 0;
+}
+
+#else
+
+int main(void)
+{
+   printf("built without SSE2 (or with STBI_SIMD 0), nothing to compare\n");
+   return 0;
+}
+
+#endif
@@ -21,7 +21,9 @@ enum FF_SHADER_ATTRIBUTE {
 	FF_ATTRIBUTE_TEXTURE1,
 	FF_ATTRIBUTE_TEXTURE2,
 	FF_ATTRIBUTE_TEXTURE3,
-	FF_ATTRIBUTE_LAST,
+	FF_ATTRIBUTE_INSTANCE_COLOR,
+	FF_ATTRIBUTE_INSTANCE_MATRIX, // a mat4 takes 4 slots
+	FF_ATTRIBUTE_LAST = FF_ATTRIBUTE_INSTANCE_MATRIX + 4,
 };
 
 #endif
@@ -18,10 +18,6 @@ Frame       cubeFrame;
 // cube shader / textures
 GLuint  cubeTexture, baseTexture;
 GLuint	phongShader;
-GLint   locTexture;
-GLint   locLightPos;
-GLint   locMV, locMVP, locNM;
-GLint	locAmbient, locDiffuse, locSpecular;	
 
 // blur shader / textures / buffers
 #define BLUR_TEXTURE_COUNT 4
@@ -33,11 +29,63 @@ GLint	locAmbient, locDiffuse, locSpecular;
 GLuint  pbo;
 GLuint  blurShader;
 GLuint  blurTextures[BLUR_TEXTURE_COUNT];
-GLint   locBlurMVP;
 bool    blurEnabled, moveBlur;
 float   blurTimer;
 int     curBlurFrame;
 
+// instanced crate field
+#define CRATE_ROWS        20
+#define CRATE_COUNT       (CRATE_ROWS * CRATE_ROWS)
+#define CRATE_SPACING     4.0f
+GLuint         instancedShader;
+FrameArray     crates;
+InstanceBuffer crateInstances;
+
+// what Render() draws, written out by every Update()
+struct SceneState
+{
+	Frame      camera;
+	Frame      prevCamera; // as of the update before, for interpolation
+	bool       blurEnabled;
+	bool       blur;
+	mouse_info mouse;
+};
+Snapshot<SceneState> scene;
+
+// only crates the bvh finds in the view frustum are drawn
+BVH            crateTree;
+vector<vec4>   crateColors;
+vector<uint32> visibleCrates;
+vector<mat4>   visibleMatrices;
+vector<vec4>   visibleColors;
+Frustum        viewFrustum;
+const AABB     cubeBounds(vec3(-1.0f), vec3(1.0f));
+
+// every draw goes through the render queue, sorted by program / texture
+#define PHONG_DRAW_COUNT  4
+struct PhongDraw
+{
+	GLBatch * batch;
+	mat4      mvMatrix;
+	mat4      mvpMatrix;
+	mat3      normalMatrix;
+	vec3      lightPos;
+};
+struct InstancedDraw
+{
+	mat4      pMatrix;
+	vec3      lightPos;
+};
+RenderQueue   renderQueue;
+PhongDraw     phongDraws[PHONG_DRAW_COUNT];
+int           phongDrawCount;
+InstancedDraw crateDraw;
+
+// lighting shared by every shader
+const vec4 vAmbientColor(0.1f, 0.1f, 0.1f, 1);
+const vec4 vDiffuseColor(1, 1, 1, 1);
+const vec4 vSpecularColor(1, 1, 1, 1);
+
 // movement variables
 #define JUMP_VEL          20
 #define JUMP_GRAVITY      35
@@ -53,6 +101,48 @@ GLuint GetBlurFrame1(){ return (1 + ((curBlurFrame + 2) % BLUR_TEXTURE_COUNT));
 GLuint GetBlurFrame2(){ return (1 + ((curBlurFrame + 1) % BLUR_TEXTURE_COUNT)); }
 GLuint GetBlurFrame3(){ return (1 + ((curBlurFrame) % BLUR_TEXTURE_COUNT)); }
 
+// render queue callbacks, uniforms are only uploaded when they change
+void SetupPhong(void * data)
+{
+	const PhongDraw & draw = *static_cast<PhongDraw *>(data);
+	g_Shader.SetUniform("normalMatrix", draw.normalMatrix);
+	g_Shader.SetUniform("mvMatrix", draw.mvMatrix);
+	g_Shader.SetUniform("mvpMatrix", draw.mvpMatrix);
+	g_Shader.SetUniform("ambient", vAmbientColor);
+	g_Shader.SetUniform("diffuse", vDiffuseColor);
+	g_Shader.SetUniform("specular", vSpecularColor);
+	g_Shader.SetUniform("lightPos", draw.lightPos);
+	g_Shader.SetUniform("texSampler", 0);
+}
+void DrawPhong(void * data) { static_cast<PhongDraw *>(data)->batch->Draw(); }
+void SetupInstanced(void * data)
+{
+	const InstancedDraw & draw = *static_cast<InstancedDraw *>(data);
+	g_Shader.SetUniform("pMatrix", draw.pMatrix);
+	g_Shader.SetUniform("lightPos", draw.lightPos);
+	g_Shader.SetUniform("ambient", vAmbientColor);
+	g_Shader.SetUniform("specular", vSpecularColor);
+	g_Shader.SetUniform("texSampler", 0);
+}
+
+// queue a batch drawn with the phong shader at the current modelview,
+// unless its bounds are outside the view frustum
+void SubmitPhong(GLBatch & batch, GLuint texture, const AABB & bounds, const vec4 & lightPos)
+{
+	if (!viewFrustum.IsVisible(bounds.Transform(mv.top())))
+		return;
+
+	PhongDraw & draw = phongDraws[phongDrawCount++];
+	draw.batch = &batch;
+	draw.mvMatrix = mv.top();
+	draw.mvpMatrix = glm::make_mat4(transform.GetMVP());
+	transform.GetNormalMatrix(draw.normalMatrix);
+	draw.lightPos = vec3(mv.Transform(lightPos));
+
+	RenderCommand cmd = { phongShader, { texture }, 0, 0, 0, 0, 0, 0, SetupPhong, DrawPhong, &draw };
+	renderQueue.Submit(0, texture, -draw.mvMatrix[3][2], cmd);
+}
+
 /*
    [ firefly ] - OpenGL framework written by John Cramb (2012)
    =-._.-==-._.-==-._.-==-._.-==-._.-==-._.-==-._.-==-._.-==-._.-=
@@ -119,13 +209,14 @@ GLuint GetBlurFrame3(){ return (1 + ((curBlurFrame) % BLUR_TEXTURE_COUNT)); }
 
 		// set up basic OpenGL parameters
 		GL_DEBUG(glClearColor(0.3f, 0.3f, 0.3f, 1.0f));
-		GL_DEBUG(glEnable(GL_DEPTH_TEST));
+		g_GLState.Enable(GL_DEPTH_TEST);
 		
-		// load textures
-		cubeTexture = g_Texture.LoadTexture("crate.png");
-		baseTexture = g_Texture.LoadTexture("concrete2.jpg", true);
+		// decode textures on the job system while the shaders compile
+		cubeTexture = g_Texture.LoadTextureAsync("crate.png");
+		baseTexture = g_Texture.LoadTextureAsync("concrete2.jpg", true);
 
-		// load shaders
+		// load shaders, compiled as one batch so the driver can overlap them
+		g_Shader.BeginBatch();
 		phongShader = g_Shader.CreateProgram("texPhong.vert", "texPhong.frag", 3,
 											FF_ATTRIBUTE_VERTEX, "vVertex",
 											FF_ATTRIBUTE_NORMAL, "vNormal",
@@ -135,16 +226,16 @@ GLuint GetBlurFrame3(){ return (1 + ((curBlurFrame) % BLUR_TEXTURE_COUNT)); }
 											FF_ATTRIBUTE_VERTEX, "vVertex",
 											FF_ATTRIBUTE_TEXTURE0, "vTexture0");
 
-		// get locations for shader uniforms
-		locTexture = GL_DEBUG(glGetUniformLocation(phongShader, "texSampler"));
-		locLightPos = GL_DEBUG(glGetUniformLocation(phongShader, "lightPos"));
-		locMV = GL_DEBUG(glGetUniformLocation(phongShader, "mvMatrix"));
-		locMVP = GL_DEBUG(glGetUniformLocation(phongShader, "mvpMatrix"));
-		locNM = GL_DEBUG(glGetUniformLocation(phongShader, "normalMatrix"));
-		locAmbient = GL_DEBUG(glGetUniformLocation(phongShader, "ambient"));
-		locDiffuse = GL_DEBUG(glGetUniformLocation(phongShader, "diffuse"));
-		locSpecular = GL_DEBUG(glGetUniformLocation(phongShader, "specular"));
-		locBlurMVP = GL_DEBUG(glGetUniformLocation(blurShader, "mvpMatrix"));
+		instancedShader = g_Shader.CreateProgram("instanced.vert", "instanced.frag", 5,
+											FF_ATTRIBUTE_VERTEX, "vVertex",
+											FF_ATTRIBUTE_NORMAL, "vNormal",
+											FF_ATTRIBUTE_TEXTURE0, "vTexture0",
+											FF_ATTRIBUTE_INSTANCE_COLOR, "vInstanceColor",
+											FF_ATTRIBUTE_INSTANCE_MATRIX, "vInstanceMatrix");
+		g_Shader.EndBatch();
+
+		// make sure the textures are uploaded before the first frame
+		g_Texture.FinishLoading();
 
 		// create geometry
 		gltMakeCube(cube, 1);
@@ -179,18 +270,39 @@ GLuint GetBlurFrame3(){ return (1 + ((curBlurFrame) % BLUR_TEXTURE_COUNT)); }
 			base.Vertex3f(baseSize, baseHeight + baseSize, -baseSize);
 		base.End();
 
+		// scatter crates over the floor, they are all drawn with one call
+		crateColors.resize(CRATE_COUNT);
+		crates.Resize(CRATE_COUNT);
+		for (uint32 i = 0; i < CRATE_COUNT; ++i)
+		{
+			float x = ((i % CRATE_ROWS) - CRATE_ROWS / 2 + 0.5f) * CRATE_SPACING;
+			float z = ((i / CRATE_ROWS) - CRATE_ROWS / 2 + 0.5f) * CRATE_SPACING;
+			float yaw = i * 2.4f;
+			crates.SetOrigin(i, vec3(x, baseHeight + 1.0f, z));
+			crates.SetForward(i, vec3(sin(yaw), 0.0f, cos(yaw)));
+			crateColors[i] = vec4(0.7f + 0.3f * sin(i * 1.3f), 0.7f + 0.3f * sin(i * 2.1f), 0.7f + 0.3f * sin(i * 3.7f), 1.0f);
+		}
+
+		// the crates don't move, so their world bounds go in the tree once
+		crates.Update(mat4(1.0f));
+		for (uint32 i = 0; i < CRATE_COUNT; ++i)
+			crateTree.Insert(cubeBounds.Transform(crates.GetWorldMatrices()[i]), i);
+		crateTree.Rebuild();
+
+		crateInstances.Create(CRATE_COUNT);
+		crateInstances.Attach(cube.GetVertexArray());
+
 		// create pixel buffer
 		glGenBuffers(1, &pbo);
-		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+		g_GLState.BindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
 		glBufferData(GL_PIXEL_PACK_BUFFER, PIXEL_DATA_SIZE, NULL, GL_DYNAMIC_DRAW);
-		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		g_GLState.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 
 		// create blur textures
 		glGenTextures(BLUR_TEXTURE_COUNT, blurTextures);
 		for (int i = 0; i < BLUR_TEXTURE_COUNT; ++i)
 		{
-			glActiveTexture(GL_TEXTURE1 + i);
-			glBindTexture(GL_TEXTURE_2D, blurTextures[i]);
+			g_GLState.BindTexture(1 + i, blurTextures[i]);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -214,7 +326,9 @@ GLuint GetBlurFrame3(){ return (1 + ((curBlurFrame) % BLUR_TEXTURE_COUNT)); }
     {
 		g_Texture.DeleteTextures();
 		g_Shader.DeletePrograms();
-		glDeleteBuffers(1, &pbo);
+		crateInstances.Delete();
+		crateTree.Clear();
+		g_GLState.DeleteBuffers(1, &pbo);
     }
 
 
@@ -224,14 +338,8 @@ GLuint GetBlurFrame3(){ return (1 + ((curBlurFrame) % BLUR_TEXTURE_COUNT)); }
     {
 		// retrieve current mouse state
         mouse_info mi = GetMouse();
-		string buffer;
-
-		// write program information to window title
-		if (blurEnabled) buffer = "[B]";
-        SetWindowTitle("firefly-demo v%d.%d (FPS: %.2lf)"
-                       " x-%d y-%d %s",
-                       FF_MAJOR_VERSION, FF_MINOR_VERSION,
-                       GetFPS(), mi.x, mi.y, buffer.c_str());
+		SceneState & state = scene.Write();
+		state.prevCamera = cameraFrame;
 
 		// calculate movement rate and direction
 		bool forceBlur = false;
@@ -258,7 +366,7 @@ GLuint GetBlurFrame3(){ return (1 + ((curBlurFrame) % BLUR_TEXTURE_COUNT)); }
 		cameraFrame.RotateWorld( -delta * TURN_SPEED * dt / 4, 0, 1, 0);
 
 		// keep the mouse centered
-		glfwSetMousePos(GetWidth() / 2, GetHeight() / 2);
+		SetMousePos(GetWidth() / 2, GetHeight() / 2);
 
 		// handle current jumping state
 		if (jumping) {		
@@ -275,27 +383,37 @@ GLuint GetBlurFrame3(){ return (1 + ((curBlurFrame) % BLUR_TEXTURE_COUNT)); }
 				cameraFrame.MoveUp(cameraFrame.GetOriginY() - dist);
 			}
 		}
+
+		// hand the result over to Render()
+		state.camera = cameraFrame;
+		state.blurEnabled = blurEnabled;
+		state.blur = blurEnabled && moveBlur;
+		state.mouse = mi;
 	}
 
 
 // paint pretty pixels
 
-    void App::Render(const delta_t dt, const delta_t elapsed)
+    void App::Render(const delta_t dt, const delta_t elapsed, const delta_t alpha)
     {	
+		// draw what the last update left, the camera blended between its last two
+		const SceneState & state = scene.Read();
+		Frame view;
+		view.Interpolate(state.prevCamera, state.camera, (float)alpha);
+
 		// clear buffer and save matrix state
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		// position camera
 		mat4 camera;
-		cameraFrame.GetCameraMatrix(camera);
-		mv.PushMatrix(camera);
+		view.GetCameraMatrix(camera);
+		mv.PushMatrix(camera, true);
+
+			// objects are tested in view space against the projection alone
+			viewFrustum.Extract(proj.top());
 
 			// create point light
 			vec4 vLightPos(sin(elapsed) * 10, 5, -8 + (cos(elapsed) * 15), 1);
-			vec4 vLightEyePos;
-			vec4 vAmbientColor(0.1f, 0.1f, 0.1f, 1);
-			vec4 vDiffuseColor(1, 1, 1, 1);
-			vec4 vSpecularColor(1, 1, 1, 1);
 
 			// use smoothstep to animate the cube movement
 			static float xPos;
@@ -303,85 +421,82 @@ GLuint GetBlurFrame3(){ return (1 + ((curBlurFrame) % BLUR_TEXTURE_COUNT)); }
 			xPos = (xPos) * (xPos) * (3.0f - 2.0f * (xPos));
 			xPos = (-1.5f * xPos) + (1.5f * (1.0f - xPos));
 
-			// copy uniform information to shader 
-			GL_DEBUG(glUseProgram(phongShader));
-			vLightEyePos = mv.Transform(vLightPos);
-			GL_DEBUG(glUniformMatrix3fv(locNM , 1, GL_FALSE, transform.GetNormalMatrix() ));
-			GL_DEBUG(glUniformMatrix4fv(locMV , 1, GL_FALSE, transform.GetModelView() ));
-			GL_DEBUG(glUniformMatrix4fv(locMVP, 1, GL_FALSE, transform.GetMVP() ));
-			GL_DEBUG(glUniform4fv(locAmbient, 1, &vAmbientColor[0]));
-			GL_DEBUG(glUniform4fv(locDiffuse, 1, &vDiffuseColor[0]));
-			GL_DEBUG(glUniform4fv(locSpecular, 1, &vSpecularColor[0]));
-			GL_DEBUG(glUniform3fv(locLightPos, 1, &vLightEyePos[0]));
-			GL_DEBUG(glUniform1i(locTexture, 0));
-
-			// render the floor
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, baseTexture);
-			base.Draw();
+			// queue the floor
+			renderQueue.Clear();
+			phongDrawCount = 0;
+			SubmitPhong(base, baseTexture, AABB(vec3(-40.0f, -3.0f, -40.0f), vec3(40.0f, 37.0f, 40.0f)), vLightPos);
 
 			// transform modelview to rotate cube
 			mv.PushMatrix();
-				mat4 cubePos = translate(mat4(), vec3(xPos, -0.5f, -15.f));
-				cubePos = rotate(cubePos, 100.0f * (float)sin(elapsed), vec3(1.0f, 0.0f, 0.0f));
-				cubePos = rotate(cubePos, 20.0f * (float)elapsed, vec3(0.0f, 1.0f, 0.0f));
-				mv.MultMatrix(cubePos);
-
-				// copy uniform information to shader for cube
-				vLightEyePos = mv.Transform(vLightPos);
-				GL_DEBUG(glUniform3fv(locLightPos, 1, &vLightEyePos[0]));
-				GL_DEBUG(glUniformMatrix3fv(locNM , 1, GL_FALSE, transform.GetNormalMatrix() ));
-				GL_DEBUG(glUniformMatrix4fv(locMV , 1, GL_FALSE, transform.GetModelView() ));
-				GL_DEBUG(glUniformMatrix4fv(locMVP, 1, GL_FALSE, transform.GetMVP() ));
-				glBindTexture(GL_TEXTURE_2D, cubeTexture);
-
-				// render geometry
-				cube.Draw();
+				mv.Translate(xPos, -0.5f, -15.f);
+				mv.Rotate(100.0f * (float)sin(elapsed), 1.0f, 0.0f, 0.0f);
+				mv.Rotate(20.0f * (float)elapsed, 0.0f, 1.0f, 0.0f);
+				SubmitPhong(cube, cubeTexture, cubeBounds, vLightPos);
 			mv.PopMatrix();
 
 			// draw cube at light position
 			mv.PushMatrix();
-				cubePos = translate(mat4(), vLightPos.xyz());
-				mv.MultMatrix(cubePos);
-				vLightEyePos = mv.Transform(vLightPos);
-				GL_DEBUG(glUniform3fv(locLightPos, 1, &vLightEyePos[0]));
-				GL_DEBUG(glUniformMatrix3fv(locNM , 1, GL_FALSE, transform.GetNormalMatrix() ));
-				GL_DEBUG(glUniformMatrix4fv(locMV , 1, GL_FALSE, transform.GetModelView() ));
-				GL_DEBUG(glUniformMatrix4fv(locMVP, 1, GL_FALSE, transform.GetMVP() ));
-				glBindTexture(GL_TEXTURE_2D, cubeTexture);
-				cube.Draw();
+				mv.Translate(vLightPos.xyz());
+				SubmitPhong(cube, cubeTexture, cubeBounds, vLightPos);
 			mv.PopMatrix();
 
 			// draw a stationary cube
 			mv.PushMatrix();
-				cubePos = translate(mat4(), vec3(-5, 0, 0));
-				cubePos = rotate(cubePos, 45.0f, vec3(1, 0, 0));
-				mv.MultMatrix(cubePos);
-				vLightEyePos = mv.Transform(vLightPos);
-				GL_DEBUG(glUniform3fv(locLightPos, 1, &vLightEyePos[0]));
-				GL_DEBUG(glUniformMatrix3fv(locNM , 1, GL_FALSE, transform.GetNormalMatrix() ));
-				GL_DEBUG(glUniformMatrix4fv(locMV , 1, GL_FALSE, transform.GetModelView() ));
-				GL_DEBUG(glUniformMatrix4fv(locMVP, 1, GL_FALSE, transform.GetMVP() ));
-				glBindTexture(GL_TEXTURE_2D, cubeTexture);
-				cube.Draw();
+				mv.Translate(-5, 0, 0);
+				mv.Rotate(45.0f, 1, 0, 0);
+				SubmitPhong(cube, cubeTexture, cubeBounds, vLightPos);
 			mv.PopMatrix();
 
 		mv.PopMatrix();
 
+		// the crate field, one draw call for every crate in view
+		{
+			FF_PROFILE_SCOPE("Cull");
+			crates.Update(camera);
+			crateTree.Cull(Frustum(proj.top() * camera), visibleCrates);
+
+			visibleMatrices.resize(visibleCrates.size());
+			visibleColors.resize(visibleCrates.size());
+			for (size_t i = 0; i < visibleCrates.size(); ++i)
+			{
+				visibleMatrices[i] = crates.GetModelViewMatrices()[visibleCrates[i]];
+				visibleColors[i] = crateColors[visibleCrates[i]];
+			}
+		}
+
+		if (!visibleCrates.empty())
+		{
+			GLuint count = (GLuint)visibleCrates.size();
+			crateInstances.SetMatrices(&visibleMatrices[0], count);
+			crateInstances.SetColors(&visibleColors[0], count);
+			crateDraw.pMatrix = proj.top();
+			crateDraw.lightPos = vec3(camera * vLightPos);
+
+			RenderCommand crateCmd = { instancedShader, { cubeTexture }, cube.GetVertexArray(), GL_TRIANGLES, 0, 0,
+									   (GLsizei)cube.GetVertexCount(), (GLsizei)count, SetupInstanced, 0, &crateDraw };
+			renderQueue.Submit(0, cubeTexture, 0.0f, crateCmd);
+		}
+
+		// sorted by program and texture, so the crate texture is bound once
+		{
+			FF_PROFILE_GPU("Scene");
+			renderQueue.Execute();
+		}
+
 		// update blur frame textures
 		blurTimer += (float)dt;
 		if (blurTimer > BLUR_FRAME_DELAY)
 		{
 			// save frame buffer to pbo
-			glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+			g_GLState.BindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
 			glReadPixels(0, 0, g_App.GetWidth(), g_App.GetHeight(), GL_RGB, GL_UNSIGNED_BYTE, NULL);
-			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			g_GLState.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 
 			// save pixel buffer to texture and increment frame index
-			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
-			glActiveTexture(GL_TEXTURE0 + GetBlurFrame0());
+			g_GLState.BindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+			g_GLState.ActiveTexture(GetBlurFrame0());
 			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, g_App.GetWidth(), g_App.GetHeight(), 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			g_GLState.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
 			// reset iterator variables
 			blurTimer = 0;
@@ -389,20 +504,35 @@ GLuint GetBlurFrame3(){ return (1 + ((curBlurFrame) % BLUR_TEXTURE_COUNT)); }
 		}
 
 		// use stored blur textures to generate frame
-		if (blurEnabled && moveBlur) 
+		if (state.blur)
 		{
+			FF_PROFILE_GPU("Blur");
+
 			// render quad to the screen
 			mat4 ortho = glm::ortho(0.0f, (float)g_App.GetWidth(), 0.0f, (float)g_App.GetHeight());
-			glDisable(GL_DEPTH_TEST);
-			glUseProgram(blurShader);
-			glUniformMatrix4fv(locBlurMVP, 1, GL_FALSE, value_ptr(ortho));
-			glUniform1i(glGetUniformLocation(blurShader, "blurFrame0"), GetBlurFrame0());
-			glUniform1i(glGetUniformLocation(blurShader, "blurFrame1"), GetBlurFrame1());
-			glUniform1i(glGetUniformLocation(blurShader, "blurFrame2"), GetBlurFrame2());
-			glUniform1i(glGetUniformLocation(blurShader, "blurFrame3"), GetBlurFrame3());
+			g_GLState.Disable(GL_DEPTH_TEST);
+			g_Shader.UseProgram(blurShader);
+			g_Shader.SetUniform("mvpMatrix", ortho);
+			g_Shader.SetUniform("blurFrame0", (GLint)GetBlurFrame0());
+			g_Shader.SetUniform("blurFrame1", (GLint)GetBlurFrame1());
+			g_Shader.SetUniform("blurFrame2", (GLint)GetBlurFrame2());
+			g_Shader.SetUniform("blurFrame3", (GLint)GetBlurFrame3());
 			screen.Draw();
-			glEnable(GL_DEPTH_TEST);
+			g_GLState.InvalidateVertexArray();
+			g_GLState.Enable(GL_DEPTH_TEST);
 		}
+
+		// write program information to window title, GL calls are the last frame's
+		// and gpu time is from the oldest frame whose timings are back
+		const GLStateStats & gl = g_GLState.GetStats();
+        SetWindowTitle("firefly-demo v%d.%d (FPS: %.2lf)"
+                       " x-%d y-%d GL %u/%u crates %u/%d cpu %.2fms gpu %.2fms %s",
+                       FF_MAJOR_VERSION, FF_MINOR_VERSION,
+                       GetFPS(), state.mouse.x, state.mouse.y, gl.issued,
+                       gl.issued + gl.skipped, (uint32)visibleCrates.size(),
+                       CRATE_COUNT, g_Profiler.GetTime("Render"),
+                       g_Profiler.GetTime("Render", true, FF_PROFILE_GPU_LATENCY - 1),
+                       state.blurEnabled ? "[B]" : "");
 	}
 
 
@@ -414,7 +544,7 @@ GLuint GetBlurFrame3(){ return (1 + ((curBlurFrame) % BLUR_TEXTURE_COUNT)); }
         GL_DEBUG(glViewport(0, 0, width, height));
 
 		// use a perspective projection for the viewport
-		proj.PushMatrix(perspective(35.f, (float) width / (float) height, 0.1f, 1000.f));
+		proj.LoadMatrix(perspective(35.f, (float) width / (float) height, 0.1f, 1000.f));
 		transform.SetMatrices(mv, proj);
 	}
 
@@ -445,6 +575,11 @@ GLuint GetBlurFrame3(){ return (1 + ((curBlurFrame) % BLUR_TEXTURE_COUNT)); }
 					}
 					break;
 
+			// write the last few seconds out for chrome://tracing
+			case GLFW_KEY_F11:
+				g_Profiler.ExportTrace(FF_PROFILE_FILE);
+				break;
+
 			// save current frame buffer to file
 			case GLFW_KEY_F12:
 				g_App.Screenshot("test.bmp");